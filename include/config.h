@@ -16,6 +16,16 @@ typedef unsigned int UInt32;
 typedef unsigned int UInt;
 typedef unsigned char Byte;
 
+// Integers the size of a pointer (and so of a Value)
+
+#include <stdint.h>
+typedef intptr_t IntPtr;
+typedef uintptr_t UIntPtr;
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+ #define PROTO_64BIT 1
+#endif
+
 #include <assert.h>
 #define ASSERT(exp) assert(exp)
 
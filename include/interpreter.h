@@ -12,7 +12,27 @@
 
 #include "objects.h"
 
+/// Calls a function, or sends a message to @c rcvr, and returns the
+/// result. Native functions can use these to call back into NewtonScript:
+/// the call runs on top of the one that called the native function.
+/// Exceptions the function doesn't handle are thrown to the caller.
+
 EXPORT  Value   Call(Value func);
+EXPORT  Value   Call(Value func, int nArgs, const Value args[]);
+EXPORT  Value   Send(Value rcvr, Value msg);
+EXPORT  Value   Send(Value rcvr, Value msg, int nArgs, const Value args[]);
+
+inline  Value   Call(Value func, Value arg1)
+    { return Call(func, 1, &arg1); }
+inline  Value   Call(Value func, Value arg1, Value arg2)
+    { Value args[2] = { arg1, arg2 }; return Call(func, 2, args); }
+inline  Value   Call(Value func, Value arg1, Value arg2, Value arg3)
+    { Value args[3] = { arg1, arg2, arg3 }; return Call(func, 3, args); }
+
+inline  Value   Send(Value rcvr, Value msg, Value arg1)
+    { return Send(rcvr, msg, 1, &arg1); }
+inline  Value   Send(Value rcvr, Value msg, Value arg1, Value arg2)
+    { Value args[2] = { arg1, arg2 }; return Send(rcvr, msg, 2, args); }
 
 EXPORT  Value   GetGlobalVar(Value name);
 EXPORT  bool    GetGlobalVar(Value name, Value* result);
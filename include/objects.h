@@ -14,10 +14,13 @@
 
 #include "config.h"
 #include "proto-errors.h"
+#include "predefined.h"
+#include "predef-syms.h"      // Generated at build time by tools/mkpredef
 
 /// Fake struct for Value typechecking.
 /// This is just fakery so the compiler will do @c int vs. @c Value
-/// typechecking/overloading for us. @c Values are really @c ints.
+/// typechecking/overloading for us. @c Values are really pointer-sized
+/// integers (@c IntPtr), so they're 64 bits in an LP64 build.
 /// If you get a compiler error regarding the nonexistent <tt>struct _VALUE</tt>,
 /// you've probably passed an @c int where a @c Value was required, or vice versa.
 
@@ -35,12 +38,13 @@ const int IMMED_MASK = 0xC;
 enum {
     IMMED_SPECIAL = 0,
     IMMED_CHAR = 4,
-    IMMED_BOOLEAN = 8
+    IMMED_BOOLEAN = 8,
+    IMMED_REAL = 0xC        // 64-bit builds only (see REAL_V)
 };
 
-#define MAKEVALUE(val, tag) ((Value) (((val) << 2) | tag))
+#define MAKEVALUE(val, tag) ((Value) ((((UIntPtr) (IntPtr) (val)) << 2) | (tag)))
 
-#define IMMED_V(type, val) ((Value) (((val) << 4) | (type) | TAG_IMMED))
+#define IMMED_V(type, val) ((Value) ((((UIntPtr) (IntPtr) (val)) << 4) | (type) | TAG_IMMED))
 
 /// NIL, nada, nothing
 
@@ -50,7 +54,7 @@ const Value V_NIL = IMMED_V(IMMED_SPECIAL, 0);  // a.k.a. 2
 
 const Value V_TRUE = IMMED_V(IMMED_BOOLEAN, 1); // a.k.a. 0x1A
 
-inline int      V_TAG(Value v)      { return ((int) v) & TAG_MASK; }
+inline int      V_TAG(Value v)      { return ((IntPtr) v) & TAG_MASK; }
 
 /// @defgroup preds Type predicates
 /// Tests for Value types.
@@ -66,9 +70,19 @@ inline bool     V_ISPTR(Value v)    { return (V_TAG(v) & TAG_PTR); }
 
 /// Is the Value a character?
 
-inline bool     V_ISCHAR(Value v)   { return (((int) v) & (TAG_MASK | IMMED_MASK)) == (TAG_IMMED | IMMED_CHAR); }
+inline bool     V_ISCHAR(Value v)   { return (((IntPtr) v) & (TAG_MASK | IMMED_MASK)) == (TAG_IMMED | IMMED_CHAR); }
 
-/// Is the Value a reference to a Binary object?
+/// Is the Value a real that's stored in the Value itself? (Other reals
+/// are Binary objects of class @c real.)
+
+inline bool     V_ISIMMREAL(Value v) { return (((IntPtr) v) & (TAG_MASK | IMMED_MASK)) == (TAG_IMMED | IMMED_REAL); }
+
+/// Is the Value a real number, of either kind?
+
+EXPORT  bool    IsReal(Value obj);
+
+/// Is the Value a reference to a Binary object? (A rope counts, since it
+/// stands for a string.)
 
 EXPORT  bool    IsBinary(Value obj);
 
@@ -80,11 +94,23 @@ EXPORT  bool    IsArray(Value obj);
 
 EXPORT  bool    IsFrame(Value obj);
 
+/// Is the Value a reference to a frame table? (It's also an Array.)
+
+EXPORT  bool    IsFrameTable(Value obj);
+
+/// Is the Value a reference to a typed array? (It's a Binary.)
+
+EXPORT  bool    IsTypedArray(Value obj);
+
+/// Is the Value a reference to a view? (It's also an Array.)
+
+EXPORT  bool    IsView(Value obj);
+
 /// Is the Value a reference to a Symbol?
 
 EXPORT  bool    IsSymbol(Value obj);
 
-/// Is the Value a reference to a String?
+/// Is the Value a reference to a String? (A rope counts; see StrConcat.)
 
 EXPORT  bool    IsString(Value obj);
 
@@ -99,9 +125,16 @@ EXPORT  bool    IsString(Value obj);
 /// (Use only when speed matters and you can prove the type is correct.)
 /// @{
 
-/// Converts an int to a Value. Be aware there are only 30 significant bits in an integer Value!
+/// Largest and smallest integers that fit in a Value: 30 bits in a 32-bit
+/// build, 62 bits in a 64-bit build.
 
-inline Value    INT_V(int i)            { return MAKEVALUE(i, TAG_INT); }
+const IntPtr    MAX_INT_V = (IntPtr) (~(UIntPtr) 0 >> 3);
+const IntPtr    MIN_INT_V = -MAX_INT_V - 1;
+
+/// Converts an integer to a Value. Be aware there are only 30 (or 62)
+/// significant bits in an integer Value!
+
+inline Value    INT_V(IntPtr i)         { return MAKEVALUE(i, TAG_INT); }
 
 /// Converts a Unicode character to a Value.
 
@@ -115,27 +148,39 @@ inline Value    BOOL_V(bool b)          { return b ? V_TRUE : V_NIL; }
 
 inline Value    MAGICPTR_V(int index)   { return IMMED_V(index, TAG_MAGICPTR); }
 
-/// Converts a double to a Value.
+/// Converts a double to a Value. In a 64-bit build most doubles fit in
+/// the Value itself; the rest (and all of them in a 32-bit build) are
+/// allocated as Binary objects.
 
 EXPORT Value    REAL_V(double d);
 
 EXPORT int V_INT_error(void);   // Helper functions
 EXPORT int V_CHAR_error(void);
+EXPORT int V_INDEX_error(void);
 
 /// Converts a Value to an integer with no type check.
 /// Quickly converts a Value to an integer *without* testing the type
 /// first -- use only if you're sure the Value is an int (or it doesn't much
 /// matter if it isn't).
 
-inline int      UNSAFE_V_INT(Value v)   { return (((int) v) >> 2); }
+inline IntPtr   UNSAFE_V_INT(Value v)   { return (((IntPtr) v) >> 2); }
+
+/// Converts a Value to an integer. Throws if Value is not an integer.
 
-/// Converts a Value to an int. Throws if Value is not an integer.
+inline IntPtr   V_INT(Value v)          { return V_ISINT(v) ? (((IntPtr) v) >> 2) : V_INT_error(); }
 
-inline int      V_INT(Value v)          { return V_ISINT(v) ? (((int) v) >> 2) : V_INT_error(); }
+/// Converts a Value to an index or count. Throws if Value is not an integer,
+/// or is too big (or too negative) for an int.
+
+inline int      V_INDEX(Value v)
+{
+    IntPtr i = V_INT(v);
+    return (i == (int) i) ? (int) i : V_INDEX_error();
+}
 
 /// Converts a Value to a Unicode character. Throws if Value is not a character.
 
-inline int      V_CHAR(Value v)         { return V_ISCHAR(v) ? (((int) v) >> 4) : V_INT_error(); }
+inline int      V_CHAR(Value v)         { return V_ISCHAR(v) ? (int) (((IntPtr) v) >> 4) : V_INT_error(); }
 
 /// Converts a Value to a bool. Result is false if Value is V_NIL, otherwise true.
 
@@ -191,8 +236,10 @@ const char* const   g_exCompiler = "evt.ex.fr.compiler";    ///< Compiler errors
 /// @}
 
 /// Call once at the beginning of time to initialize the object system.
+/// A program with SYMs of its own passes InitAppPredefObjects (generated by
+/// tools/mkpredef), so they're in place before anything else is interned.
 
-EXPORT  void    InitProtoLib(void);
+EXPORT  void    InitProtoLib(void (*initAppPredefObjects)(void) = 0);
 
 /// Are Values a and b equal? Tests values of immediates, reals and symbols,
 /// otherwise tests reference (pointer) equality.
@@ -218,6 +265,10 @@ EXPORT  Value   NewArray(Value cls, int nSlots);
 
 EXPORT  Value   NewArray(int nSlots);
 
+/// Allocates a new Array object with the given slot values.
+
+EXPORT  Value   NewArray(Value cls, int nSlots, const Value values[]);
+
 /// Allocates a new Frame object.
 
 EXPORT  Value   NewFrame(void);
@@ -230,6 +281,17 @@ EXPORT  Value   NewMapWithTags(Value tagArray);
 
 EXPORT  Value   NewFrameWithMap(Value map);
 
+/// Allocates a new Frame with the given slots, all at once. Frames made
+/// with the same list of tags share a frozen map. If a tag is repeated,
+/// the slot gets the last of its values.
+
+EXPORT  Value   NewFrameWithSlots(int nSlots, const Value tags[], const Value values[]);
+
+/// Freezes a Frame map whose shape won't change, making its lookups faster.
+/// Frames that add or remove slots get their own copy of the map.
+
+EXPORT  Value   FreezeMap(Value map);
+
 /// @}
 
 /// @defgroup access Access functions
@@ -272,10 +334,18 @@ EXPORT  void    SetPath(Value obj, Value path, Value newValue);
 
 EXPORT  bool    HasPath(Value obj, Value path);
 
-/// Gets a pointer to the beginning of a binary object's data
+/// Gets a pointer to the beginning of a binary object's data. The pointer
+/// keeps the data alive by itself, but it's only good until the object is
+/// resized (or, for GetReadOnlyData, written through GetData), since that
+/// can move the data.
 
 EXPORT  void*   GetData(Value binary);
 
+/// Gets a pointer to a binary object's data for reading only. Unlike
+/// GetData, this doesn't have to copy data the object shares with a clone.
+
+EXPORT  const void* GetReadOnlyData(Value binary);
+
 /// Gets the value of an object's @em class slot.
 
 EXPORT  Value   GetClassSlot(Value obj);
@@ -288,7 +358,9 @@ EXPORT  void    SetClassSlot(Value obj, Value cls);
 
 EXPORT  void    AddArraySlot(Value array, Value newValue);
 
-/// Gets a pointer to an array's slots.
+/// Gets a pointer to an array's slots, ready to be changed. (A clone that
+/// was sharing them gets its own copy first.) Frame tables have no slots
+/// to get.
 
 EXPORT  Value*  GetArraySlots(Value array);
 
@@ -296,7 +368,8 @@ EXPORT  Value*  GetArraySlots(Value array);
 
 EXPORT  int     GetArrayLength(Value array);
 
-/// Sets the number of slots in an array.
+/// Sets the number of slots in an array. New slots (or a frame table's
+/// new rows) are nil.
 
 EXPORT  void    SetArrayLength(Value array, int nSlots);
 
@@ -313,7 +386,13 @@ EXPORT  void    SetBinaryLength(Value binary, int size);
 
 EXPORT  int     GetObjLength(Value obj);
 
-/// Clones an object (shallowly).
+/// Returns the number of times a frame has been rehashed (counting both
+/// growing and shrinking), for performance tuning.
+
+EXPORT  int     GetRehashCount(void);
+
+/// Clones an object (shallowly). A big array or binary shares its slots or
+/// data with the clone until one of them is changed.
 
 EXPORT  Value   Clone(Value obj);
 
@@ -335,7 +414,11 @@ EXPORT  void    ReplaceObject(Value oldObj, Value newObj);
 
 EXPORT  Value   Intern(const char* name);
 
-#define SYM(name) Intern(#name)
+/// Gets the Symbol whose name is the given identifier. Costs nothing at run
+/// time: every use of @c SYM in the sources is found at build time and turned
+/// into a compile-time symbol object, just like @c PSYM.
+
+#define SYM(name) PSYM(name)
 
 /// Same as @c Intern -- some people like this name better.
 
@@ -362,10 +445,308 @@ EXPORT  Value   NewString(const TCHAR* str);
 
 EXPORT  TCHAR*  GetCString(Value str);
 
-/// Appends to a String object (destructive).
+/// Appends a string, string builder, or rope to a string or string
+/// builder (destructive).
 
 EXPORT  void    StrAppend(Value str1, Value str2);
 
+/// Concatenates two strings, string builders, or ropes. Long results are
+/// ropes, whose pieces aren't copied together until they have to be. A
+/// rope counts as a string: the first function that needs its characters
+/// in one place (GetData, GetStringChar, StrAppend to it, and so on)
+/// replaces it with a plain string, as ReplaceObject does.
+
+EXPORT  Value   StrConcat(Value str1, Value str2);
+
+/// Gets a plain string with the characters of a string or rope.
+
+EXPORT  Value   FlattenString(Value str);
+
+/// Makes an empty string builder: a string that can be appended to
+/// without copying it every time.
+
+EXPORT  Value   NewStringBuilder(void);
+
+/// Turns a string builder into a plain string, and returns it.
+
+EXPORT  Value   StringBuilderFinish(Value builder);
+
+/// Gets a character of a string.
+
+EXPORT  Value   GetStringChar(Value str, int index);
+
+/// Changes a character of a string.
+
+EXPORT  void    SetStringChar(Value str, int index, Value ch);
+
+/// Compares two strings or ropes by character code. Returns a negative
+/// number, zero, or a positive number.
+
+EXPORT  int     StrCompare(Value str1, Value str2, bool ignoreCase = false);
+
+/// Finds the first occurrence of @c substr in @c str at or after
+/// @c start. Returns -1 if there isn't one.
+
+EXPORT  int     StrPos(Value str, Value substr, int start = 0);
+
+/// Replaces the first @c count occurrences of @c substr in @c str (all of
+/// them if @c count is negative) with @c replacement (destructive).
+/// Returns the number replaced.
+
+EXPORT  int     StrReplace(Value str, Value substr, Value replacement, int count = -1);
+
+/// Concatenates an array of strings, ropes, numbers, characters, and
+/// symbols into a new string. Nils are skipped.
+
+EXPORT  Value   Stringer(Value array);
+
+/// Makes a string from a number. Reals get the fewest digits that read
+/// back as the same number.
+
+EXPORT  Value   NumberStr(Value number);
+
+/// @}
+
+/// @defgroup arrayfuncs Array functions
+/// Sorting, searching, and changing arrays in place. A @c test is
+/// @c '|<|, @c '|>|, @c '|str<|, @c '|str>|, or a function of two keys that
+/// returns a negative number, zero, or a positive number. A @c key is nil
+/// (the element itself), a path, or a function of one element. Sets are
+/// arrays whose elements are compared with V_EQ.
+/// @{
+
+/// Sorts an array in place.
+
+EXPORT  void    SortArray(Value array, Value test, Value key);
+
+/// Finds @c item among the keys of an array sorted by the same test and
+/// key. Returns its index, or -1 if it isn't there.
+
+EXPORT  int     BinarySearch(Value array, Value item, Value test, Value key);
+
+/// Finds the first element at or after @c start whose key matches @c item.
+/// @c test is @c '|=|, @c '|str=|, or a function that returns non-nil for a
+/// match. Returns its index, or -1 if there isn't one.
+
+EXPORT  int     LinearSearch(Value array, Value item, int start, Value test, Value key);
+
+/// Replaces @c count1 elements of @c array1 with @c count2 elements of
+/// @c array2 (none if it's nil). A negative count means the rest of the
+/// array.
+
+EXPORT  void    ArrayMunger(Value array1, int start1, int count1,
+                            Value array2, int start2, int count2);
+
+/// Inserts an element before @c index, or removes @c count elements.
+
+EXPORT  void    ArrayInsert(Value array, Value element, int index);
+EXPORT  void    ArrayRemoveCount(Value array, int start, int count);
+
+/// Finds a value in a set. Returns its index, or -1 if it isn't there.
+
+EXPORT  int     SetContains(Value set, Value value);
+
+/// Makes a set of the elements of @c set1 and those of @c set2 that aren't
+/// in it. If @c uniqueOnly is true, duplicates within either are left out.
+
+EXPORT  Value   SetUnion(Value set1, Value set2, bool uniqueOnly);
+
+/// Makes a set of the elements of @c set1 that aren't in @c set2.
+
+EXPORT  Value   SetDifference(Value set1, Value set2);
+
+/// Do two sets have an element in common?
+
+EXPORT  bool    SetOverlaps(Value set1, Value set2);
+
+/// @}
+
+/// @defgroup valuetables Value tables
+/// Hash tables keyed by any Value. Keys are equal if they're the same
+/// object, strings with the same characters, or numbers with the same value.
+/// @{
+
+/// Makes a new, empty value table with room for @c capacity keys.
+
+EXPORT  Value   NewValueTable(int capacity = 0);
+
+/// Looks up a key. Returns false if it's not there.
+
+EXPORT  bool    ValueTableGet(Value table, Value key, Value* pValue);
+
+/// Adds a key, or changes its value.
+
+EXPORT  void    ValueTableSet(Value table, Value key, Value value);
+
+/// Removes a key. Returns false if it wasn't there.
+
+EXPORT  bool    ValueTableRemove(Value table, Value key);
+
+/// Gets the number of keys.
+
+EXPORT  int     ValueTableCount(Value table);
+
+/// Steps through the keys and values, in no particular order. Start with
+/// @c *pIter set to 0. Returns false when there are no more.
+
+EXPORT  bool    ValueTableNext(Value table, int* pIter, Value* pKey, Value* pValue);
+
+/// @}
+
+/// @defgroup btrees B-trees
+/// Ordered maps keyed by integers, strings, or symbols. Integers come
+/// before strings, and strings before symbols. Strings compare by character
+/// code, and symbols by name, ignoring case.
+/// @{
+
+/// Makes a new, empty B-tree.
+
+EXPORT  Value   NewBTree(void);
+
+/// Looks up a key. Returns false if it's not there.
+
+EXPORT  bool    BTreeGet(Value tree, Value key, Value* pValue);
+
+/// Adds a key, or changes its value.
+
+EXPORT  void    BTreeSet(Value tree, Value key, Value value);
+
+/// Removes a key. Returns false if it wasn't there.
+
+EXPORT  bool    BTreeRemove(Value tree, Value key);
+
+/// Gets the number of keys.
+
+EXPORT  int     BTreeCount(Value tree);
+
+/// Makes a cursor at the first key that isn't less than @c key (or, if
+/// @c after is true, that's greater than @c key). Returns nil if there
+/// isn't one.
+
+EXPORT  Value   BTreeSeek(Value tree, Value key, bool after = false);
+
+/// Makes a cursor at the first or last key, or returns nil if the tree is
+/// empty.
+
+EXPORT  Value   BTreeFirst(Value tree);
+EXPORT  Value   BTreeLast(Value tree);
+
+/// Gets the key and value at a cursor. Both are nil once the cursor has
+/// moved off either end of the tree, and the value is nil if the key has
+/// been removed.
+
+EXPORT  Value   BTreeCursorKey(Value cursor);
+EXPORT  Value   BTreeCursorValue(Value cursor);
+
+/// Moves a cursor to the next or previous key. Returns false if there
+/// isn't one. The tree can change while a cursor is in use; the cursor
+/// moves from where its key is, or would be.
+
+EXPORT  bool    BTreeCursorNext(Value cursor);
+EXPORT  bool    BTreeCursorPrev(Value cursor);
+
+/// @}
+
+/// @defgroup frametables Frame tables
+/// Arrays of frames stored one column per slot. A frame table acts like an
+/// array of frames, but GetSlot makes a new frame for the row each time;
+/// paths like [i, tag] read and write the table itself.
+/// @{
+
+/// Makes a frame table with the rows of an array of frames. The rows get
+/// the first frame's slots.
+
+EXPORT  Value   NewFrameTable(Value frames);
+
+/// Makes an array of frames with the rows of a frame table.
+
+EXPORT  Value   FrameTableToArray(Value table);
+
+/// Makes an array with one slot of every row.
+
+EXPORT  Value   FrameTableColumn(Value table, Value tag);
+
+/// Adds up, or finds the least or greatest of, one slot of every row.
+/// Nils are skipped; anything else that isn't a number is an error.
+
+EXPORT  Value   FrameTableSum(Value table, Value tag);
+EXPORT  Value   FrameTableMin(Value table, Value tag);
+EXPORT  Value   FrameTableMax(Value table, Value tag);
+
+/// Makes an array of the indexes of the rows whose @c tag slot is a number
+/// from @c lo up to (but not including) @c hi. A nil bound means there
+/// isn't one.
+
+EXPORT  Value   FrameTableWhere(Value table, Value tag, Value lo, Value hi);
+
+/// Makes a frame table with the rows at the given indexes.
+
+EXPORT  Value   FrameTableGather(Value table, Value indexes);
+
+/// @}
+
+/// @defgroup views Views
+/// Ranges of arrays and binaries that aren't copied. A view acts like an
+/// array with the elements in the range, and GetData and GetBinaryLength
+/// give the range of a binary. Changes to the base show through. Changes
+/// through the view go to the base if @c writeThrough is true; otherwise
+/// the first one copies the range, and the view gets its own copy.
+/// @{
+
+/// Makes a view of @c length elements of an array, typed array, binary, or
+/// view, starting at @c offset. (Elements of a binary are bytes.)
+
+EXPORT  Value   NewView(Value base, int offset, int length, bool writeThrough = false);
+
+/// @}
+
+/// @defgroup typedarrays Typed arrays
+/// Arrays of raw numbers, stored in a binary of class @c int32Array,
+/// @c float64Array, or @c uint8Array. Indexing and Length work on them as
+/// on arrays. The arithmetic functions change their first argument and
+/// return it; integer arithmetic wraps around.
+/// @{
+
+/// Makes a typed array of @c length zeros.
+
+EXPORT  Value   NewTypedArray(Value cls, int length);
+
+/// Makes a typed array with the numbers in an array, or the reverse.
+
+EXPORT  Value   ArrayToTypedArray(Value array, Value cls);
+EXPORT  Value   TypedArrayToArray(Value array);
+
+/// Adds, subtracts, or multiplies the elements of @c b into @c a, which
+/// must be the same kind and length.
+
+EXPORT  Value   TypedArrayAdd(Value a, Value b);
+EXPORT  Value   TypedArraySubtract(Value a, Value b);
+EXPORT  Value   TypedArrayMultiply(Value a, Value b);
+
+/// Multiplies every element by @c factor (an integer, for integer arrays).
+
+EXPORT  Value   TypedArrayScale(Value array, Value factor);
+
+/// Gets the dot product of two arrays of the same kind and length.
+
+EXPORT  Value   TypedArrayDot(Value a, Value b);
+
+/// Adds up, or finds the least or greatest of, the elements. Min and max
+/// return nil for an empty array.
+
+EXPORT  Value   TypedArraySum(Value array);
+EXPORT  Value   TypedArrayMin(Value array);
+EXPORT  Value   TypedArrayMax(Value array);
+
+/// Makes the full convolution (of length n + m - 1) of two arrays of the
+/// same kind.
+
+EXPORT  Value   TypedArrayConvolve(Value signal, Value kernel);
+
+/// Sorts the elements in place, ascending. NaNs go at the end.
+
+EXPORT  Value   TypedArraySort(Value array);
+
 /// @}
 
 /// Reads a stream file and return the top-level object
@@ -74,6 +74,7 @@
 #define E_NoProto -48810 // No _proto for inherited send
 #define E_NILSlotAccess -48811 // Tried to access slot of nil
 #define E_InvalidBytecode - 48812 // Invalid bytecode
+#define E_StackOverflow -48813 // Stack overflow
 
 // evt.ex.fr.compiler
 #define E_SyntaxError -49000 // Syntax error
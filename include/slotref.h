@@ -0,0 +1,149 @@
+/*
+    Proto language runtime
+
+    Slot references and frame bindings for native code
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#ifndef __SLOTREF_H__
+#define __SLOTREF_H__
+
+#include "objects.h"
+
+/** @file */
+
+/// @defgroup slotrefs Slot references
+/// Getting a frame slot by tag means searching the frame's map. A SlotRef
+/// remembers where it found its tag last time, so getting the same slot of
+/// another frame with the same map (or of the same frame again) is a
+/// compare instead of a search. They're meant to be static:
+///
+/// @code
+///     static SlotRef g_width(SYM(width));
+///     ...
+///     int w = V_INT(GetSlot(frame, g_width));
+/// @endcode
+/// @{
+
+struct SlotRef {
+    SlotRef(Value theTag) : tag(theTag), map(V_NIL), offset(-1), fixed(false) { }
+
+    Value   tag;
+    Value   map;            // Where the tag was last looked up
+    int     offset;         // and what was found (-1 if it wasn't there)
+    bool    fixed;          // The map can't change, so neither can offset
+};
+
+/// Gets a frame slot's value, or nil if there's no such slot.
+
+EXPORT  Value   GetSlot(Value frame, SlotRef& ref);
+
+/// Sets a frame slot's value, adding the slot if there isn't one.
+
+EXPORT  void    SetSlot(Value frame, SlotRef& ref, Value newValue);
+
+/// Tests existence of a frame slot.
+
+EXPORT  bool    HasSlot(Value frame, SlotRef& ref);
+
+/// @}
+
+/// @defgroup bindings Frame bindings
+/// A FrameBinding maps the members of a C++ struct to the slots of a frame,
+/// so native code can read a whole frame into a struct, or write one out,
+/// in one call:
+///
+/// @code
+///     struct Point { int x; int y; };
+///
+///     static SlotField g_pointFields[] = {
+///         SlotField(SYM(x), &Point::x),
+///         SlotField(SYM(y), &Point::y)
+///     };
+///     static FrameBinding<Point> g_point(g_pointFields, ARRAYSIZE(g_pointFields));
+///     ...
+///     Point pt;
+///     g_point.Read(frame, &pt);
+/// @endcode
+///
+/// Members can be Values, ints, doubles, or bools. A missing slot reads as
+/// nil, so it's zero (or false) for the others.
+/// @{
+
+template<typename T> struct SlotConverter;
+
+template<> struct SlotConverter<Value> {
+    static Value    ToValue(Value v) { return v; }
+    static Value    FromValue(Value v) { return v; }
+};
+
+template<> struct SlotConverter<int> {
+    static Value    ToValue(int i) { return INT_V(i); }
+    static int      FromValue(Value v) { return v == V_NIL ? 0 : (int) V_INT(v); }
+};
+
+template<> struct SlotConverter<double> {
+    static Value    ToValue(double d) { return REAL_V(d); }
+    static double   FromValue(Value v) { return v == V_NIL ? 0.0 : V_REAL(v); }
+};
+
+template<> struct SlotConverter<bool> {
+    static Value    ToValue(bool b) { return BOOL_V(b); }
+    static bool     FromValue(Value v) { return v != V_NIL; }
+};
+
+typedef void    (*SlotReadFunc)(void* pMember, Value v);
+typedef Value   (*SlotWriteFunc)(const void* pMember);
+
+template<typename M> void   ReadSlotMember(void* pMember, Value v)
+    { *(M*) pMember = SlotConverter<M>::FromValue(v); }
+
+template<typename M> Value  WriteSlotMember(const void* pMember)
+    { return SlotConverter<M>::ToValue(*(const M*) pMember); }
+
+struct SlotField {
+    template<typename S, typename M>
+    SlotField(Value tag, M S::* member)
+        : ref(tag),
+          memberOffset((size_t) &(((S*) 0)->*member)),
+          read(ReadSlotMember<M>),
+          write(WriteSlotMember<M>) { }
+
+    SlotRef         ref;
+    size_t          memberOffset;
+    SlotReadFunc    read;
+    SlotWriteFunc   write;
+};
+
+/// Reads the slots of a frame into the members of a struct, or the reverse.
+
+EXPORT  void    ReadFrameSlots(Value frame, SlotField* fields, int nFields, void* pStruct);
+EXPORT  void    WriteFrameSlots(Value frame, SlotField* fields, int nFields, const void* pStruct);
+
+template<typename S>
+struct FrameBinding {
+    FrameBinding(SlotField* theFields, int theNumFields)
+        : fields(theFields), nFields(theNumFields) { }
+
+    void    Read(Value frame, S* pStruct)
+        { ReadFrameSlots(frame, fields, nFields, pStruct); }
+    void    Write(Value frame, const S* pStruct)
+        { WriteFrameSlots(frame, fields, nFields, pStruct); }
+
+    /// Makes a new frame with a slot for each member.
+    Value   NewFrame(const S* pStruct)
+    {
+        Value frame = ::NewFrame();
+        WriteFrameSlots(frame, fields, nFields, pStruct);
+        return frame;
+    }
+
+    SlotField*  fields;
+    int         nFields;
+};
+
+/// @}
+
+#endif //__SLOTREF_H__
@@ -0,0 +1,927 @@
+/*
+    Proto language runtime
+
+    Array algorithms: sorting, searching, splicing, and sets
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "predefined.h"
+#include "native.h"
+#include "interpreter.h"
+#include "gc.h"
+#include "simd.h"
+#include <string.h>
+#include <algorithm>
+
+// Scripts used to sort and search arrays in bytecode, one interpreted
+// comparison at a time. These do it natively, moving slots with memmove.
+// They work on plain arrays and views of them; the ones that don't change
+// the length also work on frame tables and other views, an element at a
+// time.
+//
+// Sorting and searching take a test and a key, like Newton's:
+//
+//      test    '|<| or '|>| to order numbers, strings (by character code),
+//              and symbols (by name, ignoring case), in that order;
+//              '|str<| or '|str>| to order strings ignoring case; or a
+//              function of two keys that returns a negative number, zero,
+//              or a positive number
+//      key     nil to compare the elements themselves, a path (symbol,
+//              integer, or path expression) to compare a slot of each, or
+//              a function of one element that returns its key
+//
+// Linear searches take '|=|, '|str=|, or a function that returns non-nil
+// when its two arguments match. Sets are plain arrays whose elements are
+// the same if V_EQ says so.
+
+//----------------------------------------------------------------
+// Getting at the slots
+//----------------------------------------------------------------
+
+// The slots of an array for reading, or 0 if they have to be got one at a
+// time with GetSlot (frame tables, and views of them or of typed arrays).
+
+const Value*    ReadOnlySlots(Value array, int* pLength)
+{
+    Object* pObj = V_PTR(array);
+    if (!ObjIsArray(pObj))
+        PROTO_THROW_ERR(g_exType, E_NotAnArray, array);
+
+    *pLength = GetArrayLength(array);
+    if (ObjIsView(pObj))
+        return GetViewReadOnlySlots(pObj);
+    if (ObjIsFrameTable(pObj))
+        return 0;
+    return pObj->pSlots;
+}
+
+// The slots of a plain array or a view of one, ready to be changed.
+
+Value*  MutableSlots(Value array, int* pLength)
+{
+    Object* pObj = V_PTR(array);
+    if (!ObjIsArray(pObj) || ObjIsFrameTable(pObj))
+        PROTO_THROW_ERR(g_exType, E_NotAnArray, array);
+
+    if (ObjIsView(pObj)) {
+        *pLength = ViewLength(pObj);
+        return GetViewSlots(pObj);
+    }
+    Unshare(pObj);
+    *pLength = pObj->size;
+    return pObj->pSlots;
+}
+
+inline void CheckRange(int start, int count, int length)
+{
+    if (start < 0 || count < 0 || start > length - count)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+}
+
+void    ReadValues(Value array, int start, int count, Value* pDest)
+{
+    int length;
+    const Value* pSlots = ReadOnlySlots(array, &length);
+    CheckRange(start, count, length);
+    if (pSlots != 0)
+        memcpy(pDest, pSlots + start, count * sizeof(Value));
+    else {
+        for (int i = 0; i < count; i++)
+            pDest[i] = GetSlot(array, start + i);
+    }
+}
+
+void    WriteValues(Value array, int start, int count, const Value* pSrc)
+{
+    int length;
+    if (ReadOnlySlots(array, &length) != 0) {
+        Value* pSlots = MutableSlots(array, &length);
+        CheckRange(start, count, length);
+        memcpy(pSlots + start, pSrc, count * sizeof(Value));
+    }
+    else {
+        CheckRange(start, count, length);
+        for (int i = 0; i < count; i++)
+            SetSlot(array, start + i, pSrc[i]);
+    }
+}
+
+// Scratch space the collector can see.
+
+inline Value*   NewValueBuffer(int n)
+{
+    return (Value*) GC_MALLOC((n > 0 ? n : 1) * sizeof(Value));
+}
+
+//----------------------------------------------------------------
+// Keys and tests
+//----------------------------------------------------------------
+
+bool    IsFunctionObject(Value v)
+{
+    if (!V_ISPTR(v))
+        return false;
+    Object* pObj = V_PTR(v);
+    return ObjIsFrame(pObj) && pObj->size >= 1 &&
+           (pObj->pSlots[0] == FUNCTION_CLASS || pObj->pSlots[0] == NATIVE_FN_CLASS);
+}
+
+Value   ElementKey(Value element, Value key)
+{
+    if (key == V_NIL)
+        return element;
+    if (IsFunctionObject(key))
+        return Call(key, element);
+    return GetPath(element, key);
+}
+
+// The elements' keys, in a new buffer, or the elements themselves if
+// there's no key.
+
+Value*  ElementKeys(Value* values, int n, Value key)
+{
+    if (key == V_NIL)
+        return values;
+    Value* keys = NewValueBuffer(n);
+    for (int i = 0; i < n; i++)
+        keys[i] = ElementKey(values[i], key);
+    return keys;
+}
+
+struct SortTest {
+    Value   func;           // nil for a built-in test
+    int     sign;           // -1 to reverse a built-in test
+    bool    ignoreCase;
+};
+
+SortTest    ParseSortTest(Value test)
+{
+    SortTest t;
+    t.func = V_NIL;
+    t.sign = 1;
+    t.ignoreCase = false;
+
+    if (IsFunctionObject(test)) {
+        t.func = test;
+        return t;
+    }
+    if (!IsSymbol(test))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, test);
+
+    const char* name = SymbolName(test);
+    if (strncmp(name, "str", 3) == 0) {
+        t.ignoreCase = true;
+        name += 3;
+    }
+    if (strcmp(name, ">") == 0)
+        t.sign = -1;
+    else if (strcmp(name, "<") != 0)
+        PROTO_THROW_ERR(g_exType, E_BadArguments, test);
+    return t;
+}
+
+enum {
+    SK_NUMBER,
+    SK_STRING,
+    SK_SYMBOL
+};
+
+// Strings and ropes.
+
+bool    IsStringOrRope(Value key)
+{
+    if (!V_ISPTR(key))
+        return false;
+    Object* pObj = V_PTR(key);
+    return (ObjIsBinary(pObj) && pObj->cls == PSYM(string)) || ObjIsRope(pObj);
+}
+
+int     SortKeyKind(Value key)
+{
+    if (V_ISINT(key) || IsReal(key))
+        return SK_NUMBER;
+    if (IsStringOrRope(key))
+        return SK_STRING;
+    if (IsSymbol(key))
+        return SK_SYMBOL;
+    PROTO_THROW_ERR(g_exType, E_BadArguments, key);
+    return 0;
+}
+
+inline double   NumberKey(Value key)
+{
+    return V_ISINT(key) ? (double) UNSAFE_V_INT(key) : V_REAL(key);
+}
+
+int     CompareSortKeys(Value a, Value b, bool ignoreCase)
+{
+    if (V_ISINT(a) && V_ISINT(b)) {
+        IntPtr i = UNSAFE_V_INT(a);
+        IntPtr j = UNSAFE_V_INT(b);
+        return i < j ? -1 : i > j;
+    }
+
+    int kindA = SortKeyKind(a);
+    int kindB = SortKeyKind(b);
+    if (kindA != kindB)
+        return kindA - kindB;
+
+    if (kindA == SK_NUMBER) {
+        double x = NumberKey(a);
+        double y = NumberKey(b);
+        return x < y ? -1 : x > y;
+    }
+    if (kindA == SK_STRING)
+        return StrCompare(a, b, ignoreCase);
+    return strcasecmp(SymbolName(a), SymbolName(b));
+}
+
+int     CompareWithTest(const SortTest& t, Value a, Value b)
+{
+    if (t.func != V_NIL)
+        return (int) V_INT(Call(t.func, a, b));
+    return CompareSortKeys(a, b, t.ignoreCase) * t.sign;
+}
+
+//----------------------------------------------------------------
+// Sorting
+//----------------------------------------------------------------
+
+// Keys that are all integers, all symbols, or all plain strings are
+// unwrapped once before sorting, so each comparison is cheap.
+
+template<typename KEY_T>
+struct SortEntry {
+    KEY_T   key;
+    Value   value;
+};
+
+inline int  CompareEntryKeys(IntPtr a, IntPtr b, bool)
+{
+    return a < b ? -1 : a > b;
+}
+
+inline int  CompareEntryKeys(const char* a, const char* b, bool)
+{
+    return strcasecmp(a, b);
+}
+
+inline int  CompareEntryKeys(Object* a, Object* b, bool ignoreCase)
+{
+    return CompareStringChars(a, b, ignoreCase);
+}
+
+inline int  CompareEntryKeys(Value a, Value b, bool ignoreCase)
+{
+    return CompareSortKeys(a, b, ignoreCase);
+}
+
+template<typename KEY_T>
+struct EntryLess {
+    int     sign;
+    bool    ignoreCase;
+
+    bool operator()(const SortEntry<KEY_T>& a, const SortEntry<KEY_T>& b) const
+        { return CompareEntryKeys(a.key, b.key, ignoreCase) * sign < 0; }
+};
+
+// A function test is called for every comparison, so it gets a merge sort,
+// which makes fewer of them than introsort (and can't run off the ends if
+// the function isn't consistent).
+
+struct FunctionLess {
+    Value   func;
+
+    bool operator()(const SortEntry<Value>& a, const SortEntry<Value>& b) const
+        { return V_INT(Call(func, a.key, b.key)) < 0; }
+};
+
+inline IntPtr       IntKey(Value key) { return UNSAFE_V_INT(key); }
+inline const char*  NameKey(Value key) { return SymbolName(key); }
+inline Object*      StringKey(Value key) { return V_PTR(key); }
+inline Value        ValueKey(Value key) { return key; }
+
+template<typename KEY_T, typename LESS_T>
+void    SortByKeys(Value* values, const Value* keys, int n, KEY_T (*unwrap)(Value),
+                   LESS_T less, bool stable)
+{
+    SortEntry<KEY_T>* entries = (SortEntry<KEY_T>*) GC_MALLOC(n * sizeof(SortEntry<KEY_T>));
+    for (int i = 0; i < n; i++) {
+        entries[i].key = unwrap(keys[i]);
+        entries[i].value = values[i];
+    }
+
+    if (stable)
+        std::stable_sort(entries, entries + n, less);
+    else
+        std::sort(entries, entries + n, less);
+
+    for (int i = 0; i < n; i++)
+        values[i] = entries[i].value;
+    GC_FREE(entries);
+}
+
+template<typename KEY_T>
+inline void SortByKeys(Value* values, const Value* keys, int n, KEY_T (*unwrap)(Value),
+                       const SortTest& t)
+{
+    EntryLess<KEY_T> less = { t.sign, t.ignoreCase };
+    SortByKeys(values, keys, n, unwrap, less, false);
+}
+
+// Sorts a copy of the elements, and puts them back at the end, so a test
+// or key function that throws (or changes the array) can't leave it half
+// sorted.
+
+void    SortArray(Value array, Value test, Value key)
+{
+    SortTest t = ParseSortTest(test);
+    int n = GetArrayLength(array);
+    if (n < 2)
+        return;
+
+    Value* values = NewValueBuffer(n);
+    ReadValues(array, 0, n, values);
+    Value* keys = ElementKeys(values, n, key);
+
+    if (t.func != V_NIL) {
+        FunctionLess less = { t.func };
+        SortByKeys(values, keys, n, ValueKey, less, true);
+    }
+    else {
+        bool ints = true, symbols = true, strings = true;
+        for (int i = 0; i < n && (ints || symbols || strings); i++) {
+            Value k = keys[i];
+            if (!V_ISINT(k))
+                ints = false;
+            if (!V_ISPTR(k))
+                symbols = strings = false;
+            else {
+                Object* pObj = V_PTR(k);
+                if (!ObjIsSymbol(pObj))
+                    symbols = false;
+                if (!ObjIsBinary(pObj) || pObj->cls != PSYM(string))
+                    strings = false;
+            }
+        }
+
+        if (ints)
+            SortByKeys(values, keys, n, IntKey, t);
+        else if (symbols)
+            SortByKeys(values, keys, n, NameKey, t);
+        else if (strings)
+            SortByKeys(values, keys, n, StringKey, t);
+        else
+            SortByKeys(values, keys, n, ValueKey, t);
+    }
+
+    if (GetArrayLength(array) != n)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+    WriteValues(array, 0, n, values);
+
+    if (keys != values)
+        GC_FREE(keys);
+    GC_FREE(values);
+}
+
+// The array has to be sorted by the same test and key. Returns the index
+// of an element whose key compares equal to item, or -1.
+
+int     BinarySearch(Value array, Value item, Value test, Value key)
+{
+    SortTest t = ParseSortTest(test);
+    int length;
+    const Value* pSlots = ReadOnlySlots(array, &length);
+
+    int lo = 0;
+    int hi = length;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        Value element = pSlots ? pSlots[mid] : GetSlot(array, mid);
+        int cmp = CompareWithTest(t, item, ElementKey(element, key));
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+
+        // A test or key function can change the array
+        if (pSlots != 0)
+            pSlots = ReadOnlySlots(array, &length);
+        if (hi > length)
+            PROTO_THROW(g_exFr, E_OutOfBounds);
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------
+// Linear search
+//----------------------------------------------------------------
+
+// Index of the first slot at or after start that's exactly v, or -1.
+
+int     FindValueBits(const Value* pSlots, int start, int n, Value v)
+{
+    int i = start;
+#if HAVE_AVX2 && PROTO_64BIT
+    __m256i vv = _mm256_set1_epi64x((long long) v);
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (pSlots + i));
+        UInt32 mask = (UInt32) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x, vv)));
+        if (mask != 0)
+            return i + LowestBitIndex(mask);
+    }
+#elif HAVE_SSE2 && PROTO_64BIT
+    // No 64-bit compare in SSE2: both halves of a slot have to match
+    __m128i vv = _mm_set1_epi64x((long long) v);
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (pSlots + i));
+        __m128i eq = _mm_cmpeq_epi32(x, vv);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        UInt32 mask = (UInt32) _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if (mask != 0)
+            return i + LowestBitIndex(mask);
+    }
+#elif HAVE_SSE2
+    __m128i vv = _mm_set1_epi32((int) (IntPtr) v);
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (pSlots + i));
+        UInt32 mask = (UInt32) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, vv)));
+        if (mask != 0)
+            return i + LowestBitIndex(mask);
+    }
+#endif
+    for (; i < n; i++) {
+        if (pSlots[i] == v)
+            return i;
+    }
+    return -1;
+}
+
+// Index of the first element at or after start that V_EQ says is v, or -1.
+
+int     FindValue(Value array, Value v, int start)
+{
+    int length;
+    const Value* pSlots = ReadOnlySlots(array, &length);
+    if (start < 0 || start > length)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    // Only a reference can be V_EQ to something with different bits
+    if (pSlots != 0 && !V_ISPTR(v))
+        return FindValueBits(pSlots, start, length, v);
+
+    for (int i = start; i < length; i++) {
+        if (V_EQ(pSlots ? pSlots[i] : GetSlot(array, i), v))
+            return i;
+    }
+    return -1;
+}
+
+bool    EqualKeys(Value a, Value b)
+{
+    if (V_EQ(a, b))
+        return true;
+    return IsReal(a) && IsReal(b) && V_REAL(a) == V_REAL(b);
+}
+
+// Index of the first element at or after start whose key matches item, or
+// -1.
+
+int     LinearSearch(Value array, Value item, int start, Value test, Value key)
+{
+    bool isFunc = IsFunctionObject(test);
+    bool strTest = false;
+    if (!isFunc) {
+        const char* name = IsSymbol(test) ? SymbolName(test) : "";
+        if (strcmp(name, "str=") == 0)
+            strTest = true;
+        else if (strcmp(name, "=") != 0)
+            PROTO_THROW_ERR(g_exType, E_BadArguments, test);
+        if (!strTest && key == V_NIL && !IsReal(item))
+            return FindValue(array, item, start);
+    }
+
+    int length = GetArrayLength(array);
+    if (start < 0 || start > length)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    bool strItem = strTest && IsStringOrRope(item);
+    for (int i = start; i < GetArrayLength(array); i++) {
+        Value k = ElementKey(GetSlot(array, i), key);
+        if (isFunc) {
+            if (Call(test, item, k) != V_NIL)
+                return i;
+        }
+        else if (strTest) {
+            if (strItem && IsStringOrRope(k) && StrCompare(item, k, true) == 0)
+                return i;
+        }
+        else if (EqualKeys(item, k))
+            return i;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------
+// Splicing
+//----------------------------------------------------------------
+
+// Replaces count1 elements of array1 starting at start1 with count2
+// elements of array2 starting at start2 (none if array2 is nil). A
+// negative count means the rest of the array. array1 changes length
+// unless the counts are the same.
+
+void    ArrayMunger(Value array1, int start1, int count1,
+                    Value array2, int start2, int count2)
+{
+    int length1;
+    MutableSlots(array1, &length1);
+    if (count1 < 0)
+        count1 = length1 - start1;
+    CheckRange(start1, count1, length1);
+
+    // The new elements are copied out first: array2 can be array1, or a
+    // view of it, and array1's slots can move when it grows.
+    Value* pNew = 0;
+    if (array2 == V_NIL)
+        count2 = 0;
+    else {
+        int length2 = GetArrayLength(array2);
+        if (count2 < 0)
+            count2 = length2 - start2;
+        CheckRange(start2, count2, length2);
+        pNew = NewValueBuffer(count2);
+        ReadValues(array2, start2, count2, pNew);
+    }
+
+    int newLength = length1 - count1 + count2;
+    int nTail = length1 - start1 - count1;
+    if (newLength != length1 && ObjIsView(V_PTR(array1)))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, array1);     // Views can't grow
+
+    Value* pSlots;
+    if (newLength > length1) {
+        SetArrayLength(array1, newLength);
+        pSlots = MutableSlots(array1, &length1);
+        memmove(pSlots + start1 + count2, pSlots + start1 + count1, nTail * sizeof(Value));
+    }
+    else {
+        pSlots = MutableSlots(array1, &length1);
+        memmove(pSlots + start1 + count2, pSlots + start1 + count1, nTail * sizeof(Value));
+        SetArrayLength(array1, newLength);
+        pSlots = MutableSlots(array1, &length1);
+    }
+
+    if (count2 > 0) {
+        memcpy(pSlots + start1, pNew, count2 * sizeof(Value));
+        GC_FREE(pNew);
+    }
+}
+
+void    ArrayInsert(Value array, Value element, int index)
+{
+    int length;
+    MutableSlots(array, &length);
+    if (index < 0 || index > length)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    AddArraySlot(array, V_NIL);
+    Value* pSlots = MutableSlots(array, &length);
+    memmove(pSlots + index + 1, pSlots + index, (length - 1 - index) * sizeof(Value));
+    pSlots[index] = element;
+}
+
+void    ArrayRemoveCount(Value array, int start, int count)
+{
+    ArrayMunger(array, start, count, V_NIL, 0, 0);
+}
+
+//----------------------------------------------------------------
+// Sets
+//----------------------------------------------------------------
+
+// The bits that stand for a value in a set. Equal references can have
+// different bits if one has been replaced (see ReplaceObject).
+
+inline Value    MemberBits(Value v)
+{
+    return V_ISPTR(v) ? PTR_V(V_PTR(v)) : v;
+}
+
+inline bool MemberBitsLess(Value a, Value b)
+{
+    return (UIntPtr) a < (UIntPtr) b;
+}
+
+// Orders a set's values (with their indexes) so duplicates are together,
+// first one first.
+
+inline bool MemberThenIndexLess(const SortEntry<Value>& a, const SortEntry<Value>& b)
+{
+    if (a.key != b.key)
+        return MemberBitsLess(a.key, b.key);
+    return UNSAFE_V_INT(a.value) < UNSAFE_V_INT(b.value);
+}
+
+// For testing lots of values against one set. A small set is scanned, and
+// a big one is sorted and searched.
+
+const int SMALL_SET = 16;
+
+struct Membership {
+    Value*  bits;
+    int     n;
+};
+
+void    InitMembership(Membership* pM, Value set)
+{
+    pM->n = GetArrayLength(set);
+    pM->bits = NewValueBuffer(pM->n);
+    ReadValues(set, 0, pM->n, pM->bits);
+    for (int i = 0; i < pM->n; i++)
+        pM->bits[i] = MemberBits(pM->bits[i]);
+    if (pM->n > SMALL_SET)
+        std::sort(pM->bits, pM->bits + pM->n, MemberBitsLess);
+}
+
+bool    IsMember(const Membership& m, Value v)
+{
+    v = MemberBits(v);
+    if (m.n > SMALL_SET)
+        return std::binary_search(m.bits, m.bits + m.n, v, MemberBitsLess);
+    return FindValueBits(m.bits, 0, m.n, v) >= 0;
+}
+
+inline void FreeMembership(Membership* pM)
+{
+    GC_FREE(pM->bits);
+}
+
+// Index of value in set, or -1.
+
+int     SetContains(Value set, Value value)
+{
+    return FindValue(set, value, 0);
+}
+
+// The elements of set1 followed by the elements of set2 that aren't in
+// set1. If uniqueOnly is true, duplicates within either set are left out
+// too.
+
+Value   SetUnion(Value set1, Value set2, bool uniqueOnly)
+{
+    int n1 = GetArrayLength(set1);
+    int n2 = GetArrayLength(set2);
+    Value result = NewArray(n1 + n2);
+    Value* pResult = UNSAFE_V_PTR(result)->pSlots;
+    ReadValues(set1, 0, n1, pResult);
+    ReadValues(set2, 0, n2, pResult + n1);
+
+    int n = 0;
+    if (uniqueOnly) {
+        // Sort the positions by value, and keep the first of each run
+        SortEntry<Value>* entries = (SortEntry<Value>*) GC_MALLOC((n1 + n2 + 1) * sizeof(SortEntry<Value>));
+        for (int i = 0; i < n1 + n2; i++) {
+            entries[i].key = MemberBits(pResult[i]);
+            entries[i].value = INT_V(i);
+        }
+        std::sort(entries, entries + n1 + n2, MemberThenIndexLess);
+
+        Byte* keep = (Byte*) GC_MALLOC_ATOMIC(n1 + n2 + 1);
+        memset(keep, 0, n1 + n2 + 1);
+        for (int i = 0; i < n1 + n2; i++) {
+            if (i == 0 || entries[i].key != entries[i - 1].key)
+                keep[UNSAFE_V_INT(entries[i].value)] = 1;
+        }
+        for (int i = 0; i < n1 + n2; i++) {
+            if (keep[i])
+                pResult[n++] = pResult[i];
+        }
+        GC_FREE(keep);
+        GC_FREE(entries);
+    }
+    else {
+        Membership m;
+        InitMembership(&m, set1);
+        n = n1;
+        for (int i = n1; i < n1 + n2; i++) {
+            if (!IsMember(m, pResult[i]))
+                pResult[n++] = pResult[i];
+        }
+        FreeMembership(&m);
+    }
+
+    SetArrayLength(result, n);
+    return result;
+}
+
+// The elements of set1 that aren't in set2.
+
+Value   SetDifference(Value set1, Value set2)
+{
+    int n1 = GetArrayLength(set1);
+    Value result = NewArray(n1);
+    Value* pResult = UNSAFE_V_PTR(result)->pSlots;
+    ReadValues(set1, 0, n1, pResult);
+
+    Membership m;
+    InitMembership(&m, set2);
+    int n = 0;
+    for (int i = 0; i < n1; i++) {
+        if (!IsMember(m, pResult[i]))
+            pResult[n++] = pResult[i];
+    }
+    FreeMembership(&m);
+
+    SetArrayLength(result, n);
+    return result;
+}
+
+bool    SetOverlaps(Value set1, Value set2)
+{
+    int n1 = GetArrayLength(set1);
+    Value* values = NewValueBuffer(n1);
+    ReadValues(set1, 0, n1, values);
+
+    Membership m;
+    InitMembership(&m, set2);
+    bool overlaps = false;
+    for (int i = 0; i < n1 && !overlaps; i++)
+        overlaps = IsMember(m, values[i]);
+    FreeMembership(&m);
+    GC_FREE(values);
+    return overlaps;
+}
+
+//----------------------------------------------------------------
+// Natives
+//----------------------------------------------------------------
+
+inline Value    IndexOrNil(int index)
+{
+    return index < 0 ? V_NIL : INT_V(index);
+}
+
+// A nil count means the rest of the array.
+
+inline int  CountOrRest(Value count)
+{
+    return count == V_NIL ? -1 : V_INDEX(count);
+}
+
+NATIVE_FUNC(FSort)
+{
+    NATIVE_ARGS_3(array, test, key);
+    SortArray(ARG(array), ARG(test), ARG(key));
+    return ARG(array);
+}
+
+DECLARE_GLOBAL_FUNCTION("Sort", FSort, 3);
+
+NATIVE_FUNC(FBinarySearch)
+{
+    NATIVE_ARGS_4(array, item, test, key);
+    return IndexOrNil(BinarySearch(ARG(array), ARG(item), ARG(test), ARG(key)));
+}
+
+DECLARE_GLOBAL_FUNCTION("BinarySearch", FBinarySearch, 4);
+
+NATIVE_FUNC(FLSearch)
+{
+    NATIVE_ARGS_5(array, item, start, test, key);
+    return IndexOrNil(LinearSearch(ARG(array), ARG(item), V_INDEX(ARG(start)), ARG(test), ARG(key)));
+}
+
+DECLARE_GLOBAL_FUNCTION("LSearch", FLSearch, 5);
+
+NATIVE_FUNC(FLFetch)
+{
+    NATIVE_ARGS_5(array, item, start, test, key);
+    int index = LinearSearch(ARG(array), ARG(item), V_INDEX(ARG(start)), ARG(test), ARG(key));
+    return index < 0 ? V_NIL : GetSlot(ARG(array), index);
+}
+
+DECLARE_GLOBAL_FUNCTION("LFetch", FLFetch, 5);
+
+NATIVE_FUNC(FArrayMunger)
+{
+    NATIVE_ARGS_6(array1, start1, count1, array2, start2, count2);
+    ArrayMunger(ARG(array1), V_INDEX(ARG(start1)), CountOrRest(ARG(count1)),
+                ARG(array2), ARG(array2) == V_NIL ? 0 : V_INDEX(ARG(start2)), CountOrRest(ARG(count2)));
+    return ARG(array1);
+}
+
+DECLARE_GLOBAL_FUNCTION("ArrayMunger", FArrayMunger, 6);
+
+NATIVE_FUNC(FArrayInsert)
+{
+    NATIVE_ARGS_3(array, element, position);
+    ArrayInsert(ARG(array), ARG(element), V_INDEX(ARG(position)));
+    return ARG(array);
+}
+
+DECLARE_GLOBAL_FUNCTION("ArrayInsert", FArrayInsert, 3);
+
+NATIVE_FUNC(FArrayRemoveCount)
+{
+    NATIVE_ARGS_3(array, start, count);
+    ArrayRemoveCount(ARG(array), V_INDEX(ARG(start)), V_INDEX(ARG(count)));
+    return ARG(array);
+}
+
+DECLARE_GLOBAL_FUNCTION("ArrayRemoveCount", FArrayRemoveCount, 3);
+
+// Filter and map call a function for each element, in order.
+
+NATIVE_FUNC(FArrayFilter)
+{
+    NATIVE_ARGS_2(array, func);
+    int n = GetArrayLength(ARG(array));
+    Value* values = NewValueBuffer(n);
+    ReadValues(ARG(array), 0, n, values);
+
+    Value result = NewArray(n);
+    int nKept = 0;
+    for (int i = 0; i < n; i++) {
+        if (Call(ARG(func), values[i]) != V_NIL)
+            UNSAFE_V_PTR(result)->pSlots[nKept++] = values[i];
+    }
+    GC_FREE(values);
+    SetArrayLength(result, nKept);
+    return result;
+}
+
+DECLARE_GLOBAL_FUNCTION("ArrayFilter", FArrayFilter, 2);
+
+NATIVE_FUNC(FArrayMap)
+{
+    NATIVE_ARGS_2(array, func);
+    int n = GetArrayLength(ARG(array));
+    Value result = NewArray(n);
+    Value* pResult = UNSAFE_V_PTR(result)->pSlots;
+    ReadValues(ARG(array), 0, n, pResult);
+    for (int i = 0; i < n; i++)
+        pResult[i] = Call(ARG(func), pResult[i]);
+    return result;
+}
+
+DECLARE_GLOBAL_FUNCTION("ArrayMap", FArrayMap, 2);
+
+NATIVE_FUNC(FSetContains)
+{
+    NATIVE_ARGS_2(array, item);
+    return IndexOrNil(SetContains(ARG(array), ARG(item)));
+}
+
+DECLARE_GLOBAL_FUNCTION("SetContains", FSetContains, 2);
+
+NATIVE_FUNC(FSetAdd)
+{
+    NATIVE_ARGS_3(array, value, uniqueOnly);
+    if (ARG(uniqueOnly) == V_NIL || SetContains(ARG(array), ARG(value)) < 0)
+        AddArraySlot(ARG(array), ARG(value));
+    return ARG(array);
+}
+
+DECLARE_GLOBAL_FUNCTION("SetAdd", FSetAdd, 3);
+
+NATIVE_FUNC(FSetRemove)
+{
+    NATIVE_ARGS_2(array, value);
+    int index = SetContains(ARG(array), ARG(value));
+    if (index >= 0)
+        ArrayRemoveCount(ARG(array), index, 1);
+    return ARG(array);
+}
+
+DECLARE_GLOBAL_FUNCTION("SetRemove", FSetRemove, 2);
+
+NATIVE_FUNC(FSetUnion)
+{
+    NATIVE_ARGS_3(array1, array2, uniqueOnly);
+    return SetUnion(ARG(array1), ARG(array2), ARG(uniqueOnly) != V_NIL);
+}
+
+DECLARE_GLOBAL_FUNCTION("SetUnion", FSetUnion, 3);
+
+NATIVE_FUNC(FSetDifference)
+{
+    NATIVE_ARGS_2(array1, array2);
+    return SetDifference(ARG(array1), ARG(array2));
+}
+
+DECLARE_GLOBAL_FUNCTION("SetDifference", FSetDifference, 2);
+
+NATIVE_FUNC(FSetOverlaps)
+{
+    NATIVE_ARGS_2(array1, array2);
+    return BOOL_V(SetOverlaps(ARG(array1), ARG(array2)));
+}
+
+DECLARE_GLOBAL_FUNCTION("SetOverlaps", FSetOverlaps, 2);
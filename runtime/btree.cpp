@@ -0,0 +1,779 @@
+/*
+    Proto language runtime
+
+    B-trees: ordered maps for range queries
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "predefined.h"
+#include "native.h"
+#include <string.h>
+
+// A B+-tree: every key and value is in a leaf, the leaves are linked in
+// key order, and the interior nodes only hold copies of keys to steer
+// searches. Nodes are arrays, so the collector traces them like anything
+// else, and each node's keys are contiguous so a search within a node
+// stays in a few cache lines.
+//
+// Keys are integers, strings, or symbols. Keys of different kinds are
+// ordered integers first, then strings, then symbols. Strings compare by
+// character code, symbols by name, ignoring case (like symbols do).
+//
+// A tree is an array of class bTree:
+//
+//      root        the root node
+//      count       number of keys, as an integer
+//      first       the leftmost leaf
+//      last        the rightmost leaf
+//      changes     changed every time a key is added or removed
+//
+// Every node has room for one key more than the limit, so a node can take
+// a key and then split, and this is the layout of leaves (class
+// bTreeLeaf) and interior nodes (class bTreeNode):
+//
+//      n           number of keys, as an integer
+//      prev, next  neighboring leaves (leaves only)
+//      keys        BT_ORDER + 1 slots
+//      values      BT_ORDER + 1 slots (leaves), or
+//      children    BT_ORDER + 2 slots (interior nodes, n + 1 are used)
+
+enum {
+    BT_ROOT,
+    BT_COUNT,
+    BT_FIRST,
+    BT_LAST,
+    BT_CHANGES,
+    BT_SIZE
+};
+
+const int   BT_ORDER = 32;              // Most keys in a node
+const int   BT_MIN = BT_ORDER / 2;      // Fewest keys in a node (but the root)
+
+enum {
+    BTN_COUNT,
+    BTN_PREV,
+    BTN_NEXT,
+    BTN_KEYS,
+    BTN_VALUES = BTN_KEYS + BT_ORDER + 1,
+    BTN_CHILDREN = BTN_VALUES,
+    BTN_SIZE = BTN_CHILDREN + BT_ORDER + 2
+};
+
+// A cursor is an array of class bTreeCursor. It remembers its key, so when
+// the tree changes under it, it can find its place again.
+
+enum {
+    BTC_TREE,
+    BTC_LEAF,           // nil if the cursor is off either end
+    BTC_INDEX,          // and then -1 if off the start, 1 if off the end
+    BTC_KEY,
+    BTC_CHANGES,
+    BTC_SIZE
+};
+
+inline Value*   NodeSlots(Value obj)
+{
+    return UNSAFE_V_PTR(obj)->pSlots;
+}
+
+inline int  NodeCount(Value* node)
+{
+    return UNSAFE_V_INT(node[BTN_COUNT]);
+}
+
+inline bool IsLeaf(Value node)
+{
+    return UNSAFE_V_PTR(node)->cls == PSYM(bTreeLeaf);
+}
+
+// Nodes are only reachable through trees, so only trees and cursors have
+// to be checked. (Clone of a tree shares its nodes with the original, so
+// use DeepClone to copy one.)
+
+Value*  CheckBTree(Value tree)
+{
+    Object* pObj = V_PTR(tree);
+    if (!ObjIsArray(pObj) || pObj->cls != PSYM(bTree))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, tree);
+    return pObj->pSlots;
+}
+
+Value*  CheckCursor(Value cursor)
+{
+    Object* pObj = V_PTR(cursor);
+    if (!ObjIsArray(pObj) || pObj->cls != PSYM(bTreeCursor))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, cursor);
+    return pObj->pSlots;
+}
+
+//----------------------------------------------------------------
+// Comparing keys
+//----------------------------------------------------------------
+
+enum { KEY_INT, KEY_STRING, KEY_SYMBOL };
+
+int     KeyKind(Value key)
+{
+    if (V_ISINT(key))
+        return KEY_INT;
+    if (V_ISPTR(key)) {
+        Object* pObj = FlatObject(key);
+        if (ObjIsSymbol(pObj))
+            return KEY_SYMBOL;
+        if (ObjIsString(pObj))
+            return KEY_STRING;
+    }
+    PROTO_THROW_ERR(g_exType, E_BadArguments, key);
+    return 0;
+}
+
+int     CompareKeys(Value a, Value b)
+{
+    if (V_ISINT(a) && V_ISINT(b)) {
+        IntPtr i = UNSAFE_V_INT(a);
+        IntPtr j = UNSAFE_V_INT(b);
+        return i < j ? -1 : i > j;
+    }
+
+    if (a == b)
+        return 0;
+
+    int kindA = KeyKind(a);
+    int kindB = KeyKind(b);
+    if (kindA != kindB)
+        return kindA - kindB;
+
+    if (kindA == KEY_STRING)
+        return CompareStringChars(V_PTR(a), V_PTR(b), false);
+
+    return strcasecmp(SymbolName(a), SymbolName(b));
+}
+
+// Index of the first key in the node that isn't less than key (or, if
+// after is true, that's greater than key).
+
+int     SearchNode(Value* node, Value key, bool after)
+{
+    int lo = 0;
+    int hi = NodeCount(node);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = CompareKeys(node[BTN_KEYS + mid], key);
+        if (cmp < 0 || (after && cmp == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// The child of an interior node that key belongs under. Separator i is the
+// smallest key under child i + 1.
+
+inline int  ChildIndex(Value* node, Value key)
+{
+    return SearchNode(node, key, true);
+}
+
+Value   FindLeaf(Value* tree, Value key)
+{
+    Value node = tree[BT_ROOT];
+    while (!IsLeaf(node)) {
+        Value* pNode = NodeSlots(node);
+        node = pNode[BTN_CHILDREN + ChildIndex(pNode, key)];
+    }
+    return node;
+}
+
+//----------------------------------------------------------------
+// Moving things around in nodes
+//----------------------------------------------------------------
+
+inline void MoveSlots(Value* dest, Value* src, int n)
+{
+    memmove(dest, src, n * sizeof(Value));
+}
+
+Value   NewNode(bool leaf)
+{
+    Value node = NewArray(leaf ? PSYM(bTreeLeaf) : PSYM(bTreeNode), BTN_SIZE);
+    NodeSlots(node)[BTN_COUNT] = INT_V(0);
+    return node;
+}
+
+//----------------------------------------------------------------
+// Insertion
+//----------------------------------------------------------------
+
+// Splits a node that's one key over the limit. Returns the new right half,
+// and the key that separates them.
+
+Value   SplitLeaf(Value* tree, Value leaf, Value* pSep)
+{
+    Value* pLeaf = NodeSlots(leaf);
+    Value right = NewNode(true);
+    Value* pRight = NodeSlots(right);
+    int n = NodeCount(pLeaf);
+    int nLeft = n / 2;
+
+    MoveSlots(pRight + BTN_KEYS, pLeaf + BTN_KEYS + nLeft, n - nLeft);
+    MoveSlots(pRight + BTN_VALUES, pLeaf + BTN_VALUES + nLeft, n - nLeft);
+    pRight[BTN_COUNT] = INT_V(n - nLeft);
+    for (int i = nLeft; i < n; i++) {
+        pLeaf[BTN_KEYS + i] = V_NIL;
+        pLeaf[BTN_VALUES + i] = V_NIL;
+    }
+    pLeaf[BTN_COUNT] = INT_V(nLeft);
+
+    pRight[BTN_PREV] = leaf;
+    pRight[BTN_NEXT] = pLeaf[BTN_NEXT];
+    if (pLeaf[BTN_NEXT] != V_NIL)
+        NodeSlots(pLeaf[BTN_NEXT])[BTN_PREV] = right;
+    else
+        tree[BT_LAST] = right;
+    pLeaf[BTN_NEXT] = right;
+
+    *pSep = pRight[BTN_KEYS];
+    return right;
+}
+
+// The middle key of an interior node moves up, rather than being copied.
+
+Value   SplitInterior(Value node, Value* pSep)
+{
+    Value* pNode = NodeSlots(node);
+    Value right = NewNode(false);
+    Value* pRight = NodeSlots(right);
+    int n = NodeCount(pNode);
+    int nLeft = n / 2;
+    int nRight = n - nLeft - 1;
+
+    *pSep = pNode[BTN_KEYS + nLeft];
+    MoveSlots(pRight + BTN_KEYS, pNode + BTN_KEYS + nLeft + 1, nRight);
+    MoveSlots(pRight + BTN_CHILDREN, pNode + BTN_CHILDREN + nLeft + 1, nRight + 1);
+    pRight[BTN_COUNT] = INT_V(nRight);
+    for (int i = nLeft; i < n; i++) {
+        pNode[BTN_KEYS + i] = V_NIL;
+        pNode[BTN_CHILDREN + i + 1] = V_NIL;
+    }
+    pNode[BTN_COUNT] = INT_V(nLeft);
+
+    return right;
+}
+
+// Inserts into the subtree under node. If node splits, returns the new
+// right half and its separator; otherwise returns nil.
+
+Value   InsertInto(Value* tree, Value node, Value key, Value value, Value* pSep)
+{
+    Value* pNode = NodeSlots(node);
+    int n = NodeCount(pNode);
+
+    if (IsLeaf(node)) {
+        int i = SearchNode(pNode, key, false);
+        if (i < n && CompareKeys(pNode[BTN_KEYS + i], key) == 0) {
+            pNode[BTN_VALUES + i] = value;
+            return V_NIL;
+        }
+
+        MoveSlots(pNode + BTN_KEYS + i + 1, pNode + BTN_KEYS + i, n - i);
+        MoveSlots(pNode + BTN_VALUES + i + 1, pNode + BTN_VALUES + i, n - i);
+        pNode[BTN_KEYS + i] = key;
+        pNode[BTN_VALUES + i] = value;
+        pNode[BTN_COUNT] = INT_V(n + 1);
+        tree[BT_COUNT] = INT_V(UNSAFE_V_INT(tree[BT_COUNT]) + 1);
+        tree[BT_CHANGES] = INT_V(UNSAFE_V_INT(tree[BT_CHANGES]) + 1);
+
+        return (n + 1 > BT_ORDER) ? SplitLeaf(tree, node, pSep) : V_NIL;
+    }
+
+    int i = ChildIndex(pNode, key);
+    Value sep;
+    Value right = InsertInto(tree, pNode[BTN_CHILDREN + i], key, value, &sep);
+    if (right == V_NIL)
+        return V_NIL;
+
+    MoveSlots(pNode + BTN_KEYS + i + 1, pNode + BTN_KEYS + i, n - i);
+    MoveSlots(pNode + BTN_CHILDREN + i + 2, pNode + BTN_CHILDREN + i + 1, n - i);
+    pNode[BTN_KEYS + i] = sep;
+    pNode[BTN_CHILDREN + i + 1] = right;
+    pNode[BTN_COUNT] = INT_V(n + 1);
+
+    return (n + 1 > BT_ORDER) ? SplitInterior(node, pSep) : V_NIL;
+}
+
+//----------------------------------------------------------------
+// Removal
+//----------------------------------------------------------------
+
+// Child i of parent has just dropped below BT_MIN keys. It borrows a key
+// from a neighbor if the neighbor can spare one, and otherwise merges with
+// it.
+
+void    FixUnderflow(Value* tree, Value* pParent, int i)
+{
+    int nParent = NodeCount(pParent);
+    int iLeft = (i > 0) ? i - 1 : i;
+    Value left = pParent[BTN_CHILDREN + iLeft];
+    Value right = pParent[BTN_CHILDREN + iLeft + 1];
+    Value* pLeft = NodeSlots(left);
+    Value* pRight = NodeSlots(right);
+    int nLeft = NodeCount(pLeft);
+    int nRight = NodeCount(pRight);
+    bool leaf = IsLeaf(left);
+
+    if (i > 0 && nLeft > BT_MIN) {
+        // Borrow the left neighbor's last key
+        MoveSlots(pRight + BTN_KEYS + 1, pRight + BTN_KEYS, nRight);
+        if (leaf) {
+            MoveSlots(pRight + BTN_VALUES + 1, pRight + BTN_VALUES, nRight);
+            pRight[BTN_KEYS] = pLeft[BTN_KEYS + nLeft - 1];
+            pRight[BTN_VALUES] = pLeft[BTN_VALUES + nLeft - 1];
+            pLeft[BTN_VALUES + nLeft - 1] = V_NIL;
+            pParent[BTN_KEYS + iLeft] = pRight[BTN_KEYS];
+        }
+        else {
+            MoveSlots(pRight + BTN_CHILDREN + 1, pRight + BTN_CHILDREN, nRight + 1);
+            pRight[BTN_KEYS] = pParent[BTN_KEYS + iLeft];
+            pRight[BTN_CHILDREN] = pLeft[BTN_CHILDREN + nLeft];
+            pLeft[BTN_CHILDREN + nLeft] = V_NIL;
+            pParent[BTN_KEYS + iLeft] = pLeft[BTN_KEYS + nLeft - 1];
+        }
+        pLeft[BTN_KEYS + nLeft - 1] = V_NIL;
+        pLeft[BTN_COUNT] = INT_V(nLeft - 1);
+        pRight[BTN_COUNT] = INT_V(nRight + 1);
+    }
+    else if (i == 0 && nRight > BT_MIN) {
+        // Borrow the right neighbor's first key
+        if (leaf) {
+            pLeft[BTN_KEYS + nLeft] = pRight[BTN_KEYS];
+            pLeft[BTN_VALUES + nLeft] = pRight[BTN_VALUES];
+            MoveSlots(pRight + BTN_VALUES, pRight + BTN_VALUES + 1, nRight - 1);
+            pRight[BTN_VALUES + nRight - 1] = V_NIL;
+            MoveSlots(pRight + BTN_KEYS, pRight + BTN_KEYS + 1, nRight - 1);
+            pParent[BTN_KEYS + iLeft] = pRight[BTN_KEYS];
+        }
+        else {
+            pLeft[BTN_KEYS + nLeft] = pParent[BTN_KEYS + iLeft];
+            pLeft[BTN_CHILDREN + nLeft + 1] = pRight[BTN_CHILDREN];
+            pParent[BTN_KEYS + iLeft] = pRight[BTN_KEYS];
+            MoveSlots(pRight + BTN_CHILDREN, pRight + BTN_CHILDREN + 1, nRight);
+            pRight[BTN_CHILDREN + nRight] = V_NIL;
+            MoveSlots(pRight + BTN_KEYS, pRight + BTN_KEYS + 1, nRight - 1);
+        }
+        pRight[BTN_KEYS + nRight - 1] = V_NIL;
+        pLeft[BTN_COUNT] = INT_V(nLeft + 1);
+        pRight[BTN_COUNT] = INT_V(nRight - 1);
+    }
+    else {
+        // Merge the right node into the left one
+        if (leaf) {
+            MoveSlots(pLeft + BTN_KEYS + nLeft, pRight + BTN_KEYS, nRight);
+            MoveSlots(pLeft + BTN_VALUES + nLeft, pRight + BTN_VALUES, nRight);
+            pLeft[BTN_COUNT] = INT_V(nLeft + nRight);
+            pLeft[BTN_NEXT] = pRight[BTN_NEXT];
+            if (pRight[BTN_NEXT] != V_NIL)
+                NodeSlots(pRight[BTN_NEXT])[BTN_PREV] = left;
+            else
+                tree[BT_LAST] = left;
+        }
+        else {
+            pLeft[BTN_KEYS + nLeft] = pParent[BTN_KEYS + iLeft];
+            MoveSlots(pLeft + BTN_KEYS + nLeft + 1, pRight + BTN_KEYS, nRight);
+            MoveSlots(pLeft + BTN_CHILDREN + nLeft + 1, pRight + BTN_CHILDREN, nRight + 1);
+            pLeft[BTN_COUNT] = INT_V(nLeft + 1 + nRight);
+        }
+
+        MoveSlots(pParent + BTN_KEYS + iLeft, pParent + BTN_KEYS + iLeft + 1, nParent - iLeft - 1);
+        MoveSlots(pParent + BTN_CHILDREN + iLeft + 1, pParent + BTN_CHILDREN + iLeft + 2, nParent - iLeft - 1);
+        pParent[BTN_KEYS + nParent - 1] = V_NIL;
+        pParent[BTN_CHILDREN + nParent] = V_NIL;
+        pParent[BTN_COUNT] = INT_V(nParent - 1);
+    }
+}
+
+// Removes key from the subtree under node. Returns true if node is left
+// with too few keys.
+
+bool    RemoveFrom(Value* tree, Value node, Value key, bool* pRemoved)
+{
+    Value* pNode = NodeSlots(node);
+    int n = NodeCount(pNode);
+
+    if (IsLeaf(node)) {
+        int i = SearchNode(pNode, key, false);
+        if (i == n || CompareKeys(pNode[BTN_KEYS + i], key) != 0)
+            return false;
+
+        MoveSlots(pNode + BTN_KEYS + i, pNode + BTN_KEYS + i + 1, n - i - 1);
+        MoveSlots(pNode + BTN_VALUES + i, pNode + BTN_VALUES + i + 1, n - i - 1);
+        pNode[BTN_KEYS + n - 1] = V_NIL;
+        pNode[BTN_VALUES + n - 1] = V_NIL;
+        pNode[BTN_COUNT] = INT_V(n - 1);
+        tree[BT_COUNT] = INT_V(UNSAFE_V_INT(tree[BT_COUNT]) - 1);
+        tree[BT_CHANGES] = INT_V(UNSAFE_V_INT(tree[BT_CHANGES]) + 1);
+        *pRemoved = true;
+        return n - 1 < BT_MIN;
+    }
+
+    int i = ChildIndex(pNode, key);
+    if (RemoveFrom(tree, pNode[BTN_CHILDREN + i], key, pRemoved))
+        FixUnderflow(tree, pNode, i);
+    return NodeCount(pNode) < BT_MIN;
+}
+
+//----------------------------------------------------------------
+// Cursors
+//----------------------------------------------------------------
+
+Value   NewCursor(Value tree)
+{
+    Value cursor = NewArray(PSYM(bTreeCursor), BTC_SIZE);
+    NodeSlots(cursor)[BTC_TREE] = tree;
+    return cursor;
+}
+
+// Puts the cursor at index in leaf, or at the first key after the leaf if
+// index is past its end, or past the end of the tree if there isn't one.
+
+bool    MoveCursor(Value* pCursor, Value leaf, int index)
+{
+    while (leaf != V_NIL && index >= NodeCount(NodeSlots(leaf))) {
+        leaf = NodeSlots(leaf)[BTN_NEXT];
+        index = 0;
+    }
+
+    pCursor[BTC_CHANGES] = NodeSlots(pCursor[BTC_TREE])[BT_CHANGES];
+    pCursor[BTC_LEAF] = leaf;
+    if (leaf == V_NIL) {
+        pCursor[BTC_INDEX] = INT_V(1);
+        pCursor[BTC_KEY] = V_NIL;
+        return false;
+    }
+    pCursor[BTC_INDEX] = INT_V(index);
+    pCursor[BTC_KEY] = NodeSlots(leaf)[BTN_KEYS + index];
+    return true;
+}
+
+// Puts the cursor at the last key before index in leaf, or before the
+// start of the tree if there isn't one.
+
+bool    MoveCursorBack(Value* pCursor, Value leaf, int index)
+{
+    while (leaf != V_NIL && index < 0) {
+        leaf = NodeSlots(leaf)[BTN_PREV];
+        if (leaf != V_NIL)
+            index = NodeCount(NodeSlots(leaf)) - 1;
+    }
+
+    pCursor[BTC_CHANGES] = NodeSlots(pCursor[BTC_TREE])[BT_CHANGES];
+    pCursor[BTC_LEAF] = leaf;
+    if (leaf == V_NIL) {
+        pCursor[BTC_INDEX] = INT_V(-1);
+        pCursor[BTC_KEY] = V_NIL;
+        return false;
+    }
+    pCursor[BTC_INDEX] = INT_V(index);
+    pCursor[BTC_KEY] = NodeSlots(leaf)[BTN_KEYS + index];
+    return true;
+}
+
+// If the tree has changed since the cursor got to its key, the cursor's
+// leaf may be gone, so it finds the key's place again. Leaves *pLeaf and
+// *pIndex where the key is, or would be.
+
+void    CursorPlace(Value* pCursor, Value* pLeaf, int* pIndex)
+{
+    Value* tree = NodeSlots(pCursor[BTC_TREE]);
+    if (pCursor[BTC_CHANGES] == tree[BT_CHANGES]) {
+        *pLeaf = pCursor[BTC_LEAF];
+        *pIndex = UNSAFE_V_INT(pCursor[BTC_INDEX]);
+    }
+    else {
+        *pLeaf = FindLeaf(tree, pCursor[BTC_KEY]);
+        *pIndex = SearchNode(NodeSlots(*pLeaf), pCursor[BTC_KEY], false);
+    }
+}
+
+//----------------------------------------------------------------
+// Interface
+//----------------------------------------------------------------
+
+Value   NewBTree(void)
+{
+    Value tree = NewArray(PSYM(bTree), BT_SIZE);
+    Value* pTree = NodeSlots(tree);
+    Value root = NewNode(true);
+    pTree[BT_ROOT] = root;
+    pTree[BT_COUNT] = INT_V(0);
+    pTree[BT_FIRST] = root;
+    pTree[BT_LAST] = root;
+    pTree[BT_CHANGES] = INT_V(0);
+    return tree;
+}
+
+int     BTreeCount(Value tree)
+{
+    return UNSAFE_V_INT(CheckBTree(tree)[BT_COUNT]);
+}
+
+bool    BTreeGet(Value tree, Value key, Value* pValue)
+{
+    Value* pTree = CheckBTree(tree);
+    KeyKind(key);
+    Value* pLeaf = NodeSlots(FindLeaf(pTree, key));
+    int i = SearchNode(pLeaf, key, false);
+    if (i == NodeCount(pLeaf) || CompareKeys(pLeaf[BTN_KEYS + i], key) != 0)
+        return false;
+    *pValue = pLeaf[BTN_VALUES + i];
+    return true;
+}
+
+void    BTreeSet(Value tree, Value key, Value value)
+{
+    Value* pTree = CheckBTree(tree);
+    KeyKind(key);
+
+    Value sep;
+    Value right = InsertInto(pTree, pTree[BT_ROOT], key, value, &sep);
+    if (right != V_NIL) {
+        // The root split, so the tree gets taller
+        Value root = NewNode(false);
+        Value* pRoot = NodeSlots(root);
+        pRoot[BTN_COUNT] = INT_V(1);
+        pRoot[BTN_KEYS] = sep;
+        pRoot[BTN_CHILDREN] = pTree[BT_ROOT];
+        pRoot[BTN_CHILDREN + 1] = right;
+        pTree[BT_ROOT] = root;
+    }
+}
+
+bool    BTreeRemove(Value tree, Value key)
+{
+    Value* pTree = CheckBTree(tree);
+    KeyKind(key);
+
+    bool removed = false;
+    RemoveFrom(pTree, pTree[BT_ROOT], key, &removed);
+
+    // The tree gets shorter when the root runs out of keys
+    Value root = pTree[BT_ROOT];
+    if (!IsLeaf(root) && NodeCount(NodeSlots(root)) == 0)
+        pTree[BT_ROOT] = NodeSlots(root)[BTN_CHILDREN];
+
+    return removed;
+}
+
+// A cursor at the first key that isn't less than (or, if after is true,
+// that's greater than) key, or nil if there isn't one.
+
+Value   BTreeSeek(Value tree, Value key, bool after)
+{
+    Value* pTree = CheckBTree(tree);
+    KeyKind(key);
+    Value leaf = FindLeaf(pTree, key);
+    Value cursor = NewCursor(tree);
+    return MoveCursor(NodeSlots(cursor), leaf, SearchNode(NodeSlots(leaf), key, after)) ? cursor : V_NIL;
+}
+
+Value   BTreeFirst(Value tree)
+{
+    Value* pTree = CheckBTree(tree);
+    Value cursor = NewCursor(tree);
+    return MoveCursor(NodeSlots(cursor), pTree[BT_FIRST], 0) ? cursor : V_NIL;
+}
+
+Value   BTreeLast(Value tree)
+{
+    Value* pTree = CheckBTree(tree);
+    Value leaf = pTree[BT_LAST];
+    Value cursor = NewCursor(tree);
+    return MoveCursorBack(NodeSlots(cursor), leaf, NodeCount(NodeSlots(leaf)) - 1) ? cursor : V_NIL;
+}
+
+Value   BTreeCursorKey(Value cursor)
+{
+    return CheckCursor(cursor)[BTC_KEY];
+}
+
+Value   BTreeCursorValue(Value cursor)
+{
+    Value* pCursor = CheckCursor(cursor);
+    if (pCursor[BTC_LEAF] == V_NIL)
+        return V_NIL;
+
+    Value leaf;
+    int index;
+    CursorPlace(pCursor, &leaf, &index);
+    Value* pLeaf = NodeSlots(leaf);
+    if (index == NodeCount(pLeaf) || CompareKeys(pLeaf[BTN_KEYS + index], pCursor[BTC_KEY]) != 0)
+        return V_NIL;       // Removed since
+    return pLeaf[BTN_VALUES + index];
+}
+
+bool    BTreeCursorNext(Value cursor)
+{
+    Value* pCursor = CheckCursor(cursor);
+    if (pCursor[BTC_LEAF] == V_NIL) {
+        if (UNSAFE_V_INT(pCursor[BTC_INDEX]) > 0)
+            return false;
+        return MoveCursor(pCursor, NodeSlots(pCursor[BTC_TREE])[BT_FIRST], 0);
+    }
+
+    Value leaf;
+    int index;
+    CursorPlace(pCursor, &leaf, &index);
+    Value* pLeaf = NodeSlots(leaf);
+    if (index < NodeCount(pLeaf) && CompareKeys(pLeaf[BTN_KEYS + index], pCursor[BTC_KEY]) == 0)
+        index++;
+    return MoveCursor(pCursor, leaf, index);
+}
+
+bool    BTreeCursorPrev(Value cursor)
+{
+    Value* pCursor = CheckCursor(cursor);
+    if (pCursor[BTC_LEAF] == V_NIL) {
+        if (UNSAFE_V_INT(pCursor[BTC_INDEX]) < 0)
+            return false;
+        Value last = NodeSlots(pCursor[BTC_TREE])[BT_LAST];
+        return MoveCursorBack(pCursor, last, NodeCount(NodeSlots(last)) - 1);
+    }
+
+    Value leaf;
+    int index;
+    CursorPlace(pCursor, &leaf, &index);
+    return MoveCursorBack(pCursor, leaf, index - 1);
+}
+
+//----------------------------------------------------------------
+// Natives
+//----------------------------------------------------------------
+
+NATIVE_FUNC(FNewBTree)
+{
+    return NewBTree();
+}
+
+DECLARE_GLOBAL_FUNCTION("NewBTree", FNewBTree, 0);
+
+NATIVE_FUNC(FBTreeGet)
+{
+    NATIVE_ARGS_2(tree, key);
+    Value value;
+    return BTreeGet(ARG(tree), ARG(key), &value) ? value : V_NIL;
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeGet", FBTreeGet, 2);
+
+NATIVE_FUNC(FBTreeSet)
+{
+    NATIVE_ARGS_3(tree, key, value);
+    BTreeSet(ARG(tree), ARG(key), ARG(value));
+    return ARG(value);
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeSet", FBTreeSet, 3);
+
+NATIVE_FUNC(FBTreeRemove)
+{
+    NATIVE_ARGS_2(tree, key);
+    return BOOL_V(BTreeRemove(ARG(tree), ARG(key)));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeRemove", FBTreeRemove, 2);
+
+NATIVE_FUNC(FBTreeCount)
+{
+    NATIVE_ARGS_1(tree);
+    return INT_V(BTreeCount(ARG(tree)));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeCount", FBTreeCount, 1);
+
+NATIVE_FUNC(FBTreeLowerBound)
+{
+    NATIVE_ARGS_2(tree, key);
+    return BTreeSeek(ARG(tree), ARG(key), false);
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeLowerBound", FBTreeLowerBound, 2);
+
+NATIVE_FUNC(FBTreeUpperBound)
+{
+    NATIVE_ARGS_2(tree, key);
+    return BTreeSeek(ARG(tree), ARG(key), true);
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeUpperBound", FBTreeUpperBound, 2);
+
+NATIVE_FUNC(FBTreeFirst)
+{
+    NATIVE_ARGS_1(tree);
+    return BTreeFirst(ARG(tree));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeFirst", FBTreeFirst, 1);
+
+NATIVE_FUNC(FBTreeLast)
+{
+    NATIVE_ARGS_1(tree);
+    return BTreeLast(ARG(tree));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeLast", FBTreeLast, 1);
+
+NATIVE_FUNC(FBTreeCursorKey)
+{
+    NATIVE_ARGS_1(cursor);
+    return BTreeCursorKey(ARG(cursor));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeCursorKey", FBTreeCursorKey, 1);
+
+NATIVE_FUNC(FBTreeCursorValue)
+{
+    NATIVE_ARGS_1(cursor);
+    return BTreeCursorValue(ARG(cursor));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeCursorValue", FBTreeCursorValue, 1);
+
+NATIVE_FUNC(FBTreeCursorNext)
+{
+    NATIVE_ARGS_1(cursor);
+    return BOOL_V(BTreeCursorNext(ARG(cursor)));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeCursorNext", FBTreeCursorNext, 1);
+
+NATIVE_FUNC(FBTreeCursorPrev)
+{
+    NATIVE_ARGS_1(cursor);
+    return BOOL_V(BTreeCursorPrev(ARG(cursor)));
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeCursorPrev", FBTreeCursorPrev, 1);
+
+// The values of the keys from lo up to (but not including) hi, in order.
+
+NATIVE_FUNC(FBTreeRange)
+{
+    NATIVE_ARGS_3(tree, lo, hi);
+    KeyKind(ARG(hi));
+    Value result = NewArray(0);
+    Value cursor = BTreeSeek(ARG(tree), ARG(lo), false);
+    if (cursor != V_NIL) {
+        do {
+            if (CompareKeys(BTreeCursorKey(cursor), ARG(hi)) >= 0)
+                break;
+            AddArraySlot(result, BTreeCursorValue(cursor));
+        } while (BTreeCursorNext(cursor));
+    }
+    return result;
+}
+
+DECLARE_GLOBAL_FUNCTION("BTreeRange", FBTreeRange, 3);
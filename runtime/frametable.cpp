@@ -0,0 +1,734 @@
+/*
+    Proto language runtime
+
+    Frame tables: arrays of frames stored by column
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "gcalloc.h"
+#include "predefined.h"
+#include "native.h"
+#include "simd.h"
+#include <string.h>
+
+// Big datasets tend to be arrays of frames that all have the same slots.
+// Stored as frames, every record is a header and a slot vector somewhere
+// in the heap, and reading one slot from every record means two cache
+// misses and a FindOffset per record. A frame table stores the same data
+// as one array per slot (a column), so a scan of one slot reads
+// consecutive words.
+//
+// A frame table acts like an array of frames: GetSlot, Length, foreach,
+// and paths all work on it. But its rows aren't frames, so GetSlot makes a
+// new frame for the row each time, and changing that frame doesn't change
+// the table. Paths like [i, tag] go straight to the column, so they're fast
+// and can be set. (Clone shares the columns, so use DeepClone to copy a
+// table.)
+//
+// A frame table is an array of class frameTable:
+//
+//      map         frozen map of the rows, whose slots are in column order
+//      length      number of rows, as an integer
+//      columns     one array per slot. Columns have room for more rows
+//                  than there are, so adding rows doesn't copy them often.
+
+enum {
+    FT_MAP,
+    FT_LENGTH,
+    FT_COLUMNS
+};
+
+const int   MIN_CAPACITY = 8;
+
+inline int  NumColumns(Object* pTable)
+{
+    return pTable->size - FT_COLUMNS;
+}
+
+inline Object*  ColumnObject(Object* pTable, int col)
+{
+    return UNSAFE_V_PTR(pTable->pSlots[FT_COLUMNS + col]);
+}
+
+// Columns can be shared with a deep clone (see DeepClone), so anything
+// that writes to one has to get it this way.
+
+inline Value*   WritableColumn(Object* pTable, int col)
+{
+    Object* pColumn = ColumnObject(pTable, col);
+    Unshare(pColumn);
+    return pColumn->pSlots;
+}
+
+Object* CheckFrameTable(Value table)
+{
+    Object* pObj = V_PTR(table);
+    if (!ObjIsFrameTable(pObj))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, table);
+    return pObj;
+}
+
+inline void CheckRow(Object* pTable, int index)
+{
+    if (index < 0 || index >= FrameTableLength(pTable))
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+}
+
+// The column that holds tag, or -1.
+
+inline int  FindColumn(Object* pTable, Value tag)
+{
+    return FindOffset(pTable->pSlots[FT_MAP], tag);
+}
+
+int     FindColumnOrThrow(Object* pTable, Value tag)
+{
+    int col = FindColumn(pTable, tag);
+    if (col < 0)
+        PROTO_THROW_ERR(g_exType, E_BadArguments, tag);
+    return col;
+}
+
+//----------------------------------------------------------------
+// Rows
+//----------------------------------------------------------------
+
+// Collects the tags of a map, in slot order. (Hash maps are in the order
+// of their tables; see Printer::PrintFrameSlots.)
+
+void    AddMapTags(Value map, Value tags)
+{
+    Object* pMap = V_PTR(map);
+    MapSlots* pMapSlots = (MapSlots*) pMap->pSlots;
+    if (pMapSlots->supermap != V_NIL)
+        AddMapTags(pMapSlots->supermap, tags);
+
+    if (UNSAFE_V_INT(pMap->cls) & HASH_MAP) {
+        Object* pTable = pMap;
+        for (;;) {
+            MapSlots* pTableSlots = (MapSlots*) pTable->pSlots;
+            int tableSize = pTable->size - HashMapArraySize(0);
+            for (int i = 0; i < tableSize; i++) {
+                Value tag = pTableSlots->hash.table[i];
+                AddArraySlot(tags, (tag != V_NIL && tag != INT_V(0)) ? tag : V_NIL);
+            }
+            if (pTable != pMap || pMapSlots->hash.oldMap == V_NIL)
+                break;
+            pTable = V_PTR(pMapSlots->hash.oldMap);
+        }
+    }
+    else {
+        int nTags = SeqMapNumTags(pMap);
+        for (int i = 0; i < nTags; i++)
+            AddArraySlot(tags, pMapSlots->tags[i]);
+    }
+}
+
+// Where each column's tag is in frames with the given map, or -1 for a
+// column they don't have. Tables mostly get rows that all have the same
+// map, so this is computed once per run of them.
+
+void    FindRowOffsets(Object* pTable, Value map, int* offsets)
+{
+    int nCols = NumColumns(pTable);
+    Value* tags = ((MapSlots*) UNSAFE_V_PTR(pTable->pSlots[FT_MAP])->pSlots)->tags;
+    for (int col = 0; col < nCols; col++)
+        offsets[col] = FindOffset(map, tags[col]);
+}
+
+void    StoreRow(Object* pTable, int index, Object* pFrame, const int* offsets)
+{
+    int nCols = NumColumns(pTable);
+    for (int col = 0; col < nCols; col++) {
+        int offset = offsets[col];
+        WritableColumn(pTable, col)[index] = (offset >= 0) ? pFrame->pSlots[offset] : V_NIL;
+    }
+}
+
+// Makes room for nRows rows.
+
+void    ReserveRows(Object* pTable, int nRows)
+{
+    int nCols = NumColumns(pTable);
+    if (nCols == 0 || ColumnObject(pTable, 0)->size >= (UInt) nRows)
+        return;
+
+    int capacity = ColumnObject(pTable, 0)->size * 2;
+    if (capacity < nRows)
+        capacity = nRows;
+    if (capacity < MIN_CAPACITY)
+        capacity = MIN_CAPACITY;
+    for (int col = 0; col < nCols; col++)
+        SetSlottedLength(ColumnObject(pTable, col), capacity);
+}
+
+Value   NewTableWithMap(Value map, int nRows)
+{
+    int nCols = SeqMapNumTags(V_PTR(map));
+    Value table = NewArray(PSYM(frameTable), FT_COLUMNS + nCols);
+    Object* pTable = UNSAFE_V_PTR(table);
+    pTable->pSlots[FT_MAP] = map;
+    pTable->pSlots[FT_LENGTH] = INT_V(nRows);
+    int capacity = (nRows < MIN_CAPACITY) ? MIN_CAPACITY : nRows;
+    for (int col = 0; col < nCols; col++)
+        pTable->pSlots[FT_COLUMNS + col] = NewArray(capacity);
+    return table;
+}
+
+int     FrameTableLength(Object* pTable)
+{
+    return UNSAFE_V_INT(pTable->pSlots[FT_LENGTH]);
+}
+
+Value   GetFrameTableRow(Object* pTable, int index)
+{
+    CheckRow(pTable, index);
+
+    // Like NewFrameWithMap, but the slots are filled right away
+    int nCols = NumColumns(pTable);
+    Object* pRow = AllocObject();
+    pRow->size = nCols;
+    pRow->flags = HDR_SLOTTED | HDR_FRAME;
+    pRow->map = pTable->pSlots[FT_MAP];
+    pRow->pSlots = (nCols > 0) ? AllocSlots(nCols) : 0;
+    for (int col = 0; col < nCols; col++)
+        pRow->pSlots[col] = ColumnObject(pTable, col)->pSlots[index];
+    return PTR_V(pRow);
+}
+
+void    SetFrameTableRow(Object* pTable, int index, Value frame)
+{
+    CheckRow(pTable, index);
+    Object* pFrame = V_PTR(frame);
+    if (!ObjIsFrame(pFrame))
+        PROTO_THROW_ERR(g_exType, E_NotAFrame, frame);
+
+    int* offsets = (int*) AllocData(NumColumns(pTable) * sizeof(int));
+    FindRowOffsets(pTable, pFrame->map, offsets);
+    StoreRow(pTable, index, pFrame, offsets);
+}
+
+void    AddFrameTableRow(Object* pTable, Value frame)
+{
+    if (!IsFrame(frame))
+        PROTO_THROW_ERR(g_exType, E_NotAFrame, frame);
+
+    int index = FrameTableLength(pTable);
+    ReserveRows(pTable, index + 1);
+    Unshare(pTable);
+    pTable->pSlots[FT_LENGTH] = INT_V(index + 1);
+    SetFrameTableRow(pTable, index, frame);
+}
+
+// Rows past the end are nil in every column, so new rows are rows of nils.
+// A table that shrinks to a small part of its columns' room gives the
+// rest back.
+
+void    SetFrameTableLength(Object* pTable, int nRows)
+{
+    if (nRows < 0 || nRows > MAX_SLOTS)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    int oldRows = FrameTableLength(pTable);
+    int nCols = NumColumns(pTable);
+    if (nRows > oldRows)
+        ReserveRows(pTable, nRows);
+    else if (nCols > 0) {
+        int capacity = (nRows < MIN_CAPACITY) ? MIN_CAPACITY : nRows;
+        for (int col = 0; col < nCols; col++) {
+            Object* pColumn = ColumnObject(pTable, col);
+            if ((int) pColumn->size / 4 > capacity)
+                SetSlottedLength(pColumn, capacity);
+            int end = ((int) pColumn->size < oldRows) ? pColumn->size : oldRows;
+            Value* p = WritableColumn(pTable, col);
+            for (int i = nRows; i < end; i++)
+                p[i] = V_NIL;
+        }
+    }
+
+    Unshare(pTable);
+    pTable->pSlots[FT_LENGTH] = INT_V(nRows);
+}
+
+Value   GetFrameTableCell(Object* pTable, int index, Value tag)
+{
+    CheckRow(pTable, index);
+    int col = FindColumn(pTable, tag);
+    return (col < 0) ? V_NIL : ColumnObject(pTable, col)->pSlots[index];
+}
+
+// Setting a slot the rows don't have adds a column.
+
+void    SetFrameTableCell(Object* pTable, int index, Value tag, Value value)
+{
+    CheckRow(pTable, index);
+    int col = FindColumn(pTable, tag);
+    if (col < 0) {
+        if (!IsSymbol(tag))
+            PROTO_THROW_ERR(g_exType, E_NotASymbol, tag);
+
+        Value tags = NewArray(0);
+        AddMapTags(pTable->pSlots[FT_MAP], tags);
+        AddArraySlot(tags, tag);
+        Unshare(pTable);
+        pTable->pSlots[FT_MAP] = FreezeMap(NewMapWithTags(tags));
+
+        col = NumColumns(pTable);
+        int capacity = (col > 0) ? ColumnObject(pTable, 0)->size : FrameTableLength(pTable);
+        AddSlotValue(pTable, NewArray(capacity < MIN_CAPACITY ? MIN_CAPACITY : capacity));
+    }
+    WritableColumn(pTable, col)[index] = value;
+}
+
+//----------------------------------------------------------------
+// Column kernels
+//----------------------------------------------------------------
+
+// Integers are tagged with zero, so the Value of an integer is the integer
+// shifted left, and a column of integers can be added and compared as raw
+// words--which the vector units can do several at a time. Everything else
+// (reals, nil, and so on) goes the slow way.
+
+inline bool IsNumber(Value v)
+{
+    return V_ISINT(v) || IsReal(v);
+}
+
+int     CompareNumbers(Value a, Value b)
+{
+    if (V_ISINT(a) && V_ISINT(b)) {
+        IntPtr i = UNSAFE_V_INT(a);
+        IntPtr j = UNSAFE_V_INT(b);
+        return i < j ? -1 : i > j;
+    }
+    double x = V_ISINT(a) ? (double) UNSAFE_V_INT(a) : V_REAL(a);
+    double y = V_ISINT(b) ? (double) UNSAFE_V_INT(b) : V_REAL(b);
+    return x < y ? -1 : x > y;
+}
+
+#if PROTO_64BIT
+
+// Tagged integers at least this small can't overflow a sum of MAX_SLOTS
+// of them, which is how many a column can hold.
+
+const int   SMALL_INT_SHIFT = 35;
+const IntPtr    SMALL_INT_BIAS = (IntPtr) 1 << (SMALL_INT_SHIFT - 1);
+
+inline bool IsSmallInt(Value v)
+{
+    return (((UIntPtr) v & 3) | (((UIntPtr) v + SMALL_INT_BIAS) >> SMALL_INT_SHIFT)) == 0;
+}
+
+// Sums a column of small integers. Returns false if any value isn't one.
+
+bool    SumSmallInts(const Value* p, int n, IntPtr* pSum)
+{
+    int i = 0;
+    IntPtr sum = 0;
+    UIntPtr bad = 0;
+
+#if HAVE_AVX2
+    __m256i sum4 = _mm256_setzero_si256();
+    __m256i bad4 = _mm256_setzero_si256();
+    const __m256i tagMask4 = _mm256_set1_epi64x(3);
+    const __m256i bias4 = _mm256_set1_epi64x(SMALL_INT_BIAS);
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+        sum4 = _mm256_add_epi64(sum4, v);
+        bad4 = _mm256_or_si256(bad4, _mm256_and_si256(v, tagMask4));
+        bad4 = _mm256_or_si256(bad4, _mm256_srli_epi64(_mm256_add_epi64(v, bias4), SMALL_INT_SHIFT));
+    }
+    UIntPtr lanes4[4];
+    _mm256_storeu_si256((__m256i*) lanes4, sum4);
+    sum += lanes4[0] + lanes4[1] + lanes4[2] + lanes4[3];
+    _mm256_storeu_si256((__m256i*) lanes4, bad4);
+    bad |= lanes4[0] | lanes4[1] | lanes4[2] | lanes4[3];
+#endif
+
+#if HAVE_SSE2
+    __m128i sum2 = _mm_setzero_si128();
+    __m128i bad2 = _mm_setzero_si128();
+    const __m128i tagMask2 = _mm_set1_epi64x(3);
+    const __m128i bias2 = _mm_set1_epi64x(SMALL_INT_BIAS);
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        sum2 = _mm_add_epi64(sum2, v);
+        bad2 = _mm_or_si128(bad2, _mm_and_si128(v, tagMask2));
+        bad2 = _mm_or_si128(bad2, _mm_srli_epi64(_mm_add_epi64(v, bias2), SMALL_INT_SHIFT));
+    }
+    UIntPtr lanes2[2];
+    _mm_storeu_si128((__m128i*) lanes2, sum2);
+    sum += lanes2[0] + lanes2[1];
+    _mm_storeu_si128((__m128i*) lanes2, bad2);
+    bad |= lanes2[0] | lanes2[1];
+#endif
+
+    for (; i < n; i++) {
+        if (!IsSmallInt(p[i]))
+            return false;
+        sum += (IntPtr) p[i];
+    }
+
+    if (bad != 0)
+        return false;
+    *pSum = sum >> 2;
+    return true;
+}
+
+#endif
+
+Value   SumColumn(const Value* p, int n)
+{
+#if PROTO_64BIT
+    IntPtr sum;
+    if (SumSmallInts(p, n, &sum))
+        return INT_V(sum);
+#endif
+
+    // Integers are added exactly until they might overflow
+    IntPtr intSum = 0;
+    double realSum = 0;
+    bool isReal = false;
+    for (int i = 0; i < n; i++) {
+        Value v = p[i];
+        if (V_ISINT(v)) {
+            intSum += UNSAFE_V_INT(v);
+            if (intSum > MAX_INT_V || intSum < MIN_INT_V) {
+                realSum += intSum;
+                intSum = 0;
+                isReal = true;
+            }
+        }
+        else if (IsReal(v)) {
+            realSum += V_REAL(v);
+            isReal = true;
+        }
+        else if (v != V_NIL) {
+            PROTO_THROW_ERR(g_exType, E_NotANumber, v);
+        }
+    }
+    return isReal ? REAL_V(realSum + intSum) : INT_V(intSum);
+}
+
+#if PROTO_64BIT && HAVE_AVX2
+
+// Finds the least (or greatest) of a column of integers. Returns false if
+// any value isn't one.
+
+bool    IntExtreme(const Value* p, int n, bool greatest, Value* pResult)
+{
+    __m256i best = _mm256_set1_epi64x((long long) p[0]);
+    __m256i bad = _mm256_setzero_si256();
+    const __m256i tagMask = _mm256_set1_epi64x(3);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+        bad = _mm256_or_si256(bad, _mm256_and_si256(v, tagMask));
+        __m256i better = greatest ? _mm256_cmpgt_epi64(v, best) : _mm256_cmpgt_epi64(best, v);
+        best = _mm256_blendv_epi8(best, v, better);
+    }
+    if (!_mm256_testz_si256(bad, bad))
+        return false;
+
+    IntPtr lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, best);
+    IntPtr result = lanes[0];
+    for (int lane = 1; lane < 4; lane++) {
+        if (greatest ? lanes[lane] > result : lanes[lane] < result)
+            result = lanes[lane];
+    }
+    for (; i < n; i++) {
+        IntPtr v = (IntPtr) p[i];
+        if (v & 3)
+            return false;
+        if (greatest ? v > result : v < result)
+            result = v;
+    }
+
+    *pResult = (Value) result;
+    return true;
+}
+
+#endif
+
+// The least (or greatest) number in a column, ignoring nils. Returns nil if
+// there aren't any.
+
+Value   ColumnExtreme(const Value* p, int n, bool greatest)
+{
+#if PROTO_64BIT && HAVE_AVX2
+    Value result;
+    if (n > 0 && IntExtreme(p, n, greatest, &result))
+        return result;
+#endif
+
+    Value best = V_NIL;
+    for (int i = 0; i < n; i++) {
+        Value v = p[i];
+        if (v == V_NIL)
+            continue;
+        if (!IsNumber(v))
+            PROTO_THROW_ERR(g_exType, E_NotANumber, v);
+        if (best == V_NIL || CompareNumbers(v, best) == (greatest ? 1 : -1))
+            best = v;
+    }
+    return best;
+}
+
+// Whether v is a number from lo up to (but not including) hi. A nil bound
+// means there isn't one.
+
+inline bool InRange(Value v, Value lo, Value hi)
+{
+    if (!IsNumber(v))
+        return false;
+    return (lo == V_NIL || CompareNumbers(lo, v) <= 0)
+        && (hi == V_NIL || CompareNumbers(v, hi) < 0);
+}
+
+// Adds the indexes of the values in range to indexes.
+
+void    FindInRange(const Value* p, int n, Value lo, Value hi, Value indexes)
+{
+    if (lo != V_NIL && !IsNumber(lo))
+        PROTO_THROW_ERR(g_exType, E_NotANumber, lo);
+    if (hi != V_NIL && !IsNumber(hi))
+        PROTO_THROW_ERR(g_exType, E_NotANumber, hi);
+
+    int i = 0;
+
+#if PROTO_64BIT && HAVE_AVX2
+    // Integer bounds compare with integer values as raw words. A nil lower
+    // bound is the least word, and a nil upper bound is a word greater than
+    // any integer.
+    if ((lo == V_NIL || V_ISINT(lo)) && (hi == V_NIL || V_ISINT(hi))) {
+        const UIntPtr signBit = (UIntPtr) 1 << 63;
+        const __m256i lo4 = _mm256_set1_epi64x((long long) (lo == V_NIL ? signBit : (UIntPtr) lo));
+        const __m256i hi4 = _mm256_set1_epi64x((long long) (hi == V_NIL ? ~signBit : (UIntPtr) hi));
+        const __m256i tagMask = _mm256_set1_epi64x(3);
+        const __m256i zero = _mm256_setzero_si256();
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+            __m256i isInt = _mm256_cmpeq_epi64(_mm256_and_si256(v, tagMask), zero);
+            __m256i in = _mm256_andnot_si256(_mm256_cmpgt_epi64(lo4, v), _mm256_cmpgt_epi64(hi4, v));
+            UInt32 intMask = _mm256_movemask_pd(_mm256_castsi256_pd(isInt));
+            UInt32 mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_and_si256(in, isInt)));
+
+            // Reals in the column need the slow comparison
+            UInt32 otherMask = ~intMask & 0xF;
+            while (otherMask != 0) {
+                int lane = LowestBitIndex(otherMask);
+                if (InRange(p[i + lane], lo, hi))
+                    mask |= 1 << lane;
+                otherMask &= otherMask - 1;
+            }
+
+            while (mask != 0) {
+                AddArraySlot(indexes, INT_V(i + LowestBitIndex(mask)));
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (InRange(p[i], lo, hi))
+            AddArraySlot(indexes, INT_V(i));
+    }
+}
+
+//----------------------------------------------------------------
+// Interface
+//----------------------------------------------------------------
+
+Value   NewFrameTable(Value frames)
+{
+    int nRows;
+    const Value* pFrames = ReadOnlySlots(frames, &nRows);
+
+    // The rows get the first frame's slots, in its order
+    Value tags = NewArray(0);
+    if (nRows > 0) {
+        Value first = pFrames ? pFrames[0] : GetSlot(frames, 0);
+        Object* pFirst = V_PTR(first);
+        if (!ObjIsFrame(pFirst))
+            PROTO_THROW_ERR(g_exType, E_NotAFrame, first);
+        AddMapTags(pFirst->map, tags);
+    }
+
+    // Hash maps can have empty entries
+    Value* pTags = GetArraySlots(tags);
+    int nTags = 0;
+    for (int i = 0; i < GetArrayLength(tags); i++) {
+        if (pTags[i] != V_NIL)
+            pTags[nTags++] = pTags[i];
+    }
+    SetArrayLength(tags, nTags);
+
+    Value table = NewTableWithMap(FreezeMap(NewMapWithTags(tags)), nRows);
+    Object* pTable = UNSAFE_V_PTR(table);
+
+    int* offsets = (int*) AllocData(nTags * sizeof(int));
+    Value lastMap = V_NIL;
+    for (int i = 0; i < nRows; i++) {
+        Value frame = pFrames ? pFrames[i] : GetSlot(frames, i);
+        Object* pFrame = V_PTR(frame);
+        if (!ObjIsFrame(pFrame))
+            PROTO_THROW_ERR(g_exType, E_NotAFrame, frame);
+        if (pFrame->map != lastMap) {
+            FindRowOffsets(pTable, pFrame->map, offsets);
+            lastMap = pFrame->map;
+        }
+        StoreRow(pTable, i, pFrame, offsets);
+    }
+
+    return table;
+}
+
+Value   FrameTableToArray(Value table)
+{
+    Object* pTable = CheckFrameTable(table);
+    int nRows = FrameTableLength(pTable);
+    Value array = NewArray(nRows);
+    for (int i = 0; i < nRows; i++)
+        SetSlot(array, i, GetFrameTableRow(pTable, i));
+    return array;
+}
+
+Value   FrameTableColumn(Value table, Value tag)
+{
+    Object* pTable = CheckFrameTable(table);
+    int nRows = FrameTableLength(pTable);
+    Value column = NewArray(nRows);
+    int col = FindColumn(pTable, tag);
+    if (col >= 0 && nRows > 0)
+        memcpy(GetArraySlots(column), ColumnObject(pTable, col)->pSlots, nRows * sizeof(Value));
+    return column;
+}
+
+Value   FrameTableSum(Value table, Value tag)
+{
+    Object* pTable = CheckFrameTable(table);
+    return SumColumn(ColumnObject(pTable, FindColumnOrThrow(pTable, tag))->pSlots, FrameTableLength(pTable));
+}
+
+Value   FrameTableMin(Value table, Value tag)
+{
+    Object* pTable = CheckFrameTable(table);
+    return ColumnExtreme(ColumnObject(pTable, FindColumnOrThrow(pTable, tag))->pSlots, FrameTableLength(pTable), false);
+}
+
+Value   FrameTableMax(Value table, Value tag)
+{
+    Object* pTable = CheckFrameTable(table);
+    return ColumnExtreme(ColumnObject(pTable, FindColumnOrThrow(pTable, tag))->pSlots, FrameTableLength(pTable), true);
+}
+
+Value   FrameTableWhere(Value table, Value tag, Value lo, Value hi)
+{
+    Object* pTable = CheckFrameTable(table);
+    int col = FindColumnOrThrow(pTable, tag);
+    Value indexes = NewArray(0);
+    FindInRange(ColumnObject(pTable, col)->pSlots, FrameTableLength(pTable), lo, hi, indexes);
+    return indexes;
+}
+
+// Copies column by column, so each pass reads one column and writes another.
+
+Value   FrameTableGather(Value table, Value indexes)
+{
+    Object* pTable = CheckFrameTable(table);
+    int nRows = FrameTableLength(pTable);
+    int n;
+    const Value* pIndexes = ReadOnlySlots(indexes, &n);
+    int* rows = (int*) AllocData((n > 0 ? n : 1) * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        Value index = pIndexes ? pIndexes[i] : GetSlot(indexes, i);
+        if (!V_ISINT(index) || UNSAFE_V_INT(index) < 0 || UNSAFE_V_INT(index) >= nRows)
+            PROTO_THROW_ERR(g_exFr, E_OutOfBounds, index);
+        rows[i] = (int) UNSAFE_V_INT(index);
+    }
+
+    Value result = NewTableWithMap(pTable->pSlots[FT_MAP], n);
+    Object* pResult = UNSAFE_V_PTR(result);
+    int nCols = NumColumns(pTable);
+    for (int col = 0; col < nCols; col++) {
+        const Value* src = ColumnObject(pTable, col)->pSlots;
+        Value* dest = ColumnObject(pResult, col)->pSlots;
+        for (int i = 0; i < n; i++)
+            dest[i] = src[rows[i]];
+    }
+    return result;
+}
+
+//----------------------------------------------------------------
+// Natives
+//----------------------------------------------------------------
+
+NATIVE_FUNC(FNewFrameTable)
+{
+    NATIVE_ARGS_1(frames);
+    return NewFrameTable(ARG(frames));
+}
+
+DECLARE_GLOBAL_FUNCTION("NewFrameTable", FNewFrameTable, 1);
+
+NATIVE_FUNC(FFrameTableToArray)
+{
+    NATIVE_ARGS_1(table);
+    return FrameTableToArray(ARG(table));
+}
+
+DECLARE_GLOBAL_FUNCTION("FrameTableToArray", FFrameTableToArray, 1);
+
+NATIVE_FUNC(FFrameTableColumn)
+{
+    NATIVE_ARGS_2(table, tag);
+    return FrameTableColumn(ARG(table), ARG(tag));
+}
+
+DECLARE_GLOBAL_FUNCTION("FrameTableColumn", FFrameTableColumn, 2);
+
+NATIVE_FUNC(FFrameTableSum)
+{
+    NATIVE_ARGS_2(table, tag);
+    return FrameTableSum(ARG(table), ARG(tag));
+}
+
+DECLARE_GLOBAL_FUNCTION("FrameTableSum", FFrameTableSum, 2);
+
+NATIVE_FUNC(FFrameTableMin)
+{
+    NATIVE_ARGS_2(table, tag);
+    return FrameTableMin(ARG(table), ARG(tag));
+}
+
+DECLARE_GLOBAL_FUNCTION("FrameTableMin", FFrameTableMin, 2);
+
+NATIVE_FUNC(FFrameTableMax)
+{
+    NATIVE_ARGS_2(table, tag);
+    return FrameTableMax(ARG(table), ARG(tag));
+}
+
+DECLARE_GLOBAL_FUNCTION("FrameTableMax", FFrameTableMax, 2);
+
+NATIVE_FUNC(FFrameTableWhere)
+{
+    NATIVE_ARGS_4(table, tag, lo, hi);
+    return FrameTableWhere(ARG(table), ARG(tag), ARG(lo), ARG(hi));
+}
+
+DECLARE_GLOBAL_FUNCTION("FrameTableWhere", FFrameTableWhere, 4);
+
+NATIVE_FUNC(FFrameTableGather)
+{
+    NATIVE_ARGS_2(table, indexes);
+    return FrameTableGather(ARG(table), ARG(indexes));
+}
+
+DECLARE_GLOBAL_FUNCTION("FrameTableGather", FFrameTableGather, 2);
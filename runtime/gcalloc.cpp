@@ -0,0 +1,218 @@
+/*
+    Proto language runtime
+
+    Allocation of object memory
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "gcalloc.h"
+#include "gc.h"
+#include "gc_mark.h"
+#include <string.h>
+
+// Object headers get a kind whose descriptor is a bitmap of the pointer
+// words. (GC_MALLOC_EXPLICITLY_TYPED would do the same, but it keeps the
+// descriptor in an extra word at the end of every object.) The size and
+// flags word never holds a pointer.
+
+const int   GC_WORD_BITS = 8 * sizeof(GC_word);
+
+inline GC_word  PointerWordBit(size_t offset)
+{
+    return (GC_word) 1 << (GC_WORD_BITS - 1 - offset / sizeof(GC_word));
+}
+
+int     g_objectKind;
+
+// Slot vectors get a kind with a mark procedure that only follows Values
+// tagged as pointers, so integers and immediates that happen to look like
+// heap addresses don't keep anything alive.
+
+int     g_slotsKind;
+
+struct GC_ms_entry* MarkSlots(GC_word* addr, struct GC_ms_entry* pMarkStack,
+                              struct GC_ms_entry* pMarkStackLimit, GC_word /* env */)
+{
+    Value* pSlots = (Value*) addr;
+    size_t nSlots = GC_size(addr) / sizeof(Value);
+
+    for (size_t i = 0; i < nSlots; i++) {
+        Value v = pSlots[i];
+        if (V_TAG(v) == TAG_PTR)
+            pMarkStack = GC_MARK_AND_PUSH(UNSAFE_V_PTR(v), pMarkStack, pMarkStackLimit, (void**) &pSlots[i]);
+    }
+
+    return pMarkStack;
+}
+
+void    InitGCAlloc()
+{
+#ifdef PROTO_GC_GENERATIONAL
+    // Most collections are then minor ones that only rescan pages written
+    // since the last collection. The collector tracks the writes itself
+    // with the page protection hardware, so slot stores need no barrier.
+    GC_enable_incremental();
+#endif
+
+    GC_word objectDescr = PointerWordBit(offsetof(Object, cls))
+                        | PointerWordBit(offsetof(Object, pData))
+                        | GC_DS_BITMAP;
+    g_objectKind = GC_new_kind(GC_new_free_list(), objectDescr, 0, 1);
+
+    GC_word slotsDescr = GC_MAKE_PROC(GC_new_proc(MarkSlots), 0);
+    g_slotsKind = GC_new_kind(GC_new_free_list(), slotsDescr, 0, 1);
+
+    // An explicit collection gives the pages of dead large data back to
+    // the system right away, instead of after a few more collections.
+    GC_set_force_unmap_on_gcollect(1);
+}
+
+Object* AllocObject()
+{
+    return (Object*) GC_generic_malloc(sizeof(Object), g_objectKind);
+}
+
+Value*  AllocSlots(int nSlots)
+{
+    return (Value*) GC_generic_malloc(nSlots * sizeof(Value), g_slotsKind);
+}
+
+// GC_REALLOC keeps the kind of the object it's given, but a null pointer
+// has no kind.
+//
+// Big vectors that have to move to grow get room for half again as many
+// slots, so adding slots one at a time doesn't copy the whole vector every
+// few pages. (The collector zeroes the extra room, so the marker skips it.)
+
+const size_t    LARGE_SLOTS_MIN = 64 * 1024;   // In bytes
+
+Value*  ReallocSlots(Value* pSlots, int nSlots)
+{
+    if (pSlots == 0)
+        return AllocSlots(nSlots);
+
+    size_t size = nSlots * sizeof(Value);
+    if (size >= LARGE_SLOTS_MIN && size > GC_size(pSlots))
+        size += size / 2;
+    return (Value*) GC_REALLOC(pSlots, size);
+}
+
+//----------------------------------------------------------------
+// Binary data
+//----------------------------------------------------------------
+
+// Binary data this small goes right after the header. The header kind's
+// descriptor only covers the header words, so the data still isn't
+// scanned.
+
+const int   INLINE_DATA_MAX = 32;
+
+inline bool HasInlineData(Object* pObj)
+{
+    return pObj->pData == (void*) (pObj + 1);
+}
+
+// Data of any size is collector memory, so a pointer to it keeps it alive:
+// a native can hang on to what GetData returns without holding on to the
+// object.
+
+Object* AllocBinaryObject(int size)
+{
+    if (size > INLINE_DATA_MAX) {
+        Object* pObj = AllocObject();
+        pObj->pData = AllocData(size);
+        return pObj;
+    }
+
+    Object* pObj = (Object*) GC_generic_malloc(sizeof(Object) + size, g_objectKind);
+    if (size > 0)
+        pObj->pData = pObj + 1;
+    return pObj;
+}
+
+void*   ResizeBinaryData(Object* pObj, int size)
+{
+    if (!HasInlineData(pObj))
+        return ReallocData(pObj->pData, size);
+
+    int oldSize = pObj->size;
+    if (size <= oldSize)
+        return pObj->pData;
+
+    void* pData = AllocData(size);
+    if (oldSize > 0)
+        memcpy(pData, pObj->pData, oldSize);
+    return pData;
+}
+
+// Data in the heap gets half again as much room as it needs, so data that
+// grows a little at a time isn't copied every time.
+
+void*   GrowBinaryData(Object* pObj, int size)
+{
+    if (size <= (int) pObj->size || HasInlineData(pObj))
+        return ResizeBinaryData(pObj, size);
+
+    if (GC_size(pObj->pData) >= (size_t) size)
+        return pObj->pData;
+
+    int capacity = size + size / 2;
+    return ReallocData(pObj->pData, capacity < MAX_DATA ? capacity : MAX_DATA);
+}
+
+void    ShareBinaryData(Object* pObj, Object* pClone)
+{
+    pClone->pData = pObj->pData;
+}
+
+void*   CopyBinaryData(Object* pObj)
+{
+    int size = pObj->size;
+    void* pData = AllocData(size);
+    memcpy(pData, pObj->pData, size);
+    return pData;
+}
+
+//----------------------------------------------------------------
+// Large data
+//----------------------------------------------------------------
+
+// Data this big gets whole pages of its own from the collector's large-
+// block allocator, marked as only ever pointed to near its start. The
+// collector then needn't treat every word that happens to point into the
+// middle of a big block as a reference to it, and with bdwgc built with
+// USE_MUNMAP the pages of a dead block go back to the system.
+//
+// Large data that shrinks to less than half its block moves to a smaller
+// one, so the rest of the pages can go back too. The old block isn't freed
+// explicitly, because a native may still have a pointer to it (see
+// GetData); the collector reclaims it once nothing does.
+
+const int   LARGE_DATA_MIN = 256 * 1024;
+
+void*   AllocData(int size)
+{
+    if (size >= LARGE_DATA_MIN)
+        return GC_malloc_atomic_ignore_off_page(size);
+    return GC_MALLOC_ATOMIC(size);
+}
+
+void*   ReallocData(void* pData, int size)
+{
+    if (pData == 0)
+        return AllocData(size);
+
+    size_t blockSize = GC_size(pData);
+    if (blockSize < (size_t) LARGE_DATA_MIN && size < LARGE_DATA_MIN)
+        return GC_REALLOC(pData, size);
+
+    if ((size_t) size <= blockSize && (size_t) size >= blockSize / 2)
+        return pData;
+
+    void* pNew = AllocData(size);
+    memcpy(pNew, pData, (size_t) size < blockSize ? size : blockSize);
+    return pNew;
+}
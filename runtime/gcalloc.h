@@ -0,0 +1,82 @@
+/*
+    Proto language runtime
+
+    Allocation of object memory
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#ifndef __GCALLOC_H__
+#define __GCALLOC_H__
+
+#include "objects-private.h"
+
+// Everything that allocates object memory comes through here, so this is
+// where a different collector would plug in. There's one backend, the
+// Boehm collector, which can run in its generational mode (see
+// InitGCAlloc). That mode doesn't move objects: a minor collection only
+// rescans pages written since the last one.
+//
+// Nothing here moves an object once it's allocated, and that's what
+// rules out a copying nursery. Natives and the C++ stack hold raw Object
+// and pData pointers that the collector only finds conservatively, so it
+// couldn't update them. A moving young generation would first need C++
+// code to register its roots, and a barrier on every slot store (SetSlot
+// and writes through GetArraySlots) to record old-to-young pointers.
+//
+// Object headers and slot vectors are allocated as their own kinds of
+// collector object, so the collector knows exactly where the pointers
+// are instead of treating every word as one. Binary data is atomic
+// (never scanned at all).
+
+void    InitGCAlloc(void);
+
+// An object header. The collector only looks at cls (or map, or
+// pReplacement) and pData.
+
+Object* AllocObject(void);
+
+// A slot vector, with the slots zeroed. The collector only follows
+// pointer Values in it, not integers or immediates.
+
+Value*  AllocSlots(int nSlots);
+
+// Resizes a slot vector (which may be null). New slots are garbage.
+
+Value*  ReallocSlots(Value* pSlots, int nSlots);
+
+// A binary object's header and data, uninitialized. Small data lives in
+// the same block as the header, so boxed reals and short strings cost one
+// allocation instead of two. Data is never freed while anything points to
+// its start, even if nothing points to the header any more. Large data
+// has pages of its own, which go back to the system when it dies or
+// shrinks a lot.
+
+Object* AllocBinaryObject(int size);
+
+// Resizes a binary object's data, returning the new pData. (Data in the
+// header's block has to move out to grow.)
+
+void*   ResizeBinaryData(Object* pObj, int size);
+
+// Like ResizeBinaryData, but growing leaves room to grow into, so data that
+// grows a little at a time isn't copied every time.
+
+void*   GrowBinaryData(Object* pObj, int size);
+
+// Makes pClone share pObj's binary data (see Clone).
+
+void    ShareBinaryData(Object* pObj, Object* pClone);
+
+// Copies binary data that pObj has been sharing, returning the new pData.
+
+void*   CopyBinaryData(Object* pObj);
+
+// Binary data, uninitialized.
+
+void*   AllocData(int size);
+
+void*   ReallocData(void* pData, int size);
+
+#endif //__GCALLOC_H__
@@ -0,0 +1,207 @@
+/*
+    Proto language runtime
+
+    Walking the object graph without recursion
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#ifndef __HEAPWALK_H__
+#define __HEAPWALK_H__
+
+#include "objects-private.h"
+#include "objhash.h"
+#include "gcalloc.h"
+#include <string.h>
+
+// HeapWalker<VISITOR> goes through everything reachable from a Value, depth
+// first, reaching each object once. It keeps its own stack, so a deep
+// structure can't run the C stack out. The visitor's functions are called
+// directly, not virtually, so they're inlined into the walk. A visitor has:
+//
+//  typedef ... Mark;
+//      What the walker remembers about each object it's reached (the
+//      visitor sets it in Enter), e.g. a bool, or the object's copy.
+//  enum { kSeeForwarders = true or false };
+//      If false, forwarders are followed, and the visitor only ever sees
+//      the objects they lead to.
+//  void Leaf(Value v);
+//      Reached something that isn't an object, or is a symbol.
+//  bool Enter(Value v, Object* pObj, int depth, Mark& mark);
+//      Reached an object for the first time. Returns whether to go
+//      through its contents. The root's depth is 1.
+//  void Revisit(Value v, Object* pObj, const Mark& mark);
+//      Reached an object again (it's shared, or there's a cycle).
+//  bool Slot(Object* pObj, Value tag, int index);
+//      About to go to something pObj contains: its class (index -1), the
+//      index-th slot of an array, or the index-th slot of a frame, whose tag
+//      is given. Returns whether to.
+//  void Leave(Value v, Object* pObj, int depth);
+//      Done with the contents of an object Enter said to go through.
+//
+// What an object contains: a frame, its slot values, in map order
+// (supermaps first), but not its map; an array, its class then its slots;
+// a binary, its class; a forwarder, its replacement.
+
+template<typename VISITOR>
+class HeapWalker {
+public:
+    typedef typename VISITOR::Mark Mark;
+
+    HeapWalker(VISITOR& visitor)
+        : m_visitor(visitor)
+    {
+        m_steps = m_initialSteps;
+        m_depth = 0;
+        m_capacity = ARRAYSIZE(m_initialSteps);
+    }
+
+    void    Walk(Value root)
+    {
+        Reach(root);
+        while (m_depth > 0) {
+            Step& step = m_steps[m_depth - 1];
+            Value tag;
+            int index;
+            Value v;
+            if (NextValue(step, &tag, &index, &v)) {
+                if (m_visitor.Slot(step.pObj, tag, index))
+                    Reach(v);
+            }
+            else {
+                m_depth--;
+                m_visitor.Leave(step.obj, step.pObj, m_depth + 1);
+            }
+        }
+    }
+
+    // Makes room to remember n objects, for a walk that's known to reach
+    // about that many.
+
+    void    Reserve(int n)
+    {
+        m_visited.Reserve(n);
+    }
+
+    // Gets the mark of an object that's been reached.
+
+    bool    GetMark(Value v, /*out*/ Mark* pMark)
+    {
+        if (!V_ISPTR(v))
+            return false;
+        if (!VISITOR::kSeeForwarders)
+            v = PTR_V(V_PTR(v));
+        return m_visited.Get(v, pMark);
+    }
+
+private:
+    struct Step {
+        Value   obj;
+        Object* pObj;
+        int     next;       // What to go to next; -1 is the class
+        int     nFound;     // Frame slots gone to so far
+    };
+
+    void    Reach(Value v)
+    {
+        if (!V_ISPTR(v)) {
+            m_visitor.Leaf(v);
+            return;
+        }
+
+        Object* pObj;
+        if (VISITOR::kSeeForwarders)
+            pObj = UNSAFE_V_PTR(v);
+        else {
+            pObj = V_PTR(v);
+            v = PTR_V(pObj);
+        }
+
+        // Symbols never change and don't contain anything interesting, so
+        // they're not worth remembering
+        if (ObjIsSymbol(pObj)) {
+            m_visitor.Leaf(v);
+            return;
+        }
+
+        bool added;
+        Mark* pMark = m_visited.Add(v, &added);
+        if (!added)
+            m_visitor.Revisit(v, pObj, *pMark);
+        else if (m_visitor.Enter(v, pObj, m_depth + 1, *pMark))
+            Push(v, pObj);
+    }
+
+    void    Push(Value v, Object* pObj)
+    {
+        if (m_depth == m_capacity) {
+            Step* newSteps = (Step*) GC_MALLOC(m_capacity * 2 * sizeof(Step));
+            memcpy(newSteps, m_steps, m_depth * sizeof(Step));
+            m_steps = newSteps;
+            m_capacity *= 2;
+        }
+
+        Step& step = m_steps[m_depth++];
+        step.obj = v;
+        step.pObj = pObj;
+        step.next = -1;
+        step.nFound = 0;
+    }
+
+    bool    NextValue(Step& step, Value* pTag, int* pIndex, Value* pValue)
+    {
+        Object* pObj = step.pObj;
+        int flags = pObj->flags;
+        *pTag = V_NIL;
+
+        if (flags & HDR_FORWARDER) {
+            if (step.next >= 0)
+                return false;
+            step.next = 0;
+            *pIndex = 0;
+            *pValue = PTR_V(pObj->pReplacement);
+            return true;
+        }
+
+        if (ObjIsFrame(pObj)) {
+            // Skip the empty buckets of a hash map
+            Object* pMap = UNSAFE_V_PTR(pObj->map);
+            if (step.next < 0)
+                step.next = 0;
+            while (step.next < (int) pObj->size) {
+                int offset = step.next++;
+                Value tag = FrameSlotTag(pMap, offset);
+                if (tag != V_NIL && tag != INT_V(0)) {
+                    *pTag = tag;
+                    *pIndex = step.nFound++;
+                    *pValue = pObj->pSlots[offset];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        if (step.next < 0) {
+            step.next = 0;
+            *pIndex = -1;
+            *pValue = pObj->cls;
+            return true;
+        }
+
+        if (!(flags & HDR_SLOTTED) || step.next >= (int) pObj->size)
+            return false;
+        *pIndex = step.next++;
+        *pValue = pObj->pSlots[*pIndex];
+        return true;
+    }
+
+    VISITOR&    m_visitor;
+    ObjHashTable<Mark> m_visited;
+    Step*       m_steps;
+    int         m_depth;
+    int         m_capacity;
+    Step        m_initialSteps[32];
+};
+
+#endif //__HEAPWALK_H__
@@ -15,13 +15,9 @@
 #include "gc.h"
 #include <string.h>
 #include <stdio.h>
+#include <new>
 #include "native.h"
 
-DECLARE_PSYM(_implementor);
-DECLARE_PSYM(_nextargframe);
-DECLARE_PSYM(_proto);
-DECLARE_PSYM(_parent);
-
 Value   g_functions;
 Value   g_variables;
 
@@ -53,7 +49,7 @@ struct ArgFrame {
     Value   impl;
 };
 
-Value   FindGlobalFunction(Value name)
+Value   GetGlobalFunction(Value name)
 {
     return GetSlot(g_functions, name);
 }
@@ -168,6 +164,17 @@ struct Iterator {
     Value   numSlots;
 };
 
+// Frame tables and views don't keep their elements in their slots.
+
+inline int  IterationLength(Object* pObj)
+{
+    if (ObjIsFrameTable(pObj))
+        return FrameTableLength(pObj);
+    if (ObjIsView(pObj))
+        return ViewLength(pObj);
+    return pObj->size;
+}
+
 Value   NewIterator(Value obj, bool deeply)
 {
     // BUGBUG: deeply not implemented
@@ -184,7 +191,7 @@ Value   NewIterator(Value obj, bool deeply)
     Iterator* pIter = (Iterator*) (V_PTR(iter)->pSlots);
 
     pIter->curObj = obj;
-    int numSlots = pObj->size;
+    int numSlots = IterationLength(pObj);
     pIter->numSlots = INT_V(numSlots);
     pIter->curSlot = INT_V(0);
     if (numSlots == 0)
@@ -196,7 +203,7 @@ Value   NewIterator(Value obj, bool deeply)
     }
     else {
         pIter->curTag = INT_V(0);
-        pIter->curValue = pObj->pSlots[0];
+        pIter->curValue = GetSlot(obj, 0);
     }
 
     return iter;
@@ -213,7 +220,7 @@ bool    IteratorDone(Value iter)
     if (!(flags & HDR_SLOTTED))
         PROTO_THROW(g_exType, E_NotAFrameOrArray);
 
-    pIter->numSlots = INT_V(pObj->size);
+    pIter->numSlots = INT_V(IterationLength(pObj));
 
     if (pIter->curSlot >= pIter->numSlots)
         return true;
@@ -235,6 +242,12 @@ void    IteratorNext(Value iter)
         pIter->curTag = GetMapTag(pObj->map, index);
         pIter->curValue = pObj->pSlots[index];
     }
+    else if (ObjIsFrameTable(pObj) || ObjIsView(pObj)) {
+        // Frame table rows are made as they're needed (see frametable.cpp),
+        // and views' elements come from their bases
+        pIter->curTag = INT_V(index);
+        pIter->curValue = (index < IterationLength(pObj)) ? GetSlot(pIter->curObj, index) : V_NIL;
+    }
     else {
         pIter->curTag = INT_V(index);
         pIter->curValue = pObj->pSlots[index];
@@ -280,7 +293,7 @@ struct StackFrame {
 };
 
 struct Process {
-    Process(void* vsTop, void* csTop);
+    Process(void* vsTop, void* csTop, int vsSize, int csSize);
     void    Push(Value v);
     Value   Pop(void);
     Value   PeekN(int n);
@@ -288,15 +301,20 @@ struct Process {
     void    Dup(void);
     void    PushFrame(void);
     void    PopFrame(void);
+    void    CheckStack(int nValues);
     void    SetupCall(Value fn, int actualNumArgs);
     bool    SetupSend(Value rcvr, Value start, Value name, int actualNumArgs, bool resend);
     void    Interpret(void);
     bool    HandleException(ProtaException& ex, StackFrame* cspLimit);
+    Value   Reenter(Value rcvr, Value fn, Value name, int nArgs, const Value args[]);
+    void    Unwind(Value* vsp, StackFrame* csp, Handler* pHandler);
 
     Value*      m_vsp;
     StackFrame* m_csp;
     Value*      m_vsTop;
     StackFrame* m_csTop;
+    Value*      m_vsLimit;
+    StackFrame* m_csLimit;
     Handler*    m_pHandler;
 };
 
@@ -305,11 +323,13 @@ struct Process {
 // most recently pushed value, and the stack grows
 // toward more positive addresses.
 
-Process::Process(void* vsTop, void* csTop)
+Process::Process(void* vsTop, void* csTop, int vsSize, int csSize)
 {
     m_vsTop = (Value*) vsTop;
     m_vsp = m_vsTop;
+    m_vsLimit = m_vsTop + vsSize;
     m_csTop = (StackFrame*) csTop;
+    m_csLimit = m_csTop + csSize;
     // BUGBUG: Why not start m_csp at csTop-1?
     m_csp = m_csTop;
     memset(m_csp, 0, sizeof(StackFrame));
@@ -350,6 +370,19 @@ inline  void    Process::PushFrame()
     ++m_csp;
 }
 
+// Push and PushFrame don't check for overflow, so a bytecode function is
+// checked for room before it's set up: a frame, its locals, and VS_SLACK
+// more values for evaluating its expressions, which is far more than any
+// one statement pushes between calls.
+
+const int VS_SLACK = 256;
+
+inline  void    Process::CheckStack(int nValues)
+{
+    if (m_csp + 1 >= m_csLimit || m_vsp + nValues + VS_SLACK >= m_vsLimit)
+        PROTO_THROW(g_exIntrp, E_StackOverflow);
+}
+
 inline  void    Process::PopFrame()
 {
     // Clear all the Values in the stack frame so we don't have
@@ -387,6 +420,7 @@ void    Process::SetupCall(Value fn, int actualNumArgs)
         if (numArgs != actualNumArgs)
             PROTO_THROW(g_exIntrp, E_WrongNumArgs);
 
+        CheckStack(numLocals);
         PushFrame();
 
         m_csp->locals = m_vsp - numArgs - 3 + 1;    // Pre-offset by the very historical 3
@@ -396,7 +430,7 @@ void    Process::SetupCall(Value fn, int actualNumArgs)
 
         m_csp->func = fn;
 
-        m_csp->ip = m_csp->instrStart = (Byte*) GetData(pFn->instrs);
+        m_csp->ip = m_csp->instrStart = (Byte*) GetReadOnlyData(pFn->instrs);
 
         m_csp->literals = (pFn->literals == V_NIL) ? 0 : V_PTR(pFn->literals)->pSlots;
 
@@ -458,6 +492,7 @@ bool    Process::SetupSend(Value rcvr, Value start, Value name, int actualNumArg
         if (numArgs != actualNumArgs)
             PROTO_THROW(g_exIntrp, E_WrongNumArgs);
 
+        CheckStack(numLocals);
         PushFrame();
 
         m_csp->locals = m_vsp - numArgs - 3 + 1;    // Pre-offset by the very historical 3
@@ -467,7 +502,7 @@ bool    Process::SetupSend(Value rcvr, Value start, Value name, int actualNumArg
 
         m_csp->func = fn;
 
-        m_csp->ip = m_csp->instrStart = (Byte*) GetData(pFn->instrs);
+        m_csp->ip = m_csp->instrStart = (Byte*) GetReadOnlyData(pFn->instrs);
 
         m_csp->literals = (pFn->literals == V_NIL) ? 0 : V_PTR(pFn->literals)->pSlots;
 
@@ -512,7 +547,7 @@ void    Process::Interpret()
                 PrintCStack(csp, m_csTop, 6);
                 TRACE("\n");
                 PrintVStack(m_vsp, m_vsTop, 6, 0);
-                TRACE("\n\t%X@%d: ", (int) csp->func, csp->ip - csp->instrStart);
+                TRACE("\n\t%llX@%d: ", (unsigned long long) (UIntPtr) csp->func, (int) (csp->ip - csp->instrStart));
                 PrintInstruction(csp->ip, csp->literals);
                 TRACE("\n");
 
@@ -608,15 +643,17 @@ void    Process::Interpret()
                     Push(csp->literals[param]);
                     break;
 
-                // B field is signed for OP_PUSHCONSTANT, so EIGHTCASE won't work
+                // B field is signed for OP_PUSHCONSTANT, so EIGHTCASE won't work.
+                // It's an NTK immediate, which has the same bits as ours but
+                // is only 16 bits long, so it just needs sign-extending.
                 EIGHTCASE_SIGNED(OP_PUSHCONSTANT)
-                    Push((Value) param);
+                    Push((Value) (IntPtr) param);
                     break;
 
                 EIGHTCASE(OP_CALL)
                 {
                     Value name = Pop();
-                    Value func = FindGlobalFunction(name);
+                    Value func = GetGlobalFunction(name);
                     if (func == V_NIL)
                         PROTO_THROW(g_exIntrp, E_UndefinedFunction);
                     SetupCall(func, param);
@@ -710,10 +747,31 @@ void    Process::Interpret()
 
                 EIGHTCASE(OP_MAKEFRAME)
                 {
-                    Value frame = NewFrameWithMap(Pop());
-                    Value* pSlots = V_PTR(frame)->pSlots;
-                    for (int i = 0; i < param; i++)
-                        pSlots[i] = PeekN(param - i - 1);
+                    // The slot values are on the stack in the same order as the
+                    // literal map's tags. A map without a supermap is just a list
+                    // of tags, so build the frame from them, which shares the map
+                    // with any other frame with those tags (and hashes it if it's big).
+                    Value map = Pop();
+                    Object* pMap = V_PTR(map);
+                    Value frame;
+                    if (((MapSlots*) pMap->pSlots)->supermap == V_NIL) {
+                        int nTags = pMap->size - SeqMapArraySize(0);
+                        frame = NewFrameWithSlots(nTags, ((MapSlots*) pMap->pSlots)->tags, m_vsp - param + 1);
+                    }
+                    else {
+                        // Literal maps never change shape, so freeze them the first time through.
+                        // They come from NTK, whose map flags (sorted, shared, proto) don't
+                        // line up with ours except for HAS_PROTO, so translate them first.
+                        int flags = V_INT(pMap->cls);
+                        if (!(flags & SHARED_MAP)) {
+                            pMap->cls = INT_V(flags & HAS_PROTO);
+                            FreezeMap(map);
+                        }
+                        frame = NewFrameWithMap(map);
+                        Value* pSlots = V_PTR(frame)->pSlots;
+                        for (int i = 0; i < param; i++)
+                            pSlots[i] = PeekN(param - i - 1);
+                    }
                     Drop(param);
                     Push(frame);
                     break;
@@ -722,13 +780,14 @@ void    Process::Interpret()
                 EIGHTCASE(OP_MAKEARRAY)
                 {
                     Value cls = Pop();
-                    if (param == 0xFFFF)
-                        Push(NewArray(cls, UNSAFE_V_INT(Pop())));
+                    if (param == 0xFFFF) {
+                        int size = V_INDEX(Pop());
+                        if (size < 0)
+                            PROTO_THROW(g_exFr, E_OutOfBounds);
+                        Push(NewArray(cls, size));
+                    }
                     else {
-                        Value array = NewArray(cls, param);
-                        Value* pSlots = V_PTR(array)->pSlots;
-                        for (int i = 0; i < param; i++)
-                            pSlots[i] = PeekN(param - i - 1);
+                        Value array = NewArray(cls, param, m_vsp - param + 1);
                         Drop(param);
                         Push(array);
                     }
@@ -789,7 +848,7 @@ void    Process::Interpret()
 
                 EIGHTCASE(OP_INCRVAR)
                 {
-                    int addend = V_INT(PeekN(0));
+                    IntPtr addend = V_INT(PeekN(0));
                     Value result = INT_V(addend + V_INT(csp->locals[param]));
                     csp->locals[param] = result;
                     Push(result);
@@ -798,9 +857,9 @@ void    Process::Interpret()
 
                 EIGHTCASE(OP_BRANCHIFLOOPNOTDONE)
                 {
-                    int limit = V_INT(Pop());
-                    int index = V_INT(Pop());
-                    int incr = V_INT(Pop());
+                    IntPtr limit = V_INT(Pop());
+                    IntPtr index = V_INT(Pop());
+                    IntPtr incr = V_INT(Pop());
                     if (incr == 0)
                         PROTO_THROW(g_exIntrp, E_ZeroForLoopIncr);
                     else if ((incr > 0 && index <= limit) || (incr < 0 && index >= limit))
@@ -818,8 +877,8 @@ void    Process::Interpret()
                     // BUGBUG: all numerics are broken (slow & integer only)
         #define BINOP(cvt, oper)    \
                     {   \
-                        int b = V_INT(Pop());   \
-                        int a = V_INT(Pop());   \
+                        IntPtr b = V_INT(Pop());    \
+                        IntPtr a = V_INT(Pop());    \
                         Push(cvt(a oper b));    \
                     }
 
@@ -837,8 +896,8 @@ void    Process::Interpret()
 
                     case FF_DIVIDE:
                     {
-                        int b = V_INT(Pop());
-                        int a = V_INT(Pop());
+                        IntPtr b = V_INT(Pop());
+                        IntPtr a = V_INT(Pop());
                         Push(REAL_V((double) a / b));
                         break;
                     }
@@ -849,20 +908,24 @@ void    Process::Interpret()
 
                     case FF_AREF:
                     {
-                        int index = V_INT(Pop());
+                        int index = V_INDEX(Pop());
                         Value obj = Pop();
-                        // BUGBUG: string access not implemented
-                        Push(GetSlot(obj, index));
+                        if (V_ISPTR(obj) && IsString(obj))
+                            Push(GetStringChar(obj, index));
+                        else
+                            Push(GetSlot(obj, index));
                         break;
                     }
 
                     case FF_SETAREF:
                     {
                         Value elt = Pop();
-                        int index = V_INT(Pop());
+                        int index = V_INDEX(Pop());
                         Value obj = Pop();
-                        // BUGBUG: string access not implemented
-                        SetSlot(obj, index, elt);
+                        if (V_ISPTR(obj) && IsString(obj))
+                            SetStringChar(obj, index, elt);
+                        else
+                            SetSlot(obj, index, elt);
                         Push(elt);
                         break;
                     }
@@ -950,9 +1013,7 @@ void    Process::Interpret()
                         break;
 
                     case FF_STRINGER:
-                        // BUGBUG: not implemented
-                        assert(0);
-                        Push(V_NIL);
+                        Push(Stringer(Pop()));
                         break;
 
                     case FF_HASPATH:
@@ -1088,15 +1149,87 @@ NATIVE_FUNC(FCurrentException)
 
 DECLARE_GLOBAL_FUNCTION("CurrentException", FCurrentException, 0);
 
-// BUGBUG: Obviously a wacko placeholder
+// Calls from C++ all run on one process. A call made while it's running
+// (by a native function, say) pushes onto its stacks above whatever is
+// there, and runs a nested Interpret that returns when the called function
+// does. So a call costs a push per argument and a stack frame.
+
+const int VS_SIZE = 16384;      // Values
+const int CS_SIZE = 2048;       // Stack frames
+
+Process*    g_pProcess;
+
+Process*    CurrentProcess()
+{
+    if (g_pProcess == 0) {
+        void* vs = GC_MALLOC(VS_SIZE * sizeof(Value));
+        void* cs = GC_MALLOC(CS_SIZE * sizeof(StackFrame));
+        g_pProcess = new (GC_MALLOC(sizeof(Process))) Process(vs, cs, VS_SIZE, CS_SIZE);
+    }
+    return g_pProcess;
+}
+
+// Calls fn, or if name isn't nil sends it to rcvr. If anything throws, the
+// stacks and handlers are put back the way they were before it's rethrown,
+// so the caller (or an outer Interpret) can carry on.
+
+Value   Process::Reenter(Value rcvr, Value fn, Value name, int nArgs, const Value args[])
+{
+    if (m_vsp + nArgs + 1 >= m_vsLimit || m_csp + 1 >= m_csLimit)
+        PROTO_THROW(g_exIntrp, E_StackOverflow);
+
+    Value* vsp = m_vsp;
+    StackFrame* csp = m_csp;
+    Handler* pHandler = m_pHandler;
+    try {
+        for (int i = 0; i < nArgs; i++)
+            Push(args[i]);
+        if (name == V_NIL)
+            SetupCall(fn, nArgs);
+        else if (!SetupSend(rcvr, rcvr, name, nArgs, false))
+            PROTO_THROW(g_exIntrp, E_UndefinedMethod);
+
+        if (m_csp != csp) {         // A native function has already returned
+            Interpret();
+            ASSERT(m_csp == csp + 1);
+            PopFrame();
+        }
+        return Pop();
+    }
+    catch (...) {
+        Unwind(vsp, csp, pHandler);
+        throw;
+    }
+}
+
+void    Process::Unwind(Value* vsp, StackFrame* csp, Handler* pHandler)
+{
+    while (m_csp > csp)
+        PopFrame();
+    if (m_vsp > vsp)
+        Drop((int) (m_vsp - vsp));
+    m_vsp = vsp;
+    m_pHandler = pHandler;
+}
+
+EXPORT  Value   Call(Value func, int nArgs, const Value args[])
+{
+    return CurrentProcess()->Reenter(V_NIL, func, V_NIL, nArgs, args);
+}
 
 EXPORT  Value   Call(Value func)
 {
-    Value* stack = (Value*) GC_MALLOC(1000 * sizeof(Value));
-    Process p(stack, stack + 500);
-    p.SetupCall(func, 0);
-    p.Interpret();
-    return p.Pop();
+    return Call(func, 0, 0);
+}
+
+EXPORT  Value   Send(Value rcvr, Value msg, int nArgs, const Value args[])
+{
+    return CurrentProcess()->Reenter(rcvr, V_NIL, msg, nArgs, args);
+}
+
+EXPORT  Value   Send(Value rcvr, Value msg)
+{
+    return Send(rcvr, msg, 0, 0);
 }
 
 Value   MakeNativeFunc(NativeFuncPtr fnPtr, int numArgs)
@@ -1226,7 +1359,7 @@ void    PrintInstruction(Byte* ip, Value* literals)
 
     case OP_PUSHCONSTANT:
         TRACE("%s <", g_opNames[A]);
-        TRACEVALUE((Value) B, 0);
+        TRACEVALUE((Value) (IntPtr) B, 0);
         TRACE(">");
         break;
 
@@ -1277,7 +1410,7 @@ void    PrintCStack(StackFrame* csp, StackFrame* csTop, int nItems)
     // in printing it.
 
     for (StackFrame* sfp = limit + 1; sfp <= csp; sfp++)
-        TRACE("%X@%d ", (int) sfp->func, sfp->ip - sfp->instrStart);
+        TRACE("%llX@%d ", (unsigned long long) (UIntPtr) sfp->func, (int) (sfp->ip - sfp->instrStart));
 }
 
 #ifdef BCCOUNT
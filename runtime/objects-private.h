@@ -12,6 +12,7 @@
 
 #include "stddef.h"
 #include "objects.h"
+#include "predefined.h"
 
 struct Object {
     UInt32  size : 28;
@@ -30,7 +31,9 @@ struct Object {
 enum {
     HDR_SLOTTED = 1,
     HDR_FRAME = 2,
-    HDR_FORWARDER = 4
+    HDR_COMPACT = 2,        // (binaries) a compact string, see strings.cpp
+    HDR_FORWARDER = 4,
+    HDR_SHARED = 8          // pData/pSlots may be shared with a clone
 };
 
 const Value FUNCTION_CLASS  = IMMED_V(IMMED_SPECIAL, 0x3);      // a.k.a. 0x32
@@ -49,12 +52,125 @@ inline bool ObjIsBinary(Object* pObj)
 inline bool ObjIsSymbol(Object* pObj)
     { return (pObj->flags & HDR_SLOTTED) == 0 && pObj->cls == SYMBOL_CLASS; }
 
+// A clone of a big array or binary shares its original's slots or data
+// until one of them is written (see Clone). Anything that writes them has
+// to call this first.
+
+void    UnshareData(Object* pObj);
+
+inline void Unshare(Object* pObj)
+{
+    if (pObj->flags & HDR_SHARED)
+        UnshareData(pObj);
+}
+
+// Rebuilds a value table whose keys have been replaced by clones, since
+// they hash by identity.
+
+void    RehashValueTable(Object* pTable);
+
+// Frame tables (see frametable.cpp) are arrays that act like arrays of
+// frames, so the array functions have to check for them.
+
+inline bool ObjIsFrameTable(Object* pObj)
+    { return ObjIsArray(pObj) && pObj->cls == PSYM(frameTable); }
+
+int     FrameTableLength(Object* pTable);
+Value   GetFrameTableRow(Object* pTable, int index);
+void    SetFrameTableRow(Object* pTable, int index, Value frame);
+void    AddFrameTableRow(Object* pTable, Value frame);
+void    SetFrameTableLength(Object* pTable, int nRows);
+Value   GetFrameTableCell(Object* pTable, int index, Value tag);
+void    SetFrameTableCell(Object* pTable, int index, Value tag, Value value);
+
+// Typed arrays (see typedarray.cpp) are binaries that act like arrays of
+// numbers.
+
+int     TypedArrayKind(Object* pObj);
+int     TypedArrayElementSize(Object* pObj);
+int     TypedArrayLength(Object* pObj);
+Value   GetTypedArrayElement(Object* pObj, int index);
+void    SetTypedArrayElement(Object* pObj, int index, Value v);
+
+inline bool ObjIsTypedArray(Object* pObj)
+    { return TypedArrayKind(pObj) >= 0; }
+
+// Views (see views.cpp) are arrays that stand for a range of another
+// array or binary.
+
+inline bool ObjIsView(Object* pObj)
+    { return ObjIsArray(pObj) && pObj->cls == PSYM(view); }
+
+int     ViewLength(Object* pView);
+Value   GetViewSlot(Object* pView, int index);
+void    SetViewSlot(Object* pView, int index, Value value);
+Value*  GetViewSlots(Object* pView);
+const Value*    GetViewReadOnlySlots(Object* pView);
+void*   GetViewData(Object* pView, bool writable);
+int     GetViewDataSize(Object* pView);
+
+// An array's slots for reading only, or 0 if they have to be got one at a
+// time with GetSlot (see arrays.cpp).
+
+const Value*    ReadOnlySlots(Value array, int* pLength);
+
+// Strings, ropes, and string builders (see strings.cpp).
+
+inline bool ObjIsString(Object* pObj)
+    { return ObjIsBinary(pObj) && pObj->cls == PSYM(string); }
+
+inline bool ObjIsRope(Object* pObj)
+    { return ObjIsArray(pObj) && pObj->cls == PSYM(rope); }
+
+inline bool ObjIsStringBuilder(Object* pObj)
+    { return ObjIsBinary(pObj) && pObj->cls == PSYM(stringBuilder); }
+
+// A string whose characters all fit in a byte can be compact: one byte per
+// character (Latin-1) instead of a TCHAR. Anything that treats a compact
+// string's data as TCHARs has to widen it first, or read a wide copy;
+// GetData and GetReadOnlyData do that. Code that knows about both forms
+// can use these instead.
+
+inline bool ObjIsCompact(Object* pObj)
+    { return (pObj->flags & (HDR_SLOTTED | HDR_COMPACT)) == HDR_COMPACT; }
+
+inline int  StringChars(Object* pObj)
+{
+    int n = ObjIsCompact(pObj) ? pObj->size : pObj->size / sizeof(TCHAR);
+    return n > 0 ? n - 1 : 0;
+}
+
+inline UInt32   StringCharAt(Object* pObj, int index)
+{
+    if (ObjIsCompact(pObj))
+        return ((const Byte*) pObj->pData)[index];
+    return (UInt32) ((const TCHAR*) pObj->pData)[index];
+}
+
+void    WidenString(Object* pObj);
+const TCHAR*    WideCopy(Object* pObj);
+Value   NewStringFromUTF16(const Byte* p, int nUnits);
+bool    StringsEqual(Object* pA, Object* pB);
+int     CompareStringChars(Object* pA, Object* pB, bool ignoreCase);
+
 const int MAX_SLOTS = (1 << 28) - 1;
 const int MAX_DATA = (1 << 28) - 1;
 
-inline Value PTR_V(void* p) { return (Value) (((int) p) | TAG_PTR); }
+inline Value PTR_V(void* p) { return (Value) (((IntPtr) p) | TAG_PTR); }
 Object* V_PTR(Value v);
-inline Object* UNSAFE_V_PTR(Value v) { return (Object*) (((int) v) - 1); }
+inline Object* UNSAFE_V_PTR(Value v) { return (Object*) (((IntPtr) v) - 1); }
+
+// A rope stands for a string. Anything that needs it to be one flattens it
+// first, which makes the rope a forwarder to its flat string.
+
+Object* FlattenRope(Object* pRope);
+int     StringLength(Value str);
+
+inline Object*  FlatObject(Value v)
+{
+    Object* pObj = V_PTR(v);
+    return ObjIsRope(pObj) ? FlattenRope(pObj) : pObj;
+}
 
 // Map class flags (for the cls slot of map objects)
 
@@ -62,9 +178,30 @@ enum {
     SORTED_MAP = 1,
     HASH_MAP = 2,
     HAS_PROTO = 4,
-    SHARED_MAP = 8
+    SHARED_MAP = 8,
+    BLOOM_MAP = 16          // The map's filter bits are up to date
 };
 
+// The rest of a map's class is a Bloom filter of the tags in it and its
+// supermaps, so a lookup can usually prove a tag isn't there without
+// searching. Each tag sets two of the filter bits (see TagBloomBits).
+// A map without BLOOM_MAP has its filter computed on the first lookup.
+
+const int MAP_BLOOM_SHIFT = 5;
+const int MAP_BLOOM_BITS = 24;      // Keeps the class a nonnegative fixnum
+const int MAP_BLOOM_MASK = ((1 << MAP_BLOOM_BITS) - 1) << MAP_BLOOM_SHIFT;
+
+// The filter bits are taken from the tag's address rather than its symbol
+// hash, which would cost two more loads. Symbols never move.
+
+inline int TagBloomBits(Value tag)
+{
+    UInt32 h = (UInt32) ((size_t) tag >> 4) * 0x9E3779B1u;
+    int b1 = (h >> 24) % MAP_BLOOM_BITS;
+    int b2 = ((h >> 16) & 0xFF) % MAP_BLOOM_BITS;
+    return ((1 << b1) | (1 << b2)) << MAP_BLOOM_SHIFT;
+}
+
 const Value SEQUENTIAL_MAP_CLASS = INT_V(0);
 const Value HASH_MAP_CLASS = INT_V(HASH_MAP);
 
@@ -73,7 +210,10 @@ struct MapSlots {
     union {
         Value   tags[1];        // for sequential maps
         struct {                // for hash maps
-            Value   nOccupied;
+            Value   nOccupied;      // Counts both tables while rehashing
+            Value   nDeleted;       // Tombstones (INT_V(0) tags) in this table
+            Value   oldMap;         // Map being rehashed from, or nil (see RehashFrame)
+            Value   nMigrated;      // Buckets of oldMap rehashed so far
             Value   table[1];
         } hash;
     };
@@ -82,9 +222,65 @@ struct MapSlots {
 inline int SeqMapArraySize(int nSlots) { return offsetof(MapSlots, tags[nSlots]) / sizeof(Value); }
 inline int HashMapArraySize(int nSlots) { return offsetof(MapSlots, hash.table[nSlots]) / sizeof(Value); }
 
+// A sorted map is a frozen sequential map (see FreezeMap). Its tags are
+// followed by the same number of INT_V indexes into them, ordered by tag,
+// for binary search.
+
+inline int SeqMapNumTags(Object* pMap)
+{
+    int n = pMap->size - SeqMapArraySize(0);
+    return (UNSAFE_V_INT(pMap->cls) & SORTED_MAP) ? n / 2 : n;
+}
+
+// The tag of one of a map's own slots (not counting supermaps).
+
+inline Value    OwnTagAtOffset(Object* pMap, int offset)
+{
+    MapSlots* pMapSlots = (MapSlots*) pMap->pSlots;
+    if (UNSAFE_V_INT(pMap->cls) & HASH_MAP) {
+        int tableSize = pMap->size - HashMapArraySize(0);
+        if (offset < tableSize)
+            return pMapSlots->hash.table[offset];
+        if (pMapSlots->hash.oldMap == V_NIL)
+            return V_NIL;
+
+        // Still being rehashed, and the slot's in the old part
+        Object* pOldMap = UNSAFE_V_PTR(pMapSlots->hash.oldMap);
+        offset -= tableSize;
+        if (offset < pOldMap->size - HashMapArraySize(0))
+            return ((MapSlots*) pOldMap->pSlots)->hash.table[offset];
+        return V_NIL;
+    }
+
+    if (offset < SeqMapNumTags(pMap))
+        return pMapSlots->tags[offset];
+    return V_NIL;
+}
+
+// The tag of a frame slot, from its index, without searching. Returns nil
+// if that isn't easy (the map has a supermap) or there's no such slot, so a
+// remembered index (see slotref.cpp) can be checked with one compare.
+// In a hash map, an empty bucket's slot gives nil or INT_V(0) (a tombstone).
+
+inline Value    TagAtOffset(Object* pMap, int offset)
+{
+    MapSlots* pMapSlots = (MapSlots*) pMap->pSlots;
+    if (pMapSlots->supermap != V_NIL || offset < 0)
+        return V_NIL;
+    return OwnTagAtOffset(pMap, offset);
+}
+
+// Like TagAtOffset, but follows supermaps, for going through all of a
+// frame's slots in order (see heapwalk.h).
+
+Value   FrameSlotTag(Object* pMap, int offset);
+
 void    SetSlottedLength(Object* pObj, int nSlots);
+void    AddSlotValue(Object* pObj, Value newValue);
 
 Value   GetMapTag(Value map, int index);
+int     FindOffset(Value map, Value tag);
+Value   MapForTags(int nTags, const Value tags[], Value* pOffsets);
 
 struct SymbolData {
     int     hash;
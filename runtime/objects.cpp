@@ -9,19 +9,13 @@
 
 #include "config.h"
 #include "objects-private.h"
-#include "objhash.h"
+#include "heapwalk.h"
+#include "gcalloc.h"
 #include "gc.h"
 #include "predefined.h"
+#include "simd.h"
 #include <string.h>
-
-DECLARE_PSYM(_proto);
-DECLARE_PSYM(array);
-DECLARE_PSYM(cobj);
-DECLARE_PSYM(data);
-DECLARE_PSYM(errcode);
-DECLARE_PSYM(pathexpr);
-DECLARE_PSYM(real);
-DECLARE_PSYM(string);
+#include <algorithm>
 
 void    CheckFrame(Value frame);
 
@@ -40,6 +34,12 @@ int     V_INT_error()
     return 0;
 }
 
+int     V_INDEX_error()
+{
+    PROTO_THROW(g_exFr, E_OutOfBounds);
+    return 0;
+}
+
 int     V_CHAR_error()
 {
     PROTO_THROW(g_exType, E_NotACharacter);
@@ -68,13 +68,62 @@ Object* V_PTR(Value v)
     return pObj;
 }
 
+// In a 64-bit build, a double whose exponent is within 2^+-63 or so (or
+// that is zero) is kept in the Value, shifted over to make room for the
+// IMMED_REAL tag. That takes four bits away from the exponent. The bits are
+// rotated to put the sign at the bottom, and the exponent is offset so
+// the window starts at zero. Zero stays zero, so the (boxed) double at the
+// bottom of the window can't be confused with it.
+//
+// That leaves integers their 62 bits, which NaN-boxing wouldn't.
+
+#if PROTO_64BIT
+
+const UIntPtr   REAL_EXP_OFFSET = (UIntPtr) (1023 - 63) << 53;
+
+inline UIntPtr  RotateLeft1(UIntPtr x)  { return (x << 1) | (x >> 63); }
+inline UIntPtr  RotateRight1(UIntPtr x) { return (x >> 1) | (x << 63); }
+
+#endif
+
 Value   REAL_V(double d)
 {
+#if PROTO_64BIT
+    UIntPtr bits;
+    memcpy(&bits, &d, sizeof(bits));
+    UIntPtr rot = RotateLeft1(bits);
+    if (rot > 1) {
+        rot -= REAL_EXP_OFFSET;
+        if (rot <= 1 || (rot >> 60) != 0)
+            return NewBinary(PSYM(real), &d, sizeof(double));
+    }
+    return (Value) ((rot << 4) | IMMED_REAL | TAG_IMMED);
+#else
     return NewBinary(PSYM(real), &d, sizeof(double));
+#endif
+}
+
+bool    IsReal(Value obj)
+{
+    if (V_ISIMMREAL(obj))
+        return true;
+    return V_ISPTR(obj) && V_EQ(V_PTR(obj)->cls, PSYM(real));
 }
 
 double  V_REAL(Value v)
 {
+#if PROTO_64BIT
+    if (V_ISIMMREAL(v)) {
+        UIntPtr rot = ((UIntPtr) v) >> 4;
+        if (rot > 1)
+            rot += REAL_EXP_OFFSET;
+        UIntPtr bits = RotateRight1(rot);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+#endif
+
     Object* pObj = V_PTR(v);
     if (!V_EQ(pObj->cls, PSYM(real)))
         PROTO_THROW(g_exType, E_NotAReal);
@@ -94,14 +143,22 @@ bool    V_EQ(Value a, Value b)
         return false;
 }
 
+// A rope (see strings.cpp) is an array inside, but it stands for a string.
+
 bool    IsBinary(Value obj)
 {
-    return V_ISPTR(obj) && (V_PTR(obj)->flags & HDR_SLOTTED) == 0;
+    if (!V_ISPTR(obj))
+        return false;
+    Object* pObj = V_PTR(obj);
+    return ObjIsBinary(pObj) || ObjIsRope(pObj);
 }
 
 bool    IsArray(Value obj)
 {
-    return V_ISPTR(obj) && (V_PTR(obj)->flags & (HDR_SLOTTED | HDR_FRAME)) == HDR_SLOTTED;
+    if (!V_ISPTR(obj))
+        return false;
+    Object* pObj = V_PTR(obj);
+    return ObjIsArray(pObj) && !ObjIsRope(pObj);
 }
 
 bool    IsFrame(Value obj)
@@ -109,6 +166,11 @@ bool    IsFrame(Value obj)
     return V_ISPTR(obj) && (V_PTR(obj)->flags & (HDR_SLOTTED | HDR_FRAME)) == (HDR_SLOTTED | HDR_FRAME);
 }
 
+bool    IsFrameTable(Value obj)
+{
+    return V_ISPTR(obj) && ObjIsFrameTable(V_PTR(obj));
+}
+
 bool    IsSymbol(Value obj)
 {
     return V_ISPTR(obj) && ObjIsSymbol(V_PTR(obj));
@@ -117,7 +179,7 @@ bool    IsSymbol(Value obj)
 bool    IsString(Value obj)
 {
     Object* pObj = V_PTR(obj);
-    return (pObj->flags & HDR_SLOTTED) == 0 && pObj->cls == PSYM(string);
+    return ObjIsString(pObj) || ObjIsRope(pObj);
 }
 
 //----------------------------------------------------------------
@@ -132,12 +194,10 @@ bool    IsString(Value obj)
 
 Value   NewBinary(Value cls, int size)
 {
-    Object* pObj = GC_NEW(Object);
+    Object* pObj = AllocBinaryObject(size);
     pObj->size = size;
     pObj->flags = 0;
     pObj->cls = cls;
-    if (size > 0)
-        pObj->pData = GC_MALLOC_ATOMIC(size);
     return PTR_V(pObj);
 }
 
@@ -150,14 +210,12 @@ Value   NewBinary(Value cls, int size)
 
 Value   NewBinary(Value cls, void* pData, int size)
 {
-    Object* pObj = GC_NEW(Object);
+    Object* pObj = AllocBinaryObject(size);
     pObj->size = size;
     pObj->flags = 0;
     pObj->cls = cls;
-    if (size > 0) {
-        pObj->pData = GC_MALLOC_ATOMIC(size);
+    if (size > 0)
         memcpy(pObj->pData, pData, size);
-    }
     return PTR_V(pObj);
 }
 
@@ -175,12 +233,12 @@ Value   NewArray(Value cls, int nSlots)
 {
     if (nSlots < 0 || nSlots > MAX_SLOTS)
         PROTO_THROW(g_exFr, E_BadArguments);
-    Object* pObj = GC_NEW(Object);
+    Object* pObj = AllocObject();
     pObj->size = nSlots;
     pObj->flags = HDR_SLOTTED;
     pObj->cls = cls;
     if (nSlots > 0) {
-        Value* pSlots = (Value*) GC_MALLOC(nSlots * sizeof(Value));
+        Value* pSlots = AllocSlots(nSlots);
         pObj->pSlots = pSlots;
         for (int i = 0; i < nSlots; i++)
             pSlots[i] = V_NIL;
@@ -199,13 +257,33 @@ Value   NewArray(int nSlots)
     return NewArray(PSYM(array), nSlots);
 }
 
+/** Allocates a new Array, with its slots copied from @c values.
+*/
+
+Value   NewArray(Value cls, int nSlots, const Value values[])
+{
+    Value array = NewArray(cls, nSlots);
+    if (nSlots > 0)
+        memcpy(UNSAFE_V_PTR(array)->pSlots, values, nSlots * sizeof(Value));
+    return array;
+}
+
 /** Gets the value from the @c index-th slot of @c array.
 */
 
 Value   GetSlot(Value array, int index)
 {
     Object* pObj = V_PTR(array);
-    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED)
+    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED) {
+        if (ObjIsTypedArray(pObj))
+            return GetTypedArrayElement(pObj, index);
+        PROTO_THROW(g_exType, E_NotAnArray);
+    }
+    if (pObj->cls == PSYM(frameTable))
+        return GetFrameTableRow(pObj, index);
+    if (pObj->cls == PSYM(view))
+        return GetViewSlot(pObj, index);
+    if (pObj->cls == PSYM(rope))
         PROTO_THROW(g_exType, E_NotAnArray);
     if (index < 0 || index >= (int) pObj->size)
         PROTO_THROW(g_exFr, E_OutOfBounds);
@@ -214,9 +292,29 @@ Value   GetSlot(Value array, int index)
 
 void*   GetData(Value binary)
 {
-    Object* pObj = V_PTR(binary);
+    Object* pObj = FlatObject(binary);
+    if (ObjIsView(pObj))
+        return GetViewData(pObj, true);
     if ((pObj->flags & HDR_SLOTTED))
         PROTO_THROW(g_exType, E_NotABinary);
+    if (pObj->flags & HDR_COMPACT)
+        WidenString(pObj);
+    Unshare(pObj);
+    return pObj->pData;
+}
+
+// A compact string is left alone, and its characters are widened into a
+// copy instead.
+
+const void* GetReadOnlyData(Value binary)
+{
+    Object* pObj = FlatObject(binary);
+    if (ObjIsView(pObj))
+        return GetViewData(pObj, false);
+    if ((pObj->flags & HDR_SLOTTED))
+        PROTO_THROW(g_exType, E_NotABinary);
+    if (pObj->flags & HDR_COMPACT)
+        return WideCopy(pObj);
     return pObj->pData;
 }
 
@@ -242,10 +340,26 @@ void    SetClassSlot(Value obj, Value cls)
 void    SetSlot(Value array, int index, Value newValue)
 {
     Object* pObj = V_PTR(array);
-    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED)
+    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED) {
+        if (ObjIsTypedArray(pObj)) {
+            SetTypedArrayElement(pObj, index, newValue);
+            return;
+        }
+        PROTO_THROW(g_exType, E_NotAnArray);
+    }
+    if (pObj->cls == PSYM(frameTable)) {
+        SetFrameTableRow(pObj, index, newValue);
+        return;
+    }
+    if (pObj->cls == PSYM(view)) {
+        SetViewSlot(pObj, index, newValue);
+        return;
+    }
+    if (pObj->cls == PSYM(rope))
         PROTO_THROW(g_exType, E_NotAnArray);
     if (index < 0 || index >= (int) pObj->size)
         PROTO_THROW(g_exFr, E_OutOfBounds);
+    Unshare(pObj);
     pObj->pSlots[index] = newValue;
 }
 
@@ -261,7 +375,8 @@ void    SetSlottedLength(Object* pObj, int nSlots)
     if (nSlots == oldSize)
         return;
 
-    Value* pSlots = (Value*) GC_REALLOC(pObj->pSlots, nSlots * sizeof(Value));
+    Unshare(pObj);
+    Value* pSlots = ReallocSlots(pObj->pSlots, nSlots);
     pObj->pSlots = pSlots;
     if (nSlots > oldSize) {
         for (int i = oldSize; i < nSlots; i++)
@@ -275,8 +390,9 @@ void    SetSlottedLength(Object* pObj, int nSlots)
 
 void    AddSlotValue(Object* pObj, Value newValue)
 {
+    Unshare(pObj);
     int nSlots = pObj->size + 1;
-    Value* pSlots = (Value*) GC_REALLOC(pObj->pSlots, nSlots * sizeof(Value));
+    Value* pSlots = ReallocSlots(pObj->pSlots, nSlots);
     pSlots[nSlots - 1] = newValue;
     pObj->size = nSlots;
     pObj->pSlots = pSlots;
@@ -285,58 +401,82 @@ void    AddSlotValue(Object* pObj, Value newValue)
 void    SetArrayLength(Value array, int nSlots)
 {
     Object* pObj = V_PTR(array);
-    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED)
+    if (!ObjIsArray(pObj) || ObjIsRope(pObj))
         PROTO_THROW(g_exType, E_NotAnArray);
-    SetSlottedLength(pObj, nSlots);
+    if (pObj->cls == PSYM(frameTable))
+        SetFrameTableLength(pObj, nSlots);
+    else if (pObj->cls == PSYM(view))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, array);     // Views can't grow
+    else
+        SetSlottedLength(pObj, nSlots);
 }
 
 void    AddArraySlot(Value array, Value newValue)
 {
     Object* pObj = V_PTR(array);
-    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED)
+    if (!ObjIsArray(pObj) || ObjIsRope(pObj))
         PROTO_THROW(g_exType, E_NotAnArray);
-    AddSlotValue(pObj, newValue);
+    if (pObj->cls == PSYM(frameTable))
+        AddFrameTableRow(pObj, newValue);
+    else if (pObj->cls == PSYM(view))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, array);     // Views can't grow
+    else
+        AddSlotValue(pObj, newValue);
 }
 
 Value*  GetArraySlots(Value array)
 {
     Object* pObj = V_PTR(array);
-    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED)
-        PROTO_THROW(g_exType, E_NotAnArray);
+    if (!ObjIsArray(pObj) || ObjIsRope(pObj) || ObjIsFrameTable(pObj))
+        PROTO_THROW(g_exType, E_NotAnArray);    // A frame table's rows aren't slots
+    if (pObj->cls == PSYM(view))
+        return GetViewSlots(pObj);
 
+    Unshare(pObj);
     return pObj->pSlots;
 }
 
 int     GetArrayLength(Value array)
 {
     Object* pObj = V_PTR(array);
-    if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != HDR_SLOTTED)
+    if (!ObjIsArray(pObj) || ObjIsRope(pObj))
         PROTO_THROW(g_exType, E_NotAnArray);
+    if (pObj->cls == PSYM(frameTable))
+        return FrameTableLength(pObj);
+    if (pObj->cls == PSYM(view))
+        return ViewLength(pObj);
 
     return pObj->size;
 }
 
 void    SetBinaryLength(Value binary, int size)
 {
-    Object* pObj = V_PTR(binary);
+    Object* pObj = FlatObject(binary);
     if ((pObj->flags & HDR_SLOTTED))
         PROTO_THROW(g_exType, E_NotABinary);
     if (size < 0 || size > MAX_DATA)
         PROTO_THROW(g_exFr, E_OutOfBounds);
 
+    if (pObj->flags & HDR_COMPACT)
+        WidenString(pObj);
     int oldSize = pObj->size;
     if (size == oldSize)
         return;
 
-    pObj->pData = GC_REALLOC(pObj->pData, size);
+    Unshare(pObj);
+    pObj->pData = ResizeBinaryData(pObj, size);
     pObj->size = size;
 }
 
 int     GetBinaryLength(Value binary)
 {
-    Object* pObj = V_PTR(binary);
+    Object* pObj = FlatObject(binary);
+    if (ObjIsView(pObj))
+        return GetViewDataSize(pObj);
     if ((pObj->flags & HDR_SLOTTED))
         PROTO_THROW(g_exType, E_NotABinary);
+    if (pObj->flags & HDR_COMPACT)
+        return pObj->size * sizeof(TCHAR);     // What it would be if it were wide
 
     return pObj->size;
 }
@@ -346,7 +486,10 @@ int     GetBinaryLength(Value binary)
 //----------------------------------------------------------------
 
 // Size where maps transition to hash tables -- this should be set on a per-platform
-// basis to the optimal point for performance. But at the moment it's 32, just because.
+// basis to the optimal point for performance. Sequential maps are searched with
+// a vectorized scan (see FindSeqMapTag), so they stay competitive with hashing
+// for longer than you'd think; BenchMapLookup in the test program measures
+// where the crossover is.
 
 const int HASH_MAP_MIN = 32;
 
@@ -384,15 +527,54 @@ Value   GetMapTag(Value map, int index)
         return V_NIL;
     }
     else {
-        if (index < (int) pMap->size - 1)
-            return pMapSlots->tags[index + 1];
+        int nTags = SeqMapNumTags(pMap);
+        if (index < nTags)
+            return pMapSlots->tags[index];
         else
-            return INT_V(pMap->size - 1);
+            return INT_V(nTags);
+    }
+}
+
+// The number of slots a map (and its supermaps) lays out in a frame. For a
+// hash map that's the size of its table(s), empty buckets and all.
+
+int     MapSlotCount(Object* pMap)
+{
+    int nSlots = 0;
+    for (;;) {
+        MapSlots* pMapSlots = (MapSlots*) pMap->pSlots;
+        if (UNSAFE_V_INT(pMap->cls) & HASH_MAP) {
+            nSlots += pMap->size - HashMapArraySize(0);
+            if (pMapSlots->hash.oldMap != V_NIL)
+                nSlots += UNSAFE_V_PTR(pMapSlots->hash.oldMap)->size - HashMapArraySize(0);
+        }
+        else {
+            nSlots += SeqMapNumTags(pMap);
+        }
+
+        if (pMapSlots->supermap == V_NIL)
+            return nSlots;
+        pMap = V_PTR(pMapSlots->supermap);
+    }
+}
+
+Value   FrameSlotTag(Object* pMap, int offset)
+{
+    MapSlots* pMapSlots = (MapSlots*) pMap->pSlots;
+    if (pMapSlots->supermap != V_NIL) {
+        // The supermaps' slots come first
+        Object* pSupermap = V_PTR(pMapSlots->supermap);
+        int nSuperSlots = MapSlotCount(pSupermap);
+        if (offset < nSuperSlots)
+            return FrameSlotTag(pSupermap, offset);
+        offset -= nSuperSlots;
     }
+    return OwnTagAtOffset(pMap, offset);
 }
 
 // Does a hash search on a hashed frame map. Finds the slot where the tag is,
-// or else (optionally) finds the slot where the tag should be added.
+// or else (optionally) finds the slot where the tag should be added, which
+// is the first tombstone on its probe path if there is one.
 // Returns true iff the tag was found.
 //
 // Table size must be a power of two. Uses double hashing.
@@ -409,14 +591,15 @@ bool    FindHashMapTag(int tableSize, MapSlots* pMapSlots, Value tag,
     int bucket = hash & sizeMask;
     // incr is the double-hashing increment. Or-ing with 1 ensures
     // it is relatively prime to the tableSize (which is a power of two).
-    int incr = ((hash * 13) & sizeMask) | 1;
+    int incr = (int) (((UInt32) hash * 13) & sizeMask) | 1;
     int freeSlot = -1;
     bool found;
 
     for (;;) {
         Value candidate = pMapSlots->hash.table[bucket];
         if (candidate == V_NIL) {
-            freeSlot = bucket;
+            if (freeSlot < 0)
+                freeSlot = bucket;
             found = false;
             break;
         }
@@ -424,7 +607,7 @@ bool    FindHashMapTag(int tableSize, MapSlots* pMapSlots, Value tag,
             found = true;
             break;
         }
-        else if (candidate == INT_V(0)) {
+        else if (candidate == INT_V(0) && freeSlot < 0) {
             freeSlot = bucket;
         }
 
@@ -438,21 +621,131 @@ bool    FindHashMapTag(int tableSize, MapSlots* pMapSlots, Value tag,
     return found;
 }
 
+// Hash maps are resized incrementally, so that adding or removing one slot
+// never means rehashing a big frame all at once. The new map hangs on to
+// the old one (in hash.oldMap) until all of its buckets have been moved
+// across, REHASH_STEP at a time, by AddSlot and RemoveSlot. Meanwhile the
+// frame data is the new table's slots followed by the old table's, and a
+// lookup that misses in the new table tries the old one.
+//
+// Migrated buckets are turned into tombstones in the old table, so a tag
+// is only ever found in one place.
+
+const int REHASH_STEP = 64;
+
+int     g_rehashCount;      // Number of times a frame has been rehashed
+
+// Moves up to nBuckets more of the old table's buckets into the new one,
+// and finishes the rehash if that was the last of them.
+
+void    MigrateBuckets(Object* pFrame, int nBuckets)
+{
+    Object* pMap = UNSAFE_V_PTR(pFrame->map);
+    MapSlots* pMapSlots = (MapSlots*) pMap->pSlots;
+    Object* pOldMap = V_PTR(pMapSlots->hash.oldMap);
+    MapSlots* pOldSlots = (MapSlots*) pOldMap->pSlots;
+
+    int tableSize = pMap->size - HashMapArraySize(0);
+    int oldSize = pOldMap->size - HashMapArraySize(0);
+    Value* oldData = pFrame->pSlots + tableSize;
+
+    int i = UNSAFE_V_INT(pMapSlots->hash.nMigrated);
+    int end = (nBuckets < oldSize - i) ? i + nBuckets : oldSize;
+    for (; i < end; i++) {
+        Value tag = pOldSlots->hash.table[i];
+        if (tag != V_NIL && tag != INT_V(0)) {
+            int slot;
+            int freeSlot;
+            bool found = FindHashMapTag(tableSize, pMapSlots, tag, &slot, &freeSlot);
+            ASSERT(!found);
+
+            if (pMapSlots->hash.table[freeSlot] == INT_V(0))
+                pMapSlots->hash.nDeleted = INT_V(UNSAFE_V_INT(pMapSlots->hash.nDeleted) - 1);
+            pMapSlots->hash.table[freeSlot] = tag;
+            pFrame->pSlots[freeSlot] = oldData[i];
+            pOldSlots->hash.table[i] = INT_V(0);
+        }
+        oldData[i] = V_NIL;
+    }
+
+    if (i < oldSize) {
+        pMapSlots->hash.nMigrated = INT_V(i);
+    }
+    else {
+        pMapSlots->hash.oldMap = V_NIL;
+        pMapSlots->hash.nMigrated = V_NIL;
+        pFrame->size = tableSize;
+        pFrame->pSlots = ReallocSlots(pFrame->pSlots, tableSize);
+    }
+}
+
+// Finishes any rehash that's under way on the frame.
+
+inline void FinishRehash(Object* pFrame)
+{
+    Object* pMap = UNSAFE_V_PTR(pFrame->map);
+    if ((UNSAFE_V_INT(pMap->cls) & HASH_MAP) && ((MapSlots*) pMap->pSlots)->hash.oldMap != V_NIL)
+        MigrateBuckets(pFrame, MAX_SLOTS);
+}
+
+// Starts an incremental rehash of a hash-mapped frame into a new table.
+
+void    StartRehash(Object* pFrame, int newSize)
+{
+    FinishRehash(pFrame);
+
+    Object* pOldMap = UNSAFE_V_PTR(pFrame->map);
+    MapSlots* oldSlots = (MapSlots*) pOldMap->pSlots;
+    int oldSize = pFrame->size;
+    int flags = UNSAFE_V_INT(pOldMap->cls);
+
+    Value newMap = NewArray(HASH_MAP_CLASS, HashMapArraySize(newSize));
+    MapSlots* newSlots = (MapSlots*) UNSAFE_V_PTR(newMap)->pSlots;
+    newSlots->hash.nOccupied = oldSlots->hash.nOccupied;
+    newSlots->hash.nDeleted = INT_V(0);
+    newSlots->hash.oldMap = pFrame->map;
+    newSlots->hash.nMigrated = INT_V(0);
+
+    // The old map's filter still covers all the tags
+    UNSAFE_V_PTR(newMap)->cls = INT_V(HASH_MAP | (flags & (BLOOM_MAP | MAP_BLOOM_MASK)));
+
+    Value* newData = AllocSlots(newSize + oldSize);
+    for (int i = 0; i < newSize; i++)
+        newData[i] = V_NIL;
+    memcpy(newData + newSize, pFrame->pSlots, oldSize * sizeof(Value));
+
+    pFrame->map = newMap;
+    pFrame->size = newSize + oldSize;
+    pFrame->pSlots = newData;
+
+    MigrateBuckets(pFrame, REHASH_STEP);
+}
+
 // Create a new hash map for the frame and rehash the existing map into it,
 // resizing and rearranging the frame slots to correspond. The existing map
-// may be hashed or sequential.
+// may be hashed or sequential. Hash maps without supermaps (which is all
+// of them in practice) are rehashed incrementally; see StartRehash.
 //
 // newSize must be a power of two.
 
 void    RehashFrame(Object* pFrame, int newSize)
 {
+    g_rehashCount++;
+
+    Object* pCurMap = UNSAFE_V_PTR(pFrame->map);
+    if ((UNSAFE_V_INT(pCurMap->cls) & HASH_MAP) && ((MapSlots*) pCurMap->pSlots)->supermap == V_NIL) {
+        StartRehash(pFrame, newSize);
+        return;
+    }
+
     // Get our bearings
 
+    FinishRehash(pFrame);
     int oldSize = pFrame->size;
 
     Value newMap = NewArray(HASH_MAP_CLASS, HashMapArraySize(newSize));
     MapSlots* newSlots = (MapSlots*) UNSAFE_V_PTR(newMap)->pSlots;
-    Value* newData = (Value*) GC_MALLOC(newSize * sizeof(Value));
+    Value* newData = AllocSlots(newSize);
 
     MapSlots* oldSlots = (MapSlots*) UNSAFE_V_PTR(pFrame->map)->pSlots;
     Value* oldData = pFrame->pSlots;
@@ -470,8 +763,10 @@ void    RehashFrame(Object* pFrame, int newSize)
         oldTags = oldSlots->tags;
     }
 
-    // Copy old tags and slots to the proper places in the new map & data
+    // Copy old tags and slots to the proper places in the new map & data,
+    // and build the new map's filter as we go
 
+    int bloom = 0;
     for (int i = 0; i < oldSize; i++) {
         Value tag = oldTags[i];
 
@@ -483,6 +778,7 @@ void    RehashFrame(Object* pFrame, int newSize)
 
             newSlots->hash.table[iFreeSlot] = tag;
             newData[iFreeSlot] = oldData[i];
+            bloom |= TagBloomBits(tag);
         }
     }
 
@@ -494,6 +790,8 @@ void    RehashFrame(Object* pFrame, int newSize)
     }
 
     newSlots->hash.nOccupied = INT_V(nOccupied);
+    newSlots->hash.nDeleted = INT_V(0);
+    UNSAFE_V_PTR(newMap)->cls = INT_V(HASH_MAP | BLOOM_MAP | bloom);
 
     // Set frame to point to new stuff
 
@@ -513,9 +811,88 @@ EXPORT  Value   NewMapWithTags(Value tagArray)
     return map;
 }
 
+// Maps smaller than this aren't worth sorting when they're frozen;
+// the tag scan is faster.
+
+const int SORTED_MAP_MIN = 16;
+
+struct TagOrder {
+    Value   tag;
+    int     index;
+};
+
+inline bool TagOrderLess(const TagOrder& a, const TagOrder& b)
+{
+    return (size_t) a.tag < (size_t) b.tag;
+}
+
+// Freezes a map whose shape isn't going to change, such as a literal map
+// or one read from a stream. It's marked shared, so the first frame to add
+// or remove a slot gets its own copy, and if it's big enough it's sorted
+// (see SeqMapNumTags) so FindOffset can use a binary search.
+// Returns the map.
+
+Value   FreezeMap(Value map)
+{
+    Object* pMap = V_PTR(map);
+    int flags = V_INT(pMap->cls);
+
+    if (!(flags & (HASH_MAP | SORTED_MAP))) {
+        int nTags = pMap->size - SeqMapArraySize(0);
+        if (nTags >= SORTED_MAP_MIN) {
+            TagOrder* order = (TagOrder*) GC_MALLOC_ATOMIC(nTags * sizeof(TagOrder));
+            Value* tags = ((MapSlots*) pMap->pSlots)->tags;
+            for (int i = 0; i < nTags; i++) {
+                order[i].tag = tags[i];
+                order[i].index = i;
+            }
+            std::sort(order, order + nTags, TagOrderLess);
+
+            SetSlottedLength(pMap, SeqMapArraySize(nTags) + nTags);
+            tags = ((MapSlots*) pMap->pSlots)->tags;
+            for (int i = 0; i < nTags; i++)
+                tags[nTags + i] = INT_V(order[i].index);
+
+            GC_FREE(order);
+            flags |= SORTED_MAP;
+        }
+    }
+
+    pMap->cls = INT_V(flags | SHARED_MAP);
+    return map;
+}
+
+// Turns a sorted map back into a plain sequential map.
+
+void    ThawMap(Object* pMap)
+{
+    int flags = UNSAFE_V_INT(pMap->cls);
+    if (flags & SORTED_MAP) {
+        SetSlottedLength(pMap, SeqMapArraySize(SeqMapNumTags(pMap)));
+        pMap->cls = INT_V(flags & ~SORTED_MAP);
+    }
+}
+
+// Gives a frame its own copy of its map, if the map is shared, so the map
+// can be changed. The copy is never frozen.
+
+void    UnshareMap(Object* pFrame)
+{
+    Object* pMap = UNSAFE_V_PTR(pFrame->map);
+    int flags = UNSAFE_V_INT(pMap->cls);
+    if (flags & SHARED_MAP) {
+        Value newMap = Clone(pFrame->map);
+        pMap = UNSAFE_V_PTR(newMap);
+        Unshare(pMap);      // The map code writes the tags directly
+        pMap->cls = INT_V(flags & ~SHARED_MAP);
+        ThawMap(pMap);
+        pFrame->map = newMap;
+    }
+}
+
 Value   NewFrame(void)
 {
-    Object* pObj = GC_NEW(Object);
+    Object* pObj = AllocObject();
     pObj->size = 0;
     pObj->flags = HDR_SLOTTED | HDR_FRAME;
     pObj->map = NewMap(V_NIL);
@@ -532,15 +909,15 @@ EXPORT  Value   NewFrameWithMap(Value map)
     if (flags & HASH_MAP)
         nSlots = pMap->size - HashMapArraySize(0);
     else
-        nSlots = pMap->size - SeqMapArraySize(0);
+        nSlots = SeqMapNumTags(pMap);
 
-    Object* pObj = GC_NEW(Object);
+    Object* pObj = AllocObject();
     pObj->size = nSlots;
     pObj->flags = HDR_SLOTTED | HDR_FRAME;
     pObj->map = map;
 
     if (nSlots > 0) {
-        Value* pSlots = (Value*) GC_MALLOC(nSlots * sizeof(Value));
+        Value* pSlots = AllocSlots(nSlots);
         pObj->pSlots = pSlots;
         for (int i = 0; i < nSlots; i++)
             pSlots[i] = V_NIL;
@@ -552,53 +929,361 @@ EXPORT  Value   NewFrameWithMap(Value map)
     return PTR_V(pObj);
 }
 
+// Finds tag in a sequential map's tag array. Returns its index, or -1.
+//
+// Symbols are unique (that's what interning is for) and are never forwarded
+// (see ReplaceObject), so tags can be compared as plain words instead of
+// with V_EQ, several at a time where the hardware allows.
+
+int     FindSeqMapTag(const Value* tags, int nTags, Value tag)
+{
+    int i = 0;
+
+#if PROTO_64BIT
+
+#if HAVE_AVX2
+    __m256i key4 = _mm256_set1_epi64x((long long) tag);
+    for (; i + 4 <= nTags; i += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*) (tags + i)), key4);
+        UInt32 mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (mask != 0)
+            return i + LowestBitIndex(mask);
+    }
+#endif
+
+#if HAVE_SSE2
+    // SSE2 has no 64-bit compare, so both halves of a Value have to match
+    __m128i key2 = _mm_set1_epi64x((long long) tag);
+    for (; i + 2 <= nTags; i += 2) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (tags + i)), key2);
+        UInt32 mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        mask &= (mask >> 1) & 0x5;
+        if (mask != 0)
+            return i + LowestBitIndex(mask) / 2;
+    }
+#endif
+
+#else
+
+#if HAVE_AVX2
+    __m256i key8 = _mm256_set1_epi32((int) tag);
+    for (; i + 8 <= nTags; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*) (tags + i)), key8);
+        UInt32 mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (mask != 0)
+            return i + LowestBitIndex(mask);
+    }
+#endif
+
+#if HAVE_SSE2
+    __m128i key4 = _mm_set1_epi32((int) tag);
+    for (; i + 4 <= nTags; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (tags + i)), key4);
+        UInt32 mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask != 0)
+            return i + LowestBitIndex(mask);
+    }
+#endif
+
+#endif
+
+    for (; i < nTags; i++) {
+        if (tags[i] == tag)
+            return i;
+    }
+
+    return -1;
+}
+
+// Finds tag in a sorted map by binary search on its index array.
+// Returns the tag's index, or -1.
+
+int     FindSortedMapTag(const Value* tags, int nTags, Value tag)
+{
+    const Value* order = tags + nTags;
+    int lo = 0;
+    int hi = nTags;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if ((size_t) tags[UNSAFE_V_INT(order[mid])] < (size_t) tag)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < nTags) {
+        int index = UNSAFE_V_INT(order[lo]);
+        if (tags[index] == tag)
+            return index;
+    }
+
+    return -1;
+}
+
+// Computes the filter of a map (see TagBloomBits) from its tags and its
+// supermaps' tags, and stores it in the map. Returns the new map flags.
+
+int     ComputeMapBloom(Object* pMap)
+{
+    int bloom = 0;
+    for (Object* pM = pMap; ; ) {
+        MapSlots* pMapSlots = (MapSlots*) pM->pSlots;
+        int flags = UNSAFE_V_INT(pM->cls);
+        if (flags & HASH_MAP) {
+            for (Object* pTable = pM; ; pTable = UNSAFE_V_PTR(pMapSlots->hash.oldMap)) {
+                MapSlots* pTableSlots = (MapSlots*) pTable->pSlots;
+                int tableSize = pTable->size - HashMapArraySize(0);
+                for (int i = 0; i < tableSize; i++) {
+                    Value tag = pTableSlots->hash.table[i];
+                    if (tag != V_NIL && tag != INT_V(0))
+                        bloom |= TagBloomBits(tag);
+                }
+                if (pTable != pM || pMapSlots->hash.oldMap == V_NIL)
+                    break;
+            }
+        }
+        else {
+            int nSlots = SeqMapNumTags(pM);
+            for (int i = 0; i < nSlots; i++)
+                bloom |= TagBloomBits(pMapSlots->tags[i]);
+        }
+
+        if (pMapSlots->supermap == V_NIL)
+            break;
+        pM = V_PTR(pMapSlots->supermap);
+    }
+
+    int flags = (UNSAFE_V_INT(pMap->cls) & ~MAP_BLOOM_MASK) | BLOOM_MAP | bloom;
+    pMap->cls = INT_V(flags);
+    return flags;
+}
+
+// Supermap chains deeper than this (which never happen in practice)
+// take the slow path in FindOffset.
+
+const int MAX_FLAT_SUPERMAPS = 16;
+
 // Find the slot index corresponding to tag, counting supermap slots.
-// (Jeff Piazza memorial recursive version)
 //
-// If tag is in map, returns a positive number which is the offset of
+// If tag is in map, returns a nonnegative number which is the offset of
 // tag in map plus the length of the supermaps -- that is, the offset
 // in the data of the slot corresponding to the tag.
 //
-// If not, returns a negative number -(S+1) where S is the size of
-// the map plus supermaps.
+// If not, returns a negative number. That's -(S+1), where S is the size
+// of the map plus supermaps, unless the map's filter rules the tag out
+// without a search, in which case it's just -1.
 //
-// I'm sure there's a less clever way to do this but it's a fond memory
-// from the original code.
+// Supermap slots come first in the data, so the chain is searched from the
+// outermost supermap in. (This used to be the Jeff Piazza memorial recursive
+// version, but the flat loop is friendlier to the tag scan.)
 
 int     FindOffset(Value map, Value tag)
 {
-    Object* pMap = V_PTR(map);
-    MapSlots* pMapSlots = (MapSlots*) (pMap->pSlots);
+    Object* pTopMap = V_PTR(map);
+    int topFlags = UNSAFE_V_INT(pTopMap->cls);
+    if (!(topFlags & BLOOM_MAP))
+        topFlags = ComputeMapBloom(pTopMap);
+    int tagBits = TagBloomBits(tag);
+    if ((topFlags & tagBits) != tagBits)
+        return -1;
+
+    Object* maps[MAX_FLAT_SUPERMAPS];
+    int nMaps = 0;
+
+    for (Value m = map; m != V_NIL; m = ((MapSlots*) maps[nMaps - 1]->pSlots)->supermap) {
+        if (nMaps == MAX_FLAT_SUPERMAPS)
+            break;
+        maps[nMaps++] = V_PTR(m);
+    }
 
-    int nPrevSlots;
+    // Slow path for absurdly deep chains: find each map by walking down from the top.
+    int depth = nMaps;
+    if (nMaps == MAX_FLAT_SUPERMAPS) {
+        depth = 0;
+        for (Value m = map; m != V_NIL; m = ((MapSlots*) V_PTR(m)->pSlots)->supermap)
+            depth++;
+    }
 
-    if (pMapSlots->supermap == V_NIL)
-        nPrevSlots = 0;
-    else {
-        int index = FindOffset(pMapSlots->supermap, tag);
-        if (index > 0)
-            return index;
-        else
-            nPrevSlots = - index - 1;
+    int nPrevSlots = 0;
+
+    for (int level = depth - 1; level >= 0; level--) {
+        Object* pMap;
+        if (level < nMaps)
+            pMap = maps[level];
+        else {
+            Value m = map;
+            for (int i = 0; i < level; i++)
+                m = ((MapSlots*) V_PTR(m)->pSlots)->supermap;
+            pMap = V_PTR(m);
+        }
+
+        MapSlots* pMapSlots = (MapSlots*) (pMap->pSlots);
+
+        int flags = UNSAFE_V_INT(pMap->cls);
+        if (flags & HASH_MAP) {
+            int tableSize = pMap->size - HashMapArraySize(0);
+            int slot;
+            if (FindHashMapTag(tableSize, pMapSlots, tag, &slot))
+                return slot + nPrevSlots;
+            nPrevSlots += tableSize;
+
+            // Slots that haven't been rehashed yet are after the new ones
+            if (pMapSlots->hash.oldMap != V_NIL) {
+                Object* pOldMap = UNSAFE_V_PTR(pMapSlots->hash.oldMap);
+                int oldSize = pOldMap->size - HashMapArraySize(0);
+                if (FindHashMapTag(oldSize, (MapSlots*) pOldMap->pSlots, tag, &slot))
+                    return slot + nPrevSlots;
+                nPrevSlots += oldSize;
+            }
+        }
+        else if (flags & SORTED_MAP) {
+            int nSlots = SeqMapNumTags(pMap);
+            int index = FindSortedMapTag(pMapSlots->tags, nSlots, tag);
+            if (index >= 0)
+                return index + nPrevSlots;
+            nPrevSlots += nSlots;
+        }
+        else {
+            int nSlots = pMap->size - SeqMapArraySize(0);
+            int index = FindSeqMapTag(pMapSlots->tags, nSlots, tag);
+            if (index >= 0)
+                return index + nPrevSlots;
+            nPrevSlots += nSlots;
+        }
     }
 
-    int flags = UNSAFE_V_INT(pMap->cls);
-    if (flags & HASH_MAP) {
-        int tableSize = pMap->size - HashMapArraySize(0);
+    return - (nPrevSlots + 1);
+}
+
+//----------------------------------------------------------------
+// Building frames all at once
+//----------------------------------------------------------------
+
+// Adding slots to a frame one at a time searches the map and grows the
+// map and slots each time (and converts the map to a hash map partway),
+// so building an N-slot frame that way takes O(N^2). NewFrameWithSlots
+// makes the map and the slots once, hashed or not depending on N. The map
+// is frozen and cached by its list of tags, so frames built with the same
+// tags (records read from a stream, say) share a map.
+//
+// The cache is direct-mapped. An entry is an array of the map, an array
+// of where each tag's slot is (which is only interesting for hash maps and
+// repeated tags), and the tags.
+
+const int MAP_CACHE_SIZE = 256;
+
+enum {
+    MCE_MAP,
+    MCE_OFFSETS,
+    MCE_TAGS
+};
+
+Value   g_mapCache;
+
+int     TagListHash(int nTags, const Value tags[])
+{
+    UInt32 h = (UInt32) nTags;
+    for (int i = 0; i < nTags; i++)
+        h = (h ^ (UInt32) ((size_t) tags[i] >> 4)) * 0x9E3779B1u;
+    return (int) (h >> 16) % MAP_CACHE_SIZE;
+}
+
+// Makes a frozen map for the tags, and fills in offsets.
+
+Value   MakeMapForTags(int nTags, const Value tags[], Value* offsets)
+{
+    for (int i = 0; i < nTags; i++) {
+        if (!IsSymbol(tags[i]))
+            PROTO_THROW_ERR(g_exType, E_NotASymbol, tags[i]);
+    }
+
+    if (nTags < HASH_MAP_MIN) {
+        Value map = NewArray(SEQUENTIAL_MAP_CLASS, SeqMapArraySize(nTags));
+        Value* mapTags = ((MapSlots*) UNSAFE_V_PTR(map)->pSlots)->tags;
+        int nUnique = 0;
+        for (int i = 0; i < nTags; i++) {
+            int index = FindSeqMapTag(mapTags, nUnique, tags[i]);
+            if (index < 0) {
+                index = nUnique++;
+                mapTags[index] = tags[i];
+            }
+            offsets[i] = INT_V(index);
+        }
+        if (nUnique < nTags)
+            SetSlottedLength(UNSAFE_V_PTR(map), SeqMapArraySize(nUnique));
+        return FreezeMap(map);
+    }
+
+    // Big enough that AddSlot won't have to rehash right away
+    int tableSize = HASH_MAP_MIN;
+    while (nTags > tableSize / 2 + tableSize / 4)
+        tableSize *= 2;
+
+    Value map = NewArray(HASH_MAP_CLASS, HashMapArraySize(tableSize));
+    MapSlots* pMapSlots = (MapSlots*) UNSAFE_V_PTR(map)->pSlots;
+    int nUnique = 0;
+    int bloom = 0;
+    for (int i = 0; i < nTags; i++) {
         int slot;
-        if (FindHashMapTag(tableSize, pMapSlots, tag, &slot))
-            return slot + nPrevSlots;
-        else
-            return - (nPrevSlots + tableSize + 1);
+        int freeSlot;
+        if (!FindHashMapTag(tableSize, pMapSlots, tags[i], &slot, &freeSlot)) {
+            pMapSlots->hash.table[freeSlot] = tags[i];
+            slot = freeSlot;
+            nUnique++;
+            bloom |= TagBloomBits(tags[i]);
+        }
+        offsets[i] = INT_V(slot);
     }
-    else {
-        int nSlots = pMap->size - SeqMapArraySize(0);
-        for (int i = 0; i < nSlots; i++) {
-            if (V_EQ(tag, pMapSlots->tags[i]))
-                return i + nPrevSlots;
+    pMapSlots->hash.nOccupied = INT_V(nUnique);
+    pMapSlots->hash.nDeleted = INT_V(0);
+    UNSAFE_V_PTR(map)->cls = INT_V(HASH_MAP | BLOOM_MAP | SHARED_MAP | bloom);
+    return map;
+}
+
+Value   MapForTags(int nTags, const Value tags[], Value* pOffsets)
+{
+    if (g_mapCache == 0)
+        g_mapCache = NewArray(MAP_CACHE_SIZE);
+
+    int hash = TagListHash(nTags, tags);
+    Value entry = UNSAFE_V_PTR(g_mapCache)->pSlots[hash];
+    if (entry != V_NIL) {
+        Object* pEntry = UNSAFE_V_PTR(entry);
+        if ((int) pEntry->size == MCE_TAGS + nTags &&
+            memcmp(pEntry->pSlots + MCE_TAGS, tags, nTags * sizeof(Value)) == 0) {
+            *pOffsets = pEntry->pSlots[MCE_OFFSETS];
+            return pEntry->pSlots[MCE_MAP];
         }
-        return - (nPrevSlots + nSlots + 1);
     }
+
+    Value offsets = NewArray(nTags);
+    Value map = MakeMapForTags(nTags, tags, UNSAFE_V_PTR(offsets)->pSlots);
+
+    entry = NewArray(MCE_TAGS + nTags);
+    Value* pEntrySlots = UNSAFE_V_PTR(entry)->pSlots;
+    pEntrySlots[MCE_MAP] = map;
+    pEntrySlots[MCE_OFFSETS] = offsets;
+    memcpy(pEntrySlots + MCE_TAGS, tags, nTags * sizeof(Value));
+    UNSAFE_V_PTR(g_mapCache)->pSlots[hash] = entry;
+
+    *pOffsets = offsets;
+    return map;
+}
+
+// A repeated tag gets the last of its values.
+
+Value   NewFrameWithSlots(int nSlots, const Value tags[], const Value values[])
+{
+    if (nSlots <= 0)
+        return NewFrame();
+
+    Value offsets;
+    Value frame = NewFrameWithMap(MapForTags(nSlots, tags, &offsets));
+    Value* pSlots = UNSAFE_V_PTR(frame)->pSlots;
+    const Value* pOffsets = UNSAFE_V_PTR(offsets)->pSlots;
+    for (int i = 0; i < nSlots; i++)
+        pSlots[UNSAFE_V_INT(pOffsets[i])] = values[i];
+    return frame;
 }
 
 bool    HasSlot(Value frame, Value tag)
@@ -650,36 +1335,66 @@ int     RemoveSlotInner(Value map, Value tag, Object* pObj)
     int flags = UNSAFE_V_INT(pMap->cls);
     if (flags & HASH_MAP) {
         int tableSize = pMap->size - HashMapArraySize(0);
+        int dataSize = tableSize;
+        MapSlots* pFoundSlots = pMapSlots;
         int slot;
-        if (FindHashMapTag(tableSize, pMapSlots, tag, &slot)) {
-            pMapSlots->hash.table[slot] = INT_V(0);
-            pObj->pSlots[slot + nPrevSlots] = V_NIL;
+        bool found = FindHashMapTag(tableSize, pMapSlots, tag, &slot);
+        int index = slot;
+
+        // The tag may not have been rehashed yet (see RehashFrame)
+        bool rehashing = (pMapSlots->hash.oldMap != V_NIL);
+        if (rehashing) {
+            Object* pOldMap = UNSAFE_V_PTR(pMapSlots->hash.oldMap);
+            dataSize += pOldMap->size - HashMapArraySize(0);
+            if (!found) {
+                pFoundSlots = (MapSlots*) pOldMap->pSlots;
+                found = FindHashMapTag(dataSize - tableSize, pFoundSlots, tag, &slot);
+                index = tableSize + slot;
+            }
+        }
+
+        if (found) {
+            pFoundSlots->hash.table[slot] = INT_V(0);
+            pObj->pSlots[index + nPrevSlots] = V_NIL;
+            if (pFoundSlots == pMapSlots)
+                pMapSlots->hash.nDeleted = INT_V(UNSAFE_V_INT(pMapSlots->hash.nDeleted) + 1);
 
             int nOccupied = UNSAFE_V_INT(pMapSlots->hash.nOccupied);
             pMapSlots->hash.nOccupied = INT_V(nOccupied - 1);
 
-            // Shrink the hash table if enough data has been removed,
-            // but don't let it get smaller than HASH_MAP_MIN.
+            // Keep any rehash moving. Otherwise, shrink the hash table if
+            // it's gotten sparse enough, but don't let it get smaller than
+            // HASH_MAP_MIN. Shrinking at 1/8 full rather than 1/4 leaves
+            // the halved table well short of AddSlot's 3/4 threshold, so
+            // adding and removing around the boundary doesn't thrash.
 
-            if (tableSize > HASH_MAP_MIN && nOccupied < tableSize / 4)
+            if (rehashing)
+                MigrateBuckets(pObj, REHASH_STEP);
+            else if (tableSize > HASH_MAP_MIN && nOccupied < tableSize / 8)
                 RehashFrame(pObj, tableSize / 2);
 
-            return slot + nPrevSlots;
+            return index + nPrevSlots;
         }
         else {
-            return - (nPrevSlots + tableSize + 1);
+            return - (nPrevSlots + dataSize + 1);
         }
     }
     else {
-        int nSlots = pMap->size - 1;
+        // A frozen supermap has to be thawed before it can change
+        if (flags & SORTED_MAP) {
+            ThawMap(pMap);
+            pMapSlots = (MapSlots*) pMap->pSlots;
+        }
+
+        int nSlots = pMap->size - SeqMapArraySize(0);
         for (int i = 0; i < nSlots; i++) {
             if (V_EQ(tag, pMapSlots->tags[i])) {
                 // Slide everything below this slot up (in this map and in the data).
                 // We don't reallocate the map or values, so the object still takes
                 // up the same amount of space. This doesn't seem worth worrying about,
                 // unless we have a lot of small frames with slot removal happening.
-                memcpy(pMapSlots->tags + i, pMapSlots->tags + i + 1, sizeof(Value) * (nSlots - i - 1));
-                memcpy(pObj->pSlots + i + nPrevSlots, pObj->pSlots + i + 1 + nPrevSlots,
+                memmove(pMapSlots->tags + i, pMapSlots->tags + i + 1, sizeof(Value) * (nSlots - i - 1));
+                memmove(pObj->pSlots + i + nPrevSlots, pObj->pSlots + i + 1 + nPrevSlots,
                        sizeof(Value) * (pObj->size - i - nPrevSlots - 1));
                 pObj->size--;
                 pMap->size--;
@@ -696,8 +1411,22 @@ void    RemoveSlot(Value frame, Value tag)
     if ((pObj->flags & (HDR_SLOTTED | HDR_FRAME)) != (HDR_SLOTTED | HDR_FRAME))
         PROTO_THROW(g_exType, E_NotAFrame);
 
+    // Don't copy a shared map just to find out there's nothing to remove
+    if (UNSAFE_V_INT(UNSAFE_V_PTR(pObj->map)->cls) & SHARED_MAP) {
+        if (FindOffset(pObj->map, tag) < 0)
+            return;
+        UnshareMap(pObj);
+    }
+
     RemoveSlotInner(pObj->map, tag, pObj);
 
+    // The filter can't forget a tag, so it has to be recomputed (which
+    // happens on the next lookup). Rehashing may already have done that.
+    Object* pMap = UNSAFE_V_PTR(pObj->map);
+    int flags = UNSAFE_V_INT(pMap->cls);
+    if (!(flags & HASH_MAP))
+        pMap->cls = INT_V(flags & ~(BLOOM_MAP | MAP_BLOOM_MASK));
+
 #ifdef _DEBUG
     CheckFrame(frame);
 #endif
@@ -729,21 +1458,50 @@ void    CheckFrame(Value frame)
         MapSlots* pMapSlots = (MapSlots*) pMap->pSlots;
         int nSlots = pMap->size - HashMapArraySize(0);
         int nOccupied = UNSAFE_V_INT(pMapSlots->hash.nOccupied);
+        int nDeleted = UNSAFE_V_INT(pMapSlots->hash.nDeleted);
         for (int i = 0; i < nSlots; i++) {
             if (pMapSlots->hash.table[i] == V_NIL || pMapSlots->hash.table[i] == INT_V(0)) {
                 ASSERT(pFrame->pSlots[i] == V_NIL);
+                if (pMapSlots->hash.table[i] == INT_V(0))
+                    nDeleted--;
             }
             else {
                 nOccupied--;
             }
         }
-        ASSERT(nOccupied == 0);
+        if (pMapSlots->hash.oldMap != V_NIL) {
+            Object* pOldMap = V_PTR(pMapSlots->hash.oldMap);
+            MapSlots* pOldSlots = (MapSlots*) pOldMap->pSlots;
+            int oldSize = pOldMap->size - HashMapArraySize(0);
+            int nMigrated = V_INT(pMapSlots->hash.nMigrated);
+            ASSERT(pFrame->size == nSlots + oldSize);
+            for (int i = 0; i < oldSize; i++) {
+                Value tag = pOldSlots->hash.table[i];
+                if (tag == V_NIL || tag == INT_V(0)) {
+                    ASSERT(pFrame->pSlots[nSlots + i] == V_NIL);
+                }
+                else {
+                    ASSERT(i >= nMigrated);
+                    nOccupied--;
+                }
+            }
+        }
+        ASSERT(nOccupied == 0 && nDeleted == 0);
     }
     else {
-        ASSERT(pFrame->size == pMap->size - SeqMapArraySize(0));
+        ASSERT(pFrame->size == SeqMapNumTags(pMap));
     }
 }
 
+// Keeps a map's filter up to date when a tag is added to it.
+
+inline void AddTagToBloom(Object* pMap, Value tag)
+{
+    int flags = UNSAFE_V_INT(pMap->cls);
+    if (flags & BLOOM_MAP)
+        pMap->cls = INT_V(flags | TagBloomBits(tag));
+}
+
 // Adds a slot to a frame, converting to hashed frame if needed.
 // Returns the index of the new slot in the frame data.
 
@@ -755,20 +1513,27 @@ int     AddSlot(Object* pFrame, Value tag)
     int flags = UNSAFE_V_INT(pMap->cls);
 
     if (flags & SHARED_MAP) {
-        Value newMap = Clone(pFrame->map);
-        pFrame->map = newMap;
-        pMap = UNSAFE_V_PTR(newMap);
-        pMap->cls = INT_V(UNSAFE_V_INT(pMap->cls) & ~SHARED_MAP);
+        UnshareMap(pFrame);
+        pMap = UNSAFE_V_PTR(pFrame->map);
         pMapSlots = (MapSlots*) pMap->pSlots;
     }
 
     if (flags & HASH_MAP) {
         int tableSize = pMap->size - HashMapArraySize(0);
 
-        // Enlarge table if more than 3/4 full
+        // Keep any rehash moving (see RehashFrame)
+
+        if (pMapSlots->hash.oldMap != V_NIL)
+            MigrateBuckets(pFrame, REHASH_STEP);
 
-        if (UNSAFE_V_INT(pMapSlots->hash.nOccupied) > (tableSize/2 + tableSize/4)) {
-            tableSize *= 2;
+        // Enlarge table if more than 3/4 full, counting tombstones (which
+        // would otherwise pile up until there were no empty buckets left).
+        // If it's mostly tombstones, rehashing at the same size clears them.
+
+        int nOccupied = UNSAFE_V_INT(pMapSlots->hash.nOccupied);
+        if (nOccupied + UNSAFE_V_INT(pMapSlots->hash.nDeleted) > (tableSize/2 + tableSize/4)) {
+            if (nOccupied > tableSize/4 + tableSize/8)
+                tableSize *= 2;
             RehashFrame(pFrame, tableSize);
             pMap = UNSAFE_V_PTR(pFrame->map);
             pMapSlots = (MapSlots*) pMap->pSlots;
@@ -779,8 +1544,11 @@ int     AddSlot(Object* pFrame, Value tag)
         bool exists = FindHashMapTag(tableSize, pMapSlots, tag, &slot, &freeSlot);
         ASSERT(!exists);
 
+        if (pMapSlots->hash.table[freeSlot] == INT_V(0))
+            pMapSlots->hash.nDeleted = INT_V(UNSAFE_V_INT(pMapSlots->hash.nDeleted) - 1);
         pMapSlots->hash.table[freeSlot] = tag;
         pMapSlots->hash.nOccupied = INT_V(UNSAFE_V_INT(pMapSlots->hash.nOccupied) + 1);
+        AddTagToBloom(pMap, tag);
 
         return freeSlot;
     }
@@ -794,6 +1562,7 @@ int     AddSlot(Object* pFrame, Value tag)
 
         SetSlottedLength(pFrame, nSlots + 1);
         AddSlotValue(pMap, tag);
+        AddTagToBloom(pMap, tag);
 
         return nSlots;
     }
@@ -834,33 +1603,98 @@ int     GetObjLength(Value obj)
             return UNSAFE_V_INT(pMapSlots->hash.nOccupied);
         }
         else {
-            return pMap->size - SeqMapArraySize(0);
+            return SeqMapNumTags(pMap);
         }
     }
+    else if (ObjIsFrameTable(pObj)) {
+        return FrameTableLength(pObj);
+    }
+    else if (ObjIsView(pObj)) {
+        return ViewLength(pObj);
+    }
+    else if (ObjIsTypedArray(pObj)) {
+        return TypedArrayLength(pObj);
+    }
+    else if (ObjIsCompact(pObj)) {
+        // What it would be if it were wide
+        return pObj->size * sizeof(TCHAR);
+    }
+    else if (ObjIsRope(pObj)) {
+        // What it will be when it's flattened
+        return (StringLength(obj) + 1) * sizeof(TCHAR);
+    }
     else {
-        return V_PTR(obj)->size;
+        return pObj->size;
     }
 }
 
+int     GetRehashCount(void)
+{
+    return g_rehashCount;
+}
+
 void    ReplaceObject(Value oldObj, Value newObj)
 {
     Object* pOld = V_PTR(oldObj);
     Object* pNew = V_PTR(newObj);
+
+    // Symbols are compared by pointer all over the place (frame maps in
+    // particular), so they can't be forwarded.
+    if (ObjIsSymbol(pOld))
+        PROTO_THROW_ERR(g_exFr, E_ReadOnly, oldObj);
+
     pOld->size = ~0;
     pOld->flags = HDR_FORWARDER;
     pOld->pReplacement = pNew;
     pOld->pData = 0;
 }
 
+// Arrays and binaries at least this big share their slots or data with
+// their clones instead of copying them. Whichever object is written first
+// copies them then, and the other copies too when it's written, since
+// nothing records when it stops sharing. (That's still at most one copy
+// per object, and only for objects that actually change.) Frames always
+// copy--their slots get written from too many places.
+
+const int   SHARE_MIN_BYTES = 256;
+
+inline bool ShouldShareData(Object* pObj)
+{
+    if (ObjIsFrame(pObj))
+        return false;
+    int nBytes = (pObj->flags & HDR_SLOTTED) ? pObj->size * sizeof(Value) : pObj->size;
+    return nBytes >= SHARE_MIN_BYTES;
+}
+
+void    UnshareData(Object* pObj)
+{
+    ASSERT(pObj->flags & HDR_SHARED);
+    if (pObj->flags & HDR_SLOTTED) {
+        Value* pSlots = AllocSlots(pObj->size);
+        memcpy(pSlots, pObj->pSlots, pObj->size * sizeof(Value));
+        pObj->pSlots = pSlots;
+    }
+    else {
+        pObj->pData = CopyBinaryData(pObj);
+    }
+    pObj->flags &= ~HDR_SHARED;
+}
+
 Value   Clone(Value obj)
 {
     if (!V_ISPTR(obj))
         return obj;
 
     Object* pObj = V_PTR(obj);
+
+    // A map that's about to be shared can't be in the middle of a rehash
+    if (ObjIsFrame(pObj))
+        FinishRehash(pObj);
+
     int size = pObj->size;
+    bool share = ShouldShareData(pObj);
 
-    Object* pNew = GC_NEW(Object);
+    Object* pNew = (share || (pObj->flags & HDR_SLOTTED)) ? AllocObject() : AllocBinaryObject(size);
 
     pNew->size = size;
     pNew->flags = pObj->flags;
@@ -875,74 +1709,109 @@ Value   Clone(Value obj)
         pNew->cls = pObj->cls;
     }
 
-    if (size > 0) {
+    if (share) {
+        if (pObj->flags & HDR_SLOTTED)
+            pNew->pSlots = pObj->pSlots;
+        else
+            ShareBinaryData(pObj, pNew);
+        pObj->flags |= HDR_SHARED;
+        pNew->flags |= HDR_SHARED;
+    }
+    else if (size > 0) {
         if (pObj->flags & HDR_SLOTTED) {
-            int numBytes =  size * sizeof(Value);
-            pNew->pSlots = (Value*) GC_MALLOC(numBytes);
-            memcpy(pNew->pSlots, pObj->pSlots, numBytes);
+            pNew->pSlots = AllocSlots(size);
+            memcpy(pNew->pSlots, pObj->pSlots, size * sizeof(Value));
         }
         else {
-            pNew->pData = GC_MALLOC_ATOMIC(size);
             memcpy(pNew->pData, pObj->pData, size);
         }
     }
-    else {
-        pNew->pData = 0;
-    }
 
     return PTR_V(pNew);
 }
 
-Value   DeepCloneInner(Value obj, ObjHashTable<Value>& hash)
-{
-    ASSERT(V_ISPTR(obj));
-
-    // Symbols don't get cloned
-    if (IsSymbol(obj))
-        return obj;
-
-    Value newObj;
-
-    if (hash.Get(obj, &newObj))
-        return newObj;
-
-    newObj = Clone(obj);
+// DeepClone walks the original with a HeapWalker, so deep structures (long
+// linked lists, say) can't run the C stack out. Each object is cloned
+// (shallowly) when it's first reached, and the clone is remembered as the
+// original's mark, which preserves sharing and cycles. When the walk leaves
+// an object, everything it refers to has been cloned, so its clone's slots
+// are pointed at the clones.
+//
+// The clones are allocated one at a time rather than carved out of one
+// block sized by a counting pass. Headers and slot vectors are different
+// kinds of collector object (see gcalloc.cpp), so they can't share a
+// block. A block would also stay alive as long as any clone in it did.
+// And a counting pass would need the same table of originals it had
+// already seen, so it would cost about as much as the clone itself.
+
+struct DeepCloner {
+    typedef Value Mark;
+    enum { kSeeForwarders = false };
+
+    DeepCloner() : m_walker(*this) { }
+
+    void    Leaf(Value v) { }
+    bool    Enter(Value v, Object* pObj, int depth, Value& clone)
+        { clone = Clone(v); return true; }
+    void    Revisit(Value v, Object* pObj, Value clone) { }
+    bool    Slot(Object* pObj, Value tag, int index)
+        { return true; }
+    void    Leave(Value v, Object* pObj, int depth);
+
+    Value   CloneOf(Value v)
+    {
+        Value clone;
+        return m_walker.GetMark(v, &clone) ? clone : v;     // Symbols don't get cloned
+    }
 
-    hash.Set(obj, newObj);
+    HeapWalker<DeepCloner> m_walker;
+};
 
-    Object* pNewObj = UNSAFE_V_PTR(newObj);
+void    DeepCloner::Leave(Value v, Object* pObj, int depth)
+{
+    Object* pNewObj = UNSAFE_V_PTR(CloneOf(v));
 
     if (pNewObj->flags & HDR_SLOTTED) {
         // Clone array class slot (frame maps are shared, not cloned)
         if (ObjIsArray(pNewObj) && V_ISPTR(pNewObj->cls))
-            pNewObj->cls = DeepCloneInner(pNewObj->cls, hash);
+            pNewObj->cls = CloneOf(pNewObj->cls);
 
-        // Clone slots
+        // Clone slots. A big array that only holds symbols and immediates
+        // keeps sharing its original's slots.
         for (int i = 0; i < pNewObj->size; i++) {
-            Value v = pNewObj->pSlots[i];
-            if (V_ISPTR(v))
-                pNewObj->pSlots[i] = DeepCloneInner(v, hash);
+            Value slot = pNewObj->pSlots[i];
+            if (V_ISPTR(slot)) {
+                Value newSlot = CloneOf(slot);
+                if (newSlot != slot) {
+                    Unshare(pNewObj);
+                    pNewObj->pSlots[i] = newSlot;
+                }
+            }
         }
+
+        if (pNewObj->cls == PSYM(valueTable))
+            RehashValueTable(pNewObj);
     }
     else {
         // Clone binary class slot
         if (V_ISPTR(pNewObj->cls))
-            pNewObj->cls = DeepCloneInner(pNewObj->cls, hash);
+            pNewObj->cls = CloneOf(pNewObj->cls);
     }
-
-    return newObj;
 }
 
 Value   DeepClone(Value obj)
 {
-    if (V_ISPTR(obj)) {
-        ObjHashTable<Value> hash;
-
-        return DeepCloneInner(obj, hash);
-    }
-    else {
+    if (!V_ISPTR(obj))
         return obj;
-    }
+
+    // The elements of a big array or frame are usually objects of their
+    // own, so there are at least that many to remember
+    DeepCloner cloner;
+    Object* pObj = V_PTR(obj);
+    if (pObj->flags & HDR_SLOTTED)
+        cloner.m_walker.Reserve(pObj->size + 1);
+    cloner.m_walker.Walk(obj);
+    return cloner.CloneOf(obj);
 }
 
 Value   GetPath(Value obj, Value path)
@@ -963,8 +1832,13 @@ Value   GetPath(Value obj, Value path)
 
             for (int i = 0; i < nSlots; i++) {
                 Value pathElt = pPath->pSlots[i];
-                if (V_ISINT(pathElt))
-                    curObj = GetSlot(curObj, UNSAFE_V_INT(pathElt));
+                if (V_ISINT(pathElt)) {
+                    // A row and slot of a frame table is read from the column
+                    if (i + 1 < nSlots && !V_ISINT(pPath->pSlots[i + 1]) && IsFrameTable(curObj))
+                        curObj = GetFrameTableCell(UNSAFE_V_PTR(curObj), UNSAFE_V_INT(pathElt), pPath->pSlots[++i]);
+                    else
+                        curObj = GetSlot(curObj, UNSAFE_V_INT(pathElt));
+                }
                 else
                     curObj = GetSlot(curObj, pathElt);
             }
@@ -996,7 +1870,7 @@ void    SetPath(Value obj, Value path, Value newValue)
             if (nSlots == 0)
                 PROTO_THROW_ERR(g_exType, E_InvalidPath, path);
 
-            for (int i = 0; i < nSlots - 1; i++) {
+            for (int i = 0; i < nSlots - 2; i++) {
                 pathElt = pPath->pSlots[i];
                 if (V_ISINT(pathElt))
                     curObj = GetSlot(curObj, UNSAFE_V_INT(pathElt));
@@ -1004,6 +1878,20 @@ void    SetPath(Value obj, Value path, Value newValue)
                     curObj = GetSlot(curObj, pathElt);
             }
 
+            // A row and slot of a frame table is written to the column
+            if (nSlots >= 2) {
+                pathElt = pPath->pSlots[nSlots - 2];
+                if (V_ISINT(pathElt) && !V_ISINT(pPath->pSlots[nSlots - 1]) && IsFrameTable(curObj)) {
+                    SetFrameTableCell(UNSAFE_V_PTR(curObj), UNSAFE_V_INT(pathElt),
+                                      pPath->pSlots[nSlots - 1], newValue);
+                    return;
+                }
+                if (V_ISINT(pathElt))
+                    curObj = GetSlot(curObj, UNSAFE_V_INT(pathElt));
+                else
+                    curObj = GetSlot(curObj, pathElt);
+            }
+
             pathElt = pPath->pSlots[nSlots - 1];
             if (V_ISINT(pathElt))
                 SetSlot(curObj, UNSAFE_V_INT(pathElt), newValue);
@@ -1024,7 +1912,7 @@ bool    HasPath(Value obj, Value path)
     if (V_ISINT(path)) {
         UInt index = UNSAFE_V_INT(path);
         Object* pObj = V_PTR(obj);
-        if (ObjIsArray(pObj) && index < pObj->size)
+        if (ObjIsArray(pObj) && index < (UInt) GetArrayLength(obj))
             return true;
         else
             return false;
@@ -1047,8 +1935,8 @@ bool    HasPath(Value obj, Value path)
 
                     if (V_ISINT(pathElt)) {
                         UInt index = UNSAFE_V_INT(pathElt);
-                        if (ObjIsArray(pCurObj) && index < pCurObj->size)
-                            curObj = pCurObj->pSlots[UNSAFE_V_INT(pathElt)];
+                        if (ObjIsArray(pCurObj) && index < (UInt) GetArrayLength(curObj))
+                            curObj = GetSlot(curObj, index);
                         else
                             return false;
                     }
@@ -1103,10 +1991,27 @@ Value   NewString(int size)
     return NewBinary(PSYM(string), size);
 }
 
+// Strings are made compact when they can be (see strings.cpp).
+
 Value   NewString(const TCHAR* str)
 {
-    Value result = NewBinary(PSYM(string), (wcslen(str) + 1) * sizeof(TCHAR));
-    wcscpy((TCHAR*) GetData(result), str);
+    int len = wcslen(str);
+    bool compact = true;
+    for (int i = 0; i < len && compact; i++)
+        compact = (UInt32) str[i] < 256;
+
+    if (!compact) {
+        Value result = NewBinary(PSYM(string), (len + 1) * sizeof(TCHAR));
+        wcscpy((TCHAR*) GetData(result), str);
+        return result;
+    }
+
+    Value result = NewBinary(PSYM(string), len + 1);
+    Object* pObj = UNSAFE_V_PTR(result);
+    pObj->flags |= HDR_COMPACT;
+    Byte* p = (Byte*) pObj->pData;
+    for (int i = 0; i <= len; i++)
+        p[i] = (Byte) str[i];
     return result;
 }
 
@@ -1115,28 +2020,16 @@ TCHAR*  GetCString(Value str)
     return (TCHAR*) GetData(str);
 }
 
-void    StrAppend(Value str1, Value str2)
-{
-    if (!IsString(str1))
-        PROTO_THROW(g_exType, E_NotAString);
-    if (!IsString(str2))
-        PROTO_THROW(g_exType, E_NotAString);
-
-    int str1Len = GetBinaryLength(str1) / sizeof(wchar_t);
-    int str2Len = GetBinaryLength(str2) / sizeof(wchar_t);
-    SetBinaryLength(str1, (str1Len + str2Len - 1) * sizeof(wchar_t));
-    wchar_t* pstr1 = (wchar_t*) GetData(str1);
-    memcpy(pstr1 + str1Len - 1, GetData(str2), (str2Len - 1) * sizeof(wchar_t));
-    pstr1[str1Len + str2Len - 2] = 0;
-}
-
 // BUGBUG: On Win32, should just do this in DLLMain
 
-void    InitProtoLib()
+void    InitProtoLib(void (*initAppPredefObjects)(void))
 {
     extern void InitPredefObjects(void);
     extern void InitInterpreter(void);
 
+    InitGCAlloc();
     InitPredefObjects();
+    if (initAppPredefObjects != 0)
+        (*initAppPredefObjects)();
     InitInterpreter();
 }
@@ -14,6 +14,9 @@
 
 // Hash table with Value keys (uses Value itself as the key--pointer identity).
 // ObjHashTable<type> maps Value to type
+//
+// Keys are compared as words, not with V_EQ, so a forwarder and the object
+// it leads to are different keys. Callers that care resolve them first.
 
 template<typename VALUE_T>
 class ObjHashTable {
@@ -26,7 +29,7 @@ public:
 
         m_table = m_initialTable;
         m_capacity = ARRAYSIZE(m_initialTable);
-        m_mask = m_capacity - 1;
+        m_shift = 32 - 4;
         memset(m_table, 0, m_capacity * sizeof(Element));
     }
 
@@ -43,25 +46,49 @@ public:
     }
 
     void    Set(Value key, const VALUE_T& value)
+    {
+        bool added;
+        *Add(key, &added) = value;
+    }
+
+    bool    HasKey(Value key)
+    {
+        int iSlot;
+        return Find(key, &iSlot);
+    }
+
+    // Finds the key's value, adding the key (with a zero value) if it's not
+    // there yet, in one search. The pointer is good until the next Add or Set.
+
+    VALUE_T*    Add(Value key, /*out*/ bool* pAdded)
     {
         int iSlot;
         if (Find(key, &iSlot)) {
-            m_table[iSlot].value = value;
+            *pAdded = false;
         }
         else {
-            if (m_size >= m_capacity / 2 + m_capacity / 4)
+            if (m_size >= m_capacity / 2 + m_capacity / 4) {
                 Resize(m_capacity * 2);
+                Find(key, &iSlot);
+            }
 
             m_table[iSlot].key = key;
-            m_table[iSlot].value = value;
             m_size++;
+            *pAdded = true;
         }
+        return &m_table[iSlot].value;
     }
 
-    bool    HasKey(Value key)
+    // Makes room for n keys in all, so adding them doesn't resize the table
+    // over and over.
+
+    void    Reserve(int n)
     {
-        int iSlot;
-        return Find(key, &iSlot);
+        int capacity = m_capacity;
+        while (n >= capacity / 2 + capacity / 4)
+            capacity *= 2;
+        if (capacity != m_capacity)
+            Resize(capacity);
     }
 
 private:
@@ -70,22 +97,26 @@ private:
         VALUE_T value;
     };
 
+    // Objects are aligned, so the low bits of a key are all the same; the
+    // hash is taken from the top of the product instead. Linear probing
+    // keeps a search in one or two cache lines.
+
     bool    Find(Value key, int* iSlot)
     {
-        int hash = ((UInt32) key * 0x9e3779b9) & m_mask;
-        int incr = ((hash * 13) & m_mask) | 1;
+        int mask = m_capacity - 1;
+        int hash = (int) (((UInt32) ((UIntPtr) key >> 4) * 0x9E3779B9u) >> m_shift);
         for (;;) {
             Value k = m_table[hash].key;
-            if (k == 0) {
+            if (k == key) {
                 *iSlot = hash;
-                return false;
+                return true;
             }
-            else if (V_EQ(k, key)) {
+            else if (k == 0) {
                 *iSlot = hash;
-                return true;
+                return false;
             }
 
-            hash = (hash + incr) & m_mask;
+            hash = (hash + 1) & mask;
         }
 
         ASSERT(false);
@@ -95,29 +126,35 @@ private:
     void    SetCapacity(int newCapacity)
     {
         m_capacity = newCapacity;
-        m_mask = m_capacity - 1;
+        m_shift = 32;
+        for (int c = newCapacity; c > 1; c >>= 1)
+            m_shift--;
         m_table = (Element*) GC_MALLOC(m_capacity * sizeof(Element));
         memset(m_table, 0, m_capacity * sizeof(Element));
     }
 
     void    Resize(int newCapacity)
     {
+        ASSERT((newCapacity & (newCapacity - 1)) == 0 && newCapacity > m_size);
         int oldCapacity = m_capacity;
         Element* oldTable = m_table;
 
-        SetCapacity(m_capacity * 2);
+        SetCapacity(newCapacity);
 
         for (int i = 0; i < oldCapacity; i++) {
-            if (oldTable[i].key != 0)
-                Set(oldTable[i].key, oldTable[i].value);
+            if (oldTable[i].key != 0) {
+                int iSlot;
+                Find(oldTable[i].key, &iSlot);
+                m_table[iSlot] = oldTable[i];
+            }
         }
     }
 
     int     m_size;
     int     m_capacity;
-    int     m_mask;
+    int     m_shift;            // 32 - log2(m_capacity)
     Element* m_table;
-    Element m_initialTable[16];     // Must be a power of two
+    Element m_initialTable[16];     // Must be a power of two (see m_shift)
 };
 
 #endif // __OBJHASH_H__
@@ -12,174 +12,55 @@
 #include "interpreter.h"
 #include "predefined.h"
 #include "native.h"
-#include "objhash.h"
+#include "heapwalk.h"
 #include <stdio.h>
 
-DECLARE_PSYM(array);
-DECLARE_PSYM(pathexpr);
-DECLARE_PSYM(printdepth);
-DECLARE_PSYM(real);
-DECLARE_PSYM(string);
-
 typedef int (*PrintFnPtr)(const char* format, ...);
 
-void    PrintOneValue(Value v, int depth, PrintFnPtr printFn);
+// The printer is a visitor for HeapWalker, so printing a deep structure
+// doesn't use up the C stack. An object printed twice (shared, or in a
+// cycle) is printed the second time as just its address.
 
 struct Printer {
+    typedef bool Mark;
+    enum { kSeeForwarders = true };
+
     Printer(int maxDepth, PrintFnPtr printFn)
-        { m_maxDepth = maxDepth; m_printFn = printFn; m_depth = 0; }
+        { m_maxDepth = maxDepth; m_printFn = printFn; }
 
-    int     PrintFrameSlots(Value* pSlots, Value map, bool first = true);
     void    PrintOneValue(Value v);
 
+    void    Leaf(Value v);
+    bool    Enter(Value v, Object* pObj, int depth, bool& mark);
+    void    Revisit(Value v, Object* pObj, bool mark);
+    bool    Slot(Object* pObj, Value tag, int index);
+    void    Leave(Value v, Object* pObj, int depth);
+
+    void    PrintString(Object* pObj);
+    bool    IsPathExpr(Object* pObj)
+        { return V_EQ(pObj->cls, PSYM(pathexpr)); }
+    bool    ShowsClass(Object* pObj)
+        { return !V_EQ(pObj->cls, PSYM(array)); }
+
     int         m_maxDepth;
     PrintFnPtr  m_printFn;
-    int         m_depth;
-    ObjHashTable<bool> m_hash;
 };
 
-int     Printer::PrintFrameSlots(Value* pSlots, Value map, bool first)
+void    Printer::PrintOneValue(Value v)
 {
-    Object* pMap = V_PTR(map);
-    MapSlots* pMapSlots = (MapSlots*) (pMap->pSlots);
-
-    int offset;
-    if (pMapSlots->supermap == V_NIL)
-        offset = 0;
-    else
-        offset = PrintFrameSlots(pSlots, pMapSlots->supermap, false);
-
-    int nSlots;
-
-    int flags = UNSAFE_V_INT(pMap->cls);
-    if (flags & HASH_MAP) {
-        nSlots = UNSAFE_V_INT(pMapSlots->hash.nOccupied);
-        int nPrinted = 0;
-
-        int tableSize = pMap->size - HashMapArraySize(0);
-        for (int i = 0; i < tableSize; i++) {
-            Value tag = pMapSlots->hash.table[i];
-            if (tag != V_NIL && tag != INT_V(0)) {
-                PrintOneValue(tag);
-                (*m_printFn)(": ");
-                PrintOneValue(pSlots[offset + i]);
-                if (!(first && (nPrinted == nSlots - 1)))
-                    (*m_printFn)(", ");
-                nPrinted++;
-            }
-        }
-    }
-    else {
-        nSlots = pMap->size - 1;
-        for (int i = 0; i < nSlots; i++) {
-            PrintOneValue(pMapSlots->tags[i]);
-            (*m_printFn)(": ");
-            PrintOneValue(pSlots[offset + i]);
-            if (!(first && (i == nSlots - 1)))
-                (*m_printFn)(", ");
-        }
-    }
-
-    return offset + nSlots;
+    HeapWalker<Printer> walker(*this);
+    walker.Walk(v);
 }
 
-void    Printer::PrintOneValue(Value v)
+void    Printer::Leaf(Value v)
 {
-    m_depth++;
-
     switch (V_TAG(v)) {
     case TAG_INT:
-        (*m_printFn)("%d", V_INT(v));
+        (*m_printFn)("%lld", (long long) V_INT(v));
         break;
 
     case TAG_PTR:
-        {
-            Object* pObj = UNSAFE_V_PTR(v);
-
-            // Don't get into cycles
-            if (m_hash.HasKey(v)) {
-                if (ObjIsBinary(pObj))
-                    (*m_printFn)("<#%X>", (int) v);
-                else if (ObjIsArray(pObj))
-                    (*m_printFn)("[#%X]", (int) v);
-                else if (ObjIsFrame(pObj))
-                    (*m_printFn)("{#%X}", (int) v);
-            }
-            else {
-                // BUGBUG: Shouldn't do strings either
-                if (!ObjIsSymbol(pObj))
-                    m_hash.Set(v, true);
-
-                int flags = pObj->flags;
-                if (flags & HDR_FORWARDER) {
-                    (*m_printFn)("-> ");
-                    PrintOneValue(PTR_V(pObj->pReplacement));
-                }
-                else if (flags & HDR_SLOTTED) {
-                    if (flags & HDR_FRAME) {
-                        (*m_printFn)("{");
-                        if (m_depth <= m_maxDepth)
-                            PrintFrameSlots(pObj->pSlots, pObj->map);
-                        else
-                            (*m_printFn)("%X", (int) v);
-                        (*m_printFn)("}");
-                    }
-                    else if (V_EQ(pObj->cls, PSYM(pathexpr))) {
-                        int nSlots = pObj->size;
-                        for (int i = 0; i < nSlots; i++) {
-                            PrintOneValue(pObj->pSlots[i]);
-                            if (i != nSlots - 1)
-                                (*m_printFn)(".");
-                        }
-                    }
-                    else {
-                        (*m_printFn)("[");
-                        if (m_depth <= m_maxDepth) {
-                            if (!V_EQ(pObj->cls, PSYM(array))) {
-                                PrintOneValue(pObj->cls);
-                                (*m_printFn)(": ");
-                            }
-                            int nSlots = pObj->size;
-                            for (int i = 0; i < nSlots; i++) {
-                                PrintOneValue(pObj->pSlots[i]);
-                                if (i != nSlots - 1)
-                                    (*m_printFn)(", ");
-                            }
-                        }
-                        else
-                            (*m_printFn)("%X", (int) v);
-                        (*m_printFn)("]");
-                    }
-                }
-                else {
-                    ASSERT(!(flags & HDR_FRAME));
-                    Value cls = pObj->cls;
-                    if (cls == SYMBOL_CLASS)
-                        (*m_printFn)("%s", SymbolName(v));
-                    else if (V_EQ(cls, PSYM(real)))
-                        (*m_printFn)("%lf", V_REAL(v));
-                    else if (V_EQ(cls, PSYM(string))) {
-                        (*m_printFn)("\"");
-                        int len = pObj->size / sizeof(TCHAR) - 1;
-                        TCHAR* p = (TCHAR*) pObj->pData;
-                        for (int i = 0; i < len; i++) {
-                            if (p[i] >= 32 && p[i] <= 127)
-                                (*m_printFn)("%c", p[i]);
-                            else if (p[i] == 13)
-                                (*m_printFn)("\\n");
-                            else
-                                (*m_printFn)("*");
-                        }
-                        (*m_printFn)("\"");
-                    }
-                    else {
-                        (*m_printFn)("<");
-                        PrintOneValue(pObj->cls);
-                        (*m_printFn)(" %d bytes>", pObj->size);
-                    }
-                }
-            }
-        }
+        (*m_printFn)("%s", SymbolName(v));
         break;
 
     case TAG_IMMED:
@@ -189,16 +70,133 @@ void    Printer::PrintOneValue(Value v)
             (*m_printFn)("true");
         else if (V_ISCHAR(v))
             (*m_printFn)("$%c", V_CHAR(v));
+        else if (V_ISIMMREAL(v))
+            (*m_printFn)("%lf", V_REAL(v));
         else
-            (*m_printFn)("#%X", (int) v);
+            (*m_printFn)("#%llX", (unsigned long long) (UIntPtr) v);
         break;
 
     case TAG_MAGICPTR:
-        (*m_printFn)("#%X", (int) v);
+        (*m_printFn)("#%llX", (unsigned long long) (UIntPtr) v);
         break;
     }
+}
+
+void    Printer::PrintString(Object* pObj)
+{
+    (*m_printFn)("\"");
+    int len = StringChars(pObj);
+    for (int i = 0; i < len; i++) {
+        UInt32 c = StringCharAt(pObj, i);
+        if (c >= 32 && c <= 127)
+            (*m_printFn)("%c", c);
+        else if (c == 13)
+            (*m_printFn)("\\n");
+        else
+            (*m_printFn)("*");
+    }
+    (*m_printFn)("\"");
+}
 
-    m_depth--;
+bool    Printer::Enter(Value v, Object* pObj, int depth, bool& mark)
+{
+    int flags = pObj->flags;
+    if (flags & HDR_FORWARDER) {
+        (*m_printFn)("-> ");
+        return true;
+    }
+    else if (flags & HDR_SLOTTED) {
+        if (flags & HDR_FRAME) {
+            if (depth <= m_maxDepth) {
+                (*m_printFn)("{");
+                return true;
+            }
+            (*m_printFn)("{%llX}", (unsigned long long) (UIntPtr) v);
+        }
+        else if (ObjIsRope(pObj)) {
+            PrintString(UNSAFE_V_PTR(FlattenString(v)));
+        }
+        else if (IsPathExpr(pObj)) {
+            return true;
+        }
+        else {
+            if (depth <= m_maxDepth) {
+                (*m_printFn)("[");
+                return true;
+            }
+            (*m_printFn)("[%llX]", (unsigned long long) (UIntPtr) v);
+        }
+    }
+    else {
+        ASSERT(!(flags & HDR_FRAME) || ObjIsCompact(pObj));
+        Value cls = pObj->cls;
+        if (V_EQ(cls, PSYM(real)))
+            (*m_printFn)("%lf", V_REAL(v));
+        else if (V_EQ(cls, PSYM(string)))
+            PrintString(pObj);
+        else {
+            (*m_printFn)("<");
+            return true;
+        }
+    }
+    return false;
+}
+
+void    Printer::Revisit(Value v, Object* pObj, bool mark)
+{
+    if (ObjIsBinary(pObj))
+        (*m_printFn)("<#%llX>", (unsigned long long) (UIntPtr) v);
+    else if (ObjIsArray(pObj))
+        (*m_printFn)("[#%llX]", (unsigned long long) (UIntPtr) v);
+    else if (ObjIsFrame(pObj))
+        (*m_printFn)("{#%llX}", (unsigned long long) (UIntPtr) v);
+}
+
+bool    Printer::Slot(Object* pObj, Value tag, int index)
+{
+    if (pObj->flags & HDR_FORWARDER)
+        return true;
+
+    if (ObjIsFrame(pObj)) {
+        if (index > 0)
+            (*m_printFn)(", ");
+        Leaf(tag);
+        (*m_printFn)(": ");
+    }
+    else if (ObjIsBinary(pObj)) {
+        // The class is all there is
+    }
+    else if (IsPathExpr(pObj)) {
+        if (index < 0)
+            return false;
+        if (index > 0)
+            (*m_printFn)(".");
+    }
+    else {
+        if (index < 0)
+            return ShowsClass(pObj);
+        if (index > 0)
+            (*m_printFn)(", ");
+        else if (ShowsClass(pObj))
+            (*m_printFn)(": ");
+    }
+    return true;
+}
+
+void    Printer::Leave(Value v, Object* pObj, int depth)
+{
+    if (pObj->flags & HDR_FORWARDER)
+        return;
+
+    if (ObjIsFrame(pObj))
+        (*m_printFn)("}");
+    else if (ObjIsBinary(pObj))
+        (*m_printFn)(" %d bytes>", pObj->size);
+    else if (!IsPathExpr(pObj)) {
+        if (pObj->size == 0 && ShowsClass(pObj))
+            (*m_printFn)(": ");
+        (*m_printFn)("]");
+    }
 }
 
 #ifdef _DEBUG
@@ -0,0 +1,46 @@
+/*
+    Proto language runtime
+
+    SIMD configuration
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include "config.h"
+
+// Everything that uses these must also have a scalar version, for
+// platforms (and compiler settings) without them.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #define HAVE_SSE2 1
+ #include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+ #define HAVE_AVX2 1
+ #include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+ #include <intrin.h>
+#endif
+
+// Index of the lowest set bit of a (nonzero) movemask result.
+
+inline int  LowestBitIndex(UInt32 mask)
+{
+    ASSERT(mask != 0);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int) index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+#endif //__SIMD_H__
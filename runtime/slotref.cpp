@@ -0,0 +1,106 @@
+/*
+    Proto language runtime
+
+    Slot references and frame bindings for native code
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "slotref.h"
+
+// A SlotRef remembers the map it last looked its tag up in, and the index
+// it found. Most maps are changed in place (a slot added or removed, or a
+// hash table rehashed), so the index is only trusted if the map's tag at
+// that index is still the SlotRef's tag. Shared maps never change, so for
+// one of those the map compare is enough, and the answer can be "not
+// there" too--unless it has a supermap, which can still change under it.
+
+inline Object*  FrameObject(Value frame)
+{
+    Object* pObj = V_PTR(frame);
+    if (!ObjIsFrame(pObj))
+        PROTO_THROW(g_exType, E_NotAFrame);
+    return pObj;
+}
+
+inline bool RefIsCurrent(const SlotRef& ref, Object* pFrame)
+{
+    if (pFrame->map != ref.map)
+        return false;
+    return ref.fixed || (ref.offset >= 0 && TagAtOffset(UNSAFE_V_PTR(ref.map), ref.offset) == ref.tag);
+}
+
+// Looks the tag up for real, and remembers where it was.
+
+int     ResolveSlotRef(SlotRef& ref, Object* pFrame)
+{
+    int offset = FindOffset(pFrame->map, ref.tag);
+    Object* pMap = UNSAFE_V_PTR(pFrame->map);
+    bool fixed = (UNSAFE_V_INT(pMap->cls) & SHARED_MAP) != 0
+              && ((MapSlots*) pMap->pSlots)->supermap == V_NIL;
+    if (offset >= 0 || fixed) {
+        ref.map = pFrame->map;
+        ref.offset = offset;
+        ref.fixed = fixed;
+    }
+    return offset;
+}
+
+inline int  SlotRefOffset(SlotRef& ref, Object* pFrame)
+{
+    if (RefIsCurrent(ref, pFrame))
+        return ref.offset;
+    return ResolveSlotRef(ref, pFrame);
+}
+
+Value   GetSlot(Value frame, SlotRef& ref)
+{
+    Object* pObj = FrameObject(frame);
+    int offset = SlotRefOffset(ref, pObj);
+    return offset < 0 ? V_NIL : pObj->pSlots[offset];
+}
+
+void    SetSlot(Value frame, SlotRef& ref, Value newValue)
+{
+    Object* pObj = FrameObject(frame);
+    int offset = SlotRefOffset(ref, pObj);
+    if (offset >= 0)
+        pObj->pSlots[offset] = newValue;
+    else
+        SetSlot(frame, ref.tag, newValue);      // Adds it, and probably changes the map
+}
+
+bool    HasSlot(Value frame, SlotRef& ref)
+{
+    return SlotRefOffset(ref, FrameObject(frame)) >= 0;
+}
+
+//----------------------------------------------------------------
+// Frame bindings
+//----------------------------------------------------------------
+
+// Frames read through a binding usually all have the same map, so after
+// the first one every field is a compare.
+
+void    ReadFrameSlots(Value frame, SlotField* fields, int nFields, void* pStruct)
+{
+    Object* pObj = FrameObject(frame);
+    for (int i = 0; i < nFields; i++) {
+        SlotField& field = fields[i];
+        int offset = SlotRefOffset(field.ref, pObj);
+        Value v = offset < 0 ? V_NIL : pObj->pSlots[offset];
+        field.read((char*) pStruct + field.memberOffset, v);
+    }
+}
+
+void    WriteFrameSlots(Value frame, SlotField* fields, int nFields, const void* pStruct)
+{
+    FrameObject(frame);
+    for (int i = 0; i < nFields; i++) {
+        SlotField& field = fields[i];
+        SetSlot(frame, field.ref, field.write((const char*) pStruct + field.memberOffset));
+    }
+}
@@ -10,19 +10,12 @@
 #include "config.h"
 #include "objects-private.h"
 #include "predefined.h"
+#include "gcalloc.h"
 #include <iostream>
 #include <fstream>
 
 using namespace std;
 
-DECLARE_PSYM(array);
-DECLARE_PSYM(bottom);
-DECLARE_PSYM(left);
-DECLARE_PSYM(real);
-DECLARE_PSYM(right);
-DECLARE_PSYM(string);
-DECLARE_PSYM(top);
-
 enum {
     T_IMMED,
     T_CHAR,
@@ -131,8 +124,10 @@ Value   CObjectReader::ReadOne()
 
     switch (op) {
     case T_IMMED:
+        // Stream immediates are 32 bits, with the same tags as ours, so
+        // sign-extending them is all it takes to make them 64-bit Values.
         i = ReadXLong();
-        return (Value) i;
+        return (Value) (IntPtr) i;
 
     case T_CHAR:
         m_in >> b;
@@ -148,10 +143,22 @@ Value   CObjectReader::ReadOne()
     case T_BINARY:
         i = ReadXLong();
         v = NewBinary(V_NIL, i);
-        m_precedents.Add(v);
+        slot = m_precedents.Add(v);
         cls = ReadOne();
         SetClassSlot(v, cls);
         m_in.read((char*) GetData(v), i);
+        if (cls == PSYM(real) && i == sizeof(double)) {
+            // Reals are stored big-endian. Most of them can be immediates.
+            Byte* p = (Byte*) GetData(v);
+            Byte bytes[sizeof(double)];
+            for (int j = 0; j < (int) sizeof(double); j++)
+                bytes[j] = p[sizeof(double) - 1 - j];
+            double d;
+            memcpy(&d, bytes, sizeof(double));
+            Value real = REAL_V(d);
+            m_precedents.Set(slot, real);
+            return real;
+        }
         return v;
 
     case T_ARRAY:
@@ -183,11 +190,14 @@ Value   CObjectReader::ReadOne()
             Value tags = NewArray(i);
             for (slot = 0; slot < i; slot++)
                 SetSlot(tags, slot, ReadOne());
-            v = NewFrameWithMap(NewMapWithTags(tags));
+            Value offsets;
+            v = NewFrameWithMap(MapForTags(i, UNSAFE_V_PTR(tags)->pSlots, &offsets));
             m_precedents.Set(framePrecedent, v);
             Value* pSlots = V_PTR(v)->pSlots;
-            for (slot = 0; slot < i; slot++)
-                pSlots[slot] = ReadOne();
+            for (slot = 0; slot < i; slot++) {
+                Value value = ReadOne();
+                pSlots[UNSAFE_V_INT(UNSAFE_V_PTR(offsets)->pSlots[slot])] = value;
+            }
             return v;
         }
 
@@ -207,10 +217,10 @@ Value   CObjectReader::ReadOne()
     case T_STRING:
         {
             i = ReadXLong();
-            v = NewBinary(PSYM(string), i);
+            Byte* p = (Byte*) AllocData(i);
+            m_in.read((char*) p, i);
+            v = NewStringFromUTF16(p, i / 2);
             m_precedents.Add(v);
-            m_in.read((char*) GetData(v), i);
-            SWAB((char*) GetData(v), (char*) GetData(v), i);
             return v;
         }
 
@@ -0,0 +1,1055 @@
+/*
+    Proto language runtime
+
+    String builders, ropes, and compact strings
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "gcalloc.h"
+#include "valuestack.h"
+#include "predefined.h"
+#include "native.h"
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+
+// Appending to a string makes it exactly big enough and copies the new
+// piece in, so building a string out of N pieces one at a time costs
+// O(N^2) in copying. There are two ways around that.
+//
+// A string builder is a binary of class stringBuilder holding a string,
+// but with room to grow into, so appending to it only copies the new
+// piece. StringBuilderFinish turns it into a plain string.
+//
+// A rope is a concatenation whose pieces haven't been copied together yet.
+// StrConcat makes one when the result would be big. Taking its length
+// and appending it to something else (which copies its pieces where they
+// go) read it as it is. Anything else that needs its characters, which
+// includes comparing, searching, and printing as well as GetData, the
+// other binary functions, character access, and changing it, flattens it:
+// the rope is replaced by the flat string (see ReplaceObject), so
+// everything that refers to it sees a plain string from then on. A rope
+// is an array of class rope:
+//
+//      length      number of characters (not counting the null), as an
+//                  integer
+//      left, right the pieces, strings or ropes
+//
+// A compact string (HDR_COMPACT) has one byte per character instead of a
+// TCHAR, for strings whose characters are all Latin-1, which is most of
+// them. Its size is still its length plus one for the null, so the length
+// is as cheap to get as ever, with no need to cache it. GetData and
+// SetBinaryLength widen it for good first, since the caller is going to
+// treat the data as TCHARs. GetReadOnlyData hands out a wide copy instead
+// and GetBinaryLength the wide size, so reading doesn't change the string.
+// The functions here work on either form.
+//
+// A string with any character outside Latin-1 is all TCHARs, which are 4
+// bytes on Linux. There's no UTF-16 form in between: it would be a third
+// representation for every function here, and GetData's callers all
+// expect TCHARs.
+
+enum {
+    RP_LENGTH,
+    RP_LEFT,
+    RP_RIGHT,
+    RP_SIZE
+};
+
+// Concatenations shorter than this (in characters) are just copied.
+
+const int   ROPE_MIN = 256;
+
+const int   MAX_CHARS = MAX_DATA / sizeof(TCHAR) - 1;
+
+//----------------------------------------------------------------
+// Compact strings
+//----------------------------------------------------------------
+
+// Makes a compact string of len characters (garbage, then the null).
+
+Value   NewCompactString(int len)
+{
+    Value str = NewBinary(PSYM(string), len + 1);
+    Object* pObj = UNSAFE_V_PTR(str);
+    pObj->flags |= HDR_COMPACT;
+    ((Byte*) pObj->pData)[len] = 0;
+    return str;
+}
+
+// Widens in place, from the end so the bytes aren't overwritten before
+// they're read.
+
+void    WidenString(Object* pObj)
+{
+    ASSERT(ObjIsCompact(pObj));
+    int n = pObj->size;
+    if ((IntPtr) n * sizeof(TCHAR) > MAX_DATA)
+        PROTO_THROW(g_exFr, E_StringTooBig);
+
+    Unshare(pObj);
+    pObj->pData = ResizeBinaryData(pObj, n * sizeof(TCHAR));
+    pObj->size = n * sizeof(TCHAR);
+    pObj->flags &= ~HDR_COMPACT;
+
+    const Byte* src = (const Byte*) pObj->pData;
+    TCHAR* dest = (TCHAR*) pObj->pData;
+    for (int i = n - 1; i >= 0; i--)
+        dest[i] = src[i];
+}
+
+// A wide copy of a compact string's characters (with the null), for
+// reading it as TCHARs without changing it.
+
+const TCHAR*    WideCopy(Object* pObj)
+{
+    ASSERT(ObjIsCompact(pObj));
+    int n = pObj->size;
+    if ((IntPtr) n * sizeof(TCHAR) > MAX_DATA)
+        PROTO_THROW(g_exFr, E_StringTooBig);
+
+    const Byte* src = (const Byte*) pObj->pData;
+    TCHAR* dest = (TCHAR*) AllocData(n * sizeof(TCHAR));
+    for (int i = 0; i < n; i++)
+        dest[i] = src[i];
+    return dest;
+}
+
+// Gets the first len characters of a string in the given form, converting
+// them into a temporary copy if they're in the other one. Returns null if
+// they don't all fit in a compact string.
+
+const void* CharsAs(Object* pObj, int len, bool compact)
+{
+    if (ObjIsCompact(pObj) == compact)
+        return pObj->pData;
+
+    if (compact) {
+        const TCHAR* src = (const TCHAR*) pObj->pData;
+        Byte* dest = (Byte*) AllocData(len + 1);
+        for (int i = 0; i < len; i++) {
+            if ((UInt32) src[i] > 0xFF)
+                return NULL;
+            dest[i] = (Byte) src[i];
+        }
+        return dest;
+    }
+
+    const Byte* src = (const Byte*) pObj->pData;
+    TCHAR* dest = (TCHAR*) AllocData((len + 1) * sizeof(TCHAR));
+    for (int i = 0; i < len; i++)
+        dest[i] = src[i];
+    return dest;
+}
+
+// Strings in the streamed format are UTF-16, big-endian. They come in
+// compact if they can; otherwise surrogate pairs are combined if TCHAR is
+// wide enough to hold the result.
+
+Value   NewStringFromUTF16(const Byte* p, int nUnits)
+{
+    bool wide = false;
+    int len = 0;
+    for (int i = 0; i < nUnits; i++) {
+        UInt32 c = (p[2 * i] << 8) | p[2 * i + 1];
+        if (c > 0xFF)
+            wide = true;
+        if (sizeof(TCHAR) == 4 && c >= 0xD800 && c < 0xDC00 && i + 1 < nUnits) {
+            UInt32 c2 = (p[2 * i + 2] << 8) | p[2 * i + 3];
+            if (c2 >= 0xDC00 && c2 < 0xE000)
+                i++;
+        }
+        len++;
+    }
+    // The null usually comes with it
+    if (len > 0 && p[2 * nUnits - 2] == 0 && p[2 * nUnits - 1] == 0)
+        len--;
+
+    if (!wide) {
+        Value str = NewCompactString(len);
+        Byte* dest = (Byte*) UNSAFE_V_PTR(str)->pData;
+        for (int i = 0; i < len; i++)
+            dest[i] = p[2 * i + 1];
+        return str;
+    }
+
+    Value str = NewString((len + 1) * sizeof(TCHAR));
+    TCHAR* dest = (TCHAR*) UNSAFE_V_PTR(str)->pData;
+    for (int i = 0, j = 0; i < len; i++, j++) {
+        UInt32 c = (p[2 * j] << 8) | p[2 * j + 1];
+        if (sizeof(TCHAR) == 4 && c >= 0xD800 && c < 0xDC00 && j + 1 < nUnits) {
+            UInt32 c2 = (p[2 * j + 2] << 8) | p[2 * j + 3];
+            if (c2 >= 0xDC00 && c2 < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+                j++;
+            }
+        }
+        dest[i] = (TCHAR) c;
+    }
+    dest[len] = 0;
+    return str;
+}
+
+Value   GetStringChar(Value str, int index)
+{
+    Object* pObj = FlatObject(str);
+    if (!ObjIsString(pObj))
+        PROTO_THROW_ERR(g_exType, E_NotAString, str);
+    if (index < 0 || index >= StringChars(pObj))
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+    return IMMED_V(IMMED_CHAR, StringCharAt(pObj, index));
+}
+
+void    SetStringChar(Value str, int index, Value ch)
+{
+    Object* pObj = FlatObject(str);
+    if (!ObjIsString(pObj))
+        PROTO_THROW_ERR(g_exType, E_NotAString, str);
+    if (!V_ISCHAR(ch))
+        PROTO_THROW_ERR(g_exType, E_NotACharacter, ch);
+    if (index < 0 || index >= StringChars(pObj))
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    UInt32 c = V_CHAR(ch);
+    if ((int) c < 0)
+        c &= 0xFFFF;        // CHAR_V of a short
+    if (ObjIsCompact(pObj) && c > 0xFF)
+        WidenString(pObj);
+
+    Unshare(pObj);
+    if (ObjIsCompact(pObj))
+        ((Byte*) pObj->pData)[index] = (Byte) c;
+    else
+        ((TCHAR*) pObj->pData)[index] = (TCHAR) c;
+}
+
+// Number of characters in a string, builder, or rope, not counting the
+// terminating null.
+
+int     StringLength(Value str)
+{
+    Object* pObj = V_PTR(str);
+    if (ObjIsRope(pObj))
+        return UNSAFE_V_INT(pObj->pSlots[RP_LENGTH]);
+    if (!ObjIsBinary(pObj) || (pObj->cls != PSYM(string) && pObj->cls != PSYM(stringBuilder)))
+        PROTO_THROW_ERR(g_exType, E_NotAString, str);
+    return StringChars(pObj);
+}
+
+// Copies the characters of a string, builder, or rope (without the null)
+// to dest, as bytes if compact is set (every piece has to be compact
+// then) and as TCHARs otherwise. Ropes nest as deep as the concatenations
+// that made them, so this walks them with a stack instead of recursing.
+
+void    CopyStringChars(void* dest, Value str, bool compact = false)
+{
+    Byte* p = (Byte*) dest;
+    ValueStack pieces;
+    pieces.Push(str);
+
+    while (!pieces.IsEmpty()) {
+        Object* pObj = V_PTR(pieces.Pop());     // A piece may have been flattened
+        if (ObjIsRope(pObj)) {
+            pieces.Push(pObj->pSlots[RP_RIGHT]);
+            pieces.Push(pObj->pSlots[RP_LEFT]);
+            continue;
+        }
+
+        int len = StringChars(pObj);
+        if (compact) {
+            ASSERT(ObjIsCompact(pObj));
+            memcpy(p, pObj->pData, len);
+            p += len;
+        }
+        else if (ObjIsCompact(pObj)) {
+            const Byte* src = (const Byte*) pObj->pData;
+            TCHAR* wide = (TCHAR*) p;
+            for (int i = 0; i < len; i++)
+                wide[i] = src[i];
+            p += len * sizeof(TCHAR);
+        }
+        else {
+            memcpy(p, pObj->pData, len * sizeof(TCHAR));
+            p += len * sizeof(TCHAR);
+        }
+    }
+}
+
+// True if all of a rope's pieces are compact strings.
+
+bool    IsCompactRope(Object* pRope)
+{
+    ValueStack pieces;
+    pieces.Push(PTR_V(pRope));
+
+    while (!pieces.IsEmpty()) {
+        Object* pObj = V_PTR(pieces.Pop());
+        if (ObjIsRope(pObj)) {
+            pieces.Push(pObj->pSlots[RP_RIGHT]);
+            pieces.Push(pObj->pSlots[RP_LEFT]);
+        }
+        else if (!ObjIsCompact(pObj))
+            return false;
+    }
+    return true;
+}
+
+// The flat string is compact if all the pieces are.
+
+Object* FlattenRope(Object* pRope)
+{
+    Value rope = PTR_V(pRope);
+    int len = UNSAFE_V_INT(pRope->pSlots[RP_LENGTH]);
+    Value flat;
+    if (IsCompactRope(pRope)) {
+        flat = NewCompactString(len);
+        CopyStringChars(UNSAFE_V_PTR(flat)->pData, rope, true);
+    }
+    else {
+        flat = NewString((len + 1) * sizeof(TCHAR));
+        TCHAR* p = (TCHAR*) UNSAFE_V_PTR(flat)->pData;
+        CopyStringChars(p, rope);
+        p[len] = 0;
+    }
+
+    ReplaceObject(rope, flat);
+    return UNSAFE_V_PTR(flat);
+}
+
+Value   FlattenString(Value str)
+{
+    Object* pObj = FlatObject(str);
+    if (!ObjIsString(pObj))
+        PROTO_THROW_ERR(g_exType, E_NotAString, str);
+    return PTR_V(pObj);
+}
+
+// Ropes don't copy their pieces, so pieces that can change have to be
+// snapshots. (Clone shares the characters of big strings until one of them
+// changes.)
+
+Value   RopePiece(Value str)
+{
+    return ObjIsRope(V_PTR(str)) ? str : Clone(str);
+}
+
+Value   StrConcat(Value str1, Value str2)
+{
+    int len1 = StringLength(str1);
+    int len2 = StringLength(str2);
+    if (len1 + len2 > MAX_CHARS)
+        PROTO_THROW(g_exFr, E_StringTooBig);
+
+    if (len1 + len2 < ROPE_MIN) {
+        Object* p1 = V_PTR(str1);
+        Object* p2 = V_PTR(str2);
+        if (ObjIsCompact(p1) && ObjIsCompact(p2)) {
+            Value result = NewCompactString(len1 + len2);
+            Byte* p = (Byte*) UNSAFE_V_PTR(result)->pData;
+            memcpy(p, p1->pData, len1);
+            memcpy(p + len1, p2->pData, len2);
+            return result;
+        }
+
+        Value result = NewString((len1 + len2 + 1) * sizeof(TCHAR));
+        TCHAR* p = (TCHAR*) GetData(result);
+        CopyStringChars(p, str1);
+        CopyStringChars(p + len1, str2);
+        p[len1 + len2] = 0;
+        return result;
+    }
+
+    Value rope = NewArray(PSYM(rope), RP_SIZE);
+    Value* pSlots = UNSAFE_V_PTR(rope)->pSlots;
+    pSlots[RP_LENGTH] = INT_V(len1 + len2);
+    pSlots[RP_LEFT] = RopePiece(str1);
+    pSlots[RP_RIGHT] = RopePiece(str2);
+    return rope;
+}
+
+//----------------------------------------------------------------
+// Appending
+//----------------------------------------------------------------
+
+Value   NewStringBuilder(void)
+{
+    Value builder = NewBinary(PSYM(stringBuilder), sizeof(TCHAR));
+    *(TCHAR*) UNSAFE_V_PTR(builder)->pData = 0;
+    return builder;
+}
+
+// A builder's data has room to grow (see GrowBinaryData), and a plain
+// string's is exactly big enough. Builders are always wide; a compact
+// string stays compact if what's appended to it is.
+
+void    StrAppend(Value str1, Value str2)
+{
+    Object* pObj = FlatObject(str1);
+    bool builder = ObjIsStringBuilder(pObj);
+    if (!builder && !ObjIsString(pObj))
+        PROTO_THROW(g_exType, E_NotAString);
+
+    int len1 = StringChars(pObj);
+    int len2 = StringLength(str2);
+    if (len1 + len2 > MAX_CHARS)
+        PROTO_THROW(g_exFr, E_StringTooBig);
+    if (len2 == 0)
+        return;
+
+    if (ObjIsCompact(pObj)) {
+        Object* pObj2 = V_PTR(str2);
+        if (ObjIsCompact(pObj2)) {
+            Unshare(pObj);
+            pObj->pData = ResizeBinaryData(pObj, len1 + len2 + 1);
+            pObj->size = len1 + len2 + 1;
+            // The string can be appended to itself
+            Byte* p = (Byte*) pObj->pData;
+            memcpy(p + len1, pObj2->pData, len2);
+            p[len1 + len2] = 0;
+            return;
+        }
+        WidenString(pObj);
+    }
+
+    int size = (len1 + len2 + 1) * sizeof(TCHAR);
+    Unshare(pObj);
+    if (builder) {
+        pObj->pData = GrowBinaryData(pObj, size);
+        pObj->size = size;
+    }
+    else {
+        SetBinaryLength(str1, size);
+    }
+
+    TCHAR* p = (TCHAR*) pObj->pData;
+    if (V_PTR(str2) == pObj)
+        memcpy(p + len1, p, len1 * sizeof(TCHAR));
+    else
+        CopyStringChars(p + len1, str2);
+    p[len1 + len2] = 0;
+}
+
+Value   StringBuilderFinish(Value builder)
+{
+    Object* pObj = V_PTR(builder);
+    if (!ObjIsStringBuilder(pObj))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, builder);
+    pObj->cls = PSYM(string);
+    return builder;
+}
+
+//----------------------------------------------------------------
+// Comparing and searching
+//----------------------------------------------------------------
+
+// Case folding is by towlower, except that ASCII is done here so the
+// vector loops can do it too.
+
+inline UInt32   FoldChar(UInt32 c)
+{
+    if (c < 0x80)
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    return towlower((wint_t) c);
+}
+
+#if HAVE_SSE2
+inline __m128i  FoldASCII(__m128i v)
+{
+    // Bytes from 0x80 up are negative, so they're never in range
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+#endif
+
+#if HAVE_AVX2
+inline __m256i  FoldASCII(__m256i v)
+{
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    return _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+}
+#endif
+
+// Index of the first byte where a and b differ (ignoring ASCII case if
+// asked), or len. Other Latin-1 letters are left to the caller.
+
+int     MismatchBytes(const Byte* a, const Byte* b, int len, bool ignoreCase)
+{
+    int i = 0;
+#if HAVE_AVX2
+    for (; i + 32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        if (ignoreCase) {
+            va = FoldASCII(va);
+            vb = FoldASCII(vb);
+        }
+        UInt32 diff = ~(UInt32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (diff != 0)
+            return i + LowestBitIndex(diff);
+    }
+#endif
+#if HAVE_SSE2
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+        if (ignoreCase) {
+            va = FoldASCII(va);
+            vb = FoldASCII(vb);
+        }
+        UInt32 diff = ~(UInt32) _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+        if (diff != 0)
+            return i + LowestBitIndex(diff);
+    }
+#endif
+    for (; i < len; i++) {
+        UInt32 ca = a[i], cb = b[i];
+        if (ignoreCase && ca < 0x80 && cb < 0x80) {
+            ca = FoldChar(ca);
+            cb = FoldChar(cb);
+        }
+        if (ca != cb)
+            return i;
+    }
+    return len;
+}
+
+// Compares by character code, so a compact string compares the same as
+// its wide version.
+
+int     CompareStringChars(Object* pA, Object* pB, bool ignoreCase)
+{
+    int lenA = StringChars(pA);
+    int lenB = StringChars(pB);
+    int len = lenA < lenB ? lenA : lenB;
+    bool compact = ObjIsCompact(pA) && ObjIsCompact(pB);
+
+    for (int i = 0; i < len; i++) {
+        if (compact) {
+            i += MismatchBytes((const Byte*) pA->pData + i, (const Byte*) pB->pData + i,
+                               len - i, ignoreCase);
+            if (i == len)
+                break;
+        }
+        UInt32 ca = StringCharAt(pA, i);
+        UInt32 cb = StringCharAt(pB, i);
+        if (ignoreCase) {
+            ca = FoldChar(ca);
+            cb = FoldChar(cb);
+        }
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+    return lenA < lenB ? -1 : lenA > lenB;
+}
+
+bool    StringsEqual(Object* pA, Object* pB)
+{
+    int len = StringChars(pA);
+    if (StringChars(pB) != len)
+        return false;
+    if (ObjIsCompact(pA) == ObjIsCompact(pB)) {
+        int unit = ObjIsCompact(pA) ? 1 : sizeof(TCHAR);
+        return memcmp(pA->pData, pB->pData, len * unit) == 0;
+    }
+    return CompareStringChars(pA, pB, false) == 0;
+}
+
+// Index of the first occurrence of needle in hay at or after start, or -1.
+// The vector loops look for places where both the first and the last
+// characters of the needle match, and check those.
+
+int     FindBytes(const Byte* hay, int hayLen, const Byte* needle, int nLen, int start)
+{
+    int last = hayLen - nLen;
+    int i = start;
+    if (nLen == 0)
+        return i <= hayLen ? i : -1;
+
+#if HAVE_AVX2
+    __m256i first32 = _mm256_set1_epi8((char) needle[0]);
+    __m256i last32 = _mm256_set1_epi8((char) needle[nLen - 1]);
+    for (; i + 31 <= last; i += 32) {
+        __m256i b1 = _mm256_loadu_si256((const __m256i*) (hay + i));
+        __m256i b2 = _mm256_loadu_si256((const __m256i*) (hay + i + nLen - 1));
+        UInt32 mask = (UInt32) _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(b1, first32), _mm256_cmpeq_epi8(b2, last32)));
+        for (; mask != 0; mask &= mask - 1) {
+            int j = i + LowestBitIndex(mask);
+            if (memcmp(hay + j, needle, nLen) == 0)
+                return j;
+        }
+    }
+#endif
+#if HAVE_SSE2
+    __m128i first16 = _mm_set1_epi8((char) needle[0]);
+    __m128i last16 = _mm_set1_epi8((char) needle[nLen - 1]);
+    for (; i + 15 <= last; i += 16) {
+        __m128i b1 = _mm_loadu_si128((const __m128i*) (hay + i));
+        __m128i b2 = _mm_loadu_si128((const __m128i*) (hay + i + nLen - 1));
+        UInt32 mask = (UInt32) _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(b1, first16), _mm_cmpeq_epi8(b2, last16)));
+        for (; mask != 0; mask &= mask - 1) {
+            int j = i + LowestBitIndex(mask);
+            if (memcmp(hay + j, needle, nLen) == 0)
+                return j;
+        }
+    }
+#endif
+    for (; i <= last; i++) {
+        if (hay[i] == needle[0] && memcmp(hay + i, needle, nLen) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int     FindWide(const TCHAR* hay, int hayLen, const TCHAR* needle, int nLen, int start)
+{
+    int last = hayLen - nLen;
+    int i = start;
+    if (nLen == 0)
+        return i <= hayLen ? i : -1;
+
+#if HAVE_SSE2
+    if (sizeof(TCHAR) == 4) {
+        __m128i first = _mm_set1_epi32((int) needle[0]);
+        __m128i lastc = _mm_set1_epi32((int) needle[nLen - 1]);
+        for (; i + 3 <= last; i += 4) {
+            __m128i b1 = _mm_loadu_si128((const __m128i*) (hay + i));
+            __m128i b2 = _mm_loadu_si128((const __m128i*) (hay + i + nLen - 1));
+            __m128i hits = _mm_and_si128(_mm_cmpeq_epi32(b1, first), _mm_cmpeq_epi32(b2, lastc));
+            UInt32 mask = (UInt32) _mm_movemask_ps(_mm_castsi128_ps(hits));
+            for (; mask != 0; mask &= mask - 1) {
+                int j = i + LowestBitIndex(mask);
+                if (memcmp(hay + j, needle, nLen * sizeof(TCHAR)) == 0)
+                    return j;
+            }
+        }
+    }
+#endif
+    for (; i <= last; i++) {
+        if (hay[i] == needle[0] && memcmp(hay + i, needle, nLen * sizeof(TCHAR)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// The needle is converted to the haystack's form. A needle that can't be
+// made compact isn't in a compact haystack.
+
+int     FindString(Object* pHay, Object* pNeedle, int start)
+{
+    int hayLen = StringChars(pHay);
+    int nLen = StringChars(pNeedle);
+    if (start < 0)
+        start = 0;
+    if (start > hayLen)
+        return -1;
+
+    bool compact = ObjIsCompact(pHay);
+    const void* needle = CharsAs(pNeedle, nLen, compact);
+    if (needle == NULL)
+        return -1;
+    if (compact)
+        return FindBytes((const Byte*) pHay->pData, hayLen, (const Byte*) needle, nLen, start);
+    return FindWide((const TCHAR*) pHay->pData, hayLen, (const TCHAR*) needle, nLen, start);
+}
+
+int     StrCompare(Value str1, Value str2, bool ignoreCase)
+{
+    return CompareStringChars(V_PTR(FlattenString(str1)), V_PTR(FlattenString(str2)), ignoreCase);
+}
+
+int     StrPos(Value str, Value substr, int start)
+{
+    return FindString(V_PTR(FlattenString(str)), V_PTR(FlattenString(substr)), start);
+}
+
+// Replaces the first count occurrences (all of them if count is negative)
+// in place. The result is built on the side and copied back, since the
+// occurrences can be in the replacement too.
+
+int     StrReplace(Value str, Value substr, Value replacement, int count)
+{
+    Object* pObj = FlatObject(str);
+    if (!ObjIsString(pObj))
+        PROTO_THROW_ERR(g_exType, E_NotAString, str);
+    Object* pFind = V_PTR(FlattenString(substr));
+    Object* pRepl = V_PTR(FlattenString(replacement));
+    int len = StringChars(pObj);
+    int findLen = StringChars(pFind);
+    int replLen = StringChars(pRepl);
+    if (findLen == 0 || count == 0)
+        return 0;
+
+    int n = 0;
+    for (int pos = FindString(pObj, pFind, 0); pos >= 0 && n != count;
+         pos = FindString(pObj, pFind, pos + findLen))
+        n++;
+    if (n == 0)
+        return 0;
+
+    IntPtr newLen = len + (IntPtr) n * (replLen - findLen);
+    if (newLen > MAX_CHARS)
+        PROTO_THROW(g_exFr, E_StringTooBig);
+    if (ObjIsCompact(pObj) && CharsAs(pRepl, replLen, true) == NULL)
+        WidenString(pObj);
+
+    bool compact = ObjIsCompact(pObj);
+    int unit = compact ? 1 : sizeof(TCHAR);
+    const Byte* repl = (const Byte*) CharsAs(pRepl, replLen, compact);
+    Byte* buf = (Byte*) AllocData((newLen + 1) * unit);
+    Byte* dest = buf;
+    int pos = 0;
+    for (int i = 0; i < n; i++) {
+        int found = FindString(pObj, pFind, pos);
+        memcpy(dest, (const Byte*) pObj->pData + pos * unit, (found - pos) * unit);
+        dest += (found - pos) * unit;
+        memcpy(dest, repl, replLen * unit);
+        dest += replLen * unit;
+        pos = found + findLen;
+    }
+    memcpy(dest, (const Byte*) pObj->pData + pos * unit, (len - pos + 1) * unit);
+
+    Unshare(pObj);
+    pObj->pData = ResizeBinaryData(pObj, (newLen + 1) * unit);
+    pObj->size = (newLen + 1) * unit;
+    memcpy(pObj->pData, buf, (newLen + 1) * unit);
+    return n;
+}
+
+//----------------------------------------------------------------
+// Stringer
+//----------------------------------------------------------------
+
+// Stringer concatenates an array of strings, numbers, characters, and
+// symbols (nil is nothing). The first pass works out exactly how long the
+// result is and whether it can be compact, so the second can format
+// everything straight into it.
+
+static const char g_digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+int     CountDigits(UIntPtr n)
+{
+    int digits = 1;
+    for (;;) {
+        if (n < 10)
+            return digits;
+        if (n < 100)
+            return digits + 1;
+        if (n < 1000)
+            return digits + 2;
+        if (n < 10000)
+            return digits + 3;
+        n /= 10000;
+        digits += 4;
+    }
+}
+
+inline UIntPtr  Magnitude(IntPtr i)
+{
+    return (i < 0) ? (UIntPtr) 0 - (UIntPtr) i : (UIntPtr) i;
+}
+
+inline int  IntChars(IntPtr i)
+{
+    return CountDigits(Magnitude(i)) + (i < 0);
+}
+
+// Writes the digits backwards from the end, two at a time.
+
+template<typename CHAR_T>
+CHAR_T*     FormatInt(CHAR_T* dest, IntPtr i)
+{
+    int len = IntChars(i);
+    CHAR_T* p = dest + len;
+    UIntPtr n = Magnitude(i);
+    while (n >= 100) {
+        int pair = (int) (n % 100) * 2;
+        n /= 100;
+        *--p = g_digitPairs[pair + 1];
+        *--p = g_digitPairs[pair];
+    }
+    if (n >= 10) {
+        *--p = g_digitPairs[n * 2 + 1];
+        *--p = g_digitPairs[n * 2];
+    }
+    else
+        *--p = (CHAR_T) ('0' + n);
+    if (i < 0)
+        *--p = '-';
+    return dest + len;
+}
+
+// The shortest of %.15g, %.16g, and %.17g that reads back as the same
+// number. (17 digits always does.)
+
+const int REAL_CHARS = 32;
+
+int     FormatReal(char* buf, double d)
+{
+    int len = 0;
+    for (int precision = 15; precision <= 17; precision++) {
+        len = sprintf(buf, "%.*g", precision, d);
+        if (strtod(buf, NULL) == d || d != d)
+            break;
+    }
+    return len;
+}
+
+struct StringerPass {
+    int     len;
+    bool    wide;
+    char*   reals;      // Each real, formatted, REAL_CHARS apart
+    int     nReals;
+};
+
+// Ropes are flattened, for good, so the second pass gets the same string.
+
+Object* PieceString(Value v)
+{
+    return FlatObject(v);
+}
+
+// A wide piece can still go in a compact result if its characters fit.
+
+bool    FitsCompact(Object* pStr)
+{
+    if (ObjIsCompact(pStr))
+        return true;
+    const TCHAR* p = (const TCHAR*) pStr->pData;
+    int len = StringChars(pStr);
+    for (int i = 0; i < len; i++) {
+        if ((UInt32) p[i] > 0xFF)
+            return false;
+    }
+    return true;
+}
+
+void    SizeStringerPiece(Value v, StringerPass& pass, int nPieces)
+{
+    if (V_ISINT(v)) {
+        pass.len += IntChars(UNSAFE_V_INT(v));
+    }
+    else if (V_ISCHAR(v)) {
+        pass.len++;
+        if ((UInt32) V_CHAR(v) > 0xFF)
+            pass.wide = true;
+    }
+    else if (v == V_NIL) {
+    }
+    else if (IsReal(v)) {
+        if (pass.reals == NULL)
+            pass.reals = (char*) AllocData(nPieces * REAL_CHARS);
+        pass.len += FormatReal(pass.reals + pass.nReals++ * REAL_CHARS, V_REAL(v));
+    }
+    else if (V_ISPTR(v) && ObjIsSymbol(V_PTR(v))) {
+        pass.len += strlen(SymbolName(v));
+    }
+    else if (V_ISPTR(v) && (IsString(v) || ObjIsStringBuilder(V_PTR(v)))) {
+        Object* pStr = PieceString(v);
+        pass.len += StringChars(pStr);
+        if (!pass.wide && !FitsCompact(pStr))
+            pass.wide = true;
+    }
+    else
+        PROTO_THROW_ERR(g_exType, E_BadArguments, v);
+
+    if (pass.len > MAX_CHARS)
+        PROTO_THROW(g_exFr, E_StringTooBig);
+}
+
+template<typename CHAR_T>
+CHAR_T*     FormatStringerPiece(CHAR_T* dest, Value v, StringerPass& pass)
+{
+    if (V_ISINT(v))
+        return FormatInt(dest, UNSAFE_V_INT(v));
+
+    if (V_ISCHAR(v)) {
+        *dest = (CHAR_T) V_CHAR(v);
+        return dest + 1;
+    }
+
+    if (v == V_NIL)
+        return dest;
+
+    if (IsReal(v)) {
+        const char* p = pass.reals + pass.nReals++ * REAL_CHARS;
+        while (*p != 0)
+            *dest++ = *p++;
+        return dest;
+    }
+
+    if (ObjIsSymbol(UNSAFE_V_PTR(v))) {
+        for (const char* p = SymbolName(v); *p != 0; p++)
+            *dest++ = (CHAR_T) (Byte) *p;
+        return dest;
+    }
+
+    Object* pStr = PieceString(v);
+    int len = StringChars(pStr);
+    if (ObjIsCompact(pStr) && sizeof(CHAR_T) == 1)
+        memcpy(dest, pStr->pData, len);
+    else {
+        for (int i = 0; i < len; i++)
+            dest[i] = (CHAR_T) StringCharAt(pStr, i);
+    }
+    return dest + len;
+}
+
+Value   Stringer(Value array)
+{
+    Object* pArray = V_PTR(array);
+    if (!ObjIsArray(pArray) || ObjIsFrameTable(pArray) || ObjIsRope(pArray))
+        PROTO_THROW_ERR(g_exType, E_NotAnArray, array);
+
+    int nPieces;
+    const Value* pSlots = ReadOnlySlots(array, &nPieces);
+    StringerPass pass;
+    pass.len = 0;
+    pass.wide = false;
+    pass.reals = NULL;
+    pass.nReals = 0;
+    for (int i = 0; i < nPieces; i++)
+        SizeStringerPiece(pSlots ? pSlots[i] : GetSlot(array, i), pass, nPieces);
+
+    pass.nReals = 0;
+    if (!pass.wide) {
+        Value result = NewCompactString(pass.len);
+        Byte* p = (Byte*) UNSAFE_V_PTR(result)->pData;
+        for (int i = 0; i < nPieces; i++)
+            p = FormatStringerPiece(p, pSlots ? pSlots[i] : GetSlot(array, i), pass);
+        return result;
+    }
+
+    Value result = NewString((pass.len + 1) * sizeof(TCHAR));
+    TCHAR* p = (TCHAR*) UNSAFE_V_PTR(result)->pData;
+    for (int i = 0; i < nPieces; i++)
+        p = FormatStringerPiece(p, pSlots ? pSlots[i] : GetSlot(array, i), pass);
+    *p = 0;
+    return result;
+}
+
+Value   NumberStr(Value number)
+{
+    if (!V_ISINT(number) && !IsReal(number))
+        PROTO_THROW_ERR(g_exType, E_NotANumber, number);
+
+    Value array = NewArray(1);
+    SetSlot(array, 0, number);
+    return Stringer(array);
+}
+
+//----------------------------------------------------------------
+// Natives
+//----------------------------------------------------------------
+
+NATIVE_FUNC(FNewStringBuilder)
+{
+    return NewStringBuilder();
+}
+
+DECLARE_GLOBAL_FUNCTION("NewStringBuilder", FNewStringBuilder, 0);
+
+NATIVE_FUNC(FStringBuilderAppend)
+{
+    NATIVE_ARGS_2(builder, str);
+    if (!ObjIsStringBuilder(V_PTR(ARG(builder))))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, ARG(builder));
+    StrAppend(ARG(builder), ARG(str));
+    return ARG(builder);
+}
+
+DECLARE_GLOBAL_FUNCTION("StringBuilderAppend", FStringBuilderAppend, 2);
+
+NATIVE_FUNC(FStringBuilderFinish)
+{
+    NATIVE_ARGS_1(builder);
+    return StringBuilderFinish(ARG(builder));
+}
+
+DECLARE_GLOBAL_FUNCTION("StringBuilderFinish", FStringBuilderFinish, 1);
+
+NATIVE_FUNC(FStrConcat)
+{
+    NATIVE_ARGS_2(str1, str2);
+    return StrConcat(ARG(str1), ARG(str2));
+}
+
+DECLARE_GLOBAL_FUNCTION("StrConcat", FStrConcat, 2);
+
+NATIVE_FUNC(FStrFlatten)
+{
+    NATIVE_ARGS_1(str);
+    return FlattenString(ARG(str));
+}
+
+DECLARE_GLOBAL_FUNCTION("StrFlatten", FStrFlatten, 1);
+
+NATIVE_FUNC(FStrEqual)
+{
+    NATIVE_ARGS_2(str1, str2);
+    return BOOL_V(StrCompare(ARG(str1), ARG(str2), true) == 0);
+}
+
+DECLARE_GLOBAL_FUNCTION("StrEqual", FStrEqual, 2);
+
+NATIVE_FUNC(FStrCompare)
+{
+    NATIVE_ARGS_2(str1, str2);
+    return INT_V(StrCompare(ARG(str1), ARG(str2), true));
+}
+
+DECLARE_GLOBAL_FUNCTION("StrCompare", FStrCompare, 2);
+
+NATIVE_FUNC(FStrExactCompare)
+{
+    NATIVE_ARGS_2(str1, str2);
+    return INT_V(StrCompare(ARG(str1), ARG(str2), false));
+}
+
+DECLARE_GLOBAL_FUNCTION("StrExactCompare", FStrExactCompare, 2);
+
+NATIVE_FUNC(FStrPos)
+{
+    NATIVE_ARGS_3(str, substr, start);
+    int pos = StrPos(ARG(str), ARG(substr), V_INDEX(ARG(start)));
+    return pos < 0 ? V_NIL : INT_V(pos);
+}
+
+DECLARE_GLOBAL_FUNCTION("StrPos", FStrPos, 3);
+
+NATIVE_FUNC(FStrReplace)
+{
+    NATIVE_ARGS_4(str, substr, replacement, count);
+    int n = (ARG(count) == V_NIL) ? -1 : V_INDEX(ARG(count));
+    return INT_V(StrReplace(ARG(str), ARG(substr), ARG(replacement), n));
+}
+
+DECLARE_GLOBAL_FUNCTION("StrReplace", FStrReplace, 4);
+
+NATIVE_FUNC(FStringer)
+{
+    NATIVE_ARGS_1(array);
+    return Stringer(ARG(array));
+}
+
+DECLARE_GLOBAL_FUNCTION("Stringer", FStringer, 1);
+
+NATIVE_FUNC(FNumberStr)
+{
+    NATIVE_ARGS_1(number);
+    return NumberStr(ARG(number));
+}
+
+DECLARE_GLOBAL_FUNCTION("NumberStr", FNumberStr, 1);
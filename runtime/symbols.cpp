@@ -9,68 +9,147 @@
 
 #include "config.h"
 #include "objects-private.h"
+#include "symhash.h"
+#include "gcalloc.h"
 #include "gc.h"
 #include <string.h>
 
-// BUGBUG: should be replaced with double hashing
+// The symbol table is open-addressed with linear probing. Each entry caches
+// the hash, length, and name of its symbol, so a probe can reject a
+// candidate without touching the symbol object, and only has to compare
+// names when the lengths and hashes agree.
 
-struct Bucket {
-    Bucket*     next;
-    Value       sym;
+struct SymEntry {
+    int         hash;
+    int         len;
+    const char* name;
+    Value       sym;        // 0 if the entry is empty
 };
 
-Bucket*     g_buckets[16];
+const int   SYMTAB_MIN = 1024;     // Must be a power of two
 
-int     SymbolHash(const char* name)
+SymEntry*   g_symTable;
+int         g_symCapacity;
+int         g_symCount;
+
+// Symbol names live in an arena so interning a symbol costs one small
+// allocation (the header) instead of two. Arena chunks are kept alive by
+// the symbol headers pointing into them. Symbols are never collected
+// anyway, since the table refers to all of them.
+
+const int   SYM_ARENA_CHUNK = 16384;
+
+char*       g_symArena;
+int         g_symArenaLeft;
+
+SymbolData* AllocSymbolData(int size)
+{
+    size = (size + sizeof(int) - 1) & ~(sizeof(int) - 1);
+
+    // Don't waste the rest of a chunk on a ridiculously long name
+    if (size > SYM_ARENA_CHUNK / 4)
+        return (SymbolData*) GC_MALLOC_ATOMIC(size);
+
+    if (size > g_symArenaLeft) {
+        g_symArena = (char*) GC_MALLOC_ATOMIC(SYM_ARENA_CHUNK);
+        g_symArenaLeft = SYM_ARENA_CHUNK;
+    }
+
+    SymbolData* pSymData = (SymbolData*) g_symArena;
+    g_symArena += size;
+    g_symArenaLeft -= size;
+    return pSymData;
+}
+
+// Finds the entry for the given name, or the empty entry where it should go.
+
+SymEntry*   FindSymEntry(const char* name, int len, int hash)
+{
+    int mask = g_symCapacity - 1;
+    int index = hash & mask;
+    for (;;) {
+        SymEntry* pEntry = &g_symTable[index];
+        if (pEntry->sym == 0)
+            return pEntry;
+        if (pEntry->len == len && pEntry->hash == hash && !strcasecmp(pEntry->name, name))
+            return pEntry;
+        index = (index + 1) & mask;
+    }
+}
+
+void    ResizeSymTable(int newCapacity)
 {
-    int hash = 0;
-    while (*name) {
-        hash = hash * 67 + toupper(*name) - 113;     // As used by GCC
-        name++;
+    SymEntry* oldTable = g_symTable;
+    int oldCapacity = g_symCapacity;
+
+    g_symTable = (SymEntry*) GC_MALLOC(newCapacity * sizeof(SymEntry));
+    memset(g_symTable, 0, newCapacity * sizeof(SymEntry));
+    g_symCapacity = newCapacity;
+
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldTable[i].sym != 0)
+            *FindSymEntry(oldTable[i].name, oldTable[i].len, oldTable[i].hash) = oldTable[i];
     }
-    return hash;
 }
 
+// Adds a new symbol to the table. pEntry must be the empty entry returned
+// by FindSymEntry for this symbol's name.
+
+void    AddSymEntry(SymEntry* pEntry, Value sym, SymbolData* pSymData, int len)
+{
+    pEntry->hash = pSymData->hash;
+    pEntry->len = len;
+    pEntry->name = pSymData->name;
+    pEntry->sym = sym;
+    g_symCount++;
+
+    // Grow if more than 3/4 full
+    if (g_symCount > g_symCapacity / 2 + g_symCapacity / 4)
+        ResizeSymTable(g_symCapacity * 2);
+}
+
+// The predefined symbols' hashes are computed at build time by tools/mkpredef.
+
 void    InternPredefSyms(Value syms[], int len)
 {
+    if (g_symTable == 0)
+        ResizeSymTable(SYMTAB_MIN);
+
     for (int i = 0; i < len; i++) {
         SymbolData* pSymData = (SymbolData*) GetData(syms[i]);
-        // BUGBUG: Hash should be precalculated
-        pSymData->hash = SymbolHash(pSymData->name);
-        int bucket = pSymData->hash & (ARRAYSIZE(g_buckets) - 1);
-        Bucket* pBucket = GC_NEW(Bucket);
-        pBucket->next = g_buckets[bucket];
-        pBucket->sym = syms[i];
-        g_buckets[bucket] = pBucket;
+        int nameLen = strlen(pSymData->name);
+        ASSERT(pSymData->hash == SymbolHash(pSymData->name));
+        SymEntry* pEntry = FindSymEntry(pSymData->name, nameLen, pSymData->hash);
+        ASSERT(pEntry->sym == 0);
+        AddSymEntry(pEntry, syms[i], pSymData, nameLen);
     }
 }
 
 Value   Intern(const char* name)
 {
-    int len = offsetof(SymbolData, name[0]) + strlen(name) + 1;
-    int hash = SymbolHash(name);
-    int bucket = hash & (ARRAYSIZE(g_buckets) - 1);
-
-    Bucket* pBucket = g_buckets[bucket];
-    while (pBucket) {
-        Value sym = pBucket->sym;
-        if (GetBinaryLength(sym) == len) {
-            SymbolData* pSymData = (SymbolData*) GetData(sym);
-            if (pSymData->hash == hash && !strcasecmp(pSymData->name, name))
-                return sym;
-        }
-        pBucket = pBucket->next;
-    }
+    if (g_symTable == 0)
+        ResizeSymTable(SYMTAB_MIN);
 
-    Value sym = NewBinary(SYMBOL_CLASS, len);
-    SymbolData* pSymData = (SymbolData*) GetData(sym);
+    int len;
+    int hash = SymbolHash(name, &len);
+
+    SymEntry* pEntry = FindSymEntry(name, len, hash);
+    if (pEntry->sym != 0)
+        return pEntry->sym;
+
+    int size = offsetof(SymbolData, name[0]) + len + 1;
+    SymbolData* pSymData = AllocSymbolData(size);
     pSymData->hash = hash;
-    strcpy(pSymData->name, name);
+    memcpy(pSymData->name, name, len + 1);
+
+    Object* pObj = AllocObject();
+    pObj->size = size;
+    pObj->flags = 0;
+    pObj->cls = SYMBOL_CLASS;
+    pObj->pData = pSymData;
+    Value sym = PTR_V(pObj);
 
-    pBucket = GC_NEW(Bucket);
-    pBucket->next = g_buckets[bucket];
-    pBucket->sym = sym;
-    g_buckets[bucket] = pBucket;
+    AddSymEntry(pEntry, sym, pSymData, len);
 
     return sym;
 }
@@ -0,0 +1,47 @@
+/*
+    Proto language runtime
+
+    Symbol hash function
+
+    Shared by the runtime and by tools/mkpredef, which precomputes the
+    hashes of the predefined symbols at build time. The two must agree,
+    so don't change one without rebuilding the other.
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#ifndef __SYMHASH_H__
+#define __SYMHASH_H__
+
+#include "config.h"
+
+// Symbols are case-insensitive, so the hash folds ASCII case. It's FNV-1a
+// with a final avalanche step so that the low bits (which are all the
+// hash tables look at) depend on every character of the name.
+//
+// Optionally returns the length of the name, since we're walking it anyway.
+
+inline int  SymbolHash(const char* name, int* pLen = 0)
+{
+    UInt32 hash = 2166136261u;
+    const char* p = name;
+    while (*p) {
+        UInt32 c = (Byte) *p++;
+        if (c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+        hash = (hash ^ c) * 16777619u;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+
+    if (pLen != 0)
+        *pLen = (int) (p - name);
+    return (int) hash;
+}
+
+#endif //__SYMHASH_H__
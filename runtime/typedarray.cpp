@@ -0,0 +1,917 @@
+/*
+    Proto language runtime
+
+    Typed arrays: unboxed numeric arrays
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "gcalloc.h"
+#include "predefined.h"
+#include "native.h"
+#include "simd.h"
+#include <string.h>
+#include <algorithm>
+
+// Numbers in an ordinary array are Values, and every real that can't be an
+// immediate is a binary object of its own. A typed array keeps raw numbers
+// in one binary instead, so a signal of a million samples is one object,
+// and the kernels below can run over it with the vector units.
+//
+// There are three kinds, told apart by class:
+//
+//      int32Array      signed 32-bit integers
+//      float64Array    doubles
+//      uint8Array      unsigned bytes
+//
+// Indexing and Length work on them as they do on arrays. Getting an
+// element of a float64Array makes a real, so code that wants to avoid
+// that should use the kernels. The arithmetic kernels work in place, and
+// integer arithmetic wraps around the way it does in C.
+
+enum {
+    TA_INT32,
+    TA_FLOAT64,
+    TA_UINT8
+};
+
+static const int g_elementSizes[] = { sizeof(Int32), sizeof(double), sizeof(Byte) };
+
+// The kind of a typed array, or -1 if it isn't one.
+
+int     TypedArrayKind(Object* pObj)
+{
+    if (!ObjIsBinary(pObj))
+        return -1;
+    if (pObj->cls == PSYM(int32Array))
+        return TA_INT32;
+    if (pObj->cls == PSYM(float64Array))
+        return TA_FLOAT64;
+    if (pObj->cls == PSYM(uint8Array))
+        return TA_UINT8;
+    return -1;
+}
+
+int     KindOfClass(Value cls)
+{
+    if (cls == PSYM(int32Array))
+        return TA_INT32;
+    if (cls == PSYM(float64Array))
+        return TA_FLOAT64;
+    if (cls == PSYM(uint8Array))
+        return TA_UINT8;
+    PROTO_THROW_ERR(g_exType, E_BadArguments, cls);
+    return -1;
+}
+
+int     TypedArrayElementSize(Object* pObj)
+{
+    return g_elementSizes[TypedArrayKind(pObj)];
+}
+
+int     TypedArrayLength(Object* pObj)
+{
+    return pObj->size / TypedArrayElementSize(pObj);
+}
+
+Object* CheckTypedArray(Value array)
+{
+    Object* pObj = V_PTR(array);
+    if (TypedArrayKind(pObj) < 0)
+        PROTO_THROW_ERR(g_exType, E_BadArguments, array);
+    return pObj;
+}
+
+// The elementwise kernels take two arrays of the same kind and length.
+
+Object* CheckSameShape(Object* pA, Value b)
+{
+    Object* pB = CheckTypedArray(b);
+    if (pB->cls != pA->cls || pB->size != pA->size)
+        PROTO_THROW_ERR(g_exType, E_BadArguments, b);
+    return pB;
+}
+
+// Integer results too big for an integer Value (on 32-bit builds) are
+// reals.
+
+Value   IntOrReal(long long i)
+{
+    if (i > MAX_INT_V || i < MIN_INT_V)
+        return REAL_V((double) i);
+    return INT_V((IntPtr) i);
+}
+
+double  RealArg(Value v)
+{
+    if (V_ISINT(v))
+        return (double) UNSAFE_V_INT(v);
+    if (!IsReal(v))
+        PROTO_THROW_ERR(g_exType, E_NotANumber, v);
+    return V_REAL(v);
+}
+
+IntPtr  IntArg(Value v, IntPtr lo, IntPtr hi)
+{
+    if (!V_ISINT(v))
+        PROTO_THROW_ERR(g_exType, E_NotAnInteger, v);
+    IntPtr i = UNSAFE_V_INT(v);
+    if (i < lo || i > hi)
+        PROTO_THROW_ERR(g_exFr, E_ValueOutOfRange, v);
+    return i;
+}
+
+Value   GetTypedArrayElement(Object* pObj, int index)
+{
+    if (index < 0 || index >= TypedArrayLength(pObj))
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    switch (TypedArrayKind(pObj)) {
+    case TA_INT32:
+        return IntOrReal(((const Int32*) pObj->pData)[index]);
+    case TA_FLOAT64:
+        return REAL_V(((const double*) pObj->pData)[index]);
+    case TA_UINT8:
+        return INT_V(((const Byte*) pObj->pData)[index]);
+    }
+    return V_NIL;
+}
+
+void    SetTypedArrayElement(Object* pObj, int index, Value v)
+{
+    if (index < 0 || index >= TypedArrayLength(pObj))
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    int kind = TypedArrayKind(pObj);
+    Unshare(pObj);
+    switch (kind) {
+    case TA_INT32:
+        ((Int32*) pObj->pData)[index] = (Int32) IntArg(v, -0x7FFFFFFF - 1, 0x7FFFFFFF);
+        break;
+    case TA_FLOAT64:
+        ((double*) pObj->pData)[index] = RealArg(v);
+        break;
+    case TA_UINT8:
+        ((Byte*) pObj->pData)[index] = (Byte) IntArg(v, 0, 0xFF);
+        break;
+    }
+}
+
+//----------------------------------------------------------------
+// Elementwise arithmetic
+//----------------------------------------------------------------
+
+enum {
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY
+};
+
+// The scalar versions, which also finish what the vector loops leave.
+// Integers are done unsigned (as WORD_T), so they wrap without overflowing.
+
+template<typename ELEM_T, typename WORD_T>
+void    ScalarOp(ELEM_T* dest, const ELEM_T* src, int i, int n, int op)
+{
+    for (; i < n; i++) {
+        WORD_T a = (WORD_T) dest[i];
+        WORD_T b = (WORD_T) src[i];
+        dest[i] = (ELEM_T) (op == OP_ADD ? a + b : op == OP_SUBTRACT ? a - b : a * b);
+    }
+}
+
+void    Float64Op(double* dest, const double* src, int n, int op)
+{
+    int i = 0;
+#if HAVE_AVX2
+    for (; i + 4 <= n; i += 4) {
+        __m256d a = _mm256_loadu_pd(dest + i);
+        __m256d b = _mm256_loadu_pd(src + i);
+        a = (op == OP_ADD) ? _mm256_add_pd(a, b)
+          : (op == OP_SUBTRACT) ? _mm256_sub_pd(a, b) : _mm256_mul_pd(a, b);
+        _mm256_storeu_pd(dest + i, a);
+    }
+#endif
+#if HAVE_SSE2
+    for (; i + 2 <= n; i += 2) {
+        __m128d a = _mm_loadu_pd(dest + i);
+        __m128d b = _mm_loadu_pd(src + i);
+        a = (op == OP_ADD) ? _mm_add_pd(a, b)
+          : (op == OP_SUBTRACT) ? _mm_sub_pd(a, b) : _mm_mul_pd(a, b);
+        _mm_storeu_pd(dest + i, a);
+    }
+#endif
+    ScalarOp<double, double>(dest, src, i, n, op);
+}
+
+// SSE2 can't multiply 32-bit integers, so that's left to AVX2.
+
+void    Int32Op(Int32* dest, const Int32* src, int n, int op)
+{
+    int i = 0;
+#if HAVE_AVX2
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (dest + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (src + i));
+        a = (op == OP_ADD) ? _mm256_add_epi32(a, b)
+          : (op == OP_SUBTRACT) ? _mm256_sub_epi32(a, b) : _mm256_mullo_epi32(a, b);
+        _mm256_storeu_si256((__m256i*) (dest + i), a);
+    }
+#endif
+#if HAVE_SSE2
+    for (; op != OP_MULTIPLY && i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (dest + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+        a = (op == OP_ADD) ? _mm_add_epi32(a, b) : _mm_sub_epi32(a, b);
+        _mm_storeu_si128((__m128i*) (dest + i), a);
+    }
+#endif
+    ScalarOp<Int32, UInt32>(dest, src, i, n, op);
+}
+
+// Bytes can only be added and subtracted by the vector units.
+
+void    Uint8Op(Byte* dest, const Byte* src, int n, int op)
+{
+    int i = 0;
+    if (op != OP_MULTIPLY) {
+#if HAVE_AVX2
+        for (; i + 32 <= n; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (dest + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (src + i));
+            a = (op == OP_ADD) ? _mm256_add_epi8(a, b) : _mm256_sub_epi8(a, b);
+            _mm256_storeu_si256((__m256i*) (dest + i), a);
+        }
+#endif
+#if HAVE_SSE2
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (dest + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + i));
+            a = (op == OP_ADD) ? _mm_add_epi8(a, b) : _mm_sub_epi8(a, b);
+            _mm_storeu_si128((__m128i*) (dest + i), a);
+        }
+#endif
+    }
+    ScalarOp<Byte, UInt32>(dest, src, i, n, op);
+}
+
+Value   ElementwiseOp(Value a, Value b, int op)
+{
+    Object* pA = CheckTypedArray(a);
+    Object* pB = CheckSameShape(pA, b);
+    int n = TypedArrayLength(pA);
+
+    // b can be a, so its data has to be looked at after a is unshared
+    Unshare(pA);
+    switch (TypedArrayKind(pA)) {
+    case TA_INT32:
+        Int32Op((Int32*) pA->pData, (const Int32*) pB->pData, n, op);
+        break;
+    case TA_FLOAT64:
+        Float64Op((double*) pA->pData, (const double*) pB->pData, n, op);
+        break;
+    case TA_UINT8:
+        Uint8Op((Byte*) pA->pData, (const Byte*) pB->pData, n, op);
+        break;
+    }
+    return a;
+}
+
+Value   TypedArrayAdd(Value a, Value b)
+{
+    return ElementwiseOp(a, b, OP_ADD);
+}
+
+Value   TypedArraySubtract(Value a, Value b)
+{
+    return ElementwiseOp(a, b, OP_SUBTRACT);
+}
+
+Value   TypedArrayMultiply(Value a, Value b)
+{
+    return ElementwiseOp(a, b, OP_MULTIPLY);
+}
+
+// dest[i] += src[i] * factor, the inner loop of scaling and convolution.
+
+void    Float64Axpy(double* dest, const double* src, int n, double factor)
+{
+    int i = 0;
+#if HAVE_AVX2
+    __m256d f4 = _mm256_set1_pd(factor);
+    for (; i + 4 <= n; i += 4) {
+        __m256d d = _mm256_loadu_pd(dest + i);
+        __m256d s = _mm256_loadu_pd(src + i);
+        _mm256_storeu_pd(dest + i, _mm256_add_pd(d, _mm256_mul_pd(s, f4)));
+    }
+#endif
+#if HAVE_SSE2
+    __m128d f2 = _mm_set1_pd(factor);
+    for (; i + 2 <= n; i += 2) {
+        __m128d d = _mm_loadu_pd(dest + i);
+        __m128d s = _mm_loadu_pd(src + i);
+        _mm_storeu_pd(dest + i, _mm_add_pd(d, _mm_mul_pd(s, f2)));
+    }
+#endif
+    for (; i < n; i++)
+        dest[i] += src[i] * factor;
+}
+
+// Integer arrays can only be scaled by integers.
+
+Value   TypedArrayScale(Value array, Value factor)
+{
+    Object* pObj = CheckTypedArray(array);
+    int n = TypedArrayLength(pObj);
+    int kind = TypedArrayKind(pObj);
+
+    if (kind == TA_FLOAT64) {
+        double f = RealArg(factor);
+        Unshare(pObj);
+        double* p = (double*) pObj->pData;
+        int i = 0;
+#if HAVE_AVX2
+        __m256d f4 = _mm256_set1_pd(f);
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(p + i, _mm256_mul_pd(_mm256_loadu_pd(p + i), f4));
+#endif
+#if HAVE_SSE2
+        __m128d f2 = _mm_set1_pd(f);
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(p + i, _mm_mul_pd(_mm_loadu_pd(p + i), f2));
+#endif
+        for (; i < n; i++)
+            p[i] *= f;
+        return array;
+    }
+
+    if (!V_ISINT(factor))
+        PROTO_THROW_ERR(g_exType, E_NotAnInteger, factor);
+    UInt32 f = (UInt32) UNSAFE_V_INT(factor);
+    Unshare(pObj);
+    if (kind == TA_INT32) {
+        Int32* p = (Int32*) pObj->pData;
+        int i = 0;
+#if HAVE_AVX2
+        __m256i f8 = _mm256_set1_epi32((int) f);
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+            _mm256_storeu_si256((__m256i*) (p + i), _mm256_mullo_epi32(v, f8));
+        }
+#endif
+        for (; i < n; i++)
+            p[i] = (Int32) ((UInt32) p[i] * f);
+    }
+    else {
+        Byte* p = (Byte*) pObj->pData;
+        for (int i = 0; i < n; i++)
+            p[i] = (Byte) (p[i] * f);
+    }
+    return array;
+}
+
+//----------------------------------------------------------------
+// Reductions
+//----------------------------------------------------------------
+
+double  SumFloat64(const double* p, int n)
+{
+    double sum = 0;
+    int i = 0;
+#if HAVE_AVX2
+    __m256d sum4 = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+        sum4 = _mm256_add_pd(sum4, _mm256_loadu_pd(p + i));
+    double lanes4[4];
+    _mm256_storeu_pd(lanes4, sum4);
+    sum += (lanes4[0] + lanes4[1]) + (lanes4[2] + lanes4[3]);
+#endif
+#if HAVE_SSE2
+    __m128d sum2 = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2)
+        sum2 = _mm_add_pd(sum2, _mm_loadu_pd(p + i));
+    double lanes2[2];
+    _mm_storeu_pd(lanes2, sum2);
+    sum += lanes2[0] + lanes2[1];
+#endif
+    for (; i < n; i++)
+        sum += p[i];
+    return sum;
+}
+
+// 32-bit integers are sign-extended to 64 bits before they're added, so
+// the sum of as many as a binary can hold doesn't overflow.
+
+long long   SumInt32(const Int32* p, int n)
+{
+    long long sum = 0;
+    int i = 0;
+#if HAVE_SSE2
+    __m128i sum2 = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        sum2 = _mm_add_epi64(sum2, _mm_unpacklo_epi32(v, sign));
+        sum2 = _mm_add_epi64(sum2, _mm_unpackhi_epi32(v, sign));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, sum2);
+    sum += lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++)
+        sum += p[i];
+    return sum;
+}
+
+// The sum of absolute differences from zero is the sum of the bytes.
+
+long long   SumUint8(const Byte* p, int n)
+{
+    long long sum = 0;
+    int i = 0;
+#if HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum2 = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+        sum2 = _mm_add_epi64(sum2, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) (p + i)), zero));
+    long long lanes[2];
+    _mm_storeu_si128((__m128i*) lanes, sum2);
+    sum += lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++)
+        sum += p[i];
+    return sum;
+}
+
+Value   TypedArraySum(Value array)
+{
+    Object* pObj = CheckTypedArray(array);
+    int n = TypedArrayLength(pObj);
+    switch (TypedArrayKind(pObj)) {
+    case TA_INT32:
+        return IntOrReal(SumInt32((const Int32*) pObj->pData, n));
+    case TA_FLOAT64:
+        return REAL_V(SumFloat64((const double*) pObj->pData, n));
+    case TA_UINT8:
+        return IntOrReal(SumUint8((const Byte*) pObj->pData, n));
+    }
+    return V_NIL;
+}
+
+// NaNs are skipped: the vector min and max return their second operand
+// when either is a NaN, and the comparisons are false. (So the result is a
+// NaN only if they all are.)
+
+double  Float64Extreme(const double* p, int n, bool greatest)
+{
+    int i = 0;
+    while (i < n - 1 && p[i] != p[i])
+        i++;
+    double best = p[i];
+#if HAVE_AVX2
+    if (n - i >= 4) {
+        __m256d best4 = _mm256_set1_pd(best);
+        for (; i + 4 <= n; i += 4) {
+            __m256d v = _mm256_loadu_pd(p + i);
+            best4 = greatest ? _mm256_max_pd(v, best4) : _mm256_min_pd(v, best4);
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, best4);
+        for (int lane = 0; lane < 4; lane++) {
+            if (greatest ? lanes[lane] > best : lanes[lane] < best)
+                best = lanes[lane];
+        }
+    }
+#endif
+#if HAVE_SSE2
+    if (n - i >= 2) {
+        __m128d best2 = _mm_set1_pd(best);
+        for (; i + 2 <= n; i += 2) {
+            __m128d v = _mm_loadu_pd(p + i);
+            best2 = greatest ? _mm_max_pd(v, best2) : _mm_min_pd(v, best2);
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, best2);
+        for (int lane = 0; lane < 2; lane++) {
+            if (greatest ? lanes[lane] > best : lanes[lane] < best)
+                best = lanes[lane];
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (greatest ? p[i] > best : p[i] < best)
+            best = p[i];
+    }
+    return best;
+}
+
+// SSE2 has no 32-bit min or max, so it compares and blends.
+
+Int32   Int32Extreme(const Int32* p, int n, bool greatest)
+{
+    Int32 best = p[0];
+    int i = 0;
+#if HAVE_AVX2
+    __m256i best8 = _mm256_set1_epi32(best);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+        best8 = greatest ? _mm256_max_epi32(v, best8) : _mm256_min_epi32(v, best8);
+    }
+    Int32 lanes8[8];
+    _mm256_storeu_si256((__m256i*) lanes8, best8);
+    for (int lane = 0; lane < 8; lane++) {
+        if (greatest ? lanes8[lane] > best : lanes8[lane] < best)
+            best = lanes8[lane];
+    }
+#endif
+#if HAVE_SSE2
+    __m128i best4 = _mm_set1_epi32(best);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        __m128i better = greatest ? _mm_cmpgt_epi32(v, best4) : _mm_cmpgt_epi32(best4, v);
+        best4 = _mm_or_si128(_mm_and_si128(better, v), _mm_andnot_si128(better, best4));
+    }
+    Int32 lanes4[4];
+    _mm_storeu_si128((__m128i*) lanes4, best4);
+    for (int lane = 0; lane < 4; lane++) {
+        if (greatest ? lanes4[lane] > best : lanes4[lane] < best)
+            best = lanes4[lane];
+    }
+#endif
+    for (; i < n; i++) {
+        if (greatest ? p[i] > best : p[i] < best)
+            best = p[i];
+    }
+    return best;
+}
+
+Byte    Uint8Extreme(const Byte* p, int n, bool greatest)
+{
+    Byte best = p[0];
+    int i = 0;
+#if HAVE_SSE2
+    __m128i best16 = _mm_set1_epi8((char) best);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        best16 = greatest ? _mm_max_epu8(v, best16) : _mm_min_epu8(v, best16);
+    }
+    Byte lanes[16];
+    _mm_storeu_si128((__m128i*) lanes, best16);
+    for (int lane = 0; lane < 16; lane++) {
+        if (greatest ? lanes[lane] > best : lanes[lane] < best)
+            best = lanes[lane];
+    }
+#endif
+    for (; i < n; i++) {
+        if (greatest ? p[i] > best : p[i] < best)
+            best = p[i];
+    }
+    return best;
+}
+
+// Returns nil for an empty array.
+
+Value   TypedArrayExtreme(Value array, bool greatest)
+{
+    Object* pObj = CheckTypedArray(array);
+    int n = TypedArrayLength(pObj);
+    if (n == 0)
+        return V_NIL;
+
+    switch (TypedArrayKind(pObj)) {
+    case TA_INT32:
+        return IntOrReal(Int32Extreme((const Int32*) pObj->pData, n, greatest));
+    case TA_FLOAT64:
+        return REAL_V(Float64Extreme((const double*) pObj->pData, n, greatest));
+    case TA_UINT8:
+        return INT_V(Uint8Extreme((const Byte*) pObj->pData, n, greatest));
+    }
+    return V_NIL;
+}
+
+Value   TypedArrayMin(Value array)
+{
+    return TypedArrayExtreme(array, false);
+}
+
+Value   TypedArrayMax(Value array)
+{
+    return TypedArrayExtreme(array, true);
+}
+
+double  DotFloat64(const double* a, const double* b, int n)
+{
+    double sum = 0;
+    int i = 0;
+#if HAVE_AVX2
+    __m256d sum4 = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+        sum4 = _mm256_add_pd(sum4, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    double lanes4[4];
+    _mm256_storeu_pd(lanes4, sum4);
+    sum += (lanes4[0] + lanes4[1]) + (lanes4[2] + lanes4[3]);
+#endif
+#if HAVE_SSE2
+    __m128d sum2 = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2)
+        sum2 = _mm_add_pd(sum2, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    double lanes2[2];
+    _mm_storeu_pd(lanes2, sum2);
+    sum += lanes2[0] + lanes2[1];
+#endif
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+// Products of 32-bit integers are 64 bits, and so is the sum, which wraps
+// if it has to.
+
+long long   DotInt32(const Int32* a, const Int32* b, int n)
+{
+    unsigned long long sum = 0;
+    int i = 0;
+#if HAVE_AVX2
+    __m256i sum4 = _mm256_setzero_si256();
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (a + i)));
+        __m256i y = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (b + i)));
+        sum4 = _mm256_add_epi64(sum4, _mm256_mul_epi32(x, y));
+    }
+    unsigned long long lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, sum4);
+    sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < n; i++)
+        sum += (unsigned long long) ((long long) a[i] * b[i]);
+    return (long long) sum;
+}
+
+Value   TypedArrayDot(Value a, Value b)
+{
+    Object* pA = CheckTypedArray(a);
+    Object* pB = CheckSameShape(pA, b);
+    int n = TypedArrayLength(pA);
+
+    switch (TypedArrayKind(pA)) {
+    case TA_INT32:
+        return IntOrReal(DotInt32((const Int32*) pA->pData, (const Int32*) pB->pData, n));
+    case TA_FLOAT64:
+        return REAL_V(DotFloat64((const double*) pA->pData, (const double*) pB->pData, n));
+    case TA_UINT8:
+        {
+            const Byte* x = (const Byte*) pA->pData;
+            const Byte* y = (const Byte*) pB->pData;
+            long long sum = 0;
+            for (int i = 0; i < n; i++)
+                sum += x[i] * y[i];
+            return IntOrReal(sum);
+        }
+    }
+    return V_NIL;
+}
+
+//----------------------------------------------------------------
+// Convolution and sorting
+//----------------------------------------------------------------
+
+// Makes the full convolution, of length n + m - 1, of the same kind. Each
+// kernel element adds a scaled copy of the signal to the result, which is
+// a loop the vector units can do. Integers are added up in 64 bits and
+// then wrapped to fit.
+
+Value   TypedArrayConvolve(Value signal, Value kernel)
+{
+    Object* pSignal = CheckTypedArray(signal);
+    Object* pKernel = CheckTypedArray(kernel);
+    if (pKernel->cls != pSignal->cls)
+        PROTO_THROW_ERR(g_exType, E_BadArguments, kernel);
+    int n = TypedArrayLength(pSignal);
+    int m = TypedArrayLength(pKernel);
+    if (n == 0 || m == 0)
+        return NewTypedArray(pSignal->cls, 0);
+
+    int kind = TypedArrayKind(pSignal);
+    if ((long long) (n + (long long) m - 1) * g_elementSizes[kind] > MAX_DATA)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+    Value result = NewTypedArray(pSignal->cls, n + m - 1);
+    Object* pResult = UNSAFE_V_PTR(result);
+
+    if (kind == TA_FLOAT64) {
+        double* out = (double*) pResult->pData;
+        const double* s = (const double*) pSignal->pData;
+        const double* k = (const double*) pKernel->pData;
+        for (int j = 0; j < m; j++)
+            Float64Axpy(out + j, s, n, k[j]);
+        return result;
+    }
+
+    long long* sums = (long long*) AllocData((n + m - 1) * sizeof(long long));
+    memset(sums, 0, (n + m - 1) * sizeof(long long));
+    for (int j = 0; j < m; j++) {
+        long long kj = (kind == TA_INT32) ? ((const Int32*) pKernel->pData)[j]
+                                          : ((const Byte*) pKernel->pData)[j];
+        for (int i = 0; i < n; i++) {
+            long long si = (kind == TA_INT32) ? ((const Int32*) pSignal->pData)[i]
+                                              : ((const Byte*) pSignal->pData)[i];
+            sums[i + j] = (long long) ((unsigned long long) sums[i + j] + (unsigned long long) (si * kj));
+        }
+    }
+    for (int i = 0; i < n + m - 1; i++) {
+        if (kind == TA_INT32)
+            ((Int32*) pResult->pData)[i] = (Int32) (UInt32) sums[i];
+        else
+            ((Byte*) pResult->pData)[i] = (Byte) sums[i];
+    }
+    return result;
+}
+
+// NaNs go at the end.
+
+inline bool RealLess(double a, double b)
+{
+    return a < b || (a == a && b != b);
+}
+
+// Sorts in place, ascending. Bytes are counted rather than compared.
+
+Value   TypedArraySort(Value array)
+{
+    Object* pObj = CheckTypedArray(array);
+    int n = TypedArrayLength(pObj);
+    Unshare(pObj);
+
+    switch (TypedArrayKind(pObj)) {
+    case TA_INT32:
+        std::sort((Int32*) pObj->pData, (Int32*) pObj->pData + n);
+        break;
+    case TA_FLOAT64:
+        std::sort((double*) pObj->pData, (double*) pObj->pData + n, RealLess);
+        break;
+    case TA_UINT8:
+        {
+            int counts[256];
+            memset(counts, 0, sizeof(counts));
+            Byte* p = (Byte*) pObj->pData;
+            for (int i = 0; i < n; i++)
+                counts[p[i]]++;
+            for (int b = 0; b < 256; b++) {
+                memset(p, b, counts[b]);
+                p += counts[b];
+            }
+        }
+        break;
+    }
+    return array;
+}
+
+//----------------------------------------------------------------
+// Making them
+//----------------------------------------------------------------
+
+bool    IsTypedArray(Value obj)
+{
+    return V_ISPTR(obj) && TypedArrayKind(V_PTR(obj)) >= 0;
+}
+
+Value   NewTypedArray(Value cls, int length)
+{
+    int elementSize = g_elementSizes[KindOfClass(cls)];
+    if (length < 0 || length > MAX_DATA / elementSize)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+    Value array = NewBinary(cls, length * elementSize);
+    if (length > 0)     // An empty binary has no data
+        memset(UNSAFE_V_PTR(array)->pData, 0, length * elementSize);
+    return array;
+}
+
+Value   ArrayToTypedArray(Value array, Value cls)
+{
+    int n = GetArrayLength(array);
+    Value result = NewTypedArray(cls, n);
+    Object* pResult = UNSAFE_V_PTR(result);
+    for (int i = 0; i < n; i++)
+        SetTypedArrayElement(pResult, i, GetSlot(array, i));
+    return result;
+}
+
+Value   TypedArrayToArray(Value array)
+{
+    Object* pObj = CheckTypedArray(array);
+    int n = TypedArrayLength(pObj);
+    Value result = NewArray(n);
+    for (int i = 0; i < n; i++)
+        SetSlot(result, i, GetTypedArrayElement(pObj, i));
+    return result;
+}
+
+//----------------------------------------------------------------
+// Natives
+//----------------------------------------------------------------
+
+NATIVE_FUNC(FNewTypedArray)
+{
+    NATIVE_ARGS_2(cls, length);
+    return NewTypedArray(ARG(cls), V_INDEX(ARG(length)));
+}
+
+DECLARE_GLOBAL_FUNCTION("NewTypedArray", FNewTypedArray, 2);
+
+NATIVE_FUNC(FArrayToTypedArray)
+{
+    NATIVE_ARGS_2(array, cls);
+    return ArrayToTypedArray(ARG(array), ARG(cls));
+}
+
+DECLARE_GLOBAL_FUNCTION("ArrayToTypedArray", FArrayToTypedArray, 2);
+
+NATIVE_FUNC(FTypedArrayToArray)
+{
+    NATIVE_ARGS_1(array);
+    return TypedArrayToArray(ARG(array));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayToArray", FTypedArrayToArray, 1);
+
+NATIVE_FUNC(FTypedArrayAdd)
+{
+    NATIVE_ARGS_2(a, b);
+    return TypedArrayAdd(ARG(a), ARG(b));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayAdd", FTypedArrayAdd, 2);
+
+NATIVE_FUNC(FTypedArraySubtract)
+{
+    NATIVE_ARGS_2(a, b);
+    return TypedArraySubtract(ARG(a), ARG(b));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArraySubtract", FTypedArraySubtract, 2);
+
+NATIVE_FUNC(FTypedArrayMultiply)
+{
+    NATIVE_ARGS_2(a, b);
+    return TypedArrayMultiply(ARG(a), ARG(b));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayMultiply", FTypedArrayMultiply, 2);
+
+NATIVE_FUNC(FTypedArrayScale)
+{
+    NATIVE_ARGS_2(array, factor);
+    return TypedArrayScale(ARG(array), ARG(factor));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayScale", FTypedArrayScale, 2);
+
+NATIVE_FUNC(FTypedArrayDot)
+{
+    NATIVE_ARGS_2(a, b);
+    return TypedArrayDot(ARG(a), ARG(b));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayDot", FTypedArrayDot, 2);
+
+NATIVE_FUNC(FTypedArraySum)
+{
+    NATIVE_ARGS_1(array);
+    return TypedArraySum(ARG(array));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArraySum", FTypedArraySum, 1);
+
+NATIVE_FUNC(FTypedArrayMin)
+{
+    NATIVE_ARGS_1(array);
+    return TypedArrayMin(ARG(array));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayMin", FTypedArrayMin, 1);
+
+NATIVE_FUNC(FTypedArrayMax)
+{
+    NATIVE_ARGS_1(array);
+    return TypedArrayMax(ARG(array));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayMax", FTypedArrayMax, 1);
+
+NATIVE_FUNC(FTypedArrayConvolve)
+{
+    NATIVE_ARGS_2(signal, kernel);
+    return TypedArrayConvolve(ARG(signal), ARG(kernel));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArrayConvolve", FTypedArrayConvolve, 2);
+
+NATIVE_FUNC(FTypedArraySort)
+{
+    NATIVE_ARGS_1(array);
+    return TypedArraySort(ARG(array));
+}
+
+DECLARE_GLOBAL_FUNCTION("TypedArraySort", FTypedArraySort, 1);
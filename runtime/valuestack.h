@@ -0,0 +1,61 @@
+/*
+    Proto language runtime
+
+    Stacks of Values for traversing the heap without recursion
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#ifndef __VALUESTACK_H__
+#define __VALUESTACK_H__
+
+#include "gcalloc.h"
+#include <string.h>
+
+// A stack of Values that can get as big as it needs to. It starts out on
+// the C stack, and moves to the heap if it overflows.
+
+class ValueStack {
+public:
+    ValueStack()
+    {
+        m_values = m_initialValues;
+        m_size = 0;
+        m_capacity = ARRAYSIZE(m_initialValues);
+    }
+
+    bool    IsEmpty()
+    {
+        return m_size == 0;
+    }
+
+    void    Push(Value v)
+    {
+        if (m_size == m_capacity)
+            Grow();
+        m_values[m_size++] = v;
+    }
+
+    Value   Pop()
+    {
+        ASSERT(m_size > 0);
+        return m_values[--m_size];
+    }
+
+private:
+    void    Grow()
+    {
+        Value* newValues = AllocSlots(m_capacity * 2);
+        memcpy(newValues, m_values, m_size * sizeof(Value));
+        m_values = newValues;
+        m_capacity *= 2;
+    }
+
+    Value*  m_values;
+    int     m_size;
+    int     m_capacity;
+    Value   m_initialValues[64];
+};
+
+#endif //__VALUESTACK_H__
@@ -0,0 +1,496 @@
+/*
+    Proto language runtime
+
+    Value tables: hash tables keyed by any Value
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "gcalloc.h"
+#include "predefined.h"
+#include "native.h"
+#include "simd.h"
+#include <string.h>
+
+// Frames can only be keyed by symbols, so this is what you use when you
+// want to look things up by string, number, or object.
+//
+// Keys are equal if they're the same object, strings with the same
+// characters, or numbers with the same value. So strings hash by content,
+// reals by value, and everything else by identity.
+//
+// The table is open-addressed in the style of Google's SwissTable. Slots
+// come in groups of 16, and each slot has a control byte that says whether
+// it's empty, deleted, or full--and if full, holds 6 more bits of the key's
+// hash. A lookup compares a whole group of control bytes with the hash bits
+// at once, and only looks at the keys that match, so almost every key it
+// compares is the one it's looking for.
+//
+// A value table is an array of class valueTable, laid out like this:
+//
+//      count               number of keys, as an integer
+//      deleted             number of deleted slots, as an integer
+//      capacity            number of slots (a multiple of 16), as an integer
+//      key, value          capacity pairs
+//      control bytes       capacity bytes, packed into Values
+//
+// Keeping the control bytes in the same slot vector means a clone of the
+// table is just a clone of the array. The control bytes are always even,
+// so the collector sees the Values they're packed into as integers or
+// immediates, never as pointers.
+
+enum {
+    VT_COUNT,
+    VT_DELETED,
+    VT_CAPACITY,
+    VT_ENTRIES
+};
+
+const int   VT_GROUP = 16;
+const int   VT_MIN_CAPACITY = 16;
+
+const Byte  CTRL_EMPTY = 0x80;
+const Byte  CTRL_DELETED = 0xFE;
+
+inline Byte CtrlHashBits(UInt32 hash)
+{
+    return (Byte) ((hash & 0x3F) << 1);
+}
+
+inline int  TableArraySize(int capacity)
+{
+    return VT_ENTRIES + 2 * capacity + capacity / sizeof(Value);
+}
+
+inline Byte*    TableCtrl(Value* pSlots, int capacity)
+{
+    return (Byte*) (pSlots + VT_ENTRIES + 2 * capacity);
+}
+
+Object* CheckValueTable(Value table)
+{
+    Object* pObj = V_PTR(table);
+    if (!ObjIsArray(pObj) || pObj->cls != PSYM(valueTable))
+        PROTO_THROW_ERR(g_exType, E_BadArguments, table);
+    return pObj;
+}
+
+//----------------------------------------------------------------
+// Hashing keys
+//----------------------------------------------------------------
+
+// The MurmurHash3 finalizer, to spread out the bits of addresses and
+// small integers.
+
+inline UInt32   MixBits(UIntPtr x)
+{
+    UInt32 h = (UInt32) x;
+#if PROTO_64BIT
+    h ^= (UInt32) (x >> 32) * 0x85EBCA6B;
+#endif
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
+
+inline bool IsStringKey(Value v)
+{
+    return V_ISPTR(v) && IsString(v);
+}
+
+UInt32  HashValue(Value v)
+{
+    if (IsReal(v)) {
+        double d = V_REAL(v);
+        if (d == 0)
+            d = 0;          // -0.0 is equal to 0.0, so it has to hash the same
+        UIntPtr bits[sizeof(double) / sizeof(UIntPtr)];
+        memcpy(bits, &d, sizeof(d));
+        UInt32 h = MixBits(bits[0]);
+        for (int i = 1; i < (int) ARRAYSIZE(bits); i++)
+            h = MixBits(bits[i] ^ h);
+        return h;
+    }
+
+    if (V_ISPTR(v)) {
+        Object* pObj = FlatObject(v);
+        if (ObjIsString(pObj)) {
+            // FNV-1a, over the characters so a compact string hashes the
+            // same as its wide version
+            UInt32 h = 0x811C9DC5;
+            int len = StringChars(pObj);
+            for (int i = 0; i < len; i++)
+                h = (h ^ StringCharAt(pObj, i)) * 0x01000193;
+            return MixBits(h);
+        }
+        return MixBits((UIntPtr) pObj);
+    }
+
+    return MixBits((UIntPtr) v);
+}
+
+bool    ValueKeysEqual(Value a, Value b)
+{
+    if (a == b)
+        return true;
+
+    if (IsStringKey(a)) {
+        if (!IsStringKey(b))
+            return false;
+        return StringsEqual(FlatObject(a), FlatObject(b));
+    }
+
+    if (IsReal(a))
+        return IsReal(b) && V_REAL(a) == V_REAL(b);
+
+    return V_ISPTR(a) && V_ISPTR(b) && V_EQ(a, b);
+}
+
+//----------------------------------------------------------------
+// Probing
+//----------------------------------------------------------------
+
+// Bit i of the result is set if control byte i of the group is b.
+
+inline UInt32   MatchCtrl(const Byte* pGroup, Byte b)
+{
+#if HAVE_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*) pGroup);
+    return (UInt32) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) b)));
+#else
+    UInt32 mask = 0;
+    for (int i = 0; i < VT_GROUP; i++) {
+        if (pGroup[i] == b)
+            mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+// Same, for the empty and deleted bytes (the ones with the high bit set).
+
+inline UInt32   MatchFree(const Byte* pGroup)
+{
+#if HAVE_SSE2
+    return (UInt32) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) pGroup));
+#else
+    UInt32 mask = 0;
+    for (int i = 0; i < VT_GROUP; i++) {
+        if (pGroup[i] & 0x80)
+            mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+// Groups are probed in triangular order (1, 2, 3... groups apart), which
+// visits every group when the number of groups is a power of two. A probe
+// stops at a group with an empty slot, since nothing that hashed to an
+// earlier group would have been put past it.
+
+inline int  FirstGroup(UInt32 hash, int capacity)
+{
+    return (hash >> 7) & (capacity / VT_GROUP - 1);
+}
+
+// Returns the slot index of the key, or -1.
+
+int     FindKey(Value* pSlots, int capacity, Value key, UInt32 hash)
+{
+    Byte* ctrl = TableCtrl(pSlots, capacity);
+    Value* entries = pSlots + VT_ENTRIES;
+    Byte h2 = CtrlHashBits(hash);
+    int groupMask = capacity / VT_GROUP - 1;
+    int group = FirstGroup(hash, capacity);
+
+    for (int step = 1; ; step++) {
+        Byte* pGroup = ctrl + group * VT_GROUP;
+        for (UInt32 match = MatchCtrl(pGroup, h2); match != 0; match &= match - 1) {
+            int index = group * VT_GROUP + LowestBitIndex(match);
+            if (ValueKeysEqual(entries[2 * index], key))
+                return index;
+        }
+        if (MatchCtrl(pGroup, CTRL_EMPTY) != 0)
+            return -1;
+        group = (group + step) & groupMask;
+    }
+}
+
+// Returns the first empty or deleted slot on the key's probe sequence.
+// There always is one, since the table never gets full.
+
+int     FindFreeSlot(Value* pSlots, int capacity, UInt32 hash)
+{
+    Byte* ctrl = TableCtrl(pSlots, capacity);
+    int groupMask = capacity / VT_GROUP - 1;
+    int group = FirstGroup(hash, capacity);
+
+    for (int step = 1; ; step++) {
+        UInt32 match = MatchFree(ctrl + group * VT_GROUP);
+        if (match != 0)
+            return group * VT_GROUP + LowestBitIndex(match);
+        group = (group + step) & groupMask;
+    }
+}
+
+//----------------------------------------------------------------
+// Resizing
+//----------------------------------------------------------------
+
+Value*  NewTableSlots(int capacity)
+{
+    int size = TableArraySize(capacity);
+    Value* pSlots = AllocSlots(size);
+    pSlots[VT_COUNT] = INT_V(0);
+    pSlots[VT_DELETED] = INT_V(0);
+    pSlots[VT_CAPACITY] = INT_V(capacity);
+    for (int i = VT_ENTRIES; i < VT_ENTRIES + 2 * capacity; i++)
+        pSlots[i] = V_NIL;
+    memset(TableCtrl(pSlots, capacity), CTRL_EMPTY, capacity);
+    return pSlots;
+}
+
+// Rebuilds the table with the given capacity, which gets rid of the
+// deleted slots too.
+
+void    ResizeTable(Object* pTable, int newCapacity)
+{
+    Value* pOldSlots = pTable->pSlots;
+    int oldCapacity = UNSAFE_V_INT(pOldSlots[VT_CAPACITY]);
+    Byte* oldCtrl = TableCtrl(pOldSlots, oldCapacity);
+
+    Value* pSlots = NewTableSlots(newCapacity);
+    Byte* ctrl = TableCtrl(pSlots, newCapacity);
+
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldCtrl[i] & 0x80)
+            continue;
+        Value key = pOldSlots[VT_ENTRIES + 2 * i];
+        UInt32 hash = HashValue(key);
+        int index = FindFreeSlot(pSlots, newCapacity, hash);
+        ctrl[index] = CtrlHashBits(hash);
+        pSlots[VT_ENTRIES + 2 * index] = key;
+        pSlots[VT_ENTRIES + 2 * index + 1] = pOldSlots[VT_ENTRIES + 2 * i + 1];
+    }
+    pSlots[VT_COUNT] = pOldSlots[VT_COUNT];
+
+    pTable->pSlots = pSlots;
+    pTable->size = TableArraySize(newCapacity);
+    pTable->flags &= ~HDR_SHARED;
+}
+
+void    RehashValueTable(Object* pTable)
+{
+    ResizeTable(pTable, UNSAFE_V_INT(pTable->pSlots[VT_CAPACITY]));
+}
+
+//----------------------------------------------------------------
+// Interface
+//----------------------------------------------------------------
+
+Value   NewValueTable(int capacity)
+{
+    int slots = VT_MIN_CAPACITY;
+    while (slots / 2 + slots / 4 + slots / 8 < capacity)
+        slots *= 2;
+
+    Value table = NewArray(PSYM(valueTable), 0);
+    Object* pTable = UNSAFE_V_PTR(table);
+    pTable->pSlots = NewTableSlots(slots);
+    pTable->size = TableArraySize(slots);
+    return table;
+}
+
+bool    ValueTableGet(Value table, Value key, Value* pValue)
+{
+    Value* pSlots = CheckValueTable(table)->pSlots;
+    int capacity = UNSAFE_V_INT(pSlots[VT_CAPACITY]);
+    int index = FindKey(pSlots, capacity, key, HashValue(key));
+    if (index < 0)
+        return false;
+    *pValue = pSlots[VT_ENTRIES + 2 * index + 1];
+    return true;
+}
+
+void    ValueTableSet(Value table, Value key, Value value)
+{
+    Object* pTable = CheckValueTable(table);
+    Unshare(pTable);
+
+    Value* pSlots = pTable->pSlots;
+    int capacity = UNSAFE_V_INT(pSlots[VT_CAPACITY]);
+    UInt32 hash = HashValue(key);
+
+    int index = FindKey(pSlots, capacity, key, hash);
+    if (index >= 0) {
+        pSlots[VT_ENTRIES + 2 * index + 1] = value;
+        return;
+    }
+
+    // Keep the table at most 7/8 full (counting deleted slots). If it's
+    // mostly deleted slots, cleaning them out is enough.
+    int count = UNSAFE_V_INT(pSlots[VT_COUNT]);
+    int deleted = UNSAFE_V_INT(pSlots[VT_DELETED]);
+    if (count + deleted + 1 > capacity - capacity / 8) {
+        if (count + 1 > capacity / 2 - capacity / 16)
+            capacity *= 2;
+        ResizeTable(pTable, capacity);
+        pSlots = pTable->pSlots;
+        deleted = 0;
+    }
+
+    index = FindFreeSlot(pSlots, capacity, hash);
+    Byte* ctrl = TableCtrl(pSlots, capacity);
+    if (ctrl[index] == CTRL_DELETED)
+        pSlots[VT_DELETED] = INT_V(deleted - 1);
+    ctrl[index] = CtrlHashBits(hash);
+    pSlots[VT_ENTRIES + 2 * index] = key;
+    pSlots[VT_ENTRIES + 2 * index + 1] = value;
+    pSlots[VT_COUNT] = INT_V(count + 1);
+}
+
+bool    ValueTableRemove(Value table, Value key)
+{
+    Object* pTable = CheckValueTable(table);
+    Value* pSlots = pTable->pSlots;
+    int capacity = UNSAFE_V_INT(pSlots[VT_CAPACITY]);
+
+    int index = FindKey(pSlots, capacity, key, HashValue(key));
+    if (index < 0)
+        return false;
+
+    Unshare(pTable);
+    pSlots = pTable->pSlots;
+    Byte* ctrl = TableCtrl(pSlots, capacity);
+
+    // If the slot's group has an empty slot, no probe ever went past it, so
+    // the slot can be empty too. Otherwise it has to be marked deleted so
+    // probes keep going.
+    if (MatchCtrl(ctrl + (index & ~(VT_GROUP - 1)), CTRL_EMPTY) != 0) {
+        ctrl[index] = CTRL_EMPTY;
+    }
+    else {
+        ctrl[index] = CTRL_DELETED;
+        pSlots[VT_DELETED] = INT_V(UNSAFE_V_INT(pSlots[VT_DELETED]) + 1);
+    }
+    pSlots[VT_ENTRIES + 2 * index] = V_NIL;
+    pSlots[VT_ENTRIES + 2 * index + 1] = V_NIL;
+    pSlots[VT_COUNT] = INT_V(UNSAFE_V_INT(pSlots[VT_COUNT]) - 1);
+    return true;
+}
+
+int     ValueTableCount(Value table)
+{
+    return UNSAFE_V_INT(CheckValueTable(table)->pSlots[VT_COUNT]);
+}
+
+// Changing the table while stepping through it can reorder it.
+
+bool    ValueTableNext(Value table, int* pIter, Value* pKey, Value* pValue)
+{
+    Value* pSlots = CheckValueTable(table)->pSlots;
+    int capacity = UNSAFE_V_INT(pSlots[VT_CAPACITY]);
+    Byte* ctrl = TableCtrl(pSlots, capacity);
+
+    for (int i = *pIter; i < capacity; i++) {
+        if ((ctrl[i] & 0x80) == 0) {
+            *pKey = pSlots[VT_ENTRIES + 2 * i];
+            *pValue = pSlots[VT_ENTRIES + 2 * i + 1];
+            *pIter = i + 1;
+            return true;
+        }
+    }
+
+    *pIter = capacity;
+    return false;
+}
+
+//----------------------------------------------------------------
+// Natives
+//----------------------------------------------------------------
+
+NATIVE_FUNC(FNewValueTable)
+{
+    return NewValueTable(0);
+}
+
+DECLARE_GLOBAL_FUNCTION("NewValueTable", FNewValueTable, 0);
+
+NATIVE_FUNC(FValueTableGet)
+{
+    NATIVE_ARGS_2(table, key);
+    Value value;
+    if (ValueTableGet(ARG(table), ARG(key), &value))
+        return value;
+    return V_NIL;
+}
+
+DECLARE_GLOBAL_FUNCTION("ValueTableGet", FValueTableGet, 2);
+
+NATIVE_FUNC(FValueTableHas)
+{
+    NATIVE_ARGS_2(table, key);
+    Value value;
+    return BOOL_V(ValueTableGet(ARG(table), ARG(key), &value));
+}
+
+DECLARE_GLOBAL_FUNCTION("ValueTableHas", FValueTableHas, 2);
+
+NATIVE_FUNC(FValueTableSet)
+{
+    NATIVE_ARGS_3(table, key, value);
+    ValueTableSet(ARG(table), ARG(key), ARG(value));
+    return ARG(value);
+}
+
+DECLARE_GLOBAL_FUNCTION("ValueTableSet", FValueTableSet, 3);
+
+NATIVE_FUNC(FValueTableRemove)
+{
+    NATIVE_ARGS_2(table, key);
+    return BOOL_V(ValueTableRemove(ARG(table), ARG(key)));
+}
+
+DECLARE_GLOBAL_FUNCTION("ValueTableRemove", FValueTableRemove, 2);
+
+NATIVE_FUNC(FValueTableCount)
+{
+    NATIVE_ARGS_1(table);
+    return INT_V(ValueTableCount(ARG(table)));
+}
+
+DECLARE_GLOBAL_FUNCTION("ValueTableCount", FValueTableCount, 1);
+
+// ValueTableKeys and ValueTableValues return arrays in the same order.
+
+Value   ValueTableContents(Value table, bool keys)
+{
+    Value result = NewArray(ValueTableCount(table));
+    int iter = 0;
+    Value key, value;
+    for (int i = 0; ValueTableNext(table, &iter, &key, &value); i++)
+        SetSlot(result, i, keys ? key : value);
+    return result;
+}
+
+NATIVE_FUNC(FValueTableKeys)
+{
+    NATIVE_ARGS_1(table);
+    return ValueTableContents(ARG(table), true);
+}
+
+DECLARE_GLOBAL_FUNCTION("ValueTableKeys", FValueTableKeys, 1);
+
+NATIVE_FUNC(FValueTableValues)
+{
+    NATIVE_ARGS_1(table);
+    return ValueTableContents(ARG(table), false);
+}
+
+DECLARE_GLOBAL_FUNCTION("ValueTableValues", FValueTableValues, 1);
@@ -0,0 +1,312 @@
+/*
+    Proto language runtime
+
+    Views: parts of arrays and binaries, without copying
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "objects-private.h"
+#include "predefined.h"
+#include "native.h"
+#include <string.h>
+
+// Getting part of an array or binary used to mean copying it, so a parser
+// walking a big binary copied it a piece at a time. A view refers to a
+// range of another object (its base) instead. GetSlot, SetSlot, Length,
+// aref, and foreach see the range as an array; GetData, GetReadOnlyData,
+// and GetBinaryLength see it as a binary.
+//
+// Offsets and lengths are in elements of the base: slots of an array,
+// numbers of a typed array, or bytes of any other binary. (A view of a
+// compact string widens it first, so its bytes are TCHARs.)
+//
+// A view sees changes to its base. Changes through a view either go
+// through to the base, or (by default) copy the range the first time, so
+// the view stops being a view of the base and the base isn't changed. A
+// view is an array of class view:
+//
+//      base        the object it's a view of
+//      offset      where the range starts, as an integer
+//      length      number of elements in the range, as an integer
+//      write       true if changes go through to the base, nil if the
+//                  first one copies the range
+
+enum {
+    VW_BASE,
+    VW_OFFSET,
+    VW_LENGTH,
+    VW_WRITE,
+    VW_SIZE
+};
+
+inline Object*  ViewBase(Object* pView)
+{
+    return UNSAFE_V_PTR(pView->pSlots[VW_BASE]);
+}
+
+inline int  ViewOffset(Object* pView)
+{
+    return UNSAFE_V_INT(pView->pSlots[VW_OFFSET]);
+}
+
+int     ViewLength(Object* pView)
+{
+    return UNSAFE_V_INT(pView->pSlots[VW_LENGTH]);
+}
+
+// Length of the base, in its elements.
+
+int     BaseLength(Object* pBase)
+{
+    if (ObjIsBinary(pBase))
+        return ObjIsTypedArray(pBase) ? TypedArrayLength(pBase) : pBase->size;
+    if (ObjIsFrameTable(pBase))
+        return FrameTableLength(pBase);
+    return pBase->size;
+}
+
+int     ElementSize(Object* pBase)
+{
+    return ObjIsTypedArray(pBase) ? TypedArrayElementSize(pBase) : 1;
+}
+
+// The base can have shrunk since the view was made. (Ranges are checked by
+// subtracting, since offset + length can overflow.)
+
+void    CheckViewRange(Object* pView)
+{
+    if (ViewOffset(pView) > BaseLength(ViewBase(pView)) - ViewLength(pView))
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+}
+
+void    CheckViewIndex(Object* pView, int index)
+{
+    if (index < 0 || index >= ViewLength(pView))
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+    CheckViewRange(pView);
+}
+
+// The first change through a copy-on-write view copies the range, and the
+// view then writes through to the copy.
+
+void    PrepareViewWrite(Object* pView)
+{
+    if (pView->pSlots[VW_WRITE] != V_NIL)
+        return;
+
+    CheckViewRange(pView);
+    Value base = pView->pSlots[VW_BASE];
+    Object* pBase = UNSAFE_V_PTR(base);
+    int offset = ViewOffset(pView);
+    int length = ViewLength(pView);
+    Value copy;
+    if (ObjIsBinary(pBase)) {
+        int elementSize = ElementSize(pBase);
+        copy = NewBinary(pBase->cls, (char*) pBase->pData + offset * elementSize,
+                         length * elementSize);
+    }
+    else {
+        copy = NewArray(pBase->cls, length);
+        for (int i = 0; i < length; i++)
+            SetSlot(copy, i, GetSlot(base, offset + i));
+    }
+
+    pView->pSlots[VW_BASE] = copy;
+    pView->pSlots[VW_OFFSET] = INT_V(0);
+    pView->pSlots[VW_WRITE] = V_TRUE;
+}
+
+Value   GetViewSlot(Object* pView, int index)
+{
+    CheckViewIndex(pView, index);
+    return GetSlot(pView->pSlots[VW_BASE], ViewOffset(pView) + index);
+}
+
+void    SetViewSlot(Object* pView, int index, Value value)
+{
+    CheckViewIndex(pView, index);
+    PrepareViewWrite(pView);
+    SetSlot(pView->pSlots[VW_BASE], ViewOffset(pView) + index, value);
+}
+
+// The data of a view of a binary. Asking for it writable counts as a
+// change.
+
+void*   GetViewData(Object* pView, bool writable)
+{
+    if (!ObjIsBinary(ViewBase(pView)))
+        PROTO_THROW(g_exType, E_NotABinary);
+    CheckViewRange(pView);
+    if (writable)
+        PrepareViewWrite(pView);
+
+    Value base = pView->pSlots[VW_BASE];
+    char* pData = (char*) (writable ? GetData(base) : GetReadOnlyData(base));
+    return pData + ViewOffset(pView) * ElementSize(ViewBase(pView));
+}
+
+int     GetViewDataSize(Object* pView)
+{
+    Object* pBase = ViewBase(pView);
+    if (!ObjIsBinary(pBase))
+        PROTO_THROW(g_exType, E_NotABinary);
+    return ViewLength(pView) * ElementSize(pBase);
+}
+
+// The slots of a view of a plain array.
+
+Value*  GetViewSlots(Object* pView)
+{
+    Object* pBase = ViewBase(pView);
+    if (!ObjIsArray(pBase) || ObjIsFrameTable(pBase))
+        PROTO_THROW(g_exType, E_NotAnArray);
+    CheckViewRange(pView);
+    PrepareViewWrite(pView);
+    Unshare(ViewBase(pView));
+    return GetArraySlots(pView->pSlots[VW_BASE]) + ViewOffset(pView);
+}
+
+// The same, for reading only, so a copy-on-write view isn't copied. Returns
+// 0 for a view of anything but a plain array.
+
+const Value*    GetViewReadOnlySlots(Object* pView)
+{
+    Object* pBase = ViewBase(pView);
+    if (!ObjIsArray(pBase) || ObjIsFrameTable(pBase))
+        return 0;
+    CheckViewRange(pView);
+    return pBase->pSlots + ViewOffset(pView);
+}
+
+bool    IsView(Value obj)
+{
+    return V_ISPTR(obj) && ObjIsView(V_PTR(obj));
+}
+
+// A view of a view is a view of the same base.
+
+Value   NewView(Value base, int offset, int length, bool writeThrough)
+{
+    Object* pBase = V_PTR(base);
+    if (ObjIsView(pBase)) {
+        CheckViewRange(pBase);
+        if (offset < 0 || length < 0 || offset > ViewLength(pBase) - length)
+            PROTO_THROW(g_exFr, E_OutOfBounds);
+        offset += ViewOffset(pBase);
+        base = pBase->pSlots[VW_BASE];
+        pBase = UNSAFE_V_PTR(base);
+    }
+    else if (ObjIsFrame(pBase)) {
+        PROTO_THROW_ERR(g_exType, E_NotAFrameOrArray, base);
+    }
+    else if (ObjIsCompact(pBase)) {
+        WidenString(pBase);
+    }
+
+    if (offset < 0 || length < 0 || offset > BaseLength(pBase) - length)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    Value view = NewArray(PSYM(view), VW_SIZE);
+    Value* pSlots = UNSAFE_V_PTR(view)->pSlots;
+    pSlots[VW_BASE] = base;
+    pSlots[VW_OFFSET] = INT_V(offset);
+    pSlots[VW_LENGTH] = INT_V(length);
+    pSlots[VW_WRITE] = writeThrough ? V_TRUE : V_NIL;
+    return view;
+}
+
+// Extracting numbers from binaries (or views of them). They're stored
+// big-endian, the way the stream format stores them.
+
+Value   ExtractNumber(Value binary, int offset, int nBytes)
+{
+    int size = GetBinaryLength(binary);
+    if (offset < 0 || offset > size - nBytes)
+        PROTO_THROW(g_exFr, E_OutOfBounds);
+
+    const Byte* p = (const Byte*) GetReadOnlyData(binary) + offset;
+    UInt32 n = 0;
+    for (int i = 0; i < nBytes; i++)
+        n = (n << 8) | p[i];
+    if (nBytes < 4)
+        return INT_V(n);
+
+    // Longs are signed, and may not fit in an integer on 32-bit builds
+    Int32 i = (Int32) n;
+    if (i > MAX_INT_V || i < MIN_INT_V)
+        return REAL_V(i);
+    return INT_V(i);
+}
+
+//----------------------------------------------------------------
+// Natives
+//----------------------------------------------------------------
+
+// A nil count means the rest of the object. (NewView rejects a negative
+// start, which could make the rest overflow.)
+
+inline int  CountArg(Value obj, int start, Value count)
+{
+    if (count != V_NIL)
+        return V_INDEX(count);
+    return start >= 0 ? GetObjLength(obj) - start : 0;
+}
+
+NATIVE_FUNC(FNewView)
+{
+    NATIVE_ARGS_4(obj, start, count, writeThrough);
+    int start = V_INDEX(ARG(start));
+    return NewView(ARG(obj), start, CountArg(ARG(obj), start, ARG(count)),
+                   ARG(writeThrough) != V_NIL);
+}
+
+DECLARE_GLOBAL_FUNCTION("NewView", FNewView, 4);
+
+NATIVE_FUNC(FSubArray)
+{
+    NATIVE_ARGS_3(array, start, count);
+    if (!V_ISPTR(ARG(array)) || !ObjIsArray(V_PTR(ARG(array))))
+        PROTO_THROW_ERR(g_exType, E_NotAnArray, ARG(array));
+    int start = V_INDEX(ARG(start));
+    return NewView(ARG(array), start, CountArg(ARG(array), start, ARG(count)), false);
+}
+
+DECLARE_GLOBAL_FUNCTION("SubArray", FSubArray, 3);
+
+NATIVE_FUNC(FExtractBytes)
+{
+    NATIVE_ARGS_3(binary, offset, length);
+    Value binary = ARG(binary);
+    if (!V_ISPTR(binary) || (!ObjIsBinary(V_PTR(binary)) && !IsView(binary)))
+        PROTO_THROW_ERR(g_exType, E_NotABinary, binary);
+    return NewView(binary, V_INDEX(ARG(offset)), V_INDEX(ARG(length)), false);
+}
+
+DECLARE_GLOBAL_FUNCTION("ExtractBytes", FExtractBytes, 3);
+
+NATIVE_FUNC(FExtractByte)
+{
+    NATIVE_ARGS_2(binary, offset);
+    return ExtractNumber(ARG(binary), V_INDEX(ARG(offset)), 1);
+}
+
+DECLARE_GLOBAL_FUNCTION("ExtractByte", FExtractByte, 2);
+
+NATIVE_FUNC(FExtractWord)
+{
+    NATIVE_ARGS_2(binary, offset);
+    return ExtractNumber(ARG(binary), V_INDEX(ARG(offset)), 2);
+}
+
+DECLARE_GLOBAL_FUNCTION("ExtractWord", FExtractWord, 2);
+
+NATIVE_FUNC(FExtractLong)
+{
+    NATIVE_ARGS_2(binary, offset);
+    return ExtractNumber(ARG(binary), V_INDEX(ARG(offset)), 4);
+}
+
+DECLARE_GLOBAL_FUNCTION("ExtractLong", FExtractLong, 2);
@@ -6,14 +6,16 @@
 #include "gc.h"
 #include "objects.h"
 #include "interpreter.h"
+#include "slotref.h"
 #include "predefined.h"
+#include "predef-app-syms.h"    // This program's own SYMs (see tools/mkpredef)
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
 
 inline void DebugBreak(void) { __asm__("int $3"); }
 
-DECLARE_PSYM(array);
-DECLARE_PSYM(real);
-
 void TestFrames()
 {
     Value f;
@@ -171,6 +173,1181 @@ void TestFrames()
 }
 
 
+void TestSymbols()
+{
+    // Case-insensitive, and predefined symbols are the same objects Intern finds
+    ASSERT(Intern("Array") == PSYM(array));
+    ASSERT(Intern("REAL") == PSYM(real));
+    ASSERT(SYM(fooBar) == Intern("FOOBAR"));
+    ASSERT(SYM(foo) != SYM(foobar));
+
+    // Enough symbols to make the table grow several times
+    for (int i = 0; i < 20000; i++) {
+        char buf[32];
+        sprintf(buf, "manysym%d", i);
+        Value sym = Intern(buf);
+        ASSERT(!strcmp(SymbolName(sym), buf));
+    }
+
+    for (int i = 0; i < 20000; i++) {
+        char buf[32];
+        sprintf(buf, "MANYSYM%d", i);
+        Value sym = Intern(buf);
+        ASSERT(strcmp(SymbolName(sym), buf) && !strcasecmp(SymbolName(sym), buf));
+    }
+
+    ASSERT(Intern("Array") == PSYM(array));
+}
+
+
+void TestValues()
+{
+    // Integers get all the bits the Value has room for
+    ASSERT(V_INT(INT_V(MAX_INT_V)) == MAX_INT_V);
+    ASSERT(V_INT(INT_V(MIN_INT_V)) == MIN_INT_V);
+    ASSERT(V_INT(INT_V(-1)) == -1);
+
+    // Reals round-trip exactly, whether or not they fit in the Value
+    static const double reals[] = {
+        0.0, -0.0, 1.0, -2.5, 3.14159, 1e10, -1e-10, 1e300, 1e-300,
+        ldexp(1.0, -63), ldexp(1.0, -62), ldexp(1.0, 64), ldexp(1.0, 65), HUGE_VAL, -HUGE_VAL
+    };
+    for (int i = 0; i < (int) ARRAYSIZE(reals); i++) {
+        double d = V_REAL(REAL_V(reals[i]));
+        ASSERT(memcmp(&d, &reals[i], sizeof(double)) == 0);
+        ASSERT(IsReal(REAL_V(reals[i])));
+    }
+    ASSERT(V_REAL(REAL_V(nan(""))) != V_REAL(REAL_V(nan(""))));
+    ASSERT(!IsReal(INT_V(1)) && !IsReal(V_NIL));
+
+#if PROTO_64BIT
+    ASSERT(V_ISIMMREAL(REAL_V(1.0)) && V_ISIMMREAL(REAL_V(-0.0)) && V_ISIMMREAL(REAL_V(1e-10)));
+    ASSERT(!V_ISIMMREAL(REAL_V(1e300)) && !V_ISIMMREAL(REAL_V(ldexp(1.0, -63))));
+    ASSERT(REAL_V(2.5) == REAL_V(2.5));
+#endif
+}
+
+
+// Makes a big binary and returns only its data, so nothing points to the
+// binary itself any more
+
+const char* NewBigData(int size)
+{
+    Value b = NewBinary(PSYM(binary), size);
+    memset(GetData(b), 'q', size);
+    return (const char*) GetReadOnlyData(b);
+}
+
+void TestBinaries()
+{
+    static const char text[] = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    // Small data shares the header's block, and has to move out to grow
+    Value b = NewBinary(PSYM(binary), (void*) text, 8);
+    Value b2 = Clone(b);
+    SetBinaryLength(b, sizeof(text));
+    ASSERT(memcmp(GetData(b), text, 8) == 0);
+    memcpy(GetData(b), text, sizeof(text));
+    SetBinaryLength(b, 4);
+    SetBinaryLength(b, 200);
+    ASSERT(memcmp(GetData(b), text, 4) == 0);
+    ASSERT(GetBinaryLength(b2) == 8 && memcmp(GetData(b2), text, 8) == 0);
+
+    SetBinaryLength(b2, 2);
+    SetBinaryLength(b2, 0);
+    ASSERT(GetBinaryLength(b2) == 0);
+    SetBinaryLength(b2, 3);
+    ASSERT(GetBinaryLength(b2) == 3);
+
+    b = NewBinary(PSYM(binary), (void*) text, sizeof(text));
+    ASSERT(memcmp(GetData(Clone(b)), text, sizeof(text)) == 0);
+
+    // Large data grows and shrinks like any other
+    const int big = 300 * 1024;
+    SetBinaryLength(b, big);
+    ASSERT(memcmp(GetData(b), text, sizeof(text)) == 0);
+    memset(GetData(b), 'x', big);
+    SetBinaryLength(b, 8 * big);
+    char* p = (char*) GetData(b);
+    ASSERT(p[0] == 'x' && p[big - 1] == 'x');
+    p[8 * big - 1] = 'y';
+    b2 = Clone(b);
+    SetBinaryLength(b, big + 1);
+    ASSERT(((char*) GetData(b))[big - 1] == 'x');
+    SetBinaryLength(b, 100);
+    SetBinaryLength(b, 2 * big);
+    ASSERT(((char*) GetData(b))[99] == 'x');
+
+    // Shrinking a lot moves the data, but not out from under a pointer to it
+    p = (char*) GetData(b);
+    memset(p, 'z', 2 * big);
+    SetBinaryLength(b, 1000);
+    GC_gcollect();
+    ASSERT(p != GetData(b) && p[2 * big - 1] == 'z');
+    ASSERT(GetBinaryLength(b2) == 8 * big && ((char*) GetData(b2))[8 * big - 1] == 'y');
+
+    // A pointer to the data keeps it alive by itself
+    const char* pBig = NewBigData(big);
+    for (int i = 0; i < 100; i++)
+        NewBinary(PSYM(binary), big);
+    GC_gcollect();
+    ASSERT(pBig[0] == 'q' && pBig[big - 1] == 'q');
+
+    // Big arrays grow a slot at a time
+    Value a = NewArray(0);
+    for (int i = 0; i < 100000; i++)
+        AddArraySlot(a, INT_V(i));
+    ASSERT(GetArrayLength(a) == 100000 && GetSlot(a, 99999) == INT_V(99999));
+    SetArrayLength(a, 10);
+    ASSERT(GetSlot(a, 9) == INT_V(9));
+}
+
+
+void TestSharedClones()
+{
+    // Big clones share until one side is written, then each has its own
+    Value a = NewArray(1000);
+    for (int i = 0; i < 1000; i++)
+        SetSlot(a, i, INT_V(i));
+    Value a2 = Clone(a);
+    SetSlot(a2, 5, V_NIL);
+    ASSERT(GetSlot(a, 5) == INT_V(5) && GetSlot(a2, 5) == V_NIL);
+    SetArrayLength(a, 3);
+    ASSERT(GetArrayLength(a2) == 1000 && GetSlot(a2, 999) == INT_V(999));
+
+    // Writing through GetArraySlots counts too
+    Value c = NewArray(64);
+    Value c2 = Clone(c);
+    GetArraySlots(c2)[0] = INT_V(999);
+    ASSERT(GetSlot(c, 0) == V_NIL && GetSlot(c2, 0) == INT_V(999));
+
+    Value b = NewBinary(PSYM(binary), 4096);
+    memset(GetData(b), 'x', 4096);
+    Value b2 = Clone(b);
+    ASSERT(GetReadOnlyData(b2) == GetReadOnlyData(b));
+    ((char*) GetData(b))[0] = 'y';
+    ASSERT(((const char*) GetReadOnlyData(b2))[0] == 'x');
+    SetBinaryLength(b2, 8);
+    ASSERT(((char*) GetData(b))[4095] == 'x');
+
+    // Including large data, which is shared between clones of clones
+    b = NewBinary(PSYM(binary), 1024 * 1024);
+    memset(GetData(b), 'x', 1024 * 1024);
+    b2 = Clone(b);
+    Value b3 = Clone(b2);
+    SetBinaryLength(b2, 2 * 1024 * 1024);
+    ((char*) GetData(b3))[0] = 'z';
+    ASSERT(((const char*) GetReadOnlyData(b))[0] == 'x' && ((const char*) GetReadOnlyData(b2))[0] == 'x');
+
+    // DeepClone shares slots that don't have to change, but only until
+    // they do
+    Value f = NewFrame();
+    SetSlot(f, SYM(ints), a2);
+    SetSlot(f, SYM(objs), NewArray(100));
+    SetSlot(GetSlot(f, SYM(objs)), 0, f);
+    Value f2 = DeepClone(f);
+    SetSlot(GetSlot(f2, SYM(ints)), 1, V_NIL);
+    ASSERT(GetSlot(a2, 1) == INT_V(1));
+    ASSERT(GetSlot(GetSlot(f2, SYM(objs)), 0) == f2);
+    ASSERT(GetSlot(GetSlot(f, SYM(objs)), 0) == f);
+}
+
+
+void TestDeepClone()
+{
+    // A long list doesn't run out the C stack, and its cycle survives
+    const int nNodes = 200000;
+    Value list = NewArray(2);
+    Value last = list;
+    for (int i = 1; i < nNodes; i++) {
+        Value node = NewArray(2);
+        SetSlot(node, 0, INT_V(i));
+        SetSlot(last, 1, node);
+        last = node;
+    }
+    SetSlot(last, 1, list);
+
+    Value list2 = DeepClone(list);
+    Value node = list2;
+    for (int i = 0; i < nNodes; i++) {
+        ASSERT(node != list && (i == 0 || GetSlot(node, 0) == INT_V(i)));
+        node = GetSlot(node, 1);
+    }
+    ASSERT(node == list2);
+
+    // Objects reached more than once are cloned once
+    Value a = NewArray(2000);
+    for (int i = 0; i < 1000; i++) {
+        Value s = NewString(_T("shared"));
+        SetSlot(a, i, s);
+        SetSlot(a, 1999 - i, s);
+    }
+    Value a2 = DeepClone(a);
+    for (int i = 0; i < 1000; i++) {
+        ASSERT(GetSlot(a2, i) == GetSlot(a2, 1999 - i));
+        ASSERT(GetSlot(a2, i) != GetSlot(a, i));
+    }
+
+    // Every slot of a hash map and its supermap-less frame is reached
+    Value f = NewFrame();
+    Value shared = NewArray(1);
+    for (int i = 0; i < 100; i++) {
+        char buf[32];
+        sprintf(buf, "deep%d", i);
+        SetSlot(f, Intern(buf), (i % 2) ? shared : f);
+    }
+    RemoveSlot(f, SYM(deep10));
+    Value f2 = DeepClone(f);
+    ASSERT(GetSlot(f2, SYM(deep1)) != shared);
+    ASSERT(GetSlot(f2, SYM(deep1)) == GetSlot(f2, SYM(deep99)));
+    ASSERT(GetSlot(f2, SYM(deep0)) == f2 && GetSlot(f2, SYM(deep98)) == f2);
+    ASSERT(!HasSlot(f2, SYM(deep10)) && GetObjLength(f2) == 99);
+
+    // Nesting as deep as a list is long
+    Value nest = NewArray(1);
+    for (int i = 1; i < nNodes; i++) {
+        Value outer = NewArray(1);
+        SetSlot(outer, 0, nest);
+        nest = outer;
+    }
+    Value nest2 = DeepClone(nest);
+    for (int i = 1; i < nNodes; i++) {
+        ASSERT(nest2 != nest);
+        nest = GetSlot(nest, 0);
+        nest2 = GetSlot(nest2, 0);
+    }
+    ASSERT(GetSlot(nest2, 0) == V_NIL);
+}
+
+
+void TestValueTables()
+{
+    Value t = NewValueTable();
+    Value v;
+
+    // Strings by content, numbers by value, everything else by identity
+    Value obj = NewFrame();
+    ValueTableSet(t, NewString(_T("key")), INT_V(1));
+    ValueTableSet(t, INT_V(42), INT_V(2));
+    ValueTableSet(t, REAL_V(0.0), INT_V(3));
+    ValueTableSet(t, obj, INT_V(4));
+    ValueTableSet(t, SYM(foo), INT_V(5));
+    ASSERT(ValueTableGet(t, NewString(_T("key")), &v) && v == INT_V(1));
+    ASSERT(ValueTableGet(t, INT_V(42), &v) && v == INT_V(2));
+    ASSERT(ValueTableGet(t, REAL_V(-0.0), &v) && v == INT_V(3));
+    ASSERT(ValueTableGet(t, obj, &v) && v == INT_V(4));
+    ASSERT(ValueTableGet(t, SYM(foo), &v) && v == INT_V(5));
+    ASSERT(!ValueTableGet(t, NewFrame(), &v) && !ValueTableGet(t, NewString(_T("kex")), &v));
+    ASSERT(!ValueTableGet(t, INT_V(43), &v) && !ValueTableGet(t, CHAR_V(42), &v));
+    ASSERT(ValueTableCount(t) == 5);
+
+    // Lots of keys, removed and added back
+    const int nKeys = 10000;
+    for (int i = 0; i < nKeys; i++)
+        ValueTableSet(t, INT_V(i * 7), INT_V(i));
+    for (int i = 0; i < nKeys; i += 2)
+        ASSERT(ValueTableRemove(t, INT_V(i * 7)));
+    ASSERT(!ValueTableRemove(t, INT_V(0)));
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < nKeys; i += 2)
+            ValueTableSet(t, INT_V(i * 7), INT_V(-i));
+        for (int i = 0; i < nKeys; i += 2)
+            ValueTableRemove(t, INT_V(i * 7));
+    }
+    ASSERT(ValueTableCount(t) == 4 + nKeys / 2);
+    for (int i = 0; i < nKeys; i++)
+        ASSERT(ValueTableGet(t, INT_V(i * 7), &v) == (i % 2 == 1));
+
+    int n = 0, iter = 0;
+    Value key;
+    while (ValueTableNext(t, &iter, &key, &v))
+        n++;
+    ASSERT(n == ValueTableCount(t));
+
+    // Clones are separate tables, even when they're deep
+    Value t2 = Clone(t);
+    ValueTableSet(t2, INT_V(1), V_TRUE);
+    ASSERT(!ValueTableGet(t, INT_V(1), &v) && ValueTableGet(t2, INT_V(1), &v));
+    Value a = NewArray(2);
+    SetSlot(a, 0, t);
+    SetSlot(a, 1, obj);
+    Value a2 = DeepClone(a);
+    ASSERT(ValueTableGet(GetSlot(a2, 0), GetSlot(a2, 1), &v) && v == INT_V(4));
+}
+
+
+void TestBTrees()
+{
+    Value t = NewBTree();
+    Value v;
+
+    // Integers, then strings, then symbols
+    BTreeSet(t, SYM(Foo), INT_V(1));
+    BTreeSet(t, NewString(_T("b")), INT_V(2));
+    BTreeSet(t, NewString(_T("ab")), INT_V(3));
+    BTreeSet(t, INT_V(-5), INT_V(4));
+    ASSERT(BTreeGet(t, SYM(foo), &v) && v == INT_V(1));
+    ASSERT(BTreeGet(t, NewString(_T("ab")), &v) && v == INT_V(3));
+    ASSERT(!BTreeGet(t, NewString(_T("a")), &v));
+    Value c = BTreeFirst(t);
+    ASSERT(BTreeCursorKey(c) == INT_V(-5));
+    ASSERT(BTreeCursorNext(c) && BTreeCursorValue(c) == INT_V(3));
+    ASSERT(BTreeCursorNext(c) && BTreeCursorValue(c) == INT_V(2));
+    ASSERT(BTreeCursorNext(c) && BTreeCursorKey(c) == SYM(foo));
+    ASSERT(!BTreeCursorNext(c) && BTreeCursorKey(c) == V_NIL);
+    ASSERT(BTreeCursorPrev(c) && BTreeCursorKey(c) == SYM(foo));
+    ASSERT(BTreeRemove(t, SYM(foo)) && BTreeRemove(t, INT_V(-5)));
+    ASSERT(BTreeRemove(t, NewString(_T("b"))) && BTreeRemove(t, NewString(_T("ab"))));
+    ASSERT(BTreeCount(t) == 0 && BTreeFirst(t) == V_NIL);
+
+    // Enough keys for a few levels, in a scrambled order, half removed
+    const int nKeys = 20000;
+    for (int i = 0; i < nKeys; i++) {
+        int k = (i * 7919) % nKeys;
+        BTreeSet(t, INT_V(k * 2), INT_V(k));
+    }
+    ASSERT(BTreeCount(t) == nKeys);
+    for (int i = 0; i < nKeys; i += 2)
+        ASSERT(BTreeRemove(t, INT_V(((i * 7919) % nKeys) * 2)));
+    ASSERT(!BTreeRemove(t, INT_V(1)) && BTreeCount(t) == nKeys / 2);
+    for (int k = 0; k < nKeys; k++)
+        ASSERT(BTreeGet(t, INT_V(k * 2), &v) == (k % 2 == 1));
+
+    int n = 0;
+    IntPtr last = -1;
+    for (c = BTreeFirst(t); c != V_NIL && BTreeCursorKey(c) != V_NIL; BTreeCursorNext(c)) {
+        IntPtr k = V_INT(BTreeCursorKey(c));
+        ASSERT(k > last && BTreeCursorValue(c) == INT_V(k / 2));
+        last = k;
+        n++;
+    }
+    ASSERT(n == nKeys / 2);
+
+    // Bounds, and cursors that outlive changes to the tree
+    c = BTreeSeek(t, INT_V(101));
+    Value c2 = BTreeSeek(t, INT_V(101), true);
+    ASSERT(BTreeCursorKey(c) == BTreeCursorKey(c2) && V_INT(BTreeCursorKey(c)) > 101);
+    Value key = BTreeCursorKey(c);
+    BTreeSet(t, INT_V(101), V_TRUE);
+    ASSERT(BTreeSeek(t, INT_V(101), true) != V_NIL && BTreeCursorKey(BTreeSeek(t, INT_V(101))) == INT_V(101));
+    ASSERT(BTreeCursorPrev(c) && BTreeCursorKey(c) == INT_V(101));
+    BTreeRemove(t, INT_V(101));
+    ASSERT(BTreeCursorValue(c) == V_NIL);
+    ASSERT(BTreeCursorNext(c) && BTreeCursorKey(c) == key);
+
+    for (c = BTreeLast(t), n = 0; BTreeCursorKey(c) != V_NIL; BTreeCursorPrev(c)) {
+        BTreeRemove(t, BTreeCursorKey(c));
+        n++;
+    }
+    ASSERT(n == nKeys / 2 && BTreeCount(t) == 0);
+}
+
+void TestFrameTables()
+{
+    // Rows with their own maps, in a different order, and one short a slot
+    const int nRows = 1003;
+    Value frames = NewArray(nRows);
+    for (int i = 0; i < nRows; i++) {
+        Value f = NewFrame();
+        if (i % 2 == 0) {
+            SetSlot(f, SYM(x), INT_V(i));
+            SetSlot(f, SYM(name), NewString(_T("row")));
+        }
+        else {
+            SetSlot(f, SYM(name), NewString(_T("row")));
+            SetSlot(f, SYM(x), INT_V(i));
+        }
+        if (i != 7)
+            SetSlot(f, SYM(y), REAL_V(i * 0.5));
+        SetSlot(frames, i, f);
+    }
+
+    Value t = NewFrameTable(frames);
+    ASSERT(IsFrameTable(t) && IsArray(t) && GetArrayLength(t) == nRows);
+    Value row = GetSlot(t, 10);
+    ASSERT(IsFrame(row) && GetSlot(row, SYM(x)) == INT_V(10) && V_REAL(GetSlot(row, SYM(y))) == 5.0);
+    ASSERT(GetSlot(GetSlot(t, 7), SYM(y)) == V_NIL);
+
+    Value path = NewArray(SYM(pathexpr), 2);
+    SetSlot(path, 0, INT_V(20));
+    SetSlot(path, 1, SYM(x));
+    ASSERT(GetPath(t, path) == INT_V(20));
+    SetPath(t, path, INT_V(-20));
+    ASSERT(GetSlot(GetSlot(t, 20), SYM(x)) == INT_V(-20));
+    SetSlot(path, 1, SYM(z));
+    SetPath(t, path, V_TRUE);
+    ASSERT(GetPath(t, path) == V_TRUE && GetSlot(GetSlot(t, 21), SYM(z)) == V_NIL);
+
+    // Column kernels
+    IntPtr sum = 0;
+    for (int i = 0; i < nRows; i++)
+        sum += (i == 20) ? -20 : i;
+    ASSERT(FrameTableSum(t, SYM(x)) == INT_V(sum));
+    ASSERT(FrameTableMin(t, SYM(x)) == INT_V(-20) && FrameTableMax(t, SYM(x)) == INT_V(nRows - 1));
+    ASSERT(V_REAL(FrameTableMax(t, SYM(y))) == (nRows - 1) * 0.5);
+    SetPath(t, path, INT_V(1));
+    SetSlot(path, 0, INT_V(30));
+    SetPath(t, path, REAL_V(0.5));
+    ASSERT(V_REAL(FrameTableSum(t, SYM(z))) == 1.5);
+
+    Value where = FrameTableWhere(t, SYM(x), INT_V(100), INT_V(110));
+    ASSERT(GetArrayLength(where) == 10 && GetSlot(where, 0) == INT_V(100));
+    where = FrameTableWhere(t, SYM(x), V_NIL, INT_V(3));
+    ASSERT(GetArrayLength(where) == 4 && GetSlot(where, 3) == INT_V(20));
+    where = FrameTableWhere(t, SYM(y), REAL_V(1.0), REAL_V(5.0));
+    ASSERT(GetArrayLength(where) == 7);
+
+    Value g = FrameTableGather(t, where);
+    ASSERT(GetArrayLength(g) == 7 && GetSlot(GetSlot(g, 5), SYM(x)) == INT_V(8));
+
+    // Growing, and back to frames
+    for (int i = 0; i < 100; i++)
+        AddArraySlot(g, GetSlot(frames, i));
+    ASSERT(GetArrayLength(g) == 107 && GetSlot(GetSlot(g, 106), SYM(x)) == INT_V(99));
+    Value a = FrameTableToArray(g);
+    ASSERT(!IsFrameTable(a) && GetArrayLength(a) == 107);
+    ASSERT(GetSlot(GetSlot(a, 0), SYM(name)) != V_NIL);
+
+    // Changing the length changes every column, and new rows are nil
+    SetArrayLength(g, 3);
+    ASSERT(GetArrayLength(g) == 3 && GetSlot(GetSlot(g, 2), SYM(x)) == INT_V(4));
+    SetArrayLength(g, 50);
+    ASSERT(GetArrayLength(g) == 50 && GetSlot(GetSlot(g, 49), SYM(y)) == V_NIL);
+    ASSERT(GetSlot(GetSlot(g, 3), SYM(name)) == V_NIL && FrameTableSum(g, SYM(x)) == INT_V(9));
+    AddArraySlot(g, GetSlot(frames, 9));
+    ASSERT(GetArrayLength(g) == 51 && GetSlot(GetSlot(g, 50), SYM(x)) == INT_V(9));
+
+    bool caught = false;
+    try {
+        GetArraySlots(g);
+    }
+    catch (ProtaException& ex) {
+        caught = (ex.data == INT_V(E_NotAnArray));
+    }
+    ASSERT(caught);
+}
+
+void TestStringBuilding()
+{
+    // Builders, big enough to move into the large-object space
+    Value piece = NewString(_T("abcd"));
+    Value b = NewStringBuilder();
+    const int nPieces = 100000;
+    for (int i = 0; i < nPieces; i++)
+        StrAppend(b, piece);
+    ASSERT(!IsString(b));
+    Value s = StringBuilderFinish(b);
+    ASSERT(IsString(s) && GetBinaryLength(s) == (4 * nPieces + 1) * (int) sizeof(TCHAR));
+    TCHAR* p = GetCString(s);
+    ASSERT(p[0] == 'a' && p[4 * nPieces - 1] == 'd' && p[4 * nPieces] == 0);
+
+    b = NewStringBuilder();
+    StrAppend(b, piece);
+    StrAppend(b, b);
+    ASSERT(wcscmp(GetCString(b), _T("abcdabcd")) == 0);
+
+    // Ropes, made the slow way around
+    Value r = NewString(_T(""));
+    for (int i = 0; i < 20000; i++)
+        r = StrConcat(r, (i % 2) ? piece : NewString(_T("xy")));
+    ASSERT(IsString(r) && !IsArray(r));
+    Value str = NewString(_T("<"));
+    StrAppend(str, r);
+    p = GetCString(str);
+    ASSERT(wcslen(p) == 1 + 10000 * 6 && wcsncmp(p, _T("<xyabcdxy"), 9) == 0);
+    ASSERT(wcscmp(GetCString(r), p + 1) == 0);
+    ASSERT(FlattenString(r) == FlattenString(r));
+
+    // Pieces are snapshots
+    Value s1 = NewString(_T("0123456789"));
+    for (int i = 0; i < 5; i++)
+        StrAppend(s1, s1);
+    r = StrConcat(s1, piece);
+    StrAppend(s1, piece);
+    ASSERT(wcslen(GetCString(r)) == 324 && wcslen(GetCString(s1)) == 324);
+    StrAppend(s1, piece);
+    ASSERT(wcslen(GetCString(r)) == 324);
+
+    // A rope is a string to everything else, and is flattened for good
+    // when its characters are needed in one place
+    const int len = 4 + 328;
+    r = StrConcat(piece, s1);
+    ASSERT(GetObjLength(r) == (len + 1) * (int) sizeof(TCHAR));
+    ASSERT(GetStringChar(r, 4) == CHAR_V('0'));
+    ASSERT(IsString(r) && !IsArray(r) && GetBinaryLength(r) == (len + 1) * (int) sizeof(TCHAR));
+    SetStringChar(r, 0, CHAR_V('A'));
+    ASSERT(((const TCHAR*) GetReadOnlyData(r))[0] == 'A');
+    r = StrConcat(piece, s1);
+    StrAppend(r, piece);
+    ASSERT(wcslen(GetCString(r)) == len + 4);
+    r = StrConcat(piece, s1);
+    ASSERT(StrReplace(r, piece, NewString(_T("")), -1) == 3 && wcslen(GetCString(r)) == len - 12);
+}
+
+void TestCompactStrings()
+{
+    Value s = NewString(_T("Hello, World"));
+    Value w = NewString(_T("Hello, World"));
+    GetData(w);     // widens it
+    ASSERT(wcscmp((const TCHAR*) GetReadOnlyData(s), _T("Hello, World")) == 0);
+    ASSERT(GetBinaryLength(s) == 13 * (int) sizeof(TCHAR));
+    ASSERT(StrCompare(s, w) == 0 && StrCompare(s, NewString(_T("hello, world")), true) == 0);
+    ASSERT(StrCompare(s, NewString(_T("Hello"))) > 0 && StrCompare(s, NewString(_T("Help"))) < 0);
+    ASSERT(GetStringChar(s, 4) == CHAR_V('o'));
+
+    Value t = NewValueTable();
+    ValueTableSet(t, s, INT_V(1));
+    Value v;
+    ASSERT(ValueTableGet(t, w, &v) && v == INT_V(1));
+
+    // Searching, past the lengths the vector loops handle
+    Value big = NewString(_T(""));
+    for (int i = 0; i < 20; i++)
+        StrAppend(big, NewString(_T("abcdefghij")));
+    StrAppend(big, NewString(_T("needle!")));
+    ASSERT(StrPos(big, NewString(_T("needle")), 0) == 200);
+    ASSERT(StrPos(big, NewString(_T("j")), 10) == 19);
+    ASSERT(StrPos(big, NewString(_T("jab")), 195) == -1);
+    ASSERT(StrPos(big, NewString(_T("xyz")), 0) == -1);
+    ASSERT(StrCompare(big, NewString(_T("ABCDEFGHIJ")), true) > 0);
+
+    // Replacing, and widening when a character doesn't fit
+    ASSERT(StrReplace(big, NewString(_T("abc")), NewString(_T("X"))) == 20);
+    ASSERT(GetObjLength(big) == 168 * (int) sizeof(TCHAR) && StrPos(big, NewString(_T("Xdefg")), 0) == 0);
+    ASSERT(StrReplace(big, NewString(_T("X")), NewString(_T("\x263A")), 1) == 1);
+    ASSERT(GetStringChar(big, 0) == IMMED_V(IMMED_CHAR, 0x263A));
+    ASSERT(StrPos(big, NewString(_T("needle")), 0) == 160);
+
+    // Ropes flatten to whichever form their pieces all fit in
+    Value narrow = NewString(_T(""));
+    for (int i = 0; i < 20; i++)
+        StrAppend(narrow, NewString(_T("0123456789")));
+    Value r = StrConcat(narrow, s);
+    ASSERT(StrPos(r, NewString(_T("9Hello")), 0) == 199);
+    ASSERT(GetStringChar(r, 211) == CHAR_V('d'));
+    r = StrConcat(StrConcat(narrow, big), s);
+    ASSERT(GetStringChar(r, 200) == IMMED_V(IMMED_CHAR, 0x263A));
+    ASSERT(wcscmp(GetCString(r) + 367, _T("Hello, World")) == 0);
+
+    SetStringChar(s, 0, CHAR_V('J'));
+    ASSERT(wcscmp(GetCString(s), _T("Jello, World")) == 0);
+    ASSERT(GetBinaryLength(s) == 13 * (int) sizeof(TCHAR));
+}
+
+void TestStringer()
+{
+    Value pieces = NewArray(0);
+    AddArraySlot(pieces, NewString(_T("x=")));
+    AddArraySlot(pieces, INT_V(-1234567));
+    AddArraySlot(pieces, CHAR_V(' '));
+    AddArraySlot(pieces, REAL_V(0.1));
+    AddArraySlot(pieces, V_NIL);
+    AddArraySlot(pieces, SYM(sym));
+    AddArraySlot(pieces, INT_V(0));
+    Value s = Stringer(pieces);
+    ASSERT(wcscmp(GetCString(s), _T("x=-1234567 0.1sym0")) == 0);
+
+    // Wide pieces make a wide result
+    Value w = NewString(_T("\x263A"));
+    AddArraySlot(pieces, w);
+    AddArraySlot(pieces, REAL_V(1.0 / 3));
+    s = Stringer(pieces);
+    ASSERT(wcscmp(GetCString(s), _T("x=-1234567 0.1sym0\x263A") _T("0.3333333333333333")) == 0);
+
+    // Views, including ones whose elements aren't slots
+    ASSERT(wcscmp(GetCString(Stringer(NewView(pieces, 2, 3))), _T(" 0.1")) == 0);
+    Value t = NewTypedArray(SYM(int32Array), 4);
+    SetSlot(t, 1, INT_V(7));
+    SetSlot(t, 2, INT_V(-8));
+    ASSERT(wcscmp(GetCString(Stringer(NewView(t, 1, 2))), _T("7-8")) == 0);
+
+    ASSERT(wcscmp(GetCString(NumberStr(INT_V(1000000))), _T("1000000")) == 0);
+    ASSERT(wcscmp(GetCString(NumberStr(REAL_V(2.5e-8))), _T("2.5e-08")) == 0);
+}
+
+void TestTypedArrays()
+{
+    // Odd lengths, so the vector loops leave some for the scalar ones
+    const int n = 37;
+    Value a = NewTypedArray(SYM(float64Array), n);
+    Value b = NewTypedArray(SYM(float64Array), n);
+    for (int i = 0; i < n; i++) {
+        SetSlot(a, i, REAL_V(i * 0.5));
+        SetSlot(b, i, INT_V(2));
+    }
+    ASSERT(IsTypedArray(a) && GetObjLength(a) == n);
+    TypedArrayAdd(a, b);
+    ASSERT(V_REAL(GetSlot(a, 3)) == 3.5);
+    ASSERT(V_REAL(TypedArrayDot(a, b)) == 2 * (n * 2 + 0.5 * n * (n - 1) / 2));
+    ASSERT(V_REAL(TypedArrayMin(a)) == 2.0 && V_REAL(TypedArrayMax(a)) == 20.0);
+    TypedArrayScale(a, REAL_V(2.0));
+    ASSERT(V_REAL(TypedArraySum(a)) == 2 * (n * 2 + 0.5 * n * (n - 1) / 2));
+
+    Value kernel = ArrayToTypedArray(NewArray(0), SYM(float64Array));
+    ASSERT(GetObjLength(TypedArrayConvolve(a, kernel)) == 0);
+    Value pair = NewArray(2);
+    SetSlot(pair, 0, INT_V(1));
+    SetSlot(pair, 1, INT_V(-1));
+    Value diff = TypedArrayConvolve(a, ArrayToTypedArray(pair, SYM(float64Array)));
+    ASSERT(GetObjLength(diff) == n + 1 && V_REAL(GetSlot(diff, 5)) == 1.0);
+
+    // Integers wrap, and sort
+    Value ints = NewTypedArray(SYM(int32Array), n);
+    for (int i = 0; i < n; i++)
+        SetSlot(ints, i, INT_V((i * 7919) % 101 - 50));
+    Value copy = Clone(ints);
+    TypedArraySort(ints);
+    ASSERT(TypedArraySum(ints) == TypedArraySum(copy));
+    ASSERT(GetSlot(ints, 0) == TypedArrayMin(copy));
+    ASSERT(GetSlot(ints, n - 1) == TypedArrayMax(copy));
+    SetSlot(ints, 0, INT_V(0x7FFFFFFF));
+    TypedArrayAdd(ints, ints);
+    ASSERT(GetSlot(ints, 0) == INT_V(-2));
+
+    // Bytes are counted to sort them
+    Value bytes = NewTypedArray(SYM(uint8Array), 100);
+    for (int i = 0; i < 100; i++)
+        SetSlot(bytes, i, INT_V(255 - i));
+    TypedArraySort(bytes);
+    ASSERT(GetSlot(bytes, 0) == INT_V(156) && GetSlot(bytes, 99) == INT_V(255));
+    ASSERT(TypedArraySum(bytes) == INT_V(20550) && TypedArrayMax(bytes) == INT_V(255));
+}
+
+void TestViews()
+{
+    Value a = NewArray(10);
+    for (int i = 0; i < 10; i++)
+        SetSlot(a, i, INT_V(i));
+
+    // Copy-on-write
+    Value v = NewView(a, 3, 4);
+    ASSERT(IsView(v) && GetArrayLength(v) == 4 && GetObjLength(v) == 4);
+    ASSERT(GetSlot(v, 0) == INT_V(3) && GetSlot(v, 3) == INT_V(6));
+    SetSlot(a, 4, INT_V(40));
+    ASSERT(GetSlot(v, 1) == INT_V(40));
+    SetSlot(v, 0, INT_V(-1));
+    ASSERT(GetSlot(a, 3) == INT_V(3) && GetSlot(v, 0) == INT_V(-1));
+    SetSlot(a, 5, INT_V(50));
+    ASSERT(GetSlot(v, 2) == INT_V(5));
+
+    // Write-through, and views of views
+    Value w = NewView(NewView(a, 2, 8, true), 1, 3, true);
+    SetSlot(w, 0, INT_V(33));
+    ASSERT(GetSlot(a, 3) == INT_V(33) && GetSlot(w, 2) == INT_V(50));
+    SetArrayLength(a, 4);
+    bool caught = false;
+    try {
+        GetSlot(w, 1);
+    }
+    catch (ProtaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // Binaries and typed arrays
+    Byte bytes[8] = { 1, 2, 3, 4, 0xFF, 0xFF, 0xFF, 0xFE };
+    Value b = NewBinary(SYM(data), bytes, sizeof(bytes));
+    Value bv = NewView(b, 4, 4);
+    ASSERT(GetBinaryLength(bv) == 4 && ((const Byte*) GetReadOnlyData(bv))[3] == 0xFE);
+    ((Byte*) GetData(bv))[0] = 0;
+    ASSERT(((const Byte*) GetReadOnlyData(b))[4] == 0xFF);
+
+    Value t = NewTypedArray(SYM(int32Array), 8);
+    SetSlot(t, 6, INT_V(-6));
+    Value tv = NewView(t, 4, 4, true);
+    ASSERT(GetSlot(tv, 2) == INT_V(-6) && GetBinaryLength(tv) == 16);
+    SetSlot(tv, 3, INT_V(7));
+    ASSERT(GetSlot(t, 7) == INT_V(7));
+
+    // Ranges whose ends don't fit in an int are out of bounds
+    Value extractBytes = GetGlobalFunction(SYM(ExtractBytes));
+    Value ranges[][2] = {
+        { INT_V(0x7FFFFFFF), INT_V(2) },
+#if PROTO_64BIT
+        { INT_V(0), INT_V((IntPtr) 1 << 32) },
+#endif
+    };
+    for (int i = 0; i < (int) ARRAYSIZE(ranges); i++) {
+        caught = false;
+        try {
+            Call(extractBytes, b, ranges[i][0], ranges[i][1]);
+        }
+        catch (ProtaException& ex) {
+            caught = (ex.data == INT_V(E_OutOfBounds));
+        }
+        ASSERT(caught);
+    }
+}
+
+void TestArrayAlgorithms()
+{
+    Value a = NewArray(0);
+    int ints[8] = { 5, -3, 9, 0, 7, -3, 2, 8 };
+    for (int i = 0; i < 8; i++)
+        AddArraySlot(a, INT_V(ints[i]));
+
+    SortArray(a, Intern("<"), V_NIL);
+    for (int i = 1; i < 8; i++)
+        ASSERT(V_INT(GetSlot(a, i - 1)) <= V_INT(GetSlot(a, i)));
+    ASSERT(BinarySearch(a, INT_V(7), Intern("<"), V_NIL) == 5);
+    ASSERT(BinarySearch(a, INT_V(6), Intern("<"), V_NIL) == -1);
+    SortArray(a, Intern(">"), V_NIL);
+    ASSERT(GetSlot(a, 0) == INT_V(9) && GetSlot(a, 7) == INT_V(-3));
+
+    // Searching
+    ASSERT(LinearSearch(a, INT_V(-3), 0, Intern("="), V_NIL) == 6);
+    ASSERT(LinearSearch(a, INT_V(-3), 7, Intern("="), V_NIL) == 7);
+    ASSERT(LinearSearch(a, INT_V(4), 0, Intern("="), V_NIL) == -1);
+
+    // Splicing
+    ArrayInsert(a, SYM(x), 2);
+    ASSERT(GetArrayLength(a) == 9 && GetSlot(a, 2) == SYM(x) && GetSlot(a, 3) == INT_V(7));
+    ArrayRemoveCount(a, 0, 3);
+    ASSERT(GetArrayLength(a) == 6 && GetSlot(a, 0) == INT_V(7));
+    ArrayMunger(a, 1, 2, a, 0, -1);         // 7 [5 2] 0 -3 -3 => 7 7 5 2 0 -3 -3 0 -3 -3
+    ASSERT(GetArrayLength(a) == 10 && GetSlot(a, 1) == INT_V(7) && GetSlot(a, 6) == INT_V(-3));
+    ArrayMunger(a, 2, -1, V_NIL, 0, 0);
+    ASSERT(GetArrayLength(a) == 2);
+
+    // Strings, symbols, slot paths, and key and test functions
+    Value s = NewArray(0);
+    AddArraySlot(s, NewString(_T("pear")));
+    AddArraySlot(s, NewString(_T("Apple")));
+    AddArraySlot(s, NewString(_T("fig")));
+    SortArray(s, Intern("str<"), V_NIL);
+    ASSERT(StrCompare(GetSlot(s, 0), NewString(_T("Apple"))) == 0);
+    ASSERT(LinearSearch(s, NewString(_T("FIG")), 0, Intern("str="), V_NIL) == 1);
+    SortArray(s, GetGlobalFunction(SYM(StrCompare)), V_NIL);
+    ASSERT(StrCompare(GetSlot(s, 2), NewString(_T("pear"))) == 0);
+
+    Value frames = NewArray(0);
+    Value syms[3] = { SYM(gamma), SYM(Alpha), SYM(beta) };
+    for (int i = 0; i < 3; i++) {
+        Value f = NewFrame();
+        SetSlot(f, SYM(name), syms[i]);
+        AddArraySlot(frames, f);
+    }
+    SortArray(frames, Intern("<"), SYM(name));
+    ASSERT(GetSlot(GetSlot(frames, 0), SYM(name)) == SYM(Alpha));
+    ASSERT(BinarySearch(frames, SYM(GAMMA), Intern("<"), SYM(name)) == 2);
+
+    Value n = NewArray(0);
+    AddArraySlot(n, INT_V(9));
+    AddArraySlot(n, INT_V(100));
+    AddArraySlot(n, REAL_V(10.5));
+    SortArray(n, Intern("<"), V_NIL);
+    ASSERT(V_REAL(GetSlot(n, 1)) == 10.5);
+    SortArray(n, Intern("str<"), GetGlobalFunction(SYM(NumberStr)));     // "10.5" "100" "9"
+    ASSERT(GetSlot(n, 1) == INT_V(100) && GetSlot(n, 2) == INT_V(9));
+
+    // Write-through views sort part of an array
+    Value b = NewArray(6);
+    for (int i = 0; i < 6; i++)
+        SetSlot(b, i, INT_V(6 - i));
+    SortArray(NewView(b, 1, 4, true), Intern("<"), V_NIL);
+    ASSERT(GetSlot(b, 0) == INT_V(6) && GetSlot(b, 1) == INT_V(2) && GetSlot(b, 5) == INT_V(1));
+
+    // Sets, small and big
+    Value big = NewArray(40);
+    for (int i = 0; i < 40; i++)
+        SetSlot(big, i, INT_V(i * 2));
+    Value u = SetUnion(b, b, true);
+    ASSERT(GetArrayLength(u) == 6 && GetSlot(u, 0) == INT_V(6));
+    Value d = SetDifference(b, big);
+    ASSERT(GetArrayLength(d) == 3 && GetSlot(d, 0) == INT_V(3));
+    ASSERT(SetOverlaps(big, b) && !SetOverlaps(d, big));
+    ASSERT(SetContains(big, INT_V(78)) == 39 && SetContains(big, SYM(x)) == -1);
+    ASSERT(GetArrayLength(SetUnion(big, b, false)) == 43);
+}
+
+// Makes a function from hand-assembled bytecode, since there's no compiler
+// here to make one.
+
+Value NewTestFunction(const Byte* code, int codeLen, Value literals, int numArgs)
+{
+    Value tags[5] = { SYM(class), SYM(instructions), SYM(literals), SYM(argFrame), SYM(numArgs) };
+    Value values[5] = {
+        IMMED_V(IMMED_SPECIAL, 3),      // FUNCTION_CLASS (see objects-private.h)
+        NewBinary(SYM(instructions), (void*) code, codeLen),
+        literals,
+        V_NIL,
+        INT_V(numArgs)
+    };
+    return NewFrameWithSlots(5, tags, values);
+}
+
+void TestIndexArgs()
+{
+    // aref(a, index)
+    static const Byte arefCode[] = {
+        0x7B,       // getvar 3 (a)
+        0x18,       // push literal 0 (index)
+        0xC2,       // freqfunc aref
+        0x02        // return
+    };
+    Value a = NewArray(3);
+    SetSlot(a, 0, INT_V(10));
+    SetSlot(a, 1, INT_V(11));
+    Value literals = NewArray(1);
+    Value aref = NewTestFunction(arefCode, sizeof(arefCode), literals, 1);
+    SetSlot(literals, 0, INT_V(1));
+    ASSERT(Call(aref, a) == INT_V(11));
+
+#if PROTO_64BIT
+    // An index that doesn't fit in an int is out of bounds, not truncated
+    SetSlot(literals, 0, INT_V((IntPtr) 1 << 32));
+    bool caught = false;
+    try {
+        Call(aref, a);
+    }
+    catch (ProtaException& ex) {
+        caught = (ex.data == INT_V(E_OutOfBounds));
+    }
+    ASSERT(caught);
+#endif
+
+    bool threw = false;
+    try {
+        V_INDEX(INT_V(-((IntPtr) MAX_INT_V)));
+    }
+    catch (ProtaException&) {
+        threw = true;
+    }
+    ASSERT(threw == (sizeof(IntPtr) > sizeof(int)));
+}
+
+void TestDeepRecursion()
+{
+    // f(x) calls f(x) forever
+    static const Byte code[] = {
+        0x7B,       // getvar 3 (x)
+        0x18,       // push literal 0 (f)
+        0x31,       // invoke 1
+        0x02        // return
+    };
+    Value literals = NewArray(1);
+    Value f = NewTestFunction(code, sizeof(code), literals, 1);
+    SetSlot(literals, 0, f);
+    bool caught = false;
+    try {
+        Call(f, INT_V(1));
+    }
+    catch (ProtaException& ex) {
+        caught = (ex.data == INT_V(E_StackOverflow));
+    }
+    ASSERT(caught);
+
+    // The stacks are unwound, so calling still works
+    static const Byte identityCode[] = {
+        0x7B,       // getvar 3 (x)
+        0x02        // return
+    };
+    Value identity = NewTestFunction(identityCode, sizeof(identityCode), V_NIL, 1);
+    ASSERT(Call(identity, INT_V(5)) == INT_V(5));
+}
+
+void TestCalls()
+{
+    // Natives, and natives that call back
+    Value r = Call(GetGlobalFunction(SYM(StrCompare)), NewString(_T("a")), NewString(_T("b")));
+    ASSERT(V_INT(r) < 0);
+    Value a = NewArray(2);
+    SetSlot(a, 0, INT_V(12));
+    SetSlot(a, 1, INT_V(345));
+    Value strs = Call(GetGlobalFunction(SYM(ArrayMap)), a, GetGlobalFunction(SYM(NumberStr)));
+    ASSERT(StrCompare(GetSlot(strs, 1), NewString(_T("345"))) == 0);
+
+    // Sends
+    Value rcvr = NewFrame();
+    SetSlot(rcvr, SYM(str), GetGlobalFunction(SYM(NumberStr)));
+    ASSERT(StrCompare(Send(rcvr, SYM(str), INT_V(7)), NewString(_T("7"))) == 0);
+
+    // Exceptions get out, and leave the stacks as they were
+    for (int i = 0; i < 3; i++) {
+        bool caught = false;
+        try {
+            Send(rcvr, SYM(nope));
+        }
+        catch (ProtaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+
+        caught = false;
+        try {
+            Call(GetGlobalFunction(SYM(ArrayMap)), a, GetGlobalFunction(SYM(Throw)));
+        }
+        catch (ProtaException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+    ASSERT(V_INT(Call(GetGlobalFunction(SYM(BNot)), INT_V(0))) == -1);
+}
+
+struct TestPoint {
+    int     x;
+    double  y;
+    Value   name;
+    bool    visible;
+};
+
+void TestSlotRefs()
+{
+    SlotRef xRef(SYM(x));
+    SlotRef yRef(SYM(y));
+
+    // Frames that share a frozen map
+    Value tags = NewArray(2);
+    SetSlot(tags, 0, SYM(x));
+    SetSlot(tags, 1, SYM(y));
+    Value map = FreezeMap(NewMapWithTags(tags));
+    Value f1 = NewFrameWithMap(map);
+    Value f2 = NewFrameWithMap(map);
+    SetSlot(f1, yRef, INT_V(1));
+    SetSlot(f2, yRef, INT_V(2));
+    ASSERT(GetSlot(f1, yRef) == INT_V(1) && GetSlot(f2, yRef) == INT_V(2));
+    ASSERT(GetSlot(f1, SYM(y)) == INT_V(1));
+    SlotRef zRef(SYM(z));
+    ASSERT(!HasSlot(f1, zRef) && !HasSlot(f2, zRef));
+
+    // A map changed in place
+    Value f = NewFrame();
+    SetSlot(f, SYM(x), INT_V(10));
+    SetSlot(f, SYM(y), INT_V(20));
+    ASSERT(GetSlot(f, yRef) == INT_V(20));
+    RemoveSlot(f, SYM(x));
+    ASSERT(GetSlot(f, yRef) == INT_V(20) && GetSlot(f, xRef) == V_NIL);
+    SetSlot(f, xRef, INT_V(11));
+    ASSERT(GetSlot(f, SYM(x)) == INT_V(11) && GetSlot(f, xRef) == INT_V(11));
+
+    // Hash maps, through rehashing
+    for (int i = 0; i < 200; i++) {
+        char buf[32];
+        sprintf(buf, "slot%d", i);
+        SetSlot(f, Intern(buf), INT_V(i));
+        ASSERT(GetSlot(f, yRef) == INT_V(20) && GetSlot(f, xRef) == INT_V(11));
+    }
+
+    // Bindings
+    static SlotField pointFields[] = {
+        SlotField(SYM(x), &TestPoint::x),
+        SlotField(SYM(y), &TestPoint::y),
+        SlotField(SYM(name), &TestPoint::name),
+        SlotField(SYM(visible), &TestPoint::visible)
+    };
+    FrameBinding<TestPoint> binding(pointFields, ARRAYSIZE(pointFields));
+
+    TestPoint pt = { 3, 4.5, SYM(corner), true };
+    Value pf = binding.NewFrame(&pt);
+    ASSERT(GetSlot(pf, SYM(x)) == INT_V(3) && GetSlot(pf, SYM(visible)) == V_TRUE);
+    SetSlot(pf, SYM(x), INT_V(-3));
+    RemoveSlot(pf, SYM(visible));
+    TestPoint pt2;
+    binding.Read(pf, &pt2);
+    ASSERT(pt2.x == -3 && pt2.y == 4.5 && pt2.name == SYM(corner) && !pt2.visible);
+}
+
+void TestFrameBuilding()
+{
+    Value tags[100];
+    Value values[100];
+    tags[0] = SYM(x);
+    tags[1] = SYM(y);
+    tags[2] = SYM(x);
+    values[0] = INT_V(1);
+    values[1] = INT_V(2);
+    values[2] = INT_V(3);
+
+    // Small, with a repeated tag
+    Value f = NewFrameWithSlots(3, tags, values);
+    ASSERT(GetObjLength(f) == 2);
+    ASSERT(GetSlot(f, SYM(x)) == INT_V(3) && GetSlot(f, SYM(y)) == INT_V(2));
+    Value f2 = NewFrameWithSlots(3, tags, values);
+    SetSlot(f2, SYM(z), INT_V(4));
+    ASSERT(!HasSlot(f, SYM(z)) && GetSlot(f2, SYM(x)) == INT_V(3));
+
+    // Big enough to hash
+    for (int i = 0; i < 100; i++) {
+        char buf[32];
+        sprintf(buf, "built%d", i);
+        tags[i] = Intern(buf);
+        values[i] = INT_V(i * 2);
+    }
+    f = NewFrameWithSlots(100, tags, values);
+    ASSERT(GetObjLength(f) == 100);
+    for (int i = 0; i < 100; i++)
+        ASSERT(GetSlot(f, tags[i]) == INT_V(i * 2));
+    f2 = NewFrameWithSlots(100, tags, values);
+    SetSlot(f2, SYM(x), INT_V(5));
+    RemoveSlot(f2, tags[7]);
+    ASSERT(GetSlot(f2, SYM(x)) == INT_V(5) && !HasSlot(f2, tags[7]));
+    ASSERT(GetSlot(f, tags[7]) == INT_V(14) && !HasSlot(f, SYM(x)));
+
+    Value a = NewArray(PSYM(array), 3, values);
+    ASSERT(GetArrayLength(a) == 3 && GetSlot(a, 2) == INT_V(4));
+}
+
+void TestFrozenMaps()
+{
+    Value tags = NewArray(40);
+    for (int i = 0; i < 40; i++) {
+        char buf[32];
+        sprintf(buf, "frozen%d", i);
+        SetSlot(tags, i, Intern(buf));
+    }
+
+    Value map = FreezeMap(NewMapWithTags(tags));
+    Value f = NewFrameWithMap(map);
+    Value f2 = NewFrameWithMap(map);
+    for (int i = 0; i < 40; i++)
+        SetSlot(f, GetSlot(tags, i), INT_V(i));
+
+    for (int i = 0; i < 40; i++) {
+        ASSERT(GetSlot(f, GetSlot(tags, i)) == INT_V(i));
+        ASSERT(HasSlot(f2, GetSlot(tags, i)));
+    }
+    ASSERT(!HasSlot(f, SYM(notfrozen)));
+    ASSERT(GetObjLength(f) == 40);
+
+    // Changing the shape of one frame doesn't affect the other
+    SetSlot(f, SYM(notfrozen), V_TRUE);
+    RemoveSlot(f, Intern("frozen7"));
+    ASSERT(GetObjLength(f) == 40);
+    ASSERT(!HasSlot(f, Intern("frozen7")) && HasSlot(f2, Intern("frozen7")));
+    ASSERT(HasSlot(f, SYM(notfrozen)) && !HasSlot(f2, SYM(notfrozen)));
+    ASSERT(GetSlot(f, Intern("frozen39")) == INT_V(39));
+    ASSERT(GetObjLength(f2) == 40);
+}
+
+void TestMapFilters()
+{
+    // The filter must never hide a slot, however the frame got its shape
+    Value f = NewFrame();
+    Value tags[100];
+    for (int i = 0; i < 100; i++) {
+        char buf[32];
+        sprintf(buf, "filter%d", i);
+        tags[i] = Intern(buf);
+        SetSlot(f, tags[i], INT_V(i));
+        for (int j = 0; j <= i; j++)
+            ASSERT(GetSlot(f, tags[j]) == INT_V(j));
+    }
+
+    int nMisses = 0;
+    for (int i = 0; i < 1000; i++) {
+        char buf[32];
+        sprintf(buf, "nofilter%d", i);
+        nMisses += !HasSlot(f, Intern(buf));
+    }
+    ASSERT(nMisses == 1000);
+
+    for (int i = 0; i < 100; i += 2)
+        RemoveSlot(f, tags[i]);
+    for (int i = 0; i < 100; i++)
+        ASSERT(HasSlot(f, tags[i]) == (i % 2 != 0));
+
+    // Small sequential frames, including removal and re-adding
+    Value g = NewFrame();
+    for (int i = 0; i < 8; i++)
+        SetSlot(g, tags[i], INT_V(i));
+    RemoveSlot(g, tags[3]);
+    ASSERT(!HasSlot(g, tags[3]) && HasSlot(g, tags[4]));
+    SetSlot(g, tags[3], V_TRUE);
+    ASSERT(GetSlot(g, tags[3]) == V_TRUE);
+    for (int i = 8; i < 100; i++)
+        ASSERT(!HasSlot(g, tags[i]));
+}
+
+void TestRehash()
+{
+    const int nTags = 5000;
+    Value* tags = new Value[nTags];
+    for (int i = 0; i < nTags; i++) {
+        char buf[32];
+        sprintf(buf, "rehash%d", i);
+        tags[i] = Intern(buf);
+    }
+
+    // Every slot stays reachable while tables are being resized
+    int nRehashes = GetRehashCount();
+    Value f = NewFrame();
+    for (int i = 0; i < nTags; i++) {
+        SetSlot(f, tags[i], INT_V(i));
+        if (i % 97 == 0) {
+            for (int j = 0; j <= i; j++)
+                ASSERT(GetSlot(f, tags[j]) == INT_V(j));
+        }
+    }
+    ASSERT(GetObjLength(f) == nTags);
+    ASSERT(GetRehashCount() > nRehashes);
+
+    Value f2 = Clone(f);
+    for (int i = 0; i < nTags; i++)
+        ASSERT(GetSlot(f2, tags[i]) == INT_V(i));
+
+    for (int i = 0; i < nTags - 10; i++) {
+        RemoveSlot(f, tags[i]);
+        if (i % 89 == 0) {
+            for (int j = 0; j < nTags; j++)
+                ASSERT(GetSlot(f, tags[j]) == (j > i ? INT_V(j) : V_NIL));
+        }
+    }
+    ASSERT(GetObjLength(f) == 10);
+    ASSERT(GetObjLength(f2) == nTags);
+
+    // Adding and removing at a resize threshold doesn't keep resizing
+    Value g = NewFrame();
+    for (int i = 0; i < 97; i++)
+        SetSlot(g, tags[i], V_TRUE);
+    nRehashes = GetRehashCount();
+    for (int i = 0; i < 1000; i++) {
+        SetSlot(g, tags[97], V_TRUE);
+        RemoveSlot(g, tags[97]);
+    }
+    ASSERT(GetRehashCount() - nRehashes <= 1);
+
+    delete[] tags;
+}
+
+// Time frame lookups (hits and misses) for various sequential map sizes.
+// Handy for tuning HASH_MAP_MIN.
+
+void BenchMapLookup()
+{
+    static const int sizes[] = { 4, 8, 16, 32 };
+    const int nLookups = 10000000;
+
+    for (int s = 0; s < (int) ARRAYSIZE(sizes); s++) {
+        int nSlots = sizes[s];
+        Value f = NewFrame();
+        Value tags[32];
+        for (int i = 0; i < nSlots; i++) {
+            char buf[32];
+            sprintf(buf, "bench%d", i);
+            tags[i] = Intern(buf);
+            SetSlot(f, tags[i], INT_V(i));
+        }
+        Value missing = Intern("benchmissing");
+
+        int sum = 0;
+        clock_t start = clock();
+        for (int i = 0; i < nLookups; i++)
+            sum += UNSAFE_V_INT(GetSlot(f, tags[i & (nSlots - 1)]));
+        clock_t hit = clock() - start;
+
+        start = clock();
+        for (int i = 0; i < nLookups; i++)
+            sum += HasSlot(f, missing);
+        clock_t miss = clock() - start;
+
+        printf("%2d slots: hit %.1f ns, miss %.1f ns (%d)\n", nSlots,
+               hit * 1e9 / CLOCKS_PER_SEC / nLookups,
+               miss * 1e9 / CLOCKS_PER_SEC / nLookups, sum);
+    }
+}
+
+
 void teststr()
 {
     PrintValueLn(ReadStreamFile("boot.stm"));
@@ -188,11 +1365,35 @@ void testintrp()
 int main()
 {
     extern void PrintBCCounts(void);
+    extern void InitAppPredefObjects(void);
 
     try {
-        InitProtoLib();
+        InitProtoLib(InitAppPredefObjects);
 
+        TestSymbols();
+        TestValues();
+        TestBinaries();
+        TestSharedClones();
+        TestDeepClone();
+        TestValueTables();
+        TestBTrees();
+        TestFrameTables();
+        TestStringBuilding();
+        TestCompactStrings();
+        TestStringer();
+        TestTypedArrays();
+        TestViews();
+        TestArrayAlgorithms();
+        TestCalls();
+        TestIndexArgs();
+        TestDeepRecursion();
+        TestSlotRefs();
+        TestFrameBuilding();
+        TestFrozenMaps();
+        TestMapFilters();
+        TestRehash();
         //TestFrames();
+        //BenchMapLookup();
         //testiter();
         testintrp();
         //PrintBCCounts();
@@ -0,0 +1,448 @@
+/*
+    Proto language runtime
+
+    Generates the compile-time symbol objects
+
+    Usage: mkpredef <output dir> <library files...> [-- <program files...>]
+
+    Scans the sources for SYM(name), PSYM(name) and DECLARE_PSYM(name)
+    (outside comments and literals) and writes two files to the output
+    directory:
+
+        predef-syms.h       Declarations of every symbol, included by objects.h
+        predef-objs.cpp     The symbol objects, with their hashes precalculated
+
+    Only the library's files go into those, so a program's names don't
+    become part of the library. The symbols a program uses that the library
+    doesn't are written to predef-app-syms.h and predef-app-objs.cpp; the
+    program includes the header and passes InitAppPredefObjects to
+    InitProtoLib.
+
+    Symbols are case-insensitive but C++ identifiers aren't, so all the
+    spellings of a name refer to one object. The other spellings are
+    #defined to the one that's used for the object, so these names must
+    agree with PREDEF_NAME and PREDEF_SYM_NAME in predefined.h.
+
+    The outputs are only rewritten when they change, so editing a source
+    file doesn't force everything that includes objects.h to recompile.
+
+    Copyright 1997-1999 Walter R. Smith
+    Licensed under the MIT License. See LICENSE file in project root.
+*/
+
+#include "config.h"
+#include "symhash.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+
+using namespace std;
+
+const int   MAX_NAME = 254;     // Same limit as the stream reader
+
+// All spellings of each name, keyed by the case-folded name
+
+typedef map<string, set<string> > SymbolMap;
+
+string  FoldCase(const string& name)
+{
+    string folded = name;
+    for (size_t i = 0; i < folded.size(); i++)
+        folded[i] = tolower((Byte) folded[i]);
+    return folded;
+}
+
+inline bool IsIdentChar(char c)
+{
+    return isalnum((Byte) c) || c == '_';
+}
+
+// Finds the symbol uses in some code. Names in params (a macro's
+// parameters) aren't symbols.
+
+void    ScanCode(const char* code, SymbolMap& syms, const set<string>* params = 0)
+{
+    static const char* const macros[] = { "DECLARE_PSYM", "PSYM", "SYM" };
+
+    for (const char* p = code; *p; p++) {
+        if (p > code && IsIdentChar(p[-1]))
+            continue;
+
+        for (size_t m = 0; m < ARRAYSIZE(macros); m++) {
+            size_t len = strlen(macros[m]);
+            if (strncmp(p, macros[m], len) != 0)
+                continue;
+
+            const char* q = p + len;
+            while (*q == ' ' || *q == '\t')
+                q++;
+            if (*q++ != '(')
+                break;
+            while (*q == ' ' || *q == '\t')
+                q++;
+            const char* start = q;
+            while (IsIdentChar(*q))
+                q++;
+            const char* end = q;
+            while (*q == ' ' || *q == '\t')
+                q++;
+            if (end > start && *q == ')' && !isdigit((Byte) *start) && end - start <= MAX_NAME) {
+                string name(start, end - start);
+                if (params == 0 || params->find(name) == params->end())
+                    syms[FoldCase(name)].insert(name);
+            }
+            break;
+        }
+    }
+}
+
+// Preprocessor lines are skipped, except for the replacement text of a
+// #define, which is scanned without the macro's own parameters (so
+// "#define SYM(name) PSYM(name)" doesn't make a symbol called name).
+
+void    ScanLine(const char* line, SymbolMap& syms)
+{
+    const char* p = line;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p != '#') {
+        ScanCode(line, syms);
+        return;
+    }
+
+    p++;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (strncmp(p, "define", 6) != 0 || IsIdentChar(p[6]))
+        return;
+    p += 6;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    while (IsIdentChar(*p))
+        p++;
+
+    set<string> params;
+    if (*p == '(') {
+        while (*p && *p != ')') {
+            p++;
+            while (*p == ' ' || *p == '\t' || *p == ',')
+                p++;
+            const char* start = p;
+            while (IsIdentChar(*p))
+                p++;
+            if (p > start)
+                params.insert(string(start, p - start));
+            while (*p && *p != ',' && *p != ')')
+                p++;
+        }
+        if (*p == ')')
+            p++;
+    }
+
+    ScanCode(p, syms, &params);
+}
+
+// Blanks out comments and the insides of string and character literals,
+// and joins lines continued with a backslash, keeping one line per
+// logical line.
+
+string  StripSource(const string& text)
+{
+    enum { CODE, LINE_COMMENT, BLOCK_COMMENT, STRING, CHAR } state = CODE;
+    string out;
+    out.reserve(text.size());
+
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        char next = i + 1 < text.size() ? text[i + 1] : '\0';
+
+        if (c == '\\' && (next == '\n' || (next == '\r' && i + 2 < text.size() && text[i + 2] == '\n'))) {
+            i += (next == '\r') ? 2 : 1;
+            continue;
+        }
+
+        switch (state) {
+        case CODE:
+            if (c == '/' && next == '/') {
+                state = LINE_COMMENT;
+                i++;
+                out += ' ';
+            }
+            else if (c == '/' && next == '*') {
+                state = BLOCK_COMMENT;
+                i++;
+                out += ' ';
+            }
+            else {
+                if (c == '"')
+                    state = STRING;
+                else if (c == '\'')
+                    state = CHAR;
+                out += c;
+            }
+            break;
+
+        case LINE_COMMENT:
+            if (c == '\n') {
+                state = CODE;
+                out += c;
+            }
+            break;
+
+        case BLOCK_COMMENT:
+            if (c == '*' && next == '/') {
+                state = CODE;
+                i++;
+            }
+            else if (c == '\n')
+                out += c;
+            break;
+
+        case STRING:
+        case CHAR:
+            if (c == '\\')
+                i++;
+            else if (c == (state == STRING ? '"' : '\'') || c == '\n') {
+                state = CODE;
+                out += c;
+            }
+            break;
+        }
+    }
+
+    return out;
+}
+
+bool    ScanFile(const char* filename, SymbolMap& syms)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == 0) {
+        fprintf(stderr, "mkpredef: can't open %s\n", filename);
+        return false;
+    }
+
+    string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    fclose(f);
+
+    string code = StripSource(text);
+    size_t lineStart = 0;
+    while (lineStart < code.size()) {
+        size_t lineEnd = code.find('\n', lineStart);
+        if (lineEnd == string::npos)
+            lineEnd = code.size();
+        ScanLine(code.substr(lineStart, lineEnd - lineStart).c_str(), syms);
+        lineStart = lineEnd + 1;
+    }
+
+    return true;
+}
+
+// The spelling whose identifier names the object (and whose characters
+// become the symbol's print name). Lower case wins if it's used.
+
+const string&   PrimarySpelling(const string& folded, const set<string>& spellings)
+{
+    set<string>::const_iterator it = spellings.find(folded);
+    if (it != spellings.end())
+        return *it;
+    return *spellings.begin();
+}
+
+const char* const   g_copyright =
+    "    GENERATED BY tools/mkpredef -- DO NOT EDIT\n"
+    "\n"
+    "    Copyright 1997-1999 Walter R. Smith\n"
+    "    Licensed under the MIT License. See LICENSE file in project root.\n"
+    "*/\n"
+    "\n";
+
+// A program's spellings of the library's symbols that the library doesn't
+// use itself, and the library spellings they stand for.
+
+typedef map<string, string> AliasMap;
+
+// Splits a program's symbols into the ones the library already has (which
+// may need aliases) and the ones it needs objects for.
+
+void    SplitAppSymbols(const SymbolMap& lib, const SymbolMap& app,
+                        SymbolMap& newSyms, AliasMap& aliases)
+{
+    for (SymbolMap::const_iterator it = app.begin(); it != app.end(); ++it) {
+        SymbolMap::const_iterator libIt = lib.find(it->first);
+        if (libIt == lib.end()) {
+            newSyms.insert(*it);
+            continue;
+        }
+
+        const string& primary = PrimarySpelling(libIt->first, libIt->second);
+        for (set<string>::const_iterator sp = it->second.begin(); sp != it->second.end(); ++sp) {
+            if (libIt->second.find(*sp) == libIt->second.end())
+                aliases[*sp] = primary;
+        }
+    }
+}
+
+string  MakeHeader(const SymbolMap& syms, const char* guard, const AliasMap& aliases)
+{
+    string out;
+    out += "/*\n"
+           "    Proto language runtime\n"
+           "\n"
+           "    Declarations of the compile-time symbols\n"
+           "\n";
+    out += g_copyright;
+    out += string("#ifndef ") + guard + "\n"
+           "#define " + guard + "\n"
+           "\n";
+
+    for (SymbolMap::const_iterator it = syms.begin(); it != syms.end(); ++it) {
+        const string& primary = PrimarySpelling(it->first, it->second);
+        out += "DECLARE_PSYM(" + primary + ");\n";
+        for (set<string>::const_iterator sp = it->second.begin(); sp != it->second.end(); ++sp) {
+            if (*sp != primary)
+                out += "#define predef_sym_" + *sp + " predef_sym_" + primary + "\n";
+        }
+    }
+
+    for (AliasMap::const_iterator it = aliases.begin(); it != aliases.end(); ++it)
+        out += "#define predef_sym_" + it->first + " predef_sym_" + it->second + "\n";
+
+    out += "\n"
+           "#endif //" + string(guard) + "\n";
+    return out;
+}
+
+string  MakeObjects(const SymbolMap& syms, const char* initName)
+{
+    char buf[1024];
+    string out;
+
+    out += "/*\n"
+           "    Proto language runtime\n"
+           "\n"
+           "    Compile-time objects\n"
+           "\n";
+    out += g_copyright;
+    out += "#include \"config.h\"\n"
+           "#include \"predefined.h\"\n"
+           "\n"
+           "typedef struct _VALUE* Value;\n"
+           "\n"
+           "struct Binary {\n"
+           "    UInt    size : 28;\n"
+           "    UInt    flags : 4;\n"
+           "    Value   cls;\n"
+           "    void*   pData;\n"
+           "};\n"
+           "\n"
+           "const Value     SYMBOL_CLASS    = (Value) 0x55552;\n"
+           "void    InternPredefSyms(Value syms[], int len);\n"
+           "\n";
+
+    // Symbol data has the same layout as SymbolData in objects-private.h
+
+    for (SymbolMap::const_iterator it = syms.begin(); it != syms.end(); ++it) {
+        const char* name = PrimarySpelling(it->first, it->second).c_str();
+        sprintf(buf, "static struct { int hash; char name[%d]; } data_%s = { (int) 0x%08X, \"%s\" };\n",
+                (int) strlen(name) + 1, name, (UInt32) SymbolHash(name), name);
+        out += buf;
+    }
+
+    out += "\n";
+
+    for (SymbolMap::const_iterator it = syms.begin(); it != syms.end(); ++it) {
+        const char* name = PrimarySpelling(it->first, it->second).c_str();
+        sprintf(buf, "PREDEF(Binary, PREDEF_SYM_NAME(%s)) = { %d, 0, SYMBOL_CLASS, &data_%s };\n",
+                name, (int) (sizeof(int) + strlen(name) + 1), name);
+        out += buf;
+    }
+
+    out += "\n"
+           "void    " + string(initName) + "()\n"
+           "{\n";
+
+    // (C++ doesn't allow an empty array)
+    if (syms.empty()) {
+        out += "}\n";
+        return out;
+    }
+
+    out += "    static Value predefSyms[] = {\n";
+
+    for (SymbolMap::const_iterator it = syms.begin(); it != syms.end(); ++it)
+        out += "        PSYM(" + PrimarySpelling(it->first, it->second) + "),\n";
+
+    out += "    };\n"
+           "\n"
+           "    InternPredefSyms(predefSyms, ARRAYSIZE(predefSyms));\n"
+           "}\n";
+    return out;
+}
+
+// Writes the file only if its contents would change.
+
+bool    UpdateFile(const string& filename, const string& contents)
+{
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f != 0) {
+        string old;
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+            old.append(buf, n);
+        fclose(f);
+        if (old == contents)
+            return true;
+    }
+
+    f = fopen(filename.c_str(), "wb");
+    if (f == 0) {
+        fprintf(stderr, "mkpredef: can't write %s\n", filename.c_str());
+        return false;
+    }
+    fwrite(contents.data(), 1, contents.size(), f);
+    fclose(f);
+    return true;
+}
+
+int     main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: mkpredef <output dir> <library files...> [-- <program files...>]\n");
+        return 1;
+    }
+
+    SymbolMap syms;
+    SymbolMap appSyms;
+    SymbolMap* pScanning = &syms;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0)
+            pScanning = &appSyms;
+        else if (!ScanFile(argv[i], *pScanning))
+            return 1;
+    }
+
+    string dir = argv[1];
+    if (!UpdateFile(dir + "/predef-syms.h", MakeHeader(syms, "__PREDEF_SYMS_H__", AliasMap())))
+        return 1;
+    if (!UpdateFile(dir + "/predef-objs.cpp", MakeObjects(syms, "InitPredefObjects")))
+        return 1;
+
+    SymbolMap newSyms;
+    AliasMap aliases;
+    SplitAppSymbols(syms, appSyms, newSyms, aliases);
+    if (!UpdateFile(dir + "/predef-app-syms.h", MakeHeader(newSyms, "__PREDEF_APP_SYMS_H__", aliases)))
+        return 1;
+    if (!UpdateFile(dir + "/predef-app-objs.cpp", MakeObjects(newSyms, "InitAppPredefObjects")))
+        return 1;
+
+    return 0;
+}